@@ -240,15 +240,16 @@ static int is_executable(const char *path) {
 /* load modules from config: Modules.load[0], Modules.load[1], ... */
 static void load_modules_from_config(AclBlock *cfg) {
     const int MAX_MODULES = 256;
-    char path[256];
     int found = 0;
-    for (int i = 0; i < MAX_MODULES; ++i) {
-        snprintf(path, sizeof(path), "System.Modules.load[%d]", i);
-        char *mod = NULL;
-        if (!acl_get_string(cfg, path, &mod) || !mod) break;
-        log_info("config: loading module '%s'\n", mod);
-        insmod(mod);
-        found = 1;
+    AclArrayIter it;
+    AclValue *v;
+    const char *mod;
+    if (cfg && acl_array_iter_init(&it, acl_find_value_by_path(cfg, "System.Modules.load"))) {
+        while (found < MAX_MODULES && (v = acl_array_next(&it)) && acl_value_string(v, &mod)) {
+            log_info("config: loading module '%s'\n", mod);
+            insmod((char *)mod);
+            found++;
+        }
     }
 
     if (!found) {
@@ -278,7 +279,7 @@ static void launch_services_from_dir(const char *dir) {
         if (!S_ISREG(st.st_mode) || !(st.st_mode & S_IXUSR)) continue;
         pid_t pid = fork();
         if (pid < 0) { log_warn("fork failed for %s: %s\n", path, strerror(errno)); continue; }
-        if (pid == 0) { execl(path, path, NULL); perror("execl"); _exit(1); }
+        if (pid == 0) { signal(SIGHUP, SIG_IGN); execl(path, path, NULL); perror("execl"); _exit(1); }
         /* parent continues; no supervision here (simple) */
     }
     closedir(d);
@@ -291,6 +292,34 @@ void load_modules(const char* modules[]) {
     }
 }
 
+/* SIGHUP asks for the config to be reloaded; the main loop does the work */
+static volatile sig_atomic_t reload_requested;
+static void on_sighup(int sig) { (void)sig; reload_requested = 1; }
+
+/* merge /conf/system.conf into the live config and log what changed */
+static void reload_config(AclBlock **cfg) {
+    if (!*cfg) {
+        /* references are resolved as the keys init reads reach them */
+        *cfg = acl_parse_file("/conf/system.conf");
+        if (*cfg && acl_resolve_on_demand(*cfg)) log_info("acl: /conf/system.conf loaded\n");
+        return;
+    }
+    AclChangeSet *changes = NULL;
+    int r = acl_reload(cfg, "/conf/system.conf", &changes);
+    if (r < 0) {
+        log_warn("acl: reload of /conf/system.conf failed, keeping current config\n");
+        return;
+    }
+    log_info("acl: /conf/system.conf reloaded, %zu change(s)%s\n",
+             changes->count, r ? "" : " (unresolved references)");
+    for (size_t i = 0; i < changes->count; ++i) {
+        const AclChange *c = &changes->items[i];
+        log_info("acl:   %s %s\n", c->kind == ACL_CHANGE_ADDED ? "added" :
+                 c->kind == ACL_CHANGE_REMOVED ? "removed" : "modified", c->path);
+    }
+    acl_changes_free(changes);
+}
+
 /* main init (now config-aware) */
 int main(void) {
     /* create logger and console sink first */
@@ -299,14 +328,14 @@ int main(void) {
     logger_add_sink(logger, console_sink);
     log_debug("enter main()\n");
 
-    /* try to parse /conf/system.conf (non-fatal) */
-    AclBlock *cfg = acl_parse_file("/conf/system.conf");
+    /* try to load /conf/system.conf (non-fatal); a fresh precompiled image
+       next to it is mapped instead of parsing. Otherwise the file is parsed
+       lazily: init reads a handful of System keys, and only the blocks
+       they're in are parsed and resolved. */
+    AclBlock *cfg = acl_open_compiled("/conf/system.conf.aclb", "/conf/system.conf");
+    if (!cfg) cfg = acl_parse_file_lazy("/conf/system.conf");
     if (cfg) {
-        if (!acl_resolve_all(cfg)) {
-            log_warn("acl: /conf/system.conf parsed but failed to resolve references\n");
-        } else {
-            log_info("acl: /conf/system.conf loaded\n");
-        }
+        log_info("acl: /conf/system.conf loaded\n");
     } else {
         log_info("acl: /conf/system.conf not found or failed to parse, continuing with defaults\n");
     }
@@ -318,7 +347,7 @@ int main(void) {
     free(logpath);
 
     signal(SIGCHLD,SIG_IGN);
-    signal(SIGHUP,SIG_IGN);
+    signal(SIGHUP,on_sighup);
     log_debug("signals set\n");
 
     ensure_dir("/proc",0555); ensure_dir("/sys",0555);
@@ -370,6 +399,7 @@ int main(void) {
     for (int i = 1; i <= ttys && i <= 12; ++i) {
         pid_t p = fork();
         if (p == 0) {
+            signal(SIGHUP, SIG_IGN); /* only init reloads on SIGHUP */
             char ttypath[32];
             snprintf(ttypath, sizeof(ttypath), "/dev/tty%d", i);
             spawn_login(ttypath);
@@ -377,6 +407,19 @@ int main(void) {
         }
     }
 
-    log_debug("main: parent entering infinite pause loop\n");
-    for(;;) pause();
+    /* SIGHUP stays blocked except inside sigsuspend, so one that arrives
+       between checking the flag and waiting is delivered by the wait
+       instead of being lost until the next signal */
+    sigset_t hup, waitmask;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+    sigprocmask(SIG_BLOCK, &hup, &waitmask);
+    sigdelset(&waitmask, SIGHUP);
+
+    log_debug("main: parent entering infinite wait loop\n");
+    for(;;) {
+        while (!reload_requested) sigsuspend(&waitmask);
+        reload_requested = 0;
+        reload_config(&cfg);
+    }
 }
@@ -2,7 +2,8 @@
  * Minimal login that uses your libacl API (acl.h)
  *
  * Behavior:
- *  - reads /conf/users.conf via acl_parse_file()
+ *  - maps /conf/users.conf.aclb if it is fresh, else parses /conf/users.conf
+ *    lazily: only the user looked up is parsed and resolved
  *  - looks up Users.user["<name>"].passwd_hash, uid, gid, home, shell
  *  - accepts plaintext or crypt-style hash ($id$...)
  *  - on success: initgroups(), setgid(), setuid(), chdir(home), exec shell
@@ -87,26 +88,24 @@ static int verify_password(const char *entered, const char *stored_hash) {
     return strcmp(entered, stored_hash) == 0;
 }
 
-/* build a path like Users.user["name"].field */
-static void build_user_path(char *buf, size_t n, const char *user, const char *field) {
-    snprintf(buf, n, "Users.user[\"%s\"].%s", user, field);
-}
+/* the fields login reads from a user's block, in this order */
+enum { F_HASH, F_UID, F_GID, F_HOME, F_SHELL, F_COUNT };
+static const char *const user_fields[F_COUNT] = { "passwd_hash", "uid", "gid", "home", "shell" };
 
 int main(int argc, char **argv) {
     const char *conf = "/conf/users.conf"; /* path inside the running system */
+    const char *conf_image = "/conf/users.conf.aclb";
     char *err = NULL;
     printf("\x1b[2J\x1b[H"); // clear screen
 
-    AclBlock *root = acl_parse_file(conf);
+    /* an image is resolved already, and a lazy tree resolves what lookups
+       reach, so there is no acl_resolve_all pass */
+    AclBlock *root = acl_open_compiled(conf_image, conf);
+    if (!root) root = acl_parse_file_lazy(conf);
     if (!root) {
         fprintf(stderr, "login: failed to parse %s\n", conf);
         return 1;
     }
-    if (!acl_resolve_all(root)) {
-        fprintf(stderr, "login: failed to resolve config references\n");
-        acl_free(root);
-        return 1;
-    }
 
     /* prompt for username */
     char username[128];
@@ -115,11 +114,13 @@ int main(int argc, char **argv) {
     size_t ln = strlen(username); if (ln && username[ln-1]=='\n') username[ln-1]=0;
     if (username[0] == '\0') { acl_free(root); return 1; }
 
-    /* lookup passwd_hash */
+    /* find the user's block once and read all its fields from there */
     char path[256];
-    build_user_path(path, sizeof(path), username, "passwd_hash");
-    char *stored_hash = NULL;
-    if (!acl_get_string(root, path, &stored_hash) || !stored_hash) {
+    snprintf(path, sizeof(path), "Users.user[\"%s\"]", username);
+    AclValue *f[F_COUNT];
+    acl_query_many(root, path, user_fields, F_COUNT, f);
+    const char *stored_hash = NULL;
+    if (!acl_value_string(f[F_HASH], &stored_hash)) {
         fprintf(stderr, "login: user not found\n");
         acl_free(root);
         return 1;
@@ -143,17 +144,11 @@ int main(int argc, char **argv) {
 
     /* read uid/gid/home/shell */
     long uid = -1, gid = -1;
-    build_user_path(path, sizeof(path), username, "uid");
-    acl_get_int(root, path, (long *)&uid); /* header uses long* but example uses int; adapt if necessary */
-    build_user_path(path, sizeof(path), username, "gid");
-    acl_get_int(root, path, (long *)&gid);
-    build_user_path(path, sizeof(path), username, "home");
-    char *home = NULL; acl_get_string(root, path, &home);
-    if (!home) home = strdup("/");
-
-    build_user_path(path, sizeof(path), username, "shell");
-    char *shell = NULL; acl_get_string(root, path, &shell);
-    if (!shell) shell = strdup("/bin/sh");
+    acl_value_int(f[F_UID], &uid);
+    acl_value_int(f[F_GID], &gid);
+    const char *home = "/", *shell = "/bin/sh";
+    acl_value_string(f[F_HOME], &home);
+    acl_value_string(f[F_SHELL], &shell);
 
     /* set up groups/ids and drop privileges */
     if (initgroups(username, (gid_t)gid) < 0) {
@@ -168,7 +163,7 @@ int main(int argc, char **argv) {
     }
 
     /* exec the user's shell */
-    char *const args[] = { shell, NULL };
+    char *const args[] = { (char *)shell, NULL };
     execv(shell, args);
     /* exec failed */
     fprintf(stderr, "login: execv(%s): %s\n", shell, strerror(errno));
@@ -0,0 +1,37 @@
+/* pandora_conf.h - generated by acl-gen from src/acl-gen/schemas/pandora.schema; do not edit. */
+#ifndef PANDORA_CONF_H
+#define PANDORA_CONF_H
+
+#include <stddef.h>
+
+typedef struct pandora_Pandora_Mirrors_mirror {
+    const char *label;
+    const char *url;
+} pandora_Pandora_Mirrors_mirror;
+
+typedef struct pandora_Pandora_Mirrors {
+    pandora_Pandora_Mirrors_mirror *mirror;
+    size_t mirror_count;
+} pandora_Pandora_Mirrors;
+
+typedef struct pandora_Pandora {
+    pandora_Pandora_Mirrors Mirrors;
+} pandora_Pandora;
+
+typedef struct pandora_config {
+    pandora_Pandora Pandora;
+    void *mem; /* strings, freed by pandora_free */
+} pandora_config;
+
+/* Parse a config into *out, which starts from the schema's defaults.
+   Returns 1 on success; 0 if some field had the wrong type or was a
+   reference or expression (reported on stderr; the field keeps its
+   default); -1 if the file can't be read or has a syntax error, or
+   memory ran out. *out holds what was read either way and must be
+   released with pandora_free. Blocks and fields the schema doesn't
+   name are skipped. */
+int pandora_parse_file(const char *path, pandora_config *out);
+int pandora_parse_string(const char *text, size_t len, pandora_config *out);
+void pandora_free(pandora_config *c);
+
+#endif
@@ -0,0 +1,317 @@
+/* system_conf.c - generated by acl-gen from src/acl-gen/schemas/system.schema; do not edit. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acl.h"
+#include "system_conf.h"
+
+#define GEN_DEPTH 3
+
+/* strings are copied into chunks chained from the config's mem */
+typedef struct GenChunk { struct GenChunk *next; size_t used, cap; char data[]; } GenChunk;
+
+typedef enum { GT_INT, GT_FLOAT, GT_BOOL, GT_STRING } GenType;
+typedef struct GenFrame { int id; void *obj; } GenFrame;
+
+typedef struct GenState {
+    void **mem;
+    GenFrame stack[GEN_DEPTH];
+    size_t depth;
+    void **arr; size_t *arr_len; size_t arr_size; GenType arr_type; const char *arr_what;
+    int errors;
+} GenState;
+
+static char *gen_strndup(GenState *S, const char *s, size_t n) {
+    GenChunk *c = *S->mem;
+    if (!c || c->cap - c->used < n + 1) {
+        size_t cap = n + 1 > 16384 ? n + 1 : 16384;
+        GenChunk *nc = malloc(sizeof(GenChunk) + cap);
+        if (!nc) return NULL;
+        nc->next = c;
+        nc->used = 0;
+        nc->cap = cap;
+        *S->mem = c = nc;
+    }
+    char *d = c->data + c->used;
+    memcpy(d, s, n);
+    d[n] = '\0';
+    c->used += n + 1;
+    return d;
+}
+
+/* room for one more item; capacity is the next power of two */
+static void *gen_append(void **items, size_t *count, size_t size) {
+    size_t n = *count;
+    if (!(n & (n - 1))) {
+        void *p = realloc(*items, (n ? n * 2 : 1) * size);
+        if (!p) return NULL;
+        *items = p;
+    }
+    ++*count;
+    return (char *)*items + n * size;
+}
+
+static uint32_t gen_hash(const char *s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+static int gen_push(GenState *S, int id, void *obj) {
+    S->stack[S->depth++] = (GenFrame){ id, obj };
+    return ACL_SAX_CONTINUE;
+}
+
+static int gen_mismatch(GenState *S, const AclSaxValue *v, const char *what, const char *want) {
+    static const char *const kinds[] = { "int", "float", "bool", "char", "string", "reference", "expression", "array" };
+    fprintf(stderr, "%s at byte %zu: expected %s, got %s\n", what, v->offset, want, kinds[v->kind]);
+    S->errors++;
+    return v->kind == ACL_SAX_ARRAY ? ACL_SAX_SKIP : ACL_SAX_CONTINUE;
+}
+
+static int gen_int(GenState *S, const AclSaxValue *v, long *out, const char *what) {
+    if (v->kind != ACL_SAX_INT && v->kind != ACL_SAX_CHAR) return gen_mismatch(S, v, what, "int");
+    *out = v->i;
+    return ACL_SAX_CONTINUE;
+}
+
+static int gen_float(GenState *S, const AclSaxValue *v, double *out, const char *what) {
+    if (v->kind == ACL_SAX_FLOAT) *out = v->f;
+    else if (v->kind == ACL_SAX_INT) *out = (double)v->i;
+    else return gen_mismatch(S, v, what, "float");
+    return ACL_SAX_CONTINUE;
+}
+
+static int gen_bool(GenState *S, const AclSaxValue *v, int *out, const char *what) {
+    if (v->kind != ACL_SAX_BOOL) return gen_mismatch(S, v, what, "bool");
+    *out = (int)v->i;
+    return ACL_SAX_CONTINUE;
+}
+
+static int gen_string(GenState *S, const AclSaxValue *v, const char **out, const char *what) {
+    if (v->kind != ACL_SAX_STRING) return gen_mismatch(S, v, what, "string");
+    const char *s = gen_strndup(S, v->str, v->len);
+    if (!s) return ACL_SAX_STOP;
+    *out = s;
+    return ACL_SAX_CONTINUE;
+}
+
+/* an array field: its elements arrive through gen_element */
+__attribute__((unused))
+static int gen_array(GenState *S, const AclSaxValue *v, void **items, size_t *len, size_t size, GenType type, const char *what) {
+    static const char *const names[] = { "int[]", "float[]", "bool[]", "string[]" };
+    if (v->kind != ACL_SAX_ARRAY) return gen_mismatch(S, v, what, names[type]);
+    free(*items);
+    *items = NULL;
+    *len = 0;
+    S->arr = items;
+    S->arr_len = len;
+    S->arr_size = size;
+    S->arr_type = type;
+    S->arr_what = what;
+    return ACL_SAX_CONTINUE;
+}
+
+static int gen_element(void *ctx, size_t index, const AclSaxValue *v) {
+    GenState *S = ctx;
+    (void)index;
+    /* a mismatched element is reported and dropped */
+    union { long i; double f; int b; const char *s; } e;
+    int errors = S->errors, rc;
+    switch (S->arr_type) {
+        case GT_INT: rc = gen_int(S, v, &e.i, S->arr_what); break;
+        case GT_FLOAT: rc = gen_float(S, v, &e.f, S->arr_what); break;
+        case GT_BOOL: rc = gen_bool(S, v, &e.b, S->arr_what); break;
+        default: rc = gen_string(S, v, &e.s, S->arr_what); break;
+    }
+    if (rc == ACL_SAX_STOP || S->errors != errors) return rc;
+    void *slot = gen_append(S->arr, S->arr_len, S->arr_size);
+    if (!slot) return ACL_SAX_STOP;
+    memcpy(slot, &e, S->arr_size);
+    return ACL_SAX_CONTINUE;
+}
+
+static int gen_array_end(void *ctx) {
+    GenState *S = ctx;
+    S->arr = NULL;
+    return ACL_SAX_CONTINUE;
+}
+
+static int gen_exit(void *ctx) {
+    GenState *S = ctx;
+    S->depth--;
+    return ACL_SAX_CONTINUE;
+}
+
+enum { B_ROOT, B_System, B_System_Log, B_System_Modules, B_System_Services };
+
+static void init_B_System_Log(system_System_Log *o) {
+    memset(o, 0, sizeof(*o));
+    o->path = "/log/init.log";
+}
+
+static void init_B_System_Modules(system_System_Modules *o) {
+    memset(o, 0, sizeof(*o));
+}
+
+static void init_B_System_Services(system_System_Services *o) {
+    memset(o, 0, sizeof(*o));
+    o->dir = "/sbin/services";
+}
+
+static void init_B_System(system_System *o) {
+    memset(o, 0, sizeof(*o));
+    o->spawn_ttys = 3L;
+    init_B_System_Log(&o->Log);
+    init_B_System_Modules(&o->Modules);
+    init_B_System_Services(&o->Services);
+}
+
+static void init_B_ROOT(system_config *o) {
+    memset(o, 0, sizeof(*o));
+    init_B_System(&o->System);
+}
+
+static void free_B_System_Log(system_System_Log *o) {
+    (void)o;
+}
+
+static void free_B_System_Modules(system_System_Modules *o) {
+    free((void *)o->load);
+}
+
+static void free_B_System_Services(system_System_Services *o) {
+    (void)o;
+}
+
+static void free_B_System(system_System *o) {
+    free_B_System_Log(&o->Log);
+    free_B_System_Modules(&o->Modules);
+    free_B_System_Services(&o->Services);
+}
+
+static void free_B_ROOT(system_config *o) {
+    free_B_System(&o->System);
+}
+
+static int gen_enter(void *ctx, const char *name, size_t nlen, const char *label, size_t llen) {
+    GenState *S = ctx;
+    GenFrame *f = &S->stack[S->depth - 1];
+    uint32_t h = gen_hash(name, nlen);
+    (void)label;
+    (void)llen;
+    switch (f->id) {
+    case B_System: {
+        system_System *o = f->obj;
+        switch (h) {
+        case 0x63b30055u:
+            if (nlen == 8 && memcmp(name, "Services", 8) == 0) return gen_push(S, B_System_Services, &o->Services);
+            break;
+        case 0xa1dd7bf1u:
+            if (nlen == 3 && memcmp(name, "Log", 3) == 0) return gen_push(S, B_System_Log, &o->Log);
+            break;
+        case 0xe74c644au:
+            if (nlen == 7 && memcmp(name, "Modules", 7) == 0) return gen_push(S, B_System_Modules, &o->Modules);
+            break;
+        }
+        break;
+    }
+    case B_ROOT: {
+        system_config *o = f->obj;
+        switch (h) {
+        case 0x8f3184bcu:
+            if (nlen == 6 && memcmp(name, "System", 6) == 0) return gen_push(S, B_System, &o->System);
+            break;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    (void)h;
+    return ACL_SAX_SKIP; /* not in the schema */
+}
+
+static int gen_field(void *ctx, const char *name, size_t nlen, const AclSaxValue *v) {
+    GenState *S = ctx;
+    GenFrame *f = &S->stack[S->depth - 1];
+    uint32_t h = gen_hash(name, nlen);
+    switch (f->id) {
+    case B_System_Log: {
+        system_System_Log *o = f->obj;
+        switch (h) {
+        case 0x84874d36u:
+            if (nlen == 4 && memcmp(name, "path", 4) == 0) return gen_string(S, v, &o->path, "System.Log.path");
+            break;
+        }
+        break;
+    }
+    case B_System_Modules: {
+        system_System_Modules *o = f->obj;
+        switch (h) {
+        case 0xe60759e9u:
+            if (nlen == 4 && memcmp(name, "load", 4) == 0) return gen_array(S, v, (void **)&o->load, &o->load_len, sizeof(*o->load), GT_STRING, "System.Modules.load");
+            break;
+        }
+        break;
+    }
+    case B_System_Services: {
+        system_System_Services *o = f->obj;
+        switch (h) {
+        case 0xe962b194u:
+            if (nlen == 3 && memcmp(name, "dir", 3) == 0) return gen_string(S, v, &o->dir, "System.Services.dir");
+            break;
+        }
+        break;
+    }
+    case B_System: {
+        system_System *o = f->obj;
+        switch (h) {
+        case 0x91e73f35u:
+            if (nlen == 10 && memcmp(name, "spawn_ttys", 10) == 0) return gen_int(S, v, &o->spawn_ttys, "System.spawn_ttys");
+            break;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    (void)h;
+    return v->kind == ACL_SAX_ARRAY ? ACL_SAX_SKIP : ACL_SAX_CONTINUE; /* not in the schema */
+}
+
+static const AclSaxHandler HANDLER = { gen_enter, gen_exit, gen_field, gen_element, gen_array_end };
+
+static void gen_begin(GenState *S, system_config *out) {
+    memset(S, 0, sizeof(*S));
+    init_B_ROOT(out);
+    S->mem = &out->mem;
+    S->stack[0] = (GenFrame){ B_ROOT, out };
+    S->depth = 1;
+}
+
+int system_parse_string(const char *text, size_t len, system_config *out) {
+    GenState S;
+    gen_begin(&S, out);
+    int rc = acl_sax_parse_string(text, len, &HANDLER, &S);
+    return rc < 1 ? -1 : S.errors ? 0 : 1;
+}
+
+int system_parse_file(const char *path, system_config *out) {
+    GenState S;
+    gen_begin(&S, out);
+    int rc = acl_sax_parse_file(path, &HANDLER, &S);
+    return rc < 1 ? -1 : S.errors ? 0 : 1;
+}
+
+void system_free(system_config *c) {
+    if (!c) return;
+    free_B_ROOT(c);
+    for (GenChunk *k = c->mem, *next; k; k = next) {
+        next = k->next;
+        free(k);
+    }
+    memset(c, 0, sizeof(*c));
+}
@@ -0,0 +1,43 @@
+/* system_conf.h - generated by acl-gen from src/acl-gen/schemas/system.schema; do not edit. */
+#ifndef SYSTEM_CONF_H
+#define SYSTEM_CONF_H
+
+#include <stddef.h>
+
+typedef struct system_System_Log {
+    const char *path;
+} system_System_Log;
+
+typedef struct system_System_Modules {
+    const char **load;
+    size_t load_len;
+} system_System_Modules;
+
+typedef struct system_System_Services {
+    const char *dir;
+} system_System_Services;
+
+typedef struct system_System {
+    long spawn_ttys;
+    system_System_Log Log;
+    system_System_Modules Modules;
+    system_System_Services Services;
+} system_System;
+
+typedef struct system_config {
+    system_System System;
+    void *mem; /* strings, freed by system_free */
+} system_config;
+
+/* Parse a config into *out, which starts from the schema's defaults.
+   Returns 1 on success; 0 if some field had the wrong type or was a
+   reference or expression (reported on stderr; the field keeps its
+   default); -1 if the file can't be read or has a syntax error, or
+   memory ran out. *out holds what was read either way and must be
+   released with system_free. Blocks and fields the schema doesn't
+   name are skipped. */
+int system_parse_file(const char *path, system_config *out);
+int system_parse_string(const char *text, size_t len, system_config *out);
+void system_free(system_config *c);
+
+#endif
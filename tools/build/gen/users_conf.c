@@ -0,0 +1,291 @@
+/* users_conf.c - generated by acl-gen from src/acl-gen/schemas/users.schema; do not edit. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acl.h"
+#include "users_conf.h"
+
+#define GEN_DEPTH 3
+
+/* strings are copied into chunks chained from the config's mem */
+typedef struct GenChunk { struct GenChunk *next; size_t used, cap; char data[]; } GenChunk;
+
+typedef enum { GT_INT, GT_FLOAT, GT_BOOL, GT_STRING } GenType;
+typedef struct GenFrame { int id; void *obj; } GenFrame;
+
+typedef struct GenState {
+    void **mem;
+    GenFrame stack[GEN_DEPTH];
+    size_t depth;
+    void **arr; size_t *arr_len; size_t arr_size; GenType arr_type; const char *arr_what;
+    int errors;
+} GenState;
+
+static char *gen_strndup(GenState *S, const char *s, size_t n) {
+    GenChunk *c = *S->mem;
+    if (!c || c->cap - c->used < n + 1) {
+        size_t cap = n + 1 > 16384 ? n + 1 : 16384;
+        GenChunk *nc = malloc(sizeof(GenChunk) + cap);
+        if (!nc) return NULL;
+        nc->next = c;
+        nc->used = 0;
+        nc->cap = cap;
+        *S->mem = c = nc;
+    }
+    char *d = c->data + c->used;
+    memcpy(d, s, n);
+    d[n] = '\0';
+    c->used += n + 1;
+    return d;
+}
+
+/* room for one more item; capacity is the next power of two */
+static void *gen_append(void **items, size_t *count, size_t size) {
+    size_t n = *count;
+    if (!(n & (n - 1))) {
+        void *p = realloc(*items, (n ? n * 2 : 1) * size);
+        if (!p) return NULL;
+        *items = p;
+    }
+    ++*count;
+    return (char *)*items + n * size;
+}
+
+static uint32_t gen_hash(const char *s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+static int gen_push(GenState *S, int id, void *obj) {
+    S->stack[S->depth++] = (GenFrame){ id, obj };
+    return ACL_SAX_CONTINUE;
+}
+
+static int gen_mismatch(GenState *S, const AclSaxValue *v, const char *what, const char *want) {
+    static const char *const kinds[] = { "int", "float", "bool", "char", "string", "reference", "expression", "array" };
+    fprintf(stderr, "%s at byte %zu: expected %s, got %s\n", what, v->offset, want, kinds[v->kind]);
+    S->errors++;
+    return v->kind == ACL_SAX_ARRAY ? ACL_SAX_SKIP : ACL_SAX_CONTINUE;
+}
+
+static int gen_int(GenState *S, const AclSaxValue *v, long *out, const char *what) {
+    if (v->kind != ACL_SAX_INT && v->kind != ACL_SAX_CHAR) return gen_mismatch(S, v, what, "int");
+    *out = v->i;
+    return ACL_SAX_CONTINUE;
+}
+
+static int gen_float(GenState *S, const AclSaxValue *v, double *out, const char *what) {
+    if (v->kind == ACL_SAX_FLOAT) *out = v->f;
+    else if (v->kind == ACL_SAX_INT) *out = (double)v->i;
+    else return gen_mismatch(S, v, what, "float");
+    return ACL_SAX_CONTINUE;
+}
+
+static int gen_bool(GenState *S, const AclSaxValue *v, int *out, const char *what) {
+    if (v->kind != ACL_SAX_BOOL) return gen_mismatch(S, v, what, "bool");
+    *out = (int)v->i;
+    return ACL_SAX_CONTINUE;
+}
+
+static int gen_string(GenState *S, const AclSaxValue *v, const char **out, const char *what) {
+    if (v->kind != ACL_SAX_STRING) return gen_mismatch(S, v, what, "string");
+    const char *s = gen_strndup(S, v->str, v->len);
+    if (!s) return ACL_SAX_STOP;
+    *out = s;
+    return ACL_SAX_CONTINUE;
+}
+
+/* an array field: its elements arrive through gen_element */
+__attribute__((unused))
+static int gen_array(GenState *S, const AclSaxValue *v, void **items, size_t *len, size_t size, GenType type, const char *what) {
+    static const char *const names[] = { "int[]", "float[]", "bool[]", "string[]" };
+    if (v->kind != ACL_SAX_ARRAY) return gen_mismatch(S, v, what, names[type]);
+    free(*items);
+    *items = NULL;
+    *len = 0;
+    S->arr = items;
+    S->arr_len = len;
+    S->arr_size = size;
+    S->arr_type = type;
+    S->arr_what = what;
+    return ACL_SAX_CONTINUE;
+}
+
+static int gen_element(void *ctx, size_t index, const AclSaxValue *v) {
+    GenState *S = ctx;
+    (void)index;
+    /* a mismatched element is reported and dropped */
+    union { long i; double f; int b; const char *s; } e;
+    int errors = S->errors, rc;
+    switch (S->arr_type) {
+        case GT_INT: rc = gen_int(S, v, &e.i, S->arr_what); break;
+        case GT_FLOAT: rc = gen_float(S, v, &e.f, S->arr_what); break;
+        case GT_BOOL: rc = gen_bool(S, v, &e.b, S->arr_what); break;
+        default: rc = gen_string(S, v, &e.s, S->arr_what); break;
+    }
+    if (rc == ACL_SAX_STOP || S->errors != errors) return rc;
+    void *slot = gen_append(S->arr, S->arr_len, S->arr_size);
+    if (!slot) return ACL_SAX_STOP;
+    memcpy(slot, &e, S->arr_size);
+    return ACL_SAX_CONTINUE;
+}
+
+static int gen_array_end(void *ctx) {
+    GenState *S = ctx;
+    S->arr = NULL;
+    return ACL_SAX_CONTINUE;
+}
+
+static int gen_exit(void *ctx) {
+    GenState *S = ctx;
+    S->depth--;
+    return ACL_SAX_CONTINUE;
+}
+
+enum { B_ROOT, B_Users, B_Users_user };
+
+static void init_B_Users_user(users_Users_user *o) {
+    memset(o, 0, sizeof(*o));
+    o->name = "";
+    o->uid = -1L;
+    o->gid = -1L;
+    o->home = "/";
+    o->shell = "/bin/hermes";
+    o->passwd_hash = "";
+}
+
+static void init_B_Users(users_Users *o) {
+    memset(o, 0, sizeof(*o));
+}
+
+static void init_B_ROOT(users_config *o) {
+    memset(o, 0, sizeof(*o));
+    init_B_Users(&o->Users);
+}
+
+static void free_B_Users_user(users_Users_user *o) {
+    (void)o;
+}
+
+static void free_B_Users(users_Users *o) {
+    for (size_t i = 0; i < o->user_count; ++i) free_B_Users_user(&o->user[i]);
+    free(o->user);
+}
+
+static void free_B_ROOT(users_config *o) {
+    free_B_Users(&o->Users);
+}
+
+static int gen_enter(void *ctx, const char *name, size_t nlen, const char *label, size_t llen) {
+    GenState *S = ctx;
+    GenFrame *f = &S->stack[S->depth - 1];
+    uint32_t h = gen_hash(name, nlen);
+    (void)label;
+    (void)llen;
+    switch (f->id) {
+    case B_Users: {
+        users_Users *o = f->obj;
+        switch (h) {
+        case 0x60785ef2u:
+            if (nlen == 4 && memcmp(name, "user", 4) == 0) {
+                users_Users_user *e = gen_append((void **)&o->user, &o->user_count, sizeof(*e));
+                if (!e) return ACL_SAX_STOP;
+                init_B_Users_user(e);
+                e->label = label ? gen_strndup(S, label, llen) : NULL;
+                return label && !e->label ? ACL_SAX_STOP : gen_push(S, B_Users_user, e);
+            }
+            break;
+        }
+        break;
+    }
+    case B_ROOT: {
+        users_config *o = f->obj;
+        switch (h) {
+        case 0x06b432b3u:
+            if (nlen == 5 && memcmp(name, "Users", 5) == 0) return gen_push(S, B_Users, &o->Users);
+            break;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    (void)h;
+    return ACL_SAX_SKIP; /* not in the schema */
+}
+
+static int gen_field(void *ctx, const char *name, size_t nlen, const AclSaxValue *v) {
+    GenState *S = ctx;
+    GenFrame *f = &S->stack[S->depth - 1];
+    uint32_t h = gen_hash(name, nlen);
+    switch (f->id) {
+    case B_Users_user: {
+        users_Users_user *o = f->obj;
+        switch (h) {
+        case 0x11e1fc01u:
+            if (nlen == 5 && memcmp(name, "shell", 5) == 0) return gen_string(S, v, &o->shell, "Users.user.shell");
+            break;
+        case 0x5cc7e6cdu:
+            if (nlen == 3 && memcmp(name, "uid", 3) == 0) return gen_int(S, v, &o->uid, "Users.user.uid");
+            break;
+        case 0x642ad59bu:
+            if (nlen == 3 && memcmp(name, "gid", 3) == 0) return gen_int(S, v, &o->gid, "Users.user.gid");
+            break;
+        case 0x8d39bde6u:
+            if (nlen == 4 && memcmp(name, "name", 4) == 0) return gen_string(S, v, &o->name, "Users.user.name");
+            break;
+        case 0xce164093u:
+            if (nlen == 6 && memcmp(name, "locked", 6) == 0) return gen_bool(S, v, &o->locked, "Users.user.locked");
+            break;
+        case 0xd2c8c28eu:
+            if (nlen == 4 && memcmp(name, "home", 4) == 0) return gen_string(S, v, &o->home, "Users.user.home");
+            break;
+        case 0xd913982cu:
+            if (nlen == 11 && memcmp(name, "passwd_hash", 11) == 0) return gen_string(S, v, &o->passwd_hash, "Users.user.passwd_hash");
+            break;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    (void)h;
+    return v->kind == ACL_SAX_ARRAY ? ACL_SAX_SKIP : ACL_SAX_CONTINUE; /* not in the schema */
+}
+
+static const AclSaxHandler HANDLER = { gen_enter, gen_exit, gen_field, gen_element, gen_array_end };
+
+static void gen_begin(GenState *S, users_config *out) {
+    memset(S, 0, sizeof(*S));
+    init_B_ROOT(out);
+    S->mem = &out->mem;
+    S->stack[0] = (GenFrame){ B_ROOT, out };
+    S->depth = 1;
+}
+
+int users_parse_string(const char *text, size_t len, users_config *out) {
+    GenState S;
+    gen_begin(&S, out);
+    int rc = acl_sax_parse_string(text, len, &HANDLER, &S);
+    return rc < 1 ? -1 : S.errors ? 0 : 1;
+}
+
+int users_parse_file(const char *path, users_config *out) {
+    GenState S;
+    gen_begin(&S, out);
+    int rc = acl_sax_parse_file(path, &HANDLER, &S);
+    return rc < 1 ? -1 : S.errors ? 0 : 1;
+}
+
+void users_free(users_config *c) {
+    if (!c) return;
+    free_B_ROOT(c);
+    for (GenChunk *k = c->mem, *next; k; k = next) {
+        next = k->next;
+        free(k);
+    }
+    memset(c, 0, sizeof(*c));
+}
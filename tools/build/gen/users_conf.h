@@ -0,0 +1,39 @@
+/* users_conf.h - generated by acl-gen from src/acl-gen/schemas/users.schema; do not edit. */
+#ifndef USERS_CONF_H
+#define USERS_CONF_H
+
+#include <stddef.h>
+
+typedef struct users_Users_user {
+    const char *label;
+    const char *name;
+    long uid;
+    long gid;
+    const char *home;
+    const char *shell;
+    const char *passwd_hash;
+    int locked;
+} users_Users_user;
+
+typedef struct users_Users {
+    users_Users_user *user;
+    size_t user_count;
+} users_Users;
+
+typedef struct users_config {
+    users_Users Users;
+    void *mem; /* strings, freed by users_free */
+} users_config;
+
+/* Parse a config into *out, which starts from the schema's defaults.
+   Returns 1 on success; 0 if some field had the wrong type or was a
+   reference or expression (reported on stderr; the field keeps its
+   default); -1 if the file can't be read or has a syntax error, or
+   memory ran out. *out holds what was read either way and must be
+   released with users_free. Blocks and fields the schema doesn't
+   name are skipped. */
+int users_parse_file(const char *path, users_config *out);
+int users_parse_string(const char *text, size_t len, users_config *out);
+void users_free(users_config *c);
+
+#endif
@@ -0,0 +1,1761 @@
+/* acl-bench - parse-time and allocation benchmark for the ACL library.
+ *
+ * Generates a registry-like config in memory (Registry { Package "pN" {
+ * Version "x.y.z" { ... } } }) and times lexing alone, parse and free over
+ * several rounds. Allocation calls are counted by wrapping malloc/calloc/realloc
+ * at link time (see the acl-bench rule in tools/Makefile).
+ *
+ * Usage: acl-bench [packages] [versions-per-package] [rounds] [typed|inferred]
+ *        acl-bench lookup [children] [lookups] [rounds]
+ *        acl-bench array [elements] [rounds]
+ *        acl-bench refs [fields] [rounds]
+ *        acl-bench fanout [fields] [elements]
+ *        acl-bench image [users] [rounds]
+ *        acl-bench expr [fields] [rounds]
+ *        acl-bench reload [users] [rounds]
+ *        acl-bench lex [packages] [rounds]
+ *        acl-bench sax [packages] [rounds]
+ *        acl-bench lazy [users] [rounds]
+ *        acl-bench split [packages] [rounds]
+ *        acl-bench suite [shapes|all] [sizes] [rounds] [json]
+ *        acl-bench query [users] [lookups] [rounds]
+ *        acl-bench select [packages] [rounds]
+ *        acl-bench ondemand [nodes] [lookups] [rounds]
+ *        acl-bench codegen [users] [rounds]
+ *        acl-bench snapshots [readers] [seconds] [users]
+ *
+ * "inferred" drops the type keywords (name = value;), which makes the
+ * parser look ahead past every field name.
+ *
+ * "lookup" builds one block with many labelled children (Users { user "uN"
+ * { ... } }) and times acl_get_* path lookups spread across them.
+ *
+ * "array" walks one string array three ways: acl_get_string on a rebuilt
+ * "System.Modules.load[i]" path per element, a compiled path per element,
+ * and acl_array_iter.
+ *
+ * "refs" times acl_resolve_all on reference chains: each field refers to
+ * the next one (declared after it, the worst order for a pass-based
+ * resolver) and, separately, to the previous one.
+ *
+ * "fanout" has many fields referencing one shared string array and reports
+ * what acl_resolve_all allocates.
+ *
+ * "image" writes a users config to a temporary file, compiles it with
+ * acl_compile, and compares parse + resolve + a few lookups against
+ * acl_open_compiled (including its source freshness check) + the same
+ * lookups.
+ *
+ * "expr" resolves a block of expr fields built from 16 distinct
+ * expressions over $ operands, then times one expression through the
+ * one-shot expr_eval_to_string against evaluating its compiled program.
+ *
+ * "reload" rewrites a users config between rounds and compares a fresh
+ * parse + resolve against acl_reload of a live tree, for an edit to one
+ * user's field and for an edit to the Defaults field every user refers to.
+ * It then checks acl_reload of a lazy tree whose file was rewritten in
+ * place, shorter and then longer.
+ *
+ * "lex" times the lexer alone on the registry, with and without a block
+ * comment before every package, at each vector width the CPU supports
+ * (scalar, SSE2, AVX2).
+ *
+ * "sax" collects every Version's sha256 from the registry: parsing a tree
+ * and looking each one up, against the streaming parser with a field
+ * callback, and the streaming parser stopping once the first package is
+ * done.
+ *
+ * "lazy" reads one user's fields from a users config, as login does: a
+ * full parse + resolve against acl_parse_file_lazy, which parses and
+ * resolves only the blocks the lookups reach.
+ *
+ * "split" parses an index of top-level Package blocks (about 1.7 KB each,
+ * so the default is some 100 MB) with acl_parse_string and with
+ * acl_parse_string_parallel on 1, 2, 4 and 8 threads, and checks that a
+ * cross-block reference resolves the same way in each tree.
+ *
+ * "suite" generates configs of each requested shape (comma-separated:
+ * deep, wide, array, refs, expr, registry; default all) at each size
+ * (comma-separated bytes with an optional K/M/G suffix, 1K to 1G; default
+ * 1K,1M,16M) and times lex, parse, resolve, path lookups, typed getters
+ * and free separately, with allocations per phase and peak RSS. Each run
+ * is a child process. With "json" the results are one JSON document on
+ * stdout, for comparing commits; the exit status is nonzero if any
+ * reference or lookup failed.
+ *
+ * "query" reads three fields of one user at a time from a users config,
+ * in a parsed tree and in its compiled image: by a full path per field
+ * (acl_find_value_by_path), and by acl_query_many, which finds the user's
+ * block once.
+ *
+ * "select" collects every Version's sha256 from the registry and counts
+ * the deprecated Versions, in a parsed tree and in its compiled image: by
+ * two indexed paths per version (Package[p].Version[v]), and by the
+ * queries Registry.Package[*].Version[*].sha256 and
+ * **.Version[deprecated == true].
+ *
+ * "ondemand" reads a few fields of the suite's refs shape (five
+ * references per node, some in chains through other nodes) after
+ * acl_resolve_all and after acl_resolve_on_demand, parse excluded.
+ *
+ * "codegen" loads every user of a users config into structs: a tree parse
+ * + resolve read through Users.user[*] and a cursor per user, against the
+ * parser acl-gen generated from acl-gen/schemas/users.schema.
+ *
+ * "snapshots" is a stress test: reader threads read users from a config
+ * while one thread rewrites and reloads it as fast as it can, first
+ * through acl_snapshot_enter/leave, then with the tree behind a
+ * mutex for comparison. Every file generation stamps each user,
+ * and a reader that sees two generations in one snapshot, or an older
+ * version after a newer one, fails the run.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "acl.h"
+#include "expr.h"
+#include "users_conf.h"
+
+/* ---------- allocation counters (link-time wrapped) ---------- */
+
+static size_t ALLOC_CALLS = 0;
+static size_t ALLOC_BYTES = 0;
+
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t n, size_t sz);
+void *__real_realloc(void *p, size_t n);
+
+void *__wrap_malloc(size_t n) { ALLOC_CALLS++; ALLOC_BYTES += n; return __real_malloc(n); }
+void *__wrap_calloc(size_t n, size_t sz) { ALLOC_CALLS++; ALLOC_BYTES += n * sz; return __real_calloc(n, sz); }
+void *__wrap_realloc(void *p, size_t n) { ALLOC_CALLS++; ALLOC_BYTES += n; return __real_realloc(p, n); }
+
+/* ---------- timing ---------- */
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* ---------- synthetic registry generator ---------- */
+
+typedef struct { char *buf; size_t len, cap; } StrBuf;
+
+__attribute__((format(printf, 2, 3)))
+static void sb_printf(StrBuf *sb, const char *fmt, ...) {
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(sb->buf + sb->len, sb->cap - sb->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if (sb->len + (size_t)n < sb->cap) { sb->len += (size_t)n; return; }
+        sb->cap = sb->cap ? sb->cap * 2 : 4096;
+        while (sb->cap <= sb->len + (size_t)n) sb->cap *= 2;
+        sb->buf = realloc(sb->buf, sb->cap);
+    }
+}
+
+/* one Package block of the registry (nested in Registry, so indented) */
+static size_t gen_package(StrBuf *sb, int p, int versions, int inferred) {
+    const char *ts = inferred ? "" : "string ";
+    const char *tsa = inferred ? "" : "string[] ";
+    const char *tb = inferred ? "" : "bool ";
+    const char *ti = inferred ? "" : "int ";
+    sb_printf(sb, "    /* package %d */\n    Package \"pkg%d\" {\n", p, p);
+    sb_printf(sb, "        %sversions = {", tsa);
+    for (int v = 0; v < versions; ++v) sb_printf(sb, "%s\"%d.%d.0\"", v ? ", " : " ", v / 10, v % 10);
+    sb_printf(sb, " };\n");
+    sb_printf(sb, "        %slatest = \"0.0.0\";\n", ts);
+    sb_printf(sb, "        %spkg_base_url = \"https://reg.example.com/pkgs/pkg%d\";\n", ts, p);
+    sb_printf(sb, "        %stags = { \"cli\", \"tooling\" };\n", tsa);
+    for (int v = 0; v < versions; ++v) {
+        sb_printf(sb, "        Version \"%d.%d.0\" {\n", v / 10, v % 10);
+        sb_printf(sb, "            %smanifest_url = \"https://reg.example.com/pkgs/pkg%d/%d.%d.0/manifest.acl\";\n", ts, p, v / 10, v % 10);
+        sb_printf(sb, "            %ssha256 = \"%064x\";\n", ts, (unsigned)(p * 131 + v));
+        sb_printf(sb, "            %sdeprecated = %s;\n", tb, (v % 3) ? "false" : "true");
+        sb_printf(sb, "            %ssize = %d;\n", ti, 1000 + p + v);
+        sb_printf(sb, "        }\n");
+    }
+    sb_printf(sb, "    }\n");
+    return 4 + 4 * (size_t)versions;
+}
+
+static char *gen_registry(int packages, int versions, int inferred, size_t *fields_out) {
+    StrBuf sb = {0};
+    const char *ts = inferred ? "" : "string ";
+    const char *ti = inferred ? "" : "int ";
+    size_t fields = 0;
+    sb_printf(&sb, "Registry {\n    %surl = \"https://reg.example.com/index.acl\";\n    %spriority = 100;\n", ts, ti);
+    fields += 2;
+    for (int p = 0; p < packages; ++p) fields += gen_package(&sb, p, versions, inferred);
+    sb_printf(&sb, "}\n");
+    *fields_out = fields;
+    return sb.buf;
+}
+
+/* ---------- path lookups against a wide block ---------- */
+
+static int bench_lookup(int children, int lookups, int rounds) {
+    StrBuf sb = {0};
+    sb_printf(&sb, "Users {\n");
+    for (int i = 0; i < children; ++i)
+        sb_printf(&sb, "    user \"u%d\" { int uid = %d; string shell = \"/bin/sh\"; }\n", i, i);
+    sb_printf(&sb, "}\n");
+
+    double t0 = now_sec();
+    AclBlock *root = acl_parse_string(sb.buf);
+    double t1 = now_sec();
+    if (!root) { fprintf(stderr, "lookup: parse failed\n"); return 1; }
+
+    /* paths spread over the whole child list, fixed LCG so runs compare */
+    char (*paths)[64] = malloc(sizeof(*paths) * (size_t)lookups);
+    unsigned seed = 12345;
+    for (int i = 0; i < lookups; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        snprintf(paths[i], sizeof(paths[i]), "Users.user[\"u%u\"].uid", (seed >> 8) % (unsigned)children);
+    }
+
+    double best = 1e30;
+    long sum = 0;
+    for (int r = 0; r < rounds; ++r) {
+        double a = now_sec();
+        for (int i = 0; i < lookups; ++i) {
+            long v = 0;
+            if (acl_get_int(root, paths[i], &v)) sum += v;
+        }
+        double b = now_sec();
+        if (b - a < best) best = b - a;
+    }
+
+    printf("input:        %zu bytes, %d children in one block\n", sb.len, children);
+    printf("parse:        %.3f ms\n", (t1 - t0) * 1e3);
+    printf("lookup:       %d paths in %.3f ms (%.0f ns/lookup, checksum %ld)\n",
+           lookups, best * 1e3, best * 1e9 / lookups, sum);
+
+    free(paths);
+    acl_free(root);
+    free(sb.buf);
+    return 0;
+}
+
+/* ---------- walking one array ---------- */
+
+static int bench_array(int elements, int rounds) {
+    StrBuf sb = {0};
+    sb_printf(&sb, "System {\n    Modules {\n        string[] load = {");
+    for (int i = 0; i < elements; ++i) sb_printf(&sb, "%s\"mod%d\"", i ? ", " : " ", i);
+    sb_printf(&sb, " };\n    }\n}\n");
+    AclBlock *root = acl_parse_string(sb.buf);
+    if (!root) { fprintf(stderr, "array: parse failed\n"); return 1; }
+
+    double by_path = 1e30, by_compiled = 1e30, by_iter = 1e30;
+    size_t calls_path = 0, calls_compiled = 0, calls_iter = 0;
+    size_t seen = 0;
+    for (int r = 0; r < rounds; ++r) {
+        char path[64];
+        size_t c0 = ALLOC_CALLS;
+        double t0 = now_sec();
+        for (int i = 0;; ++i) {
+            char *s = NULL;
+            snprintf(path, sizeof(path), "System.Modules.load[%d]", i);
+            if (!acl_get_string(root, path, &s)) break;
+            seen += strlen(s);
+            free(s);
+        }
+        double t1 = now_sec();
+        size_t c1 = ALLOC_CALLS;
+        for (int i = 0;; ++i) {
+            const char *s;
+            snprintf(path, sizeof(path), "System.Modules.load[%d]", i);
+            AclPath *cp = acl_path_compile(path);
+            int ok = acl_value_string(acl_path_lookup(root, cp), &s);
+            acl_path_free(cp);
+            if (!ok) break;
+            seen += strlen(s);
+        }
+        double t2 = now_sec();
+        size_t c2 = ALLOC_CALLS;
+        AclArrayIter it;
+        AclValue *v;
+        const char *s;
+        acl_array_iter_init(&it, acl_find_value_by_path(root, "System.Modules.load"));
+        while ((v = acl_array_next(&it)) && acl_value_string(v, &s)) seen += strlen(s);
+        double t3 = now_sec();
+        size_t c3 = ALLOC_CALLS;
+        if (t1 - t0 < by_path) by_path = t1 - t0;
+        if (t2 - t1 < by_compiled) by_compiled = t2 - t1;
+        if (t3 - t2 < by_iter) by_iter = t3 - t2;
+        calls_path = c1 - c0; calls_compiled = c2 - c1; calls_iter = c3 - c2;
+    }
+
+    printf("array:        %d elements (checksum %zu)\n", elements, seen);
+    printf("get by path:  %.3f ms, %zu allocations\n", by_path * 1e3, calls_path);
+    printf("compiled:     %.3f ms, %zu allocations\n", by_compiled * 1e3, calls_compiled);
+    printf("iterator:     %.3f ms, %zu allocations\n", by_iter * 1e3, calls_iter);
+
+    acl_free(root);
+    free(sb.buf);
+    return 0;
+}
+
+/* ---------- reference chains ---------- */
+
+static double time_resolve(const char *text, int rounds, int *ok) {
+    double best = 1e30;
+    for (int r = 0; r < rounds; ++r) {
+        AclBlock *root = acl_parse_string(text);
+        double t0 = now_sec();
+        *ok = acl_resolve_all(root);
+        double t1 = now_sec();
+        acl_free(root);
+        if (t1 - t0 < best) best = t1 - t0;
+    }
+    return best;
+}
+
+static int bench_refs(int fields, int rounds) {
+    StrBuf fwd = {0}, back = {0};
+    sb_printf(&fwd, "Chain {\n");
+    sb_printf(&back, "Chain {\n    int f0 = 1;\n");
+    for (int i = 0; i < fields - 1; ++i) {
+        sb_printf(&fwd, "    int f%d = $.f%d;\n", i, i + 1);
+        sb_printf(&back, "    int f%d = $.f%d;\n", i + 1, i);
+    }
+    sb_printf(&fwd, "    int f%d = 1;\n}\n", fields - 1);
+    sb_printf(&back, "}\n");
+
+    int ok_fwd = 0, ok_back = 0;
+    double t_fwd = time_resolve(fwd.buf, rounds, &ok_fwd);
+    double t_back = time_resolve(back.buf, rounds, &ok_back);
+    printf("refs:         chain of %d fields\n", fields);
+    printf("forward:      %.3f ms (%.0f ns/ref)%s\n", t_fwd * 1e3, t_fwd * 1e9 / fields, ok_fwd ? "" : " UNRESOLVED");
+    printf("backward:     %.3f ms (%.0f ns/ref)%s\n", t_back * 1e3, t_back * 1e9 / fields, ok_back ? "" : " UNRESOLVED");
+    free(fwd.buf);
+    free(back.buf);
+    return 0;
+}
+
+/* ---------- many references to one array ---------- */
+
+static int bench_fanout(int fields, int elements) {
+    StrBuf sb = {0};
+    sb_printf(&sb, "Shared {\n    string[] mirrors = {");
+    for (int i = 0; i < elements; ++i) sb_printf(&sb, "%s\"https://mirror%d.example.com/pub\"", i ? ", " : " ", i);
+    sb_printf(&sb, " };\n}\nUsers {\n");
+    for (int i = 0; i < fields; ++i) sb_printf(&sb, "    string[] m%d = $Shared.mirrors;\n", i);
+    sb_printf(&sb, "}\n");
+
+    size_t b0 = ALLOC_BYTES, c0 = ALLOC_CALLS;
+    AclBlock *root = acl_parse_string(sb.buf);
+    size_t b1 = ALLOC_BYTES, c1 = ALLOC_CALLS;
+    double t0 = now_sec();
+    int ok = acl_resolve_all(root);
+    double t1 = now_sec();
+    size_t b2 = ALLOC_BYTES, c2 = ALLOC_CALLS;
+
+    printf("fanout:       %d fields -> one %d-element array%s\n", fields, elements, ok ? "" : " UNRESOLVED");
+    printf("parse:        %zu bytes in %zu allocations\n", b1 - b0, c1 - c0);
+    printf("resolve:      %.3f ms, %zu bytes in %zu allocations\n", (t1 - t0) * 1e3, b2 - b1, c2 - c1);
+
+    acl_free(root);
+    free(sb.buf);
+    return 0;
+}
+
+/* ---------- compiled image vs parsing ---------- */
+
+static long image_queries(AclBlock *root, int users) {
+    char path[64];
+    long sum = 0, v = 0;
+    const char *s = NULL;
+    for (int i = 0; i < 4; ++i) {
+        snprintf(path, sizeof(path), "Users.user[\"u%d\"].uid", i * (users - 1) / 3);
+        if (acl_get_int(root, path, &v)) sum += v;
+    }
+    if (acl_value_string(acl_find_value_by_path(root, "Users.user[\"u0\"].shell"), &s)) sum += (long)strlen(s);
+    return sum;
+}
+
+static int bench_image(int users, int rounds) {
+    StrBuf sb = {0};
+    sb_printf(&sb, "Defaults { string shell = \"/bin/sh\"; }\nUsers {\n");
+    for (int i = 0; i < users; ++i)
+        sb_printf(&sb, "    user \"u%d\" { int uid = %d; string home = \"/home/u%d\"; string shell = $Defaults.shell; }\n", i, i, i);
+    sb_printf(&sb, "}\n");
+
+    char src[] = "/tmp/acl-bench-XXXXXX";
+    int fd = mkstemp(src);
+    if (fd < 0) { perror("image: mkstemp"); free(sb.buf); return 1; }
+    FILE *f = fdopen(fd, "w");
+    fwrite(sb.buf, 1, sb.len, f);
+    fclose(f);
+    char img[sizeof(src) + 5];
+    snprintf(img, sizeof(img), "%s.aclb", src);
+
+    AclBlock *root = acl_parse_file(src);
+    int ok = root && acl_compile(root, src, img);
+    acl_free(root);
+    if (!ok) { fprintf(stderr, "image: compile failed\n"); unlink(src); free(sb.buf); return 1; }
+
+    double parsed = 1e30, mapped = 1e30;
+    size_t calls_parsed = 0, calls_mapped = 0;
+    long sum_parsed = 0, sum_mapped = 0;
+    for (int r = 0; r < rounds; ++r) {
+        size_t c0 = ALLOC_CALLS;
+        double t0 = now_sec();
+        AclBlock *t = acl_parse_file(src);
+        acl_resolve_all(t);
+        sum_parsed = image_queries(t, users);
+        acl_free(t);
+        double t1 = now_sec();
+        size_t c1 = ALLOC_CALLS;
+        AclBlock *m = acl_open_compiled(img, src);
+        sum_mapped = m ? image_queries(m, users) : -1;
+        acl_free(m);
+        double t2 = now_sec();
+        size_t c2 = ALLOC_CALLS;
+        if (t1 - t0 < parsed) parsed = t1 - t0;
+        if (t2 - t1 < mapped) mapped = t2 - t1;
+        calls_parsed = c1 - c0;
+        calls_mapped = c2 - c1;
+    }
+
+    struct stat st;
+    long img_size = stat(img, &st) == 0 ? (long)st.st_size : -1;
+    printf("input:        %zu bytes, %d users; image %ld bytes\n", sb.len, users, img_size);
+    printf("parse:        %.3f ms load + resolve + queries, %zu allocations (checksum %ld)\n",
+           parsed * 1e3, calls_parsed, sum_parsed);
+    printf("image:        %.3f ms open + check + queries, %zu allocations (checksum %ld)\n",
+           mapped * 1e3, calls_mapped, sum_mapped);
+
+    unlink(img);
+    unlink(src);
+    free(sb.buf);
+    return 0;
+}
+
+/* ---------- expr fields ---------- */
+
+static void *bench_alloc(void *ctx, size_t n) { (void)ctx; return malloc(n); }
+
+static int bench_expr(int fields, int rounds) {
+    StrBuf sb = {0};
+    sb_printf(&sb, "Calc {\n    int base = 8000;\n    float scale = 1.5;\n");
+    for (int i = 0; i < fields; ++i)
+        sb_printf(&sb, "    expr e%d = \"$.base + %d * 2 + (int)($.scale * 4) - (1 + 2) * 3\";\n", i, i % 16);
+    sb_printf(&sb, "}\n");
+
+    size_t c0 = ALLOC_CALLS;
+    AclBlock *root = acl_parse_string(sb.buf);
+    size_t c1 = ALLOC_CALLS;
+    double t0 = now_sec();
+    int ok = acl_resolve_all(root);
+    double t1 = now_sec();
+    size_t c2 = ALLOC_CALLS;
+    long v = 0;
+    acl_get_int(root, "Calc.e1", &v);
+    acl_free(root);
+    free(sb.buf);
+
+    printf("expr:         %d fields, 16 distinct expressions%s (Calc.e1 = %ld)\n", fields, ok ? "" : " UNRESOLVED", v);
+    printf("parse:        %zu allocations\n", c1 - c0);
+    printf("resolve:      %.3f ms (%.0f ns/field), %zu allocations\n",
+           (t1 - t0) * 1e3, (t1 - t0) * 1e9 / fields, c2 - c1);
+
+    /* one expression without operands, evaluated `fields` times each way */
+    const char *text = "8000 + 3 * 2 + (int)(1.5 * 4) - (1 + 2) * 3";
+    ExprProg *prog = expr_compile(text, bench_alloc, NULL);
+    if (!prog) { fprintf(stderr, "expr: compile failed\n"); return 1; }
+    double one_shot = 1e30, compiled = 1e30;
+    size_t calls_one_shot = 0, calls_compiled = 0;
+    long sum = 0;
+    for (int r = 0; r < rounds; ++r) {
+        size_t a0 = ALLOC_CALLS;
+        double s0 = now_sec();
+        for (int i = 0; i < fields; ++i) free(expr_eval_to_string(text));
+        double s1 = now_sec();
+        size_t a1 = ALLOC_CALLS;
+        for (int i = 0; i < fields; ++i) {
+            ExprVal out;
+            if (expr_eval(prog, NULL, NULL, NULL, NULL, &out)) sum += out.ival;
+        }
+        double s2 = now_sec();
+        size_t a2 = ALLOC_CALLS;
+        if (s1 - s0 < one_shot) one_shot = s1 - s0;
+        if (s2 - s1 < compiled) compiled = s2 - s1;
+        calls_one_shot = a1 - a0;
+        calls_compiled = a2 - a1;
+    }
+    free(prog);
+    printf("one-shot:     %.0f ns/eval, %.1f allocations/eval\n", one_shot * 1e9 / fields, (double)calls_one_shot / fields);
+    printf("compiled:     %.0f ns/eval, %.1f allocations/eval (checksum %ld)\n",
+           compiled * 1e9 / fields, (double)calls_compiled / fields, sum);
+    return 0;
+}
+
+/* ---------- lexer throughput by vector width ---------- */
+
+static int bench_lex(int packages, int rounds) {
+    size_t fields = 0;
+    char *plain = gen_registry(packages, 5, 0, &fields);
+
+    /* the same registry with a license-style comment before each package */
+    StrBuf sb = {0};
+    for (const char *line = plain; *line; ) {
+        const char *eol = strchr(line, '\n');
+        size_t n = eol ? (size_t)(eol - line) + 1 : strlen(line);
+        if (strncmp(line, "    Package", 11) == 0) {
+            sb_printf(&sb, "    /*\n");
+            for (int i = 0; i < 4; ++i)
+                sb_printf(&sb, "     * Maintained by the registry team; mirrored nightly, signed on publish (%d).\n", i);
+            sb_printf(&sb, "     */\n");
+        }
+        sb_printf(&sb, "%.*s", (int)n, line);
+        line += n;
+    }
+
+    const char *names[] = { "registry", "commented" };
+    const char *texts[] = { plain, sb.buf };
+    int max = acl_lex_simd(32);
+    for (int k = 0; k < 2; ++k) {
+        size_t len = strlen(texts[k]);
+        printf("input:        %s, %zu bytes\n", names[k], len);
+        for (int w = 0; w <= max; w += 16) {
+            acl_lex_simd(w);
+            double best = 1e30;
+            long tokens = 0;
+            for (int r = 0; r < rounds; ++r) {
+                double t0 = now_sec();
+                tokens = acl_lex_count(texts[k], len);
+                double t1 = now_sec();
+                if (t1 - t0 < best) best = t1 - t0;
+            }
+            printf("  %-6s      %.3f ms (%.1f MB/s, %ld tokens)\n",
+                   w == 0 ? "scalar" : w == 16 ? "sse2" : "avx2", best * 1e3, (double)len / best / 1e6, tokens);
+        }
+    }
+    acl_lex_simd(max);
+
+    free(plain);
+    free(sb.buf);
+    return 0;
+}
+
+/* ---------- streaming parse ---------- */
+
+typedef struct SaxSums { unsigned long sum; size_t seen; int stop_after_first; int depth; } SaxSums;
+
+static unsigned long sum_bytes(unsigned long sum, const char *s, size_t n) {
+    for (size_t i = 0; i < n; ++i) sum = sum * 31 + (unsigned char)s[i];
+    return sum;
+}
+
+static int sums_field(void *ctx, const char *name, size_t nlen, const AclSaxValue *v) {
+    SaxSums *S = ctx;
+    if (nlen == 6 && memcmp(name, "sha256", 6) == 0 && v->kind == ACL_SAX_STRING) {
+        S->sum = sum_bytes(S->sum, v->str, v->len);
+        S->seen++;
+    }
+    return ACL_SAX_CONTINUE;
+}
+
+static int sums_enter(void *ctx, const char *name, size_t nlen, const char *label, size_t llen) {
+    (void)name; (void)nlen; (void)label; (void)llen;
+    SaxSums *S = ctx;
+    S->depth++;
+    return ACL_SAX_CONTINUE;
+}
+
+static int sums_exit(void *ctx) {
+    SaxSums *S = ctx;
+    /* depth 2 is a Package block */
+    if (S->depth-- == 2 && S->stop_after_first) return ACL_SAX_STOP;
+    return ACL_SAX_CONTINUE;
+}
+
+static int bench_sax(int packages, int rounds) {
+    const int versions = 5;
+    size_t fields = 0;
+    char *text = gen_registry(packages, versions, 0, &fields);
+    size_t len = strlen(text);
+    const AclSaxHandler h = { sums_enter, sums_exit, sums_field, NULL, NULL };
+    char path[96];
+
+    double tree = 1e30, sax = 1e30, first = 1e30;
+    size_t calls_tree = 0, calls_sax = 0, calls_first = 0;
+    unsigned long sum_tree = 0;
+    SaxSums all = {0}, one = {0};
+    for (int r = 0; r < rounds; ++r) {
+        size_t c0 = ALLOC_CALLS;
+        double t0 = now_sec();
+        AclBlock *root = acl_parse_string(text);
+        sum_tree = 0;
+        for (int p = 0; p < packages; ++p) {
+            for (int v = 0; v < versions; ++v) {
+                char *sha;
+                snprintf(path, sizeof(path), "Registry.Package[%d].Version[%d].sha256", p, v);
+                if (acl_get_string(root, path, &sha)) sum_tree = sum_bytes(sum_tree, sha, strlen(sha));
+            }
+        }
+        acl_free(root);
+        double t1 = now_sec();
+        size_t c1 = ALLOC_CALLS;
+        all = (SaxSums){0};
+        acl_sax_parse_string(text, len, &h, &all);
+        double t2 = now_sec();
+        size_t c2 = ALLOC_CALLS;
+        one = (SaxSums){ .stop_after_first = 1 };
+        acl_sax_parse_string(text, len, &h, &one);
+        double t3 = now_sec();
+        size_t c3 = ALLOC_CALLS;
+        if (t1 - t0 < tree) tree = t1 - t0;
+        if (t2 - t1 < sax) sax = t2 - t1;
+        if (t3 - t2 < first) first = t3 - t2;
+        calls_tree = c1 - c0;
+        calls_sax = c2 - c1;
+        calls_first = c3 - c2;
+    }
+    if (sum_tree != all.sum) { fprintf(stderr, "sax: checksums differ (%lx vs %lx)\n", sum_tree, all.sum); free(text); return 1; }
+
+    printf("input:        %zu bytes, %d packages x %d versions\n", len, packages, versions);
+    printf("tree:         %.3f ms parse + lookups + free, %zu allocations\n", tree * 1e3, calls_tree);
+    printf("sax:          %.3f ms, %zu allocations (%zu hashes, checksum %lx)\n", sax * 1e3, calls_sax, all.seen, all.sum);
+    printf("sax, stopped: %.3f ms after the first package, %zu allocations (%zu hashes)\n", first * 1e3, calls_first, one.seen);
+    free(text);
+    return 0;
+}
+
+/* ---------- live reload ---------- */
+
+static int write_users(const char *path, int users, int edited_uid, const char *shell) {
+    FILE *f = fopen(path, "w");
+    if (!f) return 0;
+    fprintf(f, "Defaults { string shell = \"%s\"; }\nUsers {\n", shell);
+    for (int i = 0; i < users; ++i)
+        fprintf(f, "    user \"u%d\" { int uid = %d; string home = \"/home/u%d\"; string shell = $Defaults.shell; }\n",
+                i, i == users / 2 ? edited_uid : i, i);
+    fprintf(f, "}\n");
+    return fclose(f) == 0;
+}
+
+/* A lazy tree reloaded after its file was rewritten in place (same inode),
+   once shorter and once longer: the reload must compare the tree as first
+   read with the new file, not read new bytes at old offsets. Returns 0 if
+   it didn't. */
+static int reload_in_place(const char *src, int users) {
+    static const struct { int quarters, uid; const char *shell; } steps[] = { { 2, -5, "/bin/sh" }, { 8, -7, "/bin/ksh" } };
+    int ok = 1;
+    for (int k = 0; k < 2 && ok; ++k) {
+        write_users(src, users, 0, "/bin/sh");
+        AclBlock *t = acl_parse_file_lazy(src);
+        long uid = 0;
+        if (!t || !acl_get_int(t, "Users.user[\"u0\"].uid", &uid)) { acl_free(t); return 0; }
+        int now = users * steps[k].quarters / 4;  /* half, then twice as many */
+        write_users(src, now, steps[k].uid, steps[k].shell);
+        AclChangeSet *changes = NULL;
+        int rc = acl_reload(&t, src, &changes);
+        size_t added = 0, removed = 0;
+        for (size_t i = 0; changes && i < changes->count; ++i) {
+            added += changes->items[i].kind == ACL_CHANGE_ADDED;
+            removed += changes->items[i].kind == ACL_CHANGE_REMOVED;
+        }
+        char path[64], *shell = NULL;
+        snprintf(path, sizeof(path), "Users.user[\"u%d\"].uid", now / 2);
+        ok = rc == 1 && acl_get_int(t, path, &uid) && uid == steps[k].uid
+             && acl_get_string(t, "Users.user[\"u0\"].shell", &shell) && strcmp(shell, steps[k].shell) == 0
+             && added == (size_t)(now > users ? now - users : 0) && removed == (size_t)(now < users ? users - now : 0);
+        printf("in place:     lazy tree, %d -> %d users rewritten in place: acl_reload %d, %zu added, %zu removed, %s\n",
+               users, now, rc, added, removed, ok ? "ok" : "WRONG");
+        free(shell);
+        acl_changes_free(changes);
+        acl_free(t);
+    }
+    return ok;
+}
+
+static int bench_reload(int users, int rounds) {
+    char src[] = "/tmp/acl-bench-XXXXXX";
+    int fd = mkstemp(src);
+    if (fd < 0) { perror("reload: mkstemp"); return 1; }
+    close(fd);
+
+    write_users(src, users, 0, "/bin/sh");
+    AclBlock *live = acl_parse_file(src);
+    if (!live || !acl_resolve_all(live)) { fprintf(stderr, "reload: initial load failed\n"); unlink(src); return 1; }
+
+    static const char *const what[] = { "one uid", "Defaults.shell" };
+    for (int kind = 0; kind < 2; ++kind) {
+        double parsed = 1e30, reloaded = 1e30;
+        size_t calls_parsed = 0, calls_reloaded = 0, nchanges = 0;
+        for (int r = 0; r < rounds; ++r) {
+            /* alternate between two versions so every round has a change */
+            if (kind == 0) write_users(src, users, r % 2 ? -1 : -2, "/bin/sh");
+            else write_users(src, users, -2, r % 2 ? "/bin/ksh" : "/bin/sh");
+
+            size_t c0 = ALLOC_CALLS;
+            double t0 = now_sec();
+            AclBlock *t = acl_parse_file(src);
+            acl_resolve_all(t);
+            acl_free(t);
+            double t1 = now_sec();
+            size_t c1 = ALLOC_CALLS;
+            AclChangeSet *changes = NULL;
+            int rc = acl_reload(&live, src, &changes);
+            double t2 = now_sec();
+            size_t c2 = ALLOC_CALLS;
+            if (rc != 1) { fprintf(stderr, "reload: acl_reload returned %d\n", rc); acl_changes_free(changes); acl_free(live); unlink(src); return 1; }
+            nchanges = changes->count;
+            acl_changes_free(changes);
+            if (t1 - t0 < parsed) parsed = t1 - t0;
+            if (t2 - t1 < reloaded) reloaded = t2 - t1;
+            calls_parsed = c1 - c0;
+            calls_reloaded = c2 - c1;
+        }
+        printf("edit:         %s, %d users, %zu changes reported\n", what[kind], users, nchanges);
+        printf("parse:        %.3f ms parse + resolve + free, %zu allocations\n", parsed * 1e3, calls_parsed);
+        printf("reload:       %.3f ms acl_reload (with change set), %zu allocations\n", reloaded * 1e3, calls_reloaded);
+    }
+
+    acl_free(live);
+    int ok = reload_in_place(src, users);
+    unlink(src);
+    return ok ? 0 : 1;
+}
+
+/* ---------- lazy parsing ---------- */
+
+static long user_lookups(AclBlock *root, int user) {
+    char path[96];
+    long sum = 0, uid = 0;
+    char *s = NULL;
+    snprintf(path, sizeof(path), "Users.user[\"u%d\"].uid", user);
+    if (acl_get_int(root, path, &uid)) sum += uid;
+    snprintf(path, sizeof(path), "Users.user[\"u%d\"].home", user);
+    if (acl_get_string(root, path, &s)) { sum += (long)strlen(s); free(s); }
+    snprintf(path, sizeof(path), "Users.user[\"u%d\"].shell", user);
+    if (acl_get_string(root, path, &s)) { sum += (long)strlen(s); free(s); }
+    return sum;
+}
+
+static int bench_lazy(int users, int rounds) {
+    char src[] = "/tmp/acl-bench-XXXXXX";
+    int fd = mkstemp(src);
+    if (fd < 0) { perror("lazy: mkstemp"); return 1; }
+    close(fd);
+    if (!write_users(src, users, users / 2, "/bin/sh")) { perror("lazy: write"); unlink(src); return 1; }
+
+    double eager = 1e30, open = 1e30, lazy = 1e30;
+    size_t calls_eager = 0, calls_lazy = 0;
+    long sum_eager = 0, sum_lazy = 0;
+    for (int r = 0; r < rounds; ++r) {
+        int user = (r * 7919) % users;
+        size_t c0 = ALLOC_CALLS;
+        double t0 = now_sec();
+        AclBlock *root = acl_parse_file(src);
+        acl_resolve_all(root);
+        sum_eager = user_lookups(root, user);
+        acl_free(root);
+        double t1 = now_sec();
+        size_t c1 = ALLOC_CALLS;
+        root = acl_parse_file_lazy(src);
+        double t2 = now_sec();
+        sum_lazy = user_lookups(root, user);
+        acl_free(root);
+        double t3 = now_sec();
+        size_t c2 = ALLOC_CALLS;
+        if (sum_eager != sum_lazy) { fprintf(stderr, "lazy: lookups differ (%ld vs %ld)\n", sum_eager, sum_lazy); unlink(src); return 1; }
+        if (t1 - t0 < eager) eager = t1 - t0;
+        if (t2 - t1 < open) open = t2 - t1;
+        if (t3 - t1 < lazy) lazy = t3 - t1;
+        calls_eager = c1 - c0;
+        calls_lazy = c2 - c1;
+    }
+    struct stat st;
+    stat(src, &st);
+    printf("input:        %d users, %lld bytes\n", users, (long long)st.st_size);
+    printf("eager:        %.3f ms parse + resolve + one user + free, %zu allocations\n", eager * 1e3, calls_eager);
+    printf("lazy:         %.3f ms the same (%.3f ms to open), %zu allocations\n", lazy * 1e3, open * 1e3, calls_lazy);
+    unlink(src);
+    return 0;
+}
+
+/* ---------- bulk lookups ---------- */
+
+static const char *const QUERY_FIELDS[] = { "uid", "home", "shell" };
+
+static long query_paths(AclBlock *root, int user) {
+    char path[96];
+    long sum = 0, uid = 0;
+    const char *s;
+    snprintf(path, sizeof(path), "Users.user[\"u%d\"].uid", user);
+    if (acl_value_int(acl_find_value_by_path(root, path), &uid)) sum += uid;
+    snprintf(path, sizeof(path), "Users.user[\"u%d\"].home", user);
+    if (acl_value_string(acl_find_value_by_path(root, path), &s)) sum += (long)strlen(s);
+    snprintf(path, sizeof(path), "Users.user[\"u%d\"].shell", user);
+    if (acl_value_string(acl_find_value_by_path(root, path), &s)) sum += (long)strlen(s);
+    return sum;
+}
+
+static long query_many(AclBlock *root, int user) {
+    char path[64];
+    AclValue *v[3];
+    long sum = 0, uid = 0;
+    const char *s;
+    snprintf(path, sizeof(path), "Users.user[\"u%d\"]", user);
+    acl_query_many(root, path, QUERY_FIELDS, 3, v);
+    if (acl_value_int(v[0], &uid)) sum += uid;
+    if (acl_value_string(v[1], &s)) sum += (long)strlen(s);
+    if (acl_value_string(v[2], &s)) sum += (long)strlen(s);
+    return sum;
+}
+
+static int bench_query(int users, int lookups, int rounds) {
+    char src[] = "/tmp/acl-bench-XXXXXX";
+    int fd = mkstemp(src);
+    if (fd < 0) { perror("query: mkstemp"); return 1; }
+    close(fd);
+    char img[sizeof(src) + 5];
+    snprintf(img, sizeof(img), "%s.aclb", src);
+    AclBlock *tree = NULL, *image = NULL;
+    if (!write_users(src, users, users / 2, "/bin/sh") || !(tree = acl_parse_file(src)) || !acl_resolve_all(tree)
+        || !acl_compile(tree, src, img) || !(image = acl_open_compiled(img, src))) {
+        fprintf(stderr, "query: can't build the config\n");
+        acl_free(tree);
+        unlink(src);
+        unlink(img);
+        return 1;
+    }
+
+    static const char *const where[] = { "tree", "image" };
+    AclBlock *roots[] = { tree, image };
+    for (int k = 0; k < 2; ++k) {
+        double paths = 1e30, many = 1e30;
+        long sum_paths = 0, sum_many = 0;
+        for (int r = 0; r < rounds; ++r) {
+            double t0 = now_sec();
+            sum_paths = 0;
+            for (int i = 0; i < lookups; ++i) sum_paths += query_paths(roots[k], (int)(((long)i * 7919) % users));
+            double t1 = now_sec();
+            sum_many = 0;
+            for (int i = 0; i < lookups; ++i) sum_many += query_many(roots[k], (int)(((long)i * 7919) % users));
+            double t2 = now_sec();
+            if (t1 - t0 < paths) paths = t1 - t0;
+            if (t2 - t1 < many) many = t2 - t1;
+        }
+        if (sum_paths != sum_many) {
+            fprintf(stderr, "query: %s lookups differ (%ld vs %ld)\n", where[k], sum_paths, sum_many);
+            acl_free(tree);
+            acl_free(image);
+            unlink(src);
+            unlink(img);
+            return 1;
+        }
+        printf("%-5s paths:  %.1f ns per user (3 x acl_find_value_by_path)\n", where[k], paths * 1e9 / lookups);
+        printf("%-5s many:   %.1f ns per user (acl_query_many)\n", where[k], many * 1e9 / lookups);
+    }
+    acl_free(tree);
+    acl_free(image);
+    unlink(src);
+    unlink(img);
+    return 0;
+}
+
+/* ---------- query iterators ---------- */
+
+/* every Version's sha256 by one path per version, as tools walk today */
+static unsigned long select_paths(AclBlock *root, int packages, int versions, size_t *deprecated) {
+    char path[96];
+    unsigned long sum = 0;
+    const char *s;
+    int b;
+    *deprecated = 0;
+    for (int p = 0; p < packages; ++p) {
+        for (int v = 0; v < versions; ++v) {
+            snprintf(path, sizeof(path), "Registry.Package[%d].Version[%d].sha256", p, v);
+            if (acl_value_string(acl_find_value_by_path(root, path), &s)) sum = sum_bytes(sum, s, strlen(s));
+            snprintf(path, sizeof(path), "Registry.Package[%d].Version[%d].deprecated", p, v);
+            if (acl_value_bool(acl_find_value_by_path(root, path), &b) && b) ++*deprecated;
+        }
+    }
+    return sum;
+}
+
+static unsigned long select_query(AclBlock *root, const AclQuery *sha, const AclQuery *dep, size_t *deprecated) {
+    unsigned long sum = 0;
+    const char *s;
+    AclMatch m;
+    AclQueryIter *it = acl_query_run(root, sha);
+    while (acl_query_next(it, &m)) {
+        if (acl_value_string(m.value, &s)) sum = sum_bytes(sum, s, strlen(s));
+    }
+    acl_query_iter_free(it);
+    *deprecated = 0;
+    it = acl_query_run(root, dep);
+    while (acl_query_next(it, &m)) ++*deprecated;
+    acl_query_iter_free(it);
+    return sum;
+}
+
+static int bench_select(int packages, int rounds) {
+    const int versions = 5;
+    size_t fields = 0;
+    char *text = gen_registry(packages, versions, 0, &fields);
+    char src[] = "/tmp/acl-bench-XXXXXX";
+    int fd = mkstemp(src);
+    if (fd < 0) { perror("select: mkstemp"); free(text); return 1; }
+    size_t len = strlen(text);
+    int wrote = write(fd, text, len) == (ssize_t)len;
+    close(fd);
+    free(text);
+    char img[sizeof(src) + 5];
+    snprintf(img, sizeof(img), "%s.aclb", src);
+    AclBlock *tree = NULL, *image = NULL;
+    AclQuery *sha = acl_query_compile("Registry.Package[*].Version[*].sha256");
+    AclQuery *dep = acl_query_compile("**.Version[deprecated == true]");
+    int fail = !wrote || !sha || !dep || !(tree = acl_parse_file(src)) || !acl_resolve_all(tree)
+            || !acl_compile(tree, src, img) || !(image = acl_open_compiled(img, src));
+    if (fail) fprintf(stderr, "select: can't build the registry\n");
+
+    static const char *const where[] = { "tree", "image" };
+    AclBlock *roots[] = { tree, image };
+    for (int k = 0; k < 2 && !fail; ++k) {
+        double paths = 1e30, query = 1e30;
+        unsigned long sum_paths = 0, sum_query = 0;
+        size_t dep_paths = 0, dep_query = 0, calls = 0;
+        for (int r = 0; r < rounds; ++r) {
+            double t0 = now_sec();
+            sum_paths = select_paths(roots[k], packages, versions, &dep_paths);
+            double t1 = now_sec();
+            size_t c0 = ALLOC_CALLS;
+            sum_query = select_query(roots[k], sha, dep, &dep_query);
+            double t2 = now_sec();
+            calls = ALLOC_CALLS - c0;
+            if (t1 - t0 < paths) paths = t1 - t0;
+            if (t2 - t1 < query) query = t2 - t1;
+        }
+        if (sum_paths != sum_query || dep_paths != dep_query) {
+            fprintf(stderr, "select: %s results differ (%lx/%zu vs %lx/%zu)\n", where[k], sum_paths, dep_paths, sum_query, dep_query);
+            fail = 1;
+            break;
+        }
+        if (k == 0) printf("input:        %d packages x %d versions, %zu deprecated\n", packages, versions, dep_query);
+        printf("%-5s paths:  %.3f ms (2 x acl_find_value_by_path per version)\n", where[k], paths * 1e3);
+        printf("%-5s query:  %.3f ms (2 queries), %zu allocations\n", where[k], query * 1e3, calls);
+    }
+    acl_query_free(sha);
+    acl_query_free(dep);
+    acl_free(tree);
+    acl_free(image);
+    unlink(src);
+    unlink(img);
+    return fail;
+}
+
+/* ---------- benchmark suite ---------- */
+
+/* A config of a given shape is built from numbered units (a block, a field
+   or an array each) repeated until the text reaches the requested size;
+   `path` names a value inside unit i for the lookup phases and says
+   whether it is an int or a string. Each shape runs in a child process so
+   its peak RSS is its own. */
+
+#define DEEP_LEVELS 24
+#define SUITE_PATHS 1000
+
+typedef struct SuiteShape {
+    const char *name;
+    const char *head, *tail;
+    void (*unit)(StrBuf *sb, long i);
+    int (*path)(char *buf, size_t n, long i); /* 'i' or 's' */
+} SuiteShape;
+
+static void deep_unit(StrBuf *sb, long i) {
+    sb_printf(sb, "Deep%ld {\n", i);
+    for (int d = 1; d < DEEP_LEVELS; ++d) sb_printf(sb, "%*sL%d {\n", d * 2, "", d);
+    sb_printf(sb, "%*sint v = %ld;\n%*sstring s = \"deep%ld\";\n", DEEP_LEVELS * 2, "", i, DEEP_LEVELS * 2, "", i);
+    for (int d = DEEP_LEVELS - 1; d >= 0; --d) sb_printf(sb, "%*s}\n", d * 2, "");
+}
+
+static int deep_path(char *buf, size_t n, long i) {
+    size_t len = (size_t)snprintf(buf, n, "Deep%ld", i);
+    for (int d = 1; d < DEEP_LEVELS && len < n; ++d) len += (size_t)snprintf(buf + len, n - len, ".L%d", d);
+    if (len < n) snprintf(buf + len, n - len, i % 2 ? ".v" : ".s");
+    return i % 2 ? 'i' : 's';
+}
+
+static void wide_unit(StrBuf *sb, long i) {
+    sb_printf(sb, "    int f%ld = %ld;\n", i, i);
+    if (i % 8 == 0) sb_printf(sb, "    Child \"c%ld\" { string name = \"child%ld\"; int n = %ld; }\n", i, i, i);
+}
+
+static int wide_path(char *buf, size_t n, long i) {
+    if (i % 2) { snprintf(buf, n, "Wide.f%ld", i); return 'i'; }
+    snprintf(buf, n, "Wide.Child[\"c%ld\"].name", i / 8 * 8);
+    return 's';
+}
+
+static void array_unit(StrBuf *sb, long i) {
+    if (i % 2) {
+        sb_printf(sb, "    string[] s%ld = {", i);
+        for (int k = 0; k < 128; ++k) sb_printf(sb, "%s\"e%d\"", k ? ", " : " ", k);
+    } else {
+        sb_printf(sb, "    int[] a%ld = {", i);
+        for (int k = 0; k < 256; ++k) sb_printf(sb, "%s%d", k ? ", " : " ", k);
+    }
+    sb_printf(sb, " };\n");
+}
+
+static int array_path(char *buf, size_t n, long i) {
+    if (i % 2) { snprintf(buf, n, "Arrays.s%ld[%ld]", i, i % 128); return 's'; }
+    snprintf(buf, n, "Arrays.a%ld[%ld]", i, i % 256);
+    return 'i';
+}
+
+static void refs_unit(StrBuf *sb, long i) {
+    sb_printf(sb, "    Node \"n%ld\" { int v = $Refs.base; int w = ^base; string s = ^name; int x = $.w; int y = $Refs.Node[\"n%ld\"].x; }\n",
+              i, i ? i - 1 : 0);
+}
+
+static int refs_path(char *buf, size_t n, long i) {
+    snprintf(buf, n, "Refs.Node[\"n%ld\"].%s", i, i % 2 ? "y" : "s");
+    return i % 2 ? 'i' : 's';
+}
+
+static void expr_unit(StrBuf *sb, long i) {
+    sb_printf(sb, "    Calc \"c%ld\" { int a = %ld; expr sum = \"$.a + $Exprs.base\"; expr twice = \"$.sum * 2\"; expr tag = \"$Exprs.prefix + $.a\"; }\n",
+              i, i);
+}
+
+static int expr_path(char *buf, size_t n, long i) {
+    snprintf(buf, n, "Exprs.Calc[\"c%ld\"].%s", i, i % 2 ? "twice" : "tag");
+    return i % 2 ? 'i' : 's';
+}
+
+static void registry_unit(StrBuf *sb, long i) { gen_package(sb, (int)i, 5, 0); }
+
+static int registry_path(char *buf, size_t n, long i) {
+    snprintf(buf, n, "Registry.Package[\"pkg%ld\"].Version[\"0.%ld.0\"].%s", i, i % 5, i % 2 ? "size" : "sha256");
+    return i % 2 ? 'i' : 's';
+}
+
+static const SuiteShape SUITE_SHAPES[] = {
+    { "deep", "", "", deep_unit, deep_path },
+    { "wide", "Wide {\n", "}\n", wide_unit, wide_path },
+    { "array", "Arrays {\n", "}\n", array_unit, array_path },
+    { "refs", "Refs {\n    int base = 7;\n    string name = \"refs\";\n", "}\n", refs_unit, refs_path },
+    { "expr", "Exprs {\n    int base = 3;\n    string prefix = \"c\";\n", "}\n", expr_unit, expr_path },
+    { "registry", "Registry {\n    string url = \"https://reg.example.com/index.acl\";\n", "}\n", registry_unit, registry_path },
+};
+#define SUITE_NSHAPES (sizeof(SUITE_SHAPES) / sizeof(SUITE_SHAPES[0]))
+
+/* generate about `size` bytes of shape S; paths[] gets up to SUITE_PATHS
+   lookups spread evenly over the units */
+static char *suite_gen(const SuiteShape *S, size_t size, char **paths, int *kinds, size_t *npaths, long *units_out) {
+    StrBuf sb = {0};
+    sb_printf(&sb, "%s", S->head);
+    size_t tail = strlen(S->tail), before = sb.len;
+    S->unit(&sb, 0);
+    size_t unit = sb.len - before;
+    long units = size > before + tail + unit ? (long)((size - before - tail) / unit) : 1;
+    long stride = units > SUITE_PATHS ? units / SUITE_PATHS : 1;
+    long i = 1;
+    for (; sb.len + tail < size; ++i) S->unit(&sb, i);
+    sb_printf(&sb, "%s", S->tail);
+
+    char buf[512];
+    *npaths = 0;
+    for (long k = 0; k < i && *npaths < SUITE_PATHS; k += stride) {
+        kinds[*npaths] = S->path(buf, sizeof(buf), k);
+        paths[(*npaths)++] = strdup(buf);
+    }
+    *units_out = i;
+    return sb.buf;
+}
+
+enum { PH_LEX, PH_PARSE, PH_RESOLVE, PH_LOOKUP, PH_GET, PH_FREE, PH_COUNT };
+static const char *const PHASE_NAMES[PH_COUNT] = { "lex", "parse", "resolve", "lookup", "get", "free" };
+
+typedef struct SuitePhase { double best, total; size_t calls, bytes; } SuitePhase;
+
+/* run one shape at one size; prints one JSON object or a text paragraph */
+static int suite_run(const SuiteShape *S, size_t size, int rounds, int json) {
+    char *paths[SUITE_PATHS];
+    int kinds[SUITE_PATHS];
+    size_t npaths = 0;
+    long units = 0;
+    double g0 = now_sec();
+    char *text = suite_gen(S, size, paths, kinds, &npaths, &units);
+    double gen = now_sec() - g0;
+    size_t len = strlen(text);
+
+    SuitePhase ph[PH_COUNT];
+    for (int p = 0; p < PH_COUNT; ++p) ph[p] = (SuitePhase){ 1e30, 0, 0, 0 };
+    long tokens = 0, found = 0, got = 0;
+    int resolved = 1;
+    for (int r = 0; r < rounds; ++r) {
+        double t[PH_COUNT + 1];
+        size_t c[PH_COUNT + 1], b[PH_COUNT + 1];
+#define MARK(k) (t[k] = now_sec(), c[k] = ALLOC_CALLS, b[k] = ALLOC_BYTES)
+        MARK(PH_LEX);
+        tokens = acl_lex_count(text, len);
+        MARK(PH_PARSE);
+        AclBlock *root = acl_parse_string(text);
+        MARK(PH_RESOLVE);
+        resolved = root && acl_resolve_all(root);
+        MARK(PH_LOOKUP);
+        found = 0;
+        for (size_t k = 0; k < npaths; ++k) found += acl_find_value_by_path(root, paths[k]) != NULL;
+        MARK(PH_GET);
+        got = 0;
+        for (size_t k = 0; k < npaths; ++k) {
+            long v = 0;
+            char *s = NULL;
+            if (kinds[k] == 'i') got += acl_get_int(root, paths[k], &v);
+            else if (acl_get_string(root, paths[k], &s)) { got++; free(s); }
+        }
+        MARK(PH_FREE);
+        acl_free(root);
+        MARK(PH_COUNT);
+#undef MARK
+        for (int p = 0; p < PH_COUNT; ++p) {
+            double d = t[p + 1] - t[p];
+            if (d < ph[p].best) ph[p].best = d;
+            ph[p].total += d;
+            ph[p].calls = c[p + 1] - c[p];
+            ph[p].bytes = b[p + 1] - b[p];
+        }
+    }
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
+    if (json) {
+        printf("{\"shape\": \"%s\", \"requested_bytes\": %zu, \"bytes\": %zu, \"units\": %ld, \"tokens\": %ld, "
+               "\"rounds\": %d, \"generate_ms\": %.3f, \"resolved\": %s, \"lookups\": %zu, \"found\": %ld, \"got\": %ld, "
+               "\"peak_rss_kb\": %ld, \"phases\": {",
+               S->name, size, len, units, tokens, rounds, gen * 1e3, resolved ? "true" : "false", npaths, found, got, ru.ru_maxrss);
+        for (int p = 0; p < PH_COUNT; ++p)
+            printf("%s\"%s\": {\"best_ms\": %.4f, \"mean_ms\": %.4f, \"allocs\": %zu, \"alloc_bytes\": %zu}",
+                   p ? ", " : "", PHASE_NAMES[p], ph[p].best * 1e3, ph[p].total * 1e3 / rounds, ph[p].calls, ph[p].bytes);
+        printf("}}");
+    } else {
+        printf("input:        %s, %zu bytes, %ld units, %ld tokens%s\n", S->name, len, units, tokens, resolved ? "" : " UNRESOLVED");
+        for (int p = 0; p < PH_COUNT; ++p)
+            printf("  %-8s    %.4f ms best, %.4f ms mean, %zu allocations, %zu bytes\n",
+                   PHASE_NAMES[p], ph[p].best * 1e3, ph[p].total * 1e3 / rounds, ph[p].calls, ph[p].bytes);
+        printf("  lookups     %zu paths, %ld found, %ld read by type\n", npaths, found, got);
+        printf("  peak rss    %ld KB\n", ru.ru_maxrss);
+    }
+    fflush(stdout);
+    for (size_t k = 0; k < npaths; ++k) free(paths[k]);
+    free(text);
+    return resolved && (size_t)found == npaths && (size_t)got == npaths ? 0 : 1;
+}
+
+/* "64K", "10M", "1G" or plain bytes; 0 if malformed */
+static size_t parse_size(const char *s) {
+    char *end;
+    unsigned long long n = strtoull(s, &end, 10);
+    switch (*end) {
+        case 'K': case 'k': n <<= 10; end++; break;
+        case 'M': case 'm': n <<= 20; end++; break;
+        case 'G': case 'g': n <<= 30; end++; break;
+    }
+    return *end ? 0 : (size_t)n;
+}
+
+static int bench_suite(const char *shapes, const char *sizes, int rounds, int json) {
+    const SuiteShape *picked[SUITE_NSHAPES];
+    size_t npicked = 0;
+    for (size_t k = 0; k < SUITE_NSHAPES; ++k) {
+        const char *name = SUITE_SHAPES[k].name, *p = shapes;
+        size_t n = strlen(name);
+        int want = strcmp(shapes, "all") == 0;
+        for (; !want && (p = strstr(p, name)); p += n)
+            want = (p == shapes || p[-1] == ',') && (p[n] == ',' || p[n] == '\0');
+        if (want) picked[npicked++] = &SUITE_SHAPES[k];
+    }
+    if (!npicked) { fprintf(stderr, "suite: no shape in \"%s\"\n", shapes); return 2; }
+
+    if (json) printf("{\"benchmark\": \"acl-bench suite\", \"results\": [\n");
+    int failed = 0, first = 1;
+    char *list = strdup(sizes), *save = NULL;
+    for (char *tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        size_t size = parse_size(tok);
+        if (!size) { fprintf(stderr, "suite: bad size \"%s\"\n", tok); failed = 1; continue; }
+        for (size_t k = 0; k < npicked; ++k) {
+            if (json) printf("%s  ", first ? "" : ",\n");
+            first = 0;
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0) _exit(suite_run(picked[k], size, rounds, json));
+            int status = 0;
+            if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+                fprintf(stderr, "suite: %s at %zu bytes failed\n", picked[k]->name, size);
+                if (json && (pid < 0 || !WIFEXITED(status))) printf("{\"shape\": \"%s\", \"requested_bytes\": %zu, \"error\": true}", picked[k]->name, size);
+                failed = 1;
+            }
+        }
+    }
+    free(list);
+    if (json) printf("\n]}\n");
+    return failed;
+}
+
+/* ---------- split parsing ---------- */
+
+static char *gen_index(int packages, int versions) {
+    StrBuf sb = {0};
+    sb_printf(&sb, "Registry {\n    string url = \"https://reg.example.com\";\n}\n");
+    for (int p = 0; p < packages; ++p) {
+        sb_printf(&sb, "Package \"pkg%d\" {\n", p);
+        sb_printf(&sb, "    string registry = $Registry.url;\n");
+        sb_printf(&sb, "    string pkg_base_url = \"https://reg.example.com/pkgs/pkg%d\";\n", p);
+        sb_printf(&sb, "    string[] tags = { \"cli\", \"tooling\" };\n");
+        for (int v = 0; v < versions; ++v) {
+            sb_printf(&sb, "    Version \"%d.%d.0\" {\n", v / 10, v % 10);
+            sb_printf(&sb, "        string manifest_url = \"https://reg.example.com/pkgs/pkg%d/%d.%d.0/manifest.acl\";\n", p, v / 10, v % 10);
+            sb_printf(&sb, "        string sha256 = \"%064x\";\n", (unsigned)(p * 131 + v));
+            sb_printf(&sb, "        bool deprecated = %s;\n", (v % 3) ? "false" : "true");
+            sb_printf(&sb, "        int size = %d;\n", 1000 + p + v);
+            sb_printf(&sb, "    }\n");
+        }
+        sb_printf(&sb, "}\n");
+    }
+    return sb.buf;
+}
+
+static int bench_split(int packages, int rounds) {
+    char *text = gen_index(packages, 5);
+    size_t len = strlen(text);
+    char path[64];
+    snprintf(path, sizeof(path), "[\"pkg%d\"].registry", packages - 1);
+    printf("input:        %d top-level packages, %.1f MB\n", packages, (double)len / 1e6);
+
+    static const int threads[] = { 0, 1, 2, 4, 8 };
+    double base = 0;
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i) {
+        double best = 1e30;
+        for (int r = 0; r < rounds; ++r) {
+            double t0 = now_sec();
+            AclBlock *root = threads[i] ? acl_parse_string_parallel(text, threads[i]) : acl_parse_string(text);
+            double t1 = now_sec();
+            char *s = NULL;
+            int ok = root && acl_resolve_all(root) && acl_get_string(root, path, &s) && strcmp(s, "https://reg.example.com") == 0;
+            free(s);
+            acl_free(root);
+            if (!ok) { fprintf(stderr, "split: %s did not resolve\n", path); free(text); return 1; }
+            if (t1 - t0 < best) best = t1 - t0;
+        }
+        if (!threads[i]) {
+            base = best;
+            printf("serial:       %.3f ms acl_parse_string\n", best * 1e3);
+        } else {
+            printf("threads %d:    %.3f ms acl_parse_string_parallel (%.2fx)\n", threads[i], best * 1e3, base / best);
+        }
+    }
+    printf("cpus:         %ld online\n", sysconf(_SC_NPROCESSORS_ONLN));
+    free(text);
+    return 0;
+}
+
+/* ---------- on-demand resolution ---------- */
+
+/* the int (y) or string (s) field refs_path names for unit i */
+static long refs_read(AclBlock *root, long i) {
+    char path[64];
+    long v = 0;
+    const char *s;
+    if (refs_path(path, sizeof(path), i) == 'i') return acl_get_int(root, path, &v) ? v : -1;
+    return acl_value_string(acl_find_value_by_path(root, path), &s) ? (long)strlen(s) : -1;
+}
+
+static int bench_ondemand(int nodes, int lookups, int rounds) {
+    StrBuf sb = {0};
+    sb_printf(&sb, "Refs {\n    int base = 7;\n    string name = \"refs\";\n");
+    for (long i = 0; i < nodes; ++i) refs_unit(&sb, i);
+    sb_printf(&sb, "}\n");
+
+    double eager = 1e30, ondemand = 1e30;
+    size_t calls_eager = 0, calls_ondemand = 0;
+    long sum_eager = 0, sum_ondemand = 0;
+    for (int r = 0; r < rounds; ++r) {
+        AclBlock *a = acl_parse_string(sb.buf), *b = acl_parse_string(sb.buf);
+        if (!a || !b) { fprintf(stderr, "ondemand: parse failed\n"); acl_free(a); acl_free(b); free(sb.buf); return 1; }
+        size_t c0 = ALLOC_CALLS;
+        double t0 = now_sec();
+        acl_resolve_all(a);
+        sum_eager = 0;
+        for (int k = 0; k < lookups; ++k) sum_eager += refs_read(a, ((long)k * 7919) % nodes);
+        double t1 = now_sec();
+        size_t c1 = ALLOC_CALLS;
+        acl_resolve_on_demand(b);
+        sum_ondemand = 0;
+        for (int k = 0; k < lookups; ++k) sum_ondemand += refs_read(b, ((long)k * 7919) % nodes);
+        double t2 = now_sec();
+        size_t c2 = ALLOC_CALLS;
+        acl_free(a);
+        acl_free(b);
+        if (sum_eager != sum_ondemand) {
+            fprintf(stderr, "ondemand: lookups differ (%ld vs %ld)\n", sum_eager, sum_ondemand);
+            free(sb.buf);
+            return 1;
+        }
+        if (t1 - t0 < eager) eager = t1 - t0;
+        if (t2 - t1 < ondemand) ondemand = t2 - t1;
+        calls_eager = c1 - c0;
+        calls_ondemand = c2 - c1;
+    }
+    printf("input:        %d nodes (5 references each), %zu bytes, %d lookups\n", nodes, sb.len, lookups);
+    printf("eager:        %.3f ms acl_resolve_all + lookups, %zu allocations\n", eager * 1e3, calls_eager);
+    printf("on demand:    %.3f ms acl_resolve_on_demand + lookups, %zu allocations\n", ondemand * 1e3, calls_ondemand);
+    free(sb.buf);
+    return 0;
+}
+
+/* ---------- generated parsers ---------- */
+
+static char *gen_users_text(int users) {
+    StrBuf sb = {0};
+    sb_printf(&sb, "Users {\n");
+    for (int i = 0; i < users; ++i) {
+        sb_printf(&sb, "    user \"u%d\" {\n        string name = \"u%d\";\n        int uid = %d;\n        int gid = %d;\n", i, i, 1000 + i, 100 + i % 7);
+        sb_printf(&sb, "        string home = \"/home/u%d\";\n        string shell = \"/bin/hermes\";\n", i);
+        sb_printf(&sb, "        string passwd_hash = \"sha256$%08x$%064x\";\n        bool locked = %s;\n    }\n", i * 2654435761u, i, i % 5 ? "false" : "true");
+    }
+    sb_printf(&sb, "}\n");
+    return sb.buf;
+}
+
+static unsigned long users_sum(const users_Users_user *u) {
+    return (unsigned long)u->uid + (unsigned long)u->gid + (unsigned long)u->locked + strlen(u->label) + strlen(u->name)
+         + strlen(u->home) + strlen(u->shell) + strlen(u->passwd_hash);
+}
+
+/* the generic path: a tree, then each user's fields read into the struct */
+static unsigned long users_generic(const char *text, const AclQuery *q, size_t *count) {
+    AclBlock *root = acl_parse_string(text);
+    if (!root || !acl_resolve_all(root)) { acl_free(root); return 0; }
+    AclQueryIter *it = acl_query_run(root, q);
+    AclMatch m;
+    unsigned long sum = 0;
+    *count = 0;
+    while (acl_query_next(it, &m)) {
+        users_Users_user u = { m.label, "", -1, -1, "/", "/bin/hermes", "", 0 };
+        acl_value_string(acl_cursor_get(&m.block, "name"), &u.name);
+        acl_value_int(acl_cursor_get(&m.block, "uid"), &u.uid);
+        acl_value_int(acl_cursor_get(&m.block, "gid"), &u.gid);
+        acl_value_string(acl_cursor_get(&m.block, "home"), &u.home);
+        acl_value_string(acl_cursor_get(&m.block, "shell"), &u.shell);
+        acl_value_string(acl_cursor_get(&m.block, "passwd_hash"), &u.passwd_hash);
+        acl_value_bool(acl_cursor_get(&m.block, "locked"), &u.locked);
+        sum += users_sum(&u);
+        ++*count;
+    }
+    acl_query_iter_free(it);
+    acl_free(root);
+    return sum;
+}
+
+static unsigned long users_generated(const char *text, size_t len, size_t *count) {
+    users_config c;
+    unsigned long sum = 0;
+    if (users_parse_string(text, len, &c) == 1) {
+        for (size_t i = 0; i < c.Users.user_count; ++i) sum += users_sum(&c.Users.user[i]);
+    }
+    *count = c.Users.user_count;
+    users_free(&c);
+    return sum;
+}
+
+static int bench_codegen(int users, int rounds) {
+    char *text = gen_users_text(users);
+    size_t len = strlen(text);
+    AclQuery *q = acl_query_compile("Users.user[*]");
+    double generic = 1e30, generated = 1e30;
+    size_t calls_generic = 0, calls_generated = 0, n_generic = 0, n_generated = 0;
+    unsigned long sum_generic = 0, sum_generated = 0;
+    for (int r = 0; r < rounds; ++r) {
+        size_t c0 = ALLOC_CALLS;
+        double t0 = now_sec();
+        sum_generic = users_generic(text, q, &n_generic);
+        double t1 = now_sec();
+        size_t c1 = ALLOC_CALLS;
+        sum_generated = users_generated(text, len, &n_generated);
+        double t2 = now_sec();
+        size_t c2 = ALLOC_CALLS;
+        if (t1 - t0 < generic) generic = t1 - t0;
+        if (t2 - t1 < generated) generated = t2 - t1;
+        calls_generic = c1 - c0;
+        calls_generated = c2 - c1;
+    }
+    acl_query_free(q);
+    free(text);
+    if (n_generic != (size_t)users || n_generated != (size_t)users || sum_generic != sum_generated) {
+        fprintf(stderr, "codegen: results differ (%zu users, sum %lu vs %zu users, sum %lu)\n",
+                n_generic, sum_generic, n_generated, sum_generated);
+        return 1;
+    }
+    printf("input:        %d users, %zu bytes\n", users, len);
+    printf("generic:      %.3f ms parse + resolve + read into structs + free, %.1f MB/s, %zu allocations\n",
+           generic * 1e3, len / generic / 1e6, calls_generic);
+    printf("generated:    %.3f ms users_parse_string + users_free, %.1f MB/s, %zu allocations\n",
+           generated * 1e3, len / generated / 1e6, calls_generated);
+    return 0;
+}
+
+/* ---------- snapshots ---------- */
+
+typedef struct SnapRun {
+    AclSnapshots *snaps;     /* NULL: the mutex baseline */
+    pthread_mutex_t lock;
+    AclBlock *tree;
+    unsigned long version;
+    int users;
+    atomic_int stop;
+    atomic_ulong reads, torn;
+} SnapRun;
+
+static void write_generation(FILE *f, int users, unsigned long gen) {
+    fprintf(f, "Gen { int version = %lu; }\nUsers {\n", gen);
+    for (int i = 0; i < users; ++i)
+        fprintf(f, "    user \"u%d\" { int uid = %d; int gen = %lu; string home = \"/home/u%d-g%lu\"; }\n",
+                i, 1000 + i, gen, i, gen);
+    fprintf(f, "}\n");
+}
+
+/* one snapshot's worth of reads; returns 0 if it mixes generations */
+static int snap_check(AclBlock *root, int users, unsigned seed) {
+    long gen = -1, g = -1;
+    const char *home;
+    char path[64], want[64];
+    if (!acl_get_int(root, "Gen.version", &gen)) return 0;
+    for (int k = 0; k < 4; ++k) {
+        int u = (int)((seed + (unsigned)k * 7919u) % (unsigned)users);
+        AclCursor c;
+        snprintf(path, sizeof(path), "Users.user[\"u%d\"]", u);
+        if (!acl_cursor_open(&c, root, path)) return 0;
+        snprintf(want, sizeof(want), "/home/u%d-g%ld", u, gen);
+        if (!acl_value_int(acl_cursor_get(&c, "gen"), &g) || g != gen) return 0;
+        if (!acl_value_string(acl_cursor_get(&c, "home"), &home) || strcmp(home, want) != 0) return 0;
+    }
+    return 1;
+}
+
+static void *snap_reader(void *arg) {
+    SnapRun *R = arg;
+    AclSnapshotReader *r = R->snaps ? acl_snapshot_reader(R->snaps) : NULL;
+    unsigned long last = 0, reads = 0, torn = 0;
+    unsigned seed = (unsigned)(size_t)&seed;
+    while (!atomic_load_explicit(&R->stop, memory_order_relaxed)) {
+        unsigned long version;
+        AclBlock *root;
+        if (r) {
+            root = acl_snapshot_enter(r, &version);
+        } else {
+            pthread_mutex_lock(&R->lock);
+            root = R->tree;
+            version = R->version;
+        }
+        seed = seed * 1103515245u + 12345u;
+        if (!snap_check(root, R->users, seed >> 8) || version < last) torn++;
+        last = version;
+        if (r) acl_snapshot_leave(r);
+        else pthread_mutex_unlock(&R->lock);
+        reads++;
+    }
+    acl_snapshot_reader_close(r);
+    atomic_fetch_add(&R->reads, reads);
+    atomic_fetch_add(&R->torn, torn);
+    return NULL;
+}
+
+static int snap_run(SnapRun *R, const char *src, int readers, double seconds, size_t *reloads, size_t *pending) {
+    pthread_t *tids = calloc((size_t)readers, sizeof(pthread_t));
+    int started = 0, failed = 0;
+    while (started < readers && pthread_create(&tids[started], NULL, snap_reader, R) == 0) started++;
+    double end = now_sec() + seconds;
+    unsigned long gen = 1;
+    *reloads = *pending = 0;
+    while (started == readers && !failed && now_sec() < end) {
+        FILE *f = fopen(src, "w");
+        if (!f) { failed = 1; break; }
+        write_generation(f, R->users, ++gen);
+        fclose(f);
+        if (R->snaps) {
+            failed = acl_snapshots_reload(R->snaps) != 1;
+            size_t n = acl_snapshots_pending(R->snaps);
+            if (n > *pending) *pending = n;
+        } else {
+            AclBlock *fresh = acl_parse_file(src);
+            failed = !fresh || !acl_resolve_all(fresh);
+            if (failed) { acl_free(fresh); break; }
+            pthread_mutex_lock(&R->lock);
+            AclBlock *old = R->tree;
+            R->tree = fresh;
+            R->version++;
+            pthread_mutex_unlock(&R->lock);
+            acl_free(old);
+        }
+        ++*reloads;
+    }
+    atomic_store(&R->stop, 1);
+    for (int i = 0; i < started; ++i) pthread_join(tids[i], NULL);
+    free(tids);
+    return !failed && started == readers;
+}
+
+static int bench_snapshots(int readers, double seconds, int users) {
+    char src[] = "/tmp/acl-bench-XXXXXX";
+    int fd = mkstemp(src);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "w");
+    if (!f) { perror("snapshots: mkstemp"); return 1; }
+    write_generation(f, users, 1);
+    fclose(f);
+
+    int failed = 0;
+    for (int k = 0; k < 2 && !failed; ++k) {
+        SnapRun R;
+        memset(&R, 0, sizeof(R));
+        R.users = users;
+        pthread_mutex_init(&R.lock, NULL);
+        if (k == 0) R.snaps = acl_snapshots_open(src);
+        else if ((R.tree = acl_parse_file(src))) acl_resolve_all(R.tree);
+        if (k == 0 ? !R.snaps : !R.tree) { fprintf(stderr, "snapshots: initial load failed\n"); failed = 1; break; }
+        size_t reloads, pending;
+        if (!snap_run(&R, src, readers, seconds, &reloads, &pending)) { fprintf(stderr, "snapshots: run failed\n"); failed = 1; }
+        unsigned long reads = atomic_load(&R.reads), torn = atomic_load(&R.torn);
+        if (k == 0) {
+            printf("snapshots:    %.0f reads/s over %d readers, %zu reloads, at most %zu replaced trees held, %lu torn\n",
+                   reads / seconds, readers, reloads, pending, torn);
+            acl_snapshots_close(R.snaps);
+        } else {
+            printf("mutex:        %.0f reads/s over %d readers, %zu reloads, %lu torn\n", reads / seconds, readers, reloads, torn);
+            acl_free(R.tree);
+        }
+        pthread_mutex_destroy(&R.lock);
+        if (torn) failed = 1;
+    }
+    unlink(src);
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "snapshots") == 0) {
+        int readers = argc > 2 ? atoi(argv[2]) : 4;
+        double seconds = argc > 3 ? atof(argv[3]) : 2;
+        int users = argc > 4 ? atoi(argv[4]) : 2000;
+        if (readers < 1 || seconds <= 0 || users < 1) {
+            fprintf(stderr, "usage: %s snapshots [readers] [seconds] [users]\n", argv[0]);
+            return 2;
+        }
+        return bench_snapshots(readers, seconds, users);
+    }
+    if (argc > 1 && strcmp(argv[1], "codegen") == 0) {
+        int users = argc > 2 ? atoi(argv[2]) : 20000;
+        int rounds = argc > 3 ? atoi(argv[3]) : 5;
+        if (users < 1 || rounds < 1) {
+            fprintf(stderr, "usage: %s codegen [users] [rounds]\n", argv[0]);
+            return 2;
+        }
+        return bench_codegen(users, rounds);
+    }
+    if (argc > 1 && strcmp(argv[1], "ondemand") == 0) {
+        int nodes = argc > 2 ? atoi(argv[2]) : 100000;
+        int lookups = argc > 3 ? atoi(argv[3]) : 10;
+        int rounds = argc > 4 ? atoi(argv[4]) : 5;
+        if (nodes < 1 || lookups < 1 || rounds < 1) {
+            fprintf(stderr, "usage: %s ondemand [nodes] [lookups] [rounds]\n", argv[0]);
+            return 2;
+        }
+        return bench_ondemand(nodes, lookups, rounds);
+    }
+    if (argc > 1 && strcmp(argv[1], "select") == 0) {
+        int packages = argc > 2 ? atoi(argv[2]) : 2000;
+        int rounds = argc > 3 ? atoi(argv[3]) : 5;
+        if (packages < 1 || rounds < 1) {
+            fprintf(stderr, "usage: %s select [packages] [rounds]\n", argv[0]);
+            return 2;
+        }
+        return bench_select(packages, rounds);
+    }
+    if (argc > 1 && strcmp(argv[1], "query") == 0) {
+        int users = argc > 2 ? atoi(argv[2]) : 10000;
+        int lookups = argc > 3 ? atoi(argv[3]) : 200000;
+        int rounds = argc > 4 ? atoi(argv[4]) : 5;
+        if (users < 1 || lookups < 1 || rounds < 1) {
+            fprintf(stderr, "usage: %s query [users] [lookups] [rounds]\n", argv[0]);
+            return 2;
+        }
+        return bench_query(users, lookups, rounds);
+    }
+    if (argc > 1 && strcmp(argv[1], "suite") == 0) {
+        const char *shapes = argc > 2 ? argv[2] : "all";
+        const char *sizes = argc > 3 ? argv[3] : "1K,1M,16M";
+        int rounds = argc > 4 ? atoi(argv[4]) : 3;
+        int json = argc > 5 && strcmp(argv[5], "json") == 0;
+        if (rounds < 1 || (argc > 5 && !json)) {
+            fprintf(stderr, "usage: %s suite [shapes|all] [sizes] [rounds] [json]\n", argv[0]);
+            return 2;
+        }
+        return bench_suite(shapes, sizes, rounds, json);
+    }
+    if (argc > 1 && strcmp(argv[1], "split") == 0) {
+        int packages = argc > 2 ? atoi(argv[2]) : 60000;
+        int rounds = argc > 3 ? atoi(argv[3]) : 3;
+        if (packages < 1 || rounds < 1) {
+            fprintf(stderr, "usage: %s split [packages] [rounds]\n", argv[0]);
+            return 2;
+        }
+        return bench_split(packages, rounds);
+    }
+    if (argc > 1 && strcmp(argv[1], "lazy") == 0) {
+        int users = argc > 2 ? atoi(argv[2]) : 10000;
+        int rounds = argc > 3 ? atoi(argv[3]) : 5;
+        if (users < 1 || rounds < 1) {
+            fprintf(stderr, "usage: %s lazy [users] [rounds]\n", argv[0]);
+            return 2;
+        }
+        return bench_lazy(users, rounds);
+    }
+    if (argc > 1 && strcmp(argv[1], "sax") == 0) {
+        int packages = argc > 2 ? atoi(argv[2]) : 2000;
+        int rounds = argc > 3 ? atoi(argv[3]) : 5;
+        if (packages < 1 || rounds < 1) {
+            fprintf(stderr, "usage: %s sax [packages] [rounds]\n", argv[0]);
+            return 2;
+        }
+        return bench_sax(packages, rounds);
+    }
+    if (argc > 1 && strcmp(argv[1], "lex") == 0) {
+        int packages = argc > 2 ? atoi(argv[2]) : 2000;
+        int rounds = argc > 3 ? atoi(argv[3]) : 10;
+        if (packages < 1 || rounds < 1) {
+            fprintf(stderr, "usage: %s lex [packages] [rounds]\n", argv[0]);
+            return 2;
+        }
+        return bench_lex(packages, rounds);
+    }
+    if (argc > 1 && strcmp(argv[1], "reload") == 0) {
+        int users = argc > 2 ? atoi(argv[2]) : 10000;
+        int rounds = argc > 3 ? atoi(argv[3]) : 5;
+        if (users < 1 || rounds < 1) {
+            fprintf(stderr, "usage: %s reload [users] [rounds]\n", argv[0]);
+            return 2;
+        }
+        return bench_reload(users, rounds);
+    }
+    if (argc > 1 && strcmp(argv[1], "expr") == 0) {
+        int fields = argc > 2 ? atoi(argv[2]) : 100000;
+        int rounds = argc > 3 ? atoi(argv[3]) : 5;
+        if (fields < 1 || rounds < 1) {
+            fprintf(stderr, "usage: %s expr [fields] [rounds]\n", argv[0]);
+            return 2;
+        }
+        return bench_expr(fields, rounds);
+    }
+    if (argc > 1 && strcmp(argv[1], "image") == 0) {
+        int users = argc > 2 ? atoi(argv[2]) : 10000;
+        int rounds = argc > 3 ? atoi(argv[3]) : 5;
+        if (users < 1 || rounds < 1) {
+            fprintf(stderr, "usage: %s image [users] [rounds]\n", argv[0]);
+            return 2;
+        }
+        return bench_image(users, rounds);
+    }
+    if (argc > 1 && strcmp(argv[1], "fanout") == 0) {
+        int fields = argc > 2 ? atoi(argv[2]) : 1000;
+        int elements = argc > 3 ? atoi(argv[3]) : 1000;
+        if (fields < 1 || elements < 1) {
+            fprintf(stderr, "usage: %s fanout [fields] [elements]\n", argv[0]);
+            return 2;
+        }
+        return bench_fanout(fields, elements);
+    }
+    if (argc > 1 && strcmp(argv[1], "refs") == 0) {
+        int fields = argc > 2 ? atoi(argv[2]) : 100000;
+        int rounds = argc > 3 ? atoi(argv[3]) : 5;
+        if (fields < 2 || rounds < 1) {
+            fprintf(stderr, "usage: %s refs [fields] [rounds]\n", argv[0]);
+            return 2;
+        }
+        return bench_refs(fields, rounds);
+    }
+    if (argc > 1 && strcmp(argv[1], "array") == 0) {
+        int elements = argc > 2 ? atoi(argv[2]) : 5000;
+        int rounds = argc > 3 ? atoi(argv[3]) : 5;
+        if (elements < 1 || rounds < 1) {
+            fprintf(stderr, "usage: %s array [elements] [rounds]\n", argv[0]);
+            return 2;
+        }
+        return bench_array(elements, rounds);
+    }
+    if (argc > 1 && strcmp(argv[1], "lookup") == 0) {
+        int children = argc > 2 ? atoi(argv[2]) : 10000;
+        int lookups = argc > 3 ? atoi(argv[3]) : 100000;
+        int rounds = argc > 4 ? atoi(argv[4]) : 5;
+        if (children < 1 || lookups < 1 || rounds < 1) {
+            fprintf(stderr, "usage: %s lookup [children] [lookups] [rounds]\n", argv[0]);
+            return 2;
+        }
+        return bench_lookup(children, lookups, rounds);
+    }
+
+    int packages = argc > 1 ? atoi(argv[1]) : 2000;
+    int versions = argc > 2 ? atoi(argv[2]) : 5;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    int inferred = argc > 4 && strcmp(argv[4], "inferred") == 0;
+    if (packages < 1 || versions < 1 || rounds < 1) {
+        fprintf(stderr, "usage: %s [packages] [versions] [rounds] [typed|inferred]\n", argv[0]);
+        return 2;
+    }
+
+    size_t fields = 0;
+    char *text = gen_registry(packages, versions, inferred, &fields);
+    size_t len = strlen(text);
+
+    double lex_best = 1e30;
+    long tokens = 0;
+    for (int r = 0; r < rounds; ++r) {
+        double t0 = now_sec();
+        tokens = acl_lex_count(text, len);
+        double t1 = now_sec();
+        if (t1 - t0 < lex_best) lex_best = t1 - t0;
+    }
+
+    double parse_best = 1e30, free_best = 1e30;
+    size_t calls = 0, bytes = 0;
+    for (int r = 0; r < rounds; ++r) {
+        size_t c0 = ALLOC_CALLS, b0 = ALLOC_BYTES;
+        double t0 = now_sec();
+        AclBlock *root = acl_parse_string(text);
+        double t1 = now_sec();
+        calls = ALLOC_CALLS - c0;
+        bytes = ALLOC_BYTES - b0;
+        acl_free(root);
+        double t2 = now_sec();
+        if (t1 - t0 < parse_best) parse_best = t1 - t0;
+        if (t2 - t1 < free_best) free_best = t2 - t1;
+    }
+
+    printf("input:        %zu bytes, %zu fields (%d packages x %d versions, %s)\n",
+           len, fields, packages, versions, inferred ? "inferred" : "typed");
+    printf("lex:          %.3f ms (%.1f MB/s, %.1f Mtok/s)\n", lex_best * 1e3, (double)len / lex_best / 1e6, (double)tokens / lex_best / 1e6);
+    printf("parse:        %.3f ms (%.1f MB/s, %.1f Mtok/s)\n", parse_best * 1e3, (double)len / parse_best / 1e6, (double)tokens / parse_best / 1e6);
+    printf("free:         %.3f ms\n", free_best * 1e3);
+    printf("allocations:  %zu calls, %zu bytes (%.2f calls/field, %.1f bytes/field)\n",
+           calls, bytes, (double)calls / (double)fields, (double)bytes / (double)fields);
+
+    free(text);
+    return 0;
+}
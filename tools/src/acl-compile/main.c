@@ -0,0 +1,43 @@
+/* acl-compile - build a precompiled .aclb image from an ACL config.
+   Usage: acl-compile [-c] <source.conf> [<image>]
+   The image defaults to <source.conf>.aclb. With -c nothing is written:
+   exits 0 if the image is fresh for the source, 1 if it is stale or missing.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "acl.h"
+
+int main(int argc, char **argv) {
+    int check = 0;
+    int i = 1;
+    if (i < argc && strcmp(argv[i], "-c") == 0) { check = 1; i++; }
+    if (argc - i < 1 || argc - i > 2) {
+        fprintf(stderr, "usage: %s [-c] <source> [<image>]\n", argv[0]);
+        return 2;
+    }
+    const char *source = argv[i];
+
+    const char *target = argc - i == 2 ? argv[i + 1] : source;
+    const char *suffix = argc - i == 2 ? "" : ".aclb";
+    char *image = malloc(strlen(target) + strlen(suffix) + 1);
+    if (!image) { perror("acl-compile"); return 3; }
+    sprintf(image, "%s%s", target, suffix);
+
+    if (check) {
+        AclBlock *img = acl_open_compiled(image, source);
+        int fresh = img != NULL;
+        acl_free(img);
+        printf("%s: %s\n", image, fresh ? "fresh" : "stale");
+        free(image);
+        return fresh ? 0 : 1;
+    }
+
+    AclBlock *root = acl_parse_file(source);
+    if (!root) { free(image); return 1; }
+    int ok = acl_compile(root, source, image);
+    if (!ok) fprintf(stderr, "acl-compile: %s: cannot write %s (unresolved references or I/O error)\n", source, image);
+    acl_free(root);
+    free(image);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,687 @@
+/* acl-gen - generate a C parser specialized to an ACL schema.
+ *
+ * Usage: acl-gen <schema> <out> <prefix>
+ *
+ * Writes <out>.h and <out>.c. The header declares one struct per schema
+ * block and <prefix>_parse_file, <prefix>_parse_string and <prefix>_free.
+ * The parser runs the library's streaming parser (acl_sax_parse_*) and
+ * fills the structs from its events directly: no Block/Field tree is
+ * built, each block and field name is matched by a switch on a hash
+ * computed here, and every store goes to a struct member.
+ *
+ * A schema is an ACL file shaped like the configs it describes:
+ *
+ *   Users {
+ *       user "*" {
+ *           string name = "";
+ *           int uid = -1;
+ *           string[] groups = { "" };
+ *       }
+ *   }
+ *
+ * - A block is a struct member of its parent; a block labelled "*" may
+ *   repeat and becomes an array of structs, each with the config's label.
+ * - A field's type is its default's: int (or char), float, bool or
+ *   string. An array's type is its first element's, and its default is
+ *   empty.
+ * - References and expr fields aren't allowed in a schema, and generated
+ *   parsers reject them in configs (they can't be resolved without a
+ *   tree).
+ *
+ * A config's fields and blocks the schema doesn't name are skipped.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acl.h"
+
+/* ---------- schema model ---------- */
+
+typedef enum { GT_INT, GT_FLOAT, GT_BOOL, GT_STRING } GenType;
+static const char *const C_TYPES[] = { "long", "double", "int", "const char *" };
+
+typedef struct GenField {
+    char *name;       /* as in the config */
+    char *member;     /* C member name */
+    GenType type;
+    int is_array;
+    int typed;        /* an array's type is known */
+    long ival;
+    double fval;
+    char *sval;
+    size_t slen;
+} GenField;
+
+typedef struct GenBlock {
+    char *name, *member;
+    char *ctype;      /* struct type name */
+    char *path;       /* dotted path, for messages */
+    char *id;         /* enum constant */
+    int repeated;
+    GenField *fields; size_t nfields;
+    struct GenBlock **children; size_t nchildren;
+    struct GenBlock *parent;
+} GenBlock;
+
+typedef struct Schema {
+    const char *prefix;
+    const char *file;
+    GenBlock root;
+    GenBlock *cur;
+    GenField *array;  /* array field awaiting its first element */
+    int failed;
+    size_t depth, max_depth;
+} Schema;
+
+static void *xmalloc(size_t n) {
+    void *p = calloc(1, n);
+    if (!p) { fprintf(stderr, "acl-gen: out of memory\n"); exit(1); }
+    return p;
+}
+
+static void *xgrow(void *p, size_t count, size_t size) {
+    /* capacity is the next power of two above count */
+    if (count & (count - 1)) return p;
+    p = realloc(p, (count ? count * 2 : 1) * size);
+    if (!p) { fprintf(stderr, "acl-gen: out of memory\n"); exit(1); }
+    return p;
+}
+
+static char *xstrndup(const char *s, size_t n) {
+    char *d = xmalloc(n + 1);
+    memcpy(d, s, n);
+    return d;
+}
+
+__attribute__((format(printf, 1, 2)))
+static char *xprintf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    char *s = xmalloc((size_t)n + 1);
+    va_start(ap, fmt);
+    vsnprintf(s, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    return s;
+}
+
+__attribute__((format(printf, 3, 4)))
+static void schema_error(Schema *S, size_t offset, const char *fmt, ...) {
+    va_list ap;
+    fprintf(stderr, "%s: byte %zu: ", S->file, offset);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    S->failed = 1;
+}
+
+/* C keywords (and the member a repeated block's label goes in) get a
+   trailing underscore */
+static char *member_name(const char *name, int repeated_block) {
+    static const char *const reserved[] = {
+        "auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else", "enum",
+        "extern", "float", "for", "goto", "if", "inline", "int", "long", "register", "restrict", "return",
+        "short", "signed", "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned", "void",
+        "volatile", "while", "bool", "true", "false", "NULL", NULL
+    };
+    int clash = repeated_block && strcmp(name, "label") == 0;
+    for (size_t i = 0; !clash && reserved[i]; ++i) clash = strcmp(name, reserved[i]) == 0;
+    return clash ? xprintf("%s_", name) : xprintf("%s", name);
+}
+
+/* ---------- reading the schema ---------- */
+
+static int schema_enter(void *ctx, const char *name, size_t nlen, const char *label, size_t llen) {
+    Schema *S = ctx;
+    GenBlock *p = S->cur;
+    if (label && !(llen == 1 && label[0] == '*')) {
+        fprintf(stderr, "%s: block %.*s: a schema block's label must be \"*\"\n", S->file, (int)nlen, name);
+        S->failed = 1;
+    }
+    for (size_t i = 0; i < p->nchildren; ++i) {
+        if (strlen(p->children[i]->name) == nlen && memcmp(p->children[i]->name, name, nlen) == 0) {
+            fprintf(stderr, "%s: block %.*s appears twice in %s\n", S->file, (int)nlen, name, p->path);
+            S->failed = 1;
+        }
+    }
+    GenBlock *b = xmalloc(sizeof(GenBlock));
+    b->name = xstrndup(name, nlen);
+    b->repeated = label != NULL;
+    b->member = member_name(b->name, 0);
+    b->parent = p;
+    b->path = p == &S->root ? xprintf("%s", b->name) : xprintf("%s.%s", p->path, b->name);
+    b->ctype = xprintf("%s_%s", p == &S->root ? S->prefix : p->ctype, b->name);
+    b->id = xprintf("B_%s", b->ctype + strlen(S->prefix) + 1);
+    p->children = xgrow(p->children, p->nchildren, sizeof(GenBlock*));
+    p->children[p->nchildren++] = b;
+    S->cur = b;
+    if (++S->depth > S->max_depth) S->max_depth = S->depth;
+    return ACL_SAX_CONTINUE;
+}
+
+static int schema_exit(void *ctx) {
+    Schema *S = ctx;
+    S->cur = S->cur->parent;
+    S->depth--;
+    return ACL_SAX_CONTINUE;
+}
+
+static int schema_type(Schema *S, const AclSaxValue *v, GenType *t, const char *what) {
+    switch (v->kind) {
+        case ACL_SAX_INT: case ACL_SAX_CHAR: *t = GT_INT; return 1;
+        case ACL_SAX_FLOAT: *t = GT_FLOAT; return 1;
+        case ACL_SAX_BOOL: *t = GT_BOOL; return 1;
+        case ACL_SAX_STRING: *t = GT_STRING; return 1;
+        case ACL_SAX_ARRAY: schema_error(S, v->offset, "%s: arrays of arrays aren't supported", what); return 0;
+        default: schema_error(S, v->offset, "%s: references and expressions can't be schema types", what); return 0;
+    }
+}
+
+static int schema_field(void *ctx, const char *name, size_t nlen, const AclSaxValue *v) {
+    Schema *S = ctx;
+    GenBlock *b = S->cur;
+    if (b == &S->root) {
+        schema_error(S, v->offset, "field %.*s outside any block", (int)nlen, name);
+        return ACL_SAX_SKIP;
+    }
+    for (size_t i = 0; i < b->nfields; ++i) {
+        if (strlen(b->fields[i].name) == nlen && memcmp(b->fields[i].name, name, nlen) == 0)
+            schema_error(S, v->offset, "field %.*s appears twice in %s", (int)nlen, name, b->path);
+    }
+    b->fields = xgrow(b->fields, b->nfields, sizeof(GenField));
+    GenField *f = &b->fields[b->nfields++];
+    memset(f, 0, sizeof(*f));
+    f->name = xstrndup(name, nlen);
+    f->member = member_name(f->name, b->repeated);
+    if (v->kind == ACL_SAX_ARRAY) {
+        f->is_array = 1;
+        S->array = f;
+        return ACL_SAX_CONTINUE;
+    }
+    if (!schema_type(S, v, &f->type, f->name)) return ACL_SAX_CONTINUE;
+    f->ival = v->i;
+    f->fval = v->f;
+    if (f->type == GT_STRING) { f->sval = xstrndup(v->str, v->len); f->slen = v->len; }
+    return ACL_SAX_CONTINUE;
+}
+
+static int schema_element(void *ctx, size_t index, const AclSaxValue *v) {
+    Schema *S = ctx;
+    if (index == 0 && S->array) S->array->typed = schema_type(S, v, &S->array->type, S->array->name);
+    return v->kind == ACL_SAX_ARRAY ? ACL_SAX_SKIP : ACL_SAX_CONTINUE;
+}
+
+static int schema_array_end(void *ctx) {
+    Schema *S = ctx;
+    if (S->array && !S->array->typed && !S->failed) {
+        fprintf(stderr, "%s: %s.%s: an empty array doesn't give its element type\n", S->file, S->cur->path, S->array->name);
+        S->failed = 1;
+    }
+    S->array = NULL;
+    return ACL_SAX_CONTINUE;
+}
+
+/* Member names generated for a block must be distinct: x and x_len, or a
+   field and a block of the same name, would collide. */
+static void schema_check(Schema *S, const GenBlock *b) {
+    size_t n = 0;
+    const char **names = NULL;
+    for (size_t i = 0; i < b->nfields + b->nchildren; ++i) {
+        const char *m[2];
+        size_t k = 0;
+        if (i < b->nfields) {
+            const GenField *f = &b->fields[i];
+            m[k++] = f->member;
+            if (f->is_array) m[k++] = xprintf("%s_len", f->member);
+        } else {
+            const GenBlock *c = b->children[i - b->nfields];
+            m[k++] = c->member;
+            if (c->repeated) m[k++] = xprintf("%s_count", c->member);
+        }
+        for (size_t j = 0; j < k; ++j) {
+            for (size_t q = 0; q < n; ++q) {
+                if (strcmp(names[q], m[j]) == 0) {
+                    fprintf(stderr, "%s: %s: member %s would be generated twice\n", S->file, b->path, m[j]);
+                    S->failed = 1;
+                }
+            }
+            names = xgrow(names, n, sizeof(char*));
+            names[n++] = m[j];
+        }
+    }
+    free(names);
+    for (size_t i = 0; i < b->nchildren; ++i) schema_check(S, b->children[i]);
+}
+
+/* ---------- emitting ---------- */
+
+static uint32_t name_hash(const char *s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+static void emit_cstring(FILE *out, const char *s, size_t n) {
+    fputc('"', out);
+    for (size_t i = 0; i < n; ++i) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c == '\n') fputs("\\n", out);
+        else if (c == '\t') fputs("\\t", out);
+        else if (c < 0x20 || c >= 0x7f) fprintf(out, "\\%03o", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+/* structs, innermost first so each is complete where it is embedded */
+static void emit_structs(FILE *h, const GenBlock *b) {
+    for (size_t i = 0; i < b->nchildren; ++i) emit_structs(h, b->children[i]);
+    if (!b->parent) return;
+    fprintf(h, "typedef struct %s {\n", b->ctype);
+    if (b->repeated) fprintf(h, "    const char *label;\n");
+    for (size_t i = 0; i < b->nfields; ++i) {
+        const GenField *f = &b->fields[i];
+        const char *t = C_TYPES[f->type];
+        int ptr = t[strlen(t) - 1] == '*';
+        if (f->is_array) fprintf(h, "    %s%s*%s;\n    size_t %s_len;\n", t, ptr ? "" : " ", f->member, f->member);
+        else fprintf(h, "    %s%s%s;\n", t, ptr ? "" : " ", f->member);
+    }
+    for (size_t i = 0; i < b->nchildren; ++i) {
+        const GenBlock *c = b->children[i];
+        if (c->repeated) fprintf(h, "    %s *%s;\n    size_t %s_count;\n", c->ctype, c->member, c->member);
+        else fprintf(h, "    %s %s;\n", c->ctype, c->member);
+    }
+    fprintf(h, "} %s;\n\n", b->ctype);
+}
+
+static void emit_header(FILE *h, const Schema *S, const char *guard, const char *base) {
+    const char *p = S->prefix;
+    fprintf(h, "/* %s.h - generated by acl-gen from %s; do not edit. */\n", base, S->file);
+    fprintf(h, "#ifndef %s\n#define %s\n\n#include <stddef.h>\n\n", guard, guard);
+    emit_structs(h, &S->root);
+    fprintf(h, "typedef struct %s_config {\n", p);
+    for (size_t i = 0; i < S->root.nchildren; ++i) {
+        const GenBlock *c = S->root.children[i];
+        if (c->repeated) fprintf(h, "    %s *%s;\n    size_t %s_count;\n", c->ctype, c->member, c->member);
+        else fprintf(h, "    %s %s;\n", c->ctype, c->member);
+    }
+    fprintf(h, "    void *mem; /* strings, freed by %s_free */\n} %s_config;\n\n", p, p);
+    fprintf(h,
+        "/* Parse a config into *out, which starts from the schema's defaults.\n"
+        "   Returns 1 on success; 0 if some field had the wrong type or was a\n"
+        "   reference or expression (reported on stderr; the field keeps its\n"
+        "   default); -1 if the file can't be read or has a syntax error, or\n"
+        "   memory ran out. *out holds what was read either way and must be\n"
+        "   released with %s_free. Blocks and fields the schema doesn't\n"
+        "   name are skipped. */\n", p);
+    fprintf(h, "int %s_parse_file(const char *path, %s_config *out);\n", p, p);
+    fprintf(h, "int %s_parse_string(const char *text, size_t len, %s_config *out);\n", p, p);
+    fprintf(h, "void %s_free(%s_config *c);\n\n#endif\n", p, p);
+}
+
+static void emit_block_ids(FILE *c, const GenBlock *b) {
+    for (size_t i = 0; i < b->nchildren; ++i) {
+        fprintf(c, ", %s", b->children[i]->id);
+        emit_block_ids(c, b->children[i]);
+    }
+}
+
+/* defaults: one init function per struct, innermost first */
+static void emit_inits(FILE *c, const Schema *S, const GenBlock *b) {
+    for (size_t i = 0; i < b->nchildren; ++i) emit_inits(c, S, b->children[i]);
+    fprintf(c, "static void init_%s(%s *o) {\n    memset(o, 0, sizeof(*o));\n", b->id, b->ctype);
+    for (size_t i = 0; i < b->nfields; ++i) {
+        const GenField *f = &b->fields[i];
+        if (f->is_array) continue;
+        switch (f->type) {
+            case GT_INT: if (f->ival) fprintf(c, "    o->%s = %ldL;\n", f->member, f->ival); break;
+            case GT_FLOAT: if (f->fval != 0) fprintf(c, "    o->%s = %.17g;\n", f->member, f->fval); break;
+            case GT_BOOL: if (f->ival) fprintf(c, "    o->%s = 1;\n", f->member); break;
+            case GT_STRING:
+                fprintf(c, "    o->%s = ", f->member);
+                emit_cstring(c, f->sval, f->slen);
+                fprintf(c, ";\n");
+                break;
+        }
+    }
+    for (size_t i = 0; i < b->nchildren; ++i) {
+        const GenBlock *k = b->children[i];
+        if (!k->repeated) fprintf(c, "    init_%s(&o->%s);\n", k->id, k->member);
+    }
+    fprintf(c, "}\n\n");
+}
+
+static void emit_frees(FILE *c, const Schema *S, const GenBlock *b) {
+    for (size_t i = 0; i < b->nchildren; ++i) emit_frees(c, S, b->children[i]);
+    fprintf(c, "static void free_%s(%s *o) {\n", b->id, b->ctype);
+    int used = 0;
+    for (size_t i = 0; i < b->nfields; ++i) {
+        if (b->fields[i].is_array) fprintf(c, "    free((void *)o->%s);\n", b->fields[i].member), used = 1;
+    }
+    for (size_t i = 0; i < b->nchildren; ++i) {
+        const GenBlock *k = b->children[i];
+        used = 1;
+        if (k->repeated) {
+            fprintf(c, "    for (size_t i = 0; i < o->%s_count; ++i) free_%s(&o->%s[i]);\n", k->member, k->id, k->member);
+            fprintf(c, "    free(o->%s);\n", k->member);
+        } else {
+            fprintf(c, "    free_%s(&o->%s);\n", k->id, k->member);
+        }
+    }
+    if (!used) fprintf(c, "    (void)o;\n");
+    fprintf(c, "}\n\n");
+}
+
+typedef struct NameCase { uint32_t hash; size_t item; } NameCase;
+
+static int case_cmp(const void *a, const void *b) {
+    const NameCase *x = a, *y = b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return x->item < y->item ? -1 : x->item > y->item;
+}
+
+/* One switch over the name hashes of n names; emit_case writes the body
+   for item i, after the name has been compared. */
+static void emit_switch(FILE *c, size_t n, const char *(*name_of)(const void *, size_t), const void *ctx,
+                        void (*emit_case)(FILE *, const void *, size_t)) {
+    NameCase *cases = xmalloc((n ? n : 1) * sizeof(NameCase));
+    for (size_t i = 0; i < n; ++i) {
+        const char *s = name_of(ctx, i);
+        cases[i] = (NameCase){ name_hash(s, strlen(s)), i };
+    }
+    qsort(cases, n, sizeof(NameCase), case_cmp);
+    fprintf(c, "        switch (h) {\n");
+    for (size_t i = 0; i < n; ++i) {
+        /* names that share a hash share a case */
+        if (i == 0 || cases[i].hash != cases[i - 1].hash) fprintf(c, "        case 0x%08xu:\n", cases[i].hash);
+        const char *s = name_of(ctx, cases[i].item);
+        fprintf(c, "            if (nlen == %zu && memcmp(name, \"%s\", %zu) == 0) ", strlen(s), s, strlen(s));
+        emit_case(c, ctx, cases[i].item);
+        if (i + 1 == n || cases[i + 1].hash != cases[i].hash) fprintf(c, "            break;\n");
+    }
+    fprintf(c, "        }\n");
+    free(cases);
+}
+
+static const char *child_name(const void *ctx, size_t i) { return ((const GenBlock *)ctx)->children[i]->name; }
+static const char *field_name(const void *ctx, size_t i) { return ((const GenBlock *)ctx)->fields[i].name; }
+
+static void emit_enter_case(FILE *c, const void *ctx, size_t i) {
+    const GenBlock *k = ((const GenBlock *)ctx)->children[i];
+    if (!k->repeated) {
+        fprintf(c, "return gen_push(S, %s, &o->%s);\n", k->id, k->member);
+        return;
+    }
+    fprintf(c, "{\n");
+    fprintf(c, "                %s *e = gen_append((void **)&o->%s, &o->%s_count, sizeof(*e));\n", k->ctype, k->member, k->member);
+    fprintf(c, "                if (!e) return ACL_SAX_STOP;\n");
+    fprintf(c, "                init_%s(e);\n", k->id);
+    fprintf(c, "                e->label = label ? gen_strndup(S, label, llen) : NULL;\n");
+    fprintf(c, "                return label && !e->label ? ACL_SAX_STOP : gen_push(S, %s, e);\n", k->id);
+    fprintf(c, "            }\n");
+}
+
+static void emit_field_case(FILE *c, const void *ctx, size_t i) {
+    const GenBlock *b = ctx;
+    const GenField *f = &b->fields[i];
+    static const char *const setters[] = { "gen_int", "gen_float", "gen_bool", "gen_string" };
+    static const char *const kinds[] = { "GT_INT", "GT_FLOAT", "GT_BOOL", "GT_STRING" };
+    if (f->is_array) {
+        fprintf(c, "return gen_array(S, v, (void **)&o->%s, &o->%s_len, sizeof(*o->%s), %s, \"%s.%s\");\n",
+                f->member, f->member, f->member, kinds[f->type], b->path, f->name);
+    } else {
+        fprintf(c, "return %s(S, v, &o->%s, \"%s.%s\");\n", setters[f->type], f->member, b->path, f->name);
+    }
+}
+
+static void emit_handlers(FILE *c, const Schema *S, const GenBlock *b, int fields) {
+    for (size_t i = 0; i < b->nchildren; ++i) emit_handlers(c, S, b->children[i], fields);
+    size_t n = fields ? b->nfields : b->nchildren;
+    if (!n) return;
+    fprintf(c, "    case %s: {\n        %s *o = f->obj;\n", b->id, b->ctype);
+    emit_switch(c, n, fields ? field_name : child_name, b, fields ? emit_field_case : emit_enter_case);
+    fprintf(c, "        break;\n    }\n");
+}
+
+/* The runtime part every generated parser carries: string storage, the
+   block stack and the typed stores. */
+static const char GEN_RUNTIME[] =
+"/* strings are copied into chunks chained from the config's mem */\n"
+"typedef struct GenChunk { struct GenChunk *next; size_t used, cap; char data[]; } GenChunk;\n"
+"\n"
+"typedef enum { GT_INT, GT_FLOAT, GT_BOOL, GT_STRING } GenType;\n"
+"typedef struct GenFrame { int id; void *obj; } GenFrame;\n"
+"\n"
+"typedef struct GenState {\n"
+"    void **mem;\n"
+"    GenFrame stack[GEN_DEPTH];\n"
+"    size_t depth;\n"
+"    void **arr; size_t *arr_len; size_t arr_size; GenType arr_type; const char *arr_what;\n"
+"    int errors;\n"
+"} GenState;\n"
+"\n"
+"static char *gen_strndup(GenState *S, const char *s, size_t n) {\n"
+"    GenChunk *c = *S->mem;\n"
+"    if (!c || c->cap - c->used < n + 1) {\n"
+"        size_t cap = n + 1 > 16384 ? n + 1 : 16384;\n"
+"        GenChunk *nc = malloc(sizeof(GenChunk) + cap);\n"
+"        if (!nc) return NULL;\n"
+"        nc->next = c;\n"
+"        nc->used = 0;\n"
+"        nc->cap = cap;\n"
+"        *S->mem = c = nc;\n"
+"    }\n"
+"    char *d = c->data + c->used;\n"
+"    memcpy(d, s, n);\n"
+"    d[n] = '\\0';\n"
+"    c->used += n + 1;\n"
+"    return d;\n"
+"}\n"
+"\n"
+"/* room for one more item; capacity is the next power of two */\n"
+"static void *gen_append(void **items, size_t *count, size_t size) {\n"
+"    size_t n = *count;\n"
+"    if (!(n & (n - 1))) {\n"
+"        void *p = realloc(*items, (n ? n * 2 : 1) * size);\n"
+"        if (!p) return NULL;\n"
+"        *items = p;\n"
+"    }\n"
+"    ++*count;\n"
+"    return (char *)*items + n * size;\n"
+"}\n"
+"\n"
+"static uint32_t gen_hash(const char *s, size_t n) {\n"
+"    uint32_t h = 2166136261u;\n"
+"    for (size_t i = 0; i < n; ++i) h = (h ^ (unsigned char)s[i]) * 16777619u;\n"
+"    return h;\n"
+"}\n"
+"\n"
+"static int gen_push(GenState *S, int id, void *obj) {\n"
+"    S->stack[S->depth++] = (GenFrame){ id, obj };\n"
+"    return ACL_SAX_CONTINUE;\n"
+"}\n"
+"\n"
+"static int gen_mismatch(GenState *S, const AclSaxValue *v, const char *what, const char *want) {\n"
+"    static const char *const kinds[] = { \"int\", \"float\", \"bool\", \"char\", \"string\", \"reference\", \"expression\", \"array\" };\n"
+"    fprintf(stderr, \"%s at byte %zu: expected %s, got %s\\n\", what, v->offset, want, kinds[v->kind]);\n"
+"    S->errors++;\n"
+"    return v->kind == ACL_SAX_ARRAY ? ACL_SAX_SKIP : ACL_SAX_CONTINUE;\n"
+"}\n"
+"\n"
+"static int gen_int(GenState *S, const AclSaxValue *v, long *out, const char *what) {\n"
+"    if (v->kind != ACL_SAX_INT && v->kind != ACL_SAX_CHAR) return gen_mismatch(S, v, what, \"int\");\n"
+"    *out = v->i;\n"
+"    return ACL_SAX_CONTINUE;\n"
+"}\n"
+"\n"
+"static int gen_float(GenState *S, const AclSaxValue *v, double *out, const char *what) {\n"
+"    if (v->kind == ACL_SAX_FLOAT) *out = v->f;\n"
+"    else if (v->kind == ACL_SAX_INT) *out = (double)v->i;\n"
+"    else return gen_mismatch(S, v, what, \"float\");\n"
+"    return ACL_SAX_CONTINUE;\n"
+"}\n"
+"\n"
+"static int gen_bool(GenState *S, const AclSaxValue *v, int *out, const char *what) {\n"
+"    if (v->kind != ACL_SAX_BOOL) return gen_mismatch(S, v, what, \"bool\");\n"
+"    *out = (int)v->i;\n"
+"    return ACL_SAX_CONTINUE;\n"
+"}\n"
+"\n"
+"static int gen_string(GenState *S, const AclSaxValue *v, const char **out, const char *what) {\n"
+"    if (v->kind != ACL_SAX_STRING) return gen_mismatch(S, v, what, \"string\");\n"
+"    const char *s = gen_strndup(S, v->str, v->len);\n"
+"    if (!s) return ACL_SAX_STOP;\n"
+"    *out = s;\n"
+"    return ACL_SAX_CONTINUE;\n"
+"}\n"
+"\n"
+"/* an array field: its elements arrive through gen_element */\n"
+"__attribute__((unused))\n"
+"static int gen_array(GenState *S, const AclSaxValue *v, void **items, size_t *len, size_t size, GenType type, const char *what) {\n"
+"    static const char *const names[] = { \"int[]\", \"float[]\", \"bool[]\", \"string[]\" };\n"
+"    if (v->kind != ACL_SAX_ARRAY) return gen_mismatch(S, v, what, names[type]);\n"
+"    free(*items);\n"
+"    *items = NULL;\n"
+"    *len = 0;\n"
+"    S->arr = items;\n"
+"    S->arr_len = len;\n"
+"    S->arr_size = size;\n"
+"    S->arr_type = type;\n"
+"    S->arr_what = what;\n"
+"    return ACL_SAX_CONTINUE;\n"
+"}\n"
+"\n"
+"static int gen_element(void *ctx, size_t index, const AclSaxValue *v) {\n"
+"    GenState *S = ctx;\n"
+"    (void)index;\n"
+"    /* a mismatched element is reported and dropped */\n"
+"    union { long i; double f; int b; const char *s; } e;\n"
+"    int errors = S->errors, rc;\n"
+"    switch (S->arr_type) {\n"
+"        case GT_INT: rc = gen_int(S, v, &e.i, S->arr_what); break;\n"
+"        case GT_FLOAT: rc = gen_float(S, v, &e.f, S->arr_what); break;\n"
+"        case GT_BOOL: rc = gen_bool(S, v, &e.b, S->arr_what); break;\n"
+"        default: rc = gen_string(S, v, &e.s, S->arr_what); break;\n"
+"    }\n"
+"    if (rc == ACL_SAX_STOP || S->errors != errors) return rc;\n"
+"    void *slot = gen_append(S->arr, S->arr_len, S->arr_size);\n"
+"    if (!slot) return ACL_SAX_STOP;\n"
+"    memcpy(slot, &e, S->arr_size);\n"
+"    return ACL_SAX_CONTINUE;\n"
+"}\n"
+"\n"
+"static int gen_array_end(void *ctx) {\n"
+"    GenState *S = ctx;\n"
+"    S->arr = NULL;\n"
+"    return ACL_SAX_CONTINUE;\n"
+"}\n"
+"\n"
+"static int gen_exit(void *ctx) {\n"
+"    GenState *S = ctx;\n"
+"    S->depth--;\n"
+"    return ACL_SAX_CONTINUE;\n"
+"}\n"
+"\n";
+
+static void emit_source(FILE *c, const Schema *S, const char *base) {
+    const char *p = S->prefix;
+    fprintf(c, "/* %s.c - generated by acl-gen from %s; do not edit. */\n", base, S->file);
+    fprintf(c, "#include <stdint.h>\n#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n\n");
+    fprintf(c, "#include \"acl.h\"\n#include \"%s.h\"\n\n", base);
+    fprintf(c, "#define GEN_DEPTH %zu\n\n", S->max_depth + 1);
+    fputs(GEN_RUNTIME, c);
+
+    fprintf(c, "enum { B_ROOT");
+    emit_block_ids(c, &S->root);
+    fprintf(c, " };\n\n");
+    emit_inits(c, S, &S->root);
+    emit_frees(c, S, &S->root);
+
+    fprintf(c, "static int gen_enter(void *ctx, const char *name, size_t nlen, const char *label, size_t llen) {\n");
+    fprintf(c, "    GenState *S = ctx;\n    GenFrame *f = &S->stack[S->depth - 1];\n    uint32_t h = gen_hash(name, nlen);\n");
+    fprintf(c, "    (void)label;\n    (void)llen;\n");
+    fprintf(c, "    switch (f->id) {\n");
+    emit_handlers(c, S, &S->root, 0);
+    fprintf(c, "    default:\n        break;\n    }\n");
+    fprintf(c, "    (void)h;\n    return ACL_SAX_SKIP; /* not in the schema */\n}\n\n");
+
+    fprintf(c, "static int gen_field(void *ctx, const char *name, size_t nlen, const AclSaxValue *v) {\n");
+    fprintf(c, "    GenState *S = ctx;\n    GenFrame *f = &S->stack[S->depth - 1];\n    uint32_t h = gen_hash(name, nlen);\n");
+    fprintf(c, "    switch (f->id) {\n");
+    emit_handlers(c, S, &S->root, 1);
+    fprintf(c, "    default:\n        break;\n    }\n");
+    fprintf(c, "    (void)h;\n    return v->kind == ACL_SAX_ARRAY ? ACL_SAX_SKIP : ACL_SAX_CONTINUE; /* not in the schema */\n}\n\n");
+
+    fprintf(c, "static const AclSaxHandler HANDLER = { gen_enter, gen_exit, gen_field, gen_element, gen_array_end };\n\n");
+    fprintf(c, "static void gen_begin(GenState *S, %s_config *out) {\n", p);
+    fprintf(c, "    memset(S, 0, sizeof(*S));\n    init_B_ROOT(out);\n    S->mem = &out->mem;\n");
+    fprintf(c, "    S->stack[0] = (GenFrame){ B_ROOT, out };\n    S->depth = 1;\n}\n\n");
+    fprintf(c, "int %s_parse_string(const char *text, size_t len, %s_config *out) {\n", p, p);
+    fprintf(c, "    GenState S;\n    gen_begin(&S, out);\n");
+    fprintf(c, "    int rc = acl_sax_parse_string(text, len, &HANDLER, &S);\n");
+    fprintf(c, "    return rc < 1 ? -1 : S.errors ? 0 : 1;\n}\n\n");
+    fprintf(c, "int %s_parse_file(const char *path, %s_config *out) {\n", p, p);
+    fprintf(c, "    GenState S;\n    gen_begin(&S, out);\n");
+    fprintf(c, "    int rc = acl_sax_parse_file(path, &HANDLER, &S);\n");
+    fprintf(c, "    return rc < 1 ? -1 : S.errors ? 0 : 1;\n}\n\n");
+    fprintf(c, "void %s_free(%s_config *c) {\n", p, p);
+    fprintf(c, "    if (!c) return;\n    free_B_ROOT(c);\n");
+    fprintf(c, "    for (GenChunk *k = c->mem, *next; k; k = next) {\n        next = k->next;\n        free(k);\n    }\n");
+    fprintf(c, "    memset(c, 0, sizeof(*c));\n}\n");
+}
+
+/* ---------- main ---------- */
+
+static int valid_ident(const char *s) {
+    if (!(*s == '_' || (*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z'))) return 0;
+    for (; *s; ++s) {
+        if (!(*s == '_' || (*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || (*s >= '0' && *s <= '9'))) return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 4 || !valid_ident(argv[3])) {
+        fprintf(stderr, "usage: %s <schema> <out> <prefix>\n"
+                        "writes <out>.h and <out>.c; prefix is a C identifier\n", argv[0]);
+        return 2;
+    }
+    Schema S;
+    memset(&S, 0, sizeof(S));
+    S.prefix = argv[3];
+    S.file = argv[1];
+    S.root.path = "";
+    S.root.ctype = xprintf("%s_config", S.prefix);
+    S.root.id = "B_ROOT";
+    S.cur = &S.root;
+    const AclSaxHandler h = { schema_enter, schema_exit, schema_field, schema_element, schema_array_end };
+    if (acl_sax_parse_file(argv[1], &h, &S) < 0) {
+        fprintf(stderr, "%s: can't read the schema\n", argv[1]);
+        return 1;
+    }
+    if (!S.root.nchildren) schema_error(&S, 0, "no blocks");
+    schema_check(&S, &S.root);
+    if (S.failed) return 1;
+
+    const char *base = strrchr(argv[2], '/');
+    base = base ? base + 1 : argv[2];
+    char *guard = xprintf("%s_H", base);
+    for (char *g = guard; *g; ++g) {
+        if (*g >= 'a' && *g <= 'z') *g = (char)(*g - 'a' + 'A');
+        else if (!((*g >= 'A' && *g <= 'Z') || (*g >= '0' && *g <= '9'))) *g = '_';
+    }
+    char *hpath = xprintf("%s.h", argv[2]), *cpath = xprintf("%s.c", argv[2]);
+    FILE *hf = fopen(hpath, "w"), *cf = fopen(cpath, "w");
+    if (!hf || !cf) { perror("acl-gen"); return 1; }
+    emit_header(hf, &S, guard, base);
+    emit_source(cf, &S, base);
+    if (fclose(hf) != 0 || fclose(cf) != 0) { perror("acl-gen"); return 1; }
+    return 0;
+}
@@ -3,9 +3,191 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "acl.h"
 #include "expr.h"
 
+/* ---------- arena ---------- */
+
+/* Every node and string of a parsed tree lives in one arena owned by the
+   tree, so building a tree is mostly pointer bumps and freeing it is one
+   free() per chunk. Large requests get a dedicated chunk so they don't
+   waste the tail of the current one. */
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN alignof(max_align_t)
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t used;
+    size_t cap;
+    alignas(max_align_t) char data[];
+} ArenaChunk;
+
+typedef struct Arena {
+    ArenaChunk *head;
+} Arena;
+
+static ArenaChunk *arena_chunk_new(size_t cap) {
+    ArenaChunk *c = malloc(sizeof(ArenaChunk) + cap);
+    if (!c) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+    c->next = NULL;
+    c->used = 0;
+    c->cap = cap;
+    return c;
+}
+
+static void *arena_alloc(Arena *a, size_t n) {
+    n = (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    ArenaChunk *c = a->head;
+    if (c && c->cap - c->used >= n) {
+        void *p = c->data + c->used;
+        c->used += n;
+        return p;
+    }
+    if (n > ARENA_CHUNK_SIZE / 4) {
+        /* oversized: own chunk, linked behind the current one */
+        ArenaChunk *big = arena_chunk_new(n);
+        big->used = n;
+        if (c) { big->next = c->next; c->next = big; }
+        else a->head = big;
+        return big->data;
+    }
+    c = arena_chunk_new(ARENA_CHUNK_SIZE);
+    c->next = a->head;
+    a->head = c;
+    c->used = n;
+    return c->data;
+}
+
+static void *arena_calloc(Arena *a, size_t n) {
+    void *p = arena_alloc(a, n);
+    memset(p, 0, n);
+    return p;
+}
+
+static char *arena_strndup(Arena *a, const char *s, size_t n) {
+    char *r = arena_alloc(a, n + 1);
+    memcpy(r, s, n);
+    r[n] = '\0';
+    return r;
+}
+
+static void arena_destroy(Arena *a) {
+    ArenaChunk *c = a->head;
+    while (c) {
+        ArenaChunk *n = c->next;
+        free(c);
+        c = n;
+    }
+    a->head = NULL;
+}
+
+/* ---------- string interning ---------- */
+
+/* Identifiers and labels are interned per tree: each distinct spelling is
+   stored once in the arena, behind a header holding its hash and length.
+   Two atoms of the same tree are equal iff their pointers are, and hash
+   tables reuse the stored hash. Only the slot table is malloc'd, since it
+   grows. */
+
+typedef struct Atom { size_t hash; size_t len; char str[]; } Atom;
+typedef struct Interner { Atom **slots; size_t mask; size_t count; } Interner;
+
+#define ATOM(s) ((const Atom *)((const char *)(s) - offsetof(Atom, str)))
+#define HASH_SEED ((size_t)14695981039346656037ULL)
+#define HASH_PRIME ((size_t)1099511628211ULL)
+
+static size_t hash_mem(const char *s, size_t n) {
+    size_t h = HASH_SEED;
+    for (size_t i = 0; i < n; ++i) { h ^= (unsigned char)s[i]; h *= HASH_PRIME; }
+    return h;
+}
+
+static size_t atom_hash(const char *s) { return ATOM(s)->hash; }
+
+static void interner_grow(Interner *in) {
+    size_t cap = in->slots ? (in->mask + 1) * 2 : 256;
+    Atom **slots = calloc(cap, sizeof(Atom *));
+    if (!slots) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+    for (size_t i = 0; in->slots && i <= in->mask; ++i) {
+        Atom *a = in->slots[i];
+        if (!a) continue;
+        size_t j = a->hash & (cap - 1);
+        while (slots[j]) j = (j + 1) & (cap - 1);
+        slots[j] = a;
+    }
+    free(in->slots);
+    in->slots = slots;
+    in->mask = cap - 1;
+}
+
+/* slot holding s[0..n), or the empty slot where it would go */
+static Atom **interner_slot(const Interner *in, const char *s, size_t n, size_t h) {
+    size_t i = h & in->mask;
+    for (; in->slots[i]; i = (i + 1) & in->mask) {
+        const Atom *a = in->slots[i];
+        if (a->hash == h && a->len == n && memcmp(a->str, s, n) == 0) break;
+    }
+    return &in->slots[i];
+}
+
+/* the atom spelled like a, which belongs to another interner: a itself,
+   taken over with its storage, unless `in` has one already */
+static char *interner_adopt(Interner *in, Atom *a) {
+    if (!in->slots || (in->count + 1) * 2 > in->mask + 1) interner_grow(in);
+    Atom **slot = interner_slot(in, a->str, a->len, a->hash);
+    if (!*slot) {
+        *slot = a;
+        in->count++;
+    }
+    return (*slot)->str;
+}
+
+/* the atom for s[0..n), created on first use */
+static char *intern(Interner *in, Arena *arena, const char *s, size_t n) {
+    if (!in->slots || (in->count + 1) * 2 > in->mask + 1) interner_grow(in);
+    size_t h = hash_mem(s, n);
+    Atom **slot = interner_slot(in, s, n, h);
+    if (!*slot) {
+        Atom *a = arena_alloc(arena, sizeof(Atom) + n + 1);
+        a->hash = h;
+        a->len = n;
+        memcpy(a->str, s, n);
+        a->str[n] = '\0';
+        *slot = a;
+        in->count++;
+    }
+    return (*slot)->str;
+}
+
+/* the atom for s[0..n) (hash h) if the tree has one; NULL means no name
+   or label in the tree is spelled that way */
+static const char *interner_find_hashed(const Interner *in, const char *s, size_t n, size_t h) {
+    if (!in->slots) return NULL;
+    Atom *a = *interner_slot(in, s, n, h);
+    return a ? a->str : NULL;
+}
+
+static void interner_free(Interner *in) {
+    free(in->slots);
+    memset(in, 0, sizeof(*in));
+}
+
 /* ---------- small helpers ---------- */
 
 static char *str_dup_local(const char *s) {
@@ -16,13 +198,151 @@ static char *str_dup_local(const char *s) {
     memcpy(r, s, n + 1);
     return r;
 }
-static char *substr_dup(const char *s, size_t a, size_t b) {
-    size_t n = b - a;
-    char *r = malloc(n + 1);
-    if (!r) return NULL;
-    memcpy(r, s + a, n);
-    r[n] = '\0';
-    return r;
+
+/* ---------- byte scanning ---------- */
+
+/* The lexer spends most of its time in runs of whitespace, comment bodies
+   and string literals. These scans cover them 32 (AVX2) or 16 (SSE2)
+   bytes at a time. A vector step takes a start index and returns the
+   first match, or where fewer than a vector's worth of bytes remain; the
+   byte loop finishes from there. AVX2 is used only if the CPU has it;
+   SCAN_SCALAR builds without vectors. */
+
+#if defined(__SSE2__) && !defined(SCAN_SCALAR)
+#define SCAN_SSE2 1
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SCAN_AVX2 1
+#endif
+#endif
+
+/* vector width in use: 0, 16 or 32; -1 until first use */
+static atomic_int scan_width_sel = -1;
+
+static int scan_width_max(void) {
+#if SCAN_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return 32;
+#endif
+#if SCAN_SSE2
+    return 16;
+#else
+    return 0;
+#endif
+}
+
+#if SCAN_SSE2
+static int scan_width(void) {
+    int w = atomic_load_explicit(&scan_width_sel, memory_order_relaxed);
+    if (w < 0) {
+        w = scan_width_max();
+        atomic_store_explicit(&scan_width_sel, w, memory_order_relaxed);
+    }
+    return w;
+}
+#endif
+
+int acl_lex_simd(int width) {
+    int max = scan_width_max();
+    width = width >= 32 ? 32 : width >= 16 ? 16 : 0;
+    if (width > max) width = max;
+    atomic_store_explicit(&scan_width_sel, width, memory_order_relaxed);
+    return width;
+}
+
+/* isspace() in the C locale: ' ' and '\t' through '\r' */
+static int is_space_byte(unsigned char c) { return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t'; }
+
+#if SCAN_SSE2
+static unsigned sse2_space_mask(__m128i v) {
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8('\r' - '\t')), t);
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(ctl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))));
+}
+
+static size_t sse2_skip_space(const char *s, size_t i, size_t n) {
+    for (; i + 16 <= n; i += 16) {
+        unsigned m = ~sse2_space_mask(_mm_loadu_si128((const __m128i *)(s + i))) & 0xFFFF;
+        if (m) return i + (size_t)__builtin_ctz(m);
+    }
+    return i;
+}
+
+static size_t sse2_find2(const char *s, size_t i, size_t n, char a, char b) {
+    __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (m) return i + (size_t)__builtin_ctz(m);
+    }
+    return i;
+}
+#endif
+
+#if SCAN_AVX2
+/* Most runs are shorter than 16 bytes, so the AVX2 scans probe one SSE2
+   vector first and only then go 32 bytes at a time. */
+__attribute__((target("avx2")))
+static size_t avx2_skip_space(const char *s, size_t i, size_t n) {
+    if (i + 16 <= n) {
+        unsigned m = ~sse2_space_mask(_mm_loadu_si128((const __m128i *)(s + i))) & 0xFFFF;
+        if (m) return i + (size_t)__builtin_ctz(m);
+        i += 16;
+    }
+    const __m256i tab = _mm256_set1_epi8('\t'), span = _mm256_set1_epi8('\r' - '\t'), sp = _mm256_set1_epi8(' ');
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i t = _mm256_sub_epi8(v, tab);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(t, span), t), _mm256_cmpeq_epi8(v, sp));
+        unsigned m = ~(unsigned)_mm256_movemask_epi8(ws);
+        if (m) return i + (size_t)__builtin_ctz(m);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_find2(const char *s, size_t i, size_t n, char a, char b) {
+    if (i + 16 <= n) {
+        size_t j = sse2_find2(s, i, i + 16, a, b);
+        if (j < i + 16) return j;
+        i += 16;
+    }
+    __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if (m) return i + (size_t)__builtin_ctz(m);
+    }
+    return i;
+}
+#endif
+
+/* first non-whitespace byte in s[i..n), or n */
+static size_t scan_space(const char *s, size_t i, size_t n) {
+    if (i < n && !is_space_byte((unsigned char)s[i])) return i; /* no run: the usual case between tokens */
+#if SCAN_SSE2
+    int w = scan_width();
+#if SCAN_AVX2
+    if (w >= 32) i = avx2_skip_space(s, i, n);
+    else
+#endif
+    if (w >= 16) i = sse2_skip_space(s, i, n);
+#endif
+    while (i < n && is_space_byte((unsigned char)s[i])) i++;
+    return i;
+}
+
+/* first byte in s[i..n) equal to a or b, or n */
+static size_t scan_find2(const char *s, size_t i, size_t n, char a, char b) {
+#if SCAN_SSE2
+    int w = scan_width();
+#if SCAN_AVX2
+    if (w >= 32) i = avx2_find2(s, i, n, a, b);
+    else
+#endif
+    if (w >= 16) i = sse2_find2(s, i, n, a, b);
+#endif
+    while (i < n && s[i] != a && s[i] != b) i++;
+    return i;
 }
 
 /* ---------- lexer ---------- */
@@ -53,58 +373,129 @@ typedef enum {
     TOK_TYPE_BOOL,
     TOK_TYPE_STRING,
     TOK_TYPE_REF,
+    TOK_TYPE_EXPR,
 
     TOK_UNKNOWN
 } TokenKind;
 
+/* Tokens never own memory: identifiers and strings are (text, len) slices
+   into the source buffer, and the lexer allocates nothing. A string literal
+   with escapes has `escaped` set; whoever keeps its text decodes it (see
+   token_text). */
 typedef struct {
     TokenKind kind;
-    char *text;    /* owned for identifiers/strings */
+    const char *text;
+    size_t len;
+    int   escaped;
     long  ival;
     double fval;
     int   bval;
     int   cval;
-    size_t pos;
-    int line;
-    int col;
+    size_t pos;  /* line and column are derived on demand: see lex_line_col */
 } Token;
 
-/* source buffer and reading state */
-static const char *SRC = NULL;
-static size_t SRC_POS = 0;
-static size_t SRC_LEN = 0;
-static int LINE = 1;
-static int COL = 1;
-
-static void adv_pos(char c) {
-    if (c == '\n') { LINE++; COL = 1; } else COL++;
-}
-static char peekc(void) { return SRC_POS < SRC_LEN ? SRC[SRC_POS] : '\0'; }
-static char getc_src(void) { char c = peekc(); if (c) { adv_pos(c); SRC_POS++; } return c; }
-
-static void skip_spaces_and_comments(void) {
-    while (SRC_POS < SRC_LEN) {
-        char c = SRC[SRC_POS];
-        if (c == '\r') { adv_pos(c); SRC_POS++; continue; } /* tolerate CR */
-        if (isspace((unsigned char)c)) { adv_pos(c); SRC_POS++; continue; }
-        if (c == '/' && SRC_POS+1 < SRC_LEN && SRC[SRC_POS+1] == '/') {
-            getc_src(); getc_src();
-            while (peekc() && peekc() != '\n') getc_src();
+/* All lexer and parser state for one parse. Nothing is shared between
+   parsers, so different threads can parse different files at once. */
+#define LOOKAHEAD 4 /* token ring size: power of two, > max peek distance */
+
+typedef struct Parser {
+    /* source buffer and reading state */
+    const char *src;
+    size_t pos;
+    size_t len;
+
+    /* line numbering, advanced only when a position is reported:
+       line `line_no` starts at line_start, and newlines before line_pos
+       have been counted */
+    size_t src_start; /* after any BOM: line 1, column 1 */
+    size_t line_pos;
+    size_t line_start;
+    int line_no;
+
+    /* lookahead ring: each token is lexed exactly once */
+    Token ring[LOOKAHEAD];
+    unsigned ring_head;  /* slot of the current token */
+    unsigned ring_count; /* tokens buffered from ring_head on */
+
+    /* tree being built, the arena that owns it, and its atom table */
+    struct Tree *tree;
+    Arena *arena;
+    Interner *atoms;
+
+    /* where parse events go (see ParseSink); events inside a skipped
+       block or array are dropped while mute is nonzero */
+    const struct ParseSink *sink;
+    void *sink_ctx;
+    unsigned mute;
+
+    /* matched braces of a lazy tree's source, or NULL (see brace_scan) */
+    const struct BraceTable *braces;
+
+    /* segment tokens of the reference being parsed (see parse_ref) */
+    Token *segs;
+    size_t segs_cap;
+
+    /* decoded text of the last escaped string asked for (see token_text) */
+    char *decode;
+    size_t decode_cap;
+
+    /* array elements being collected by the tree builder */
+    struct Value *scratch;
+    size_t scratch_len;
+    size_t scratch_cap;
+
+    /* parse errors unwind here with 1, a sink stopping the parse with 2;
+       quiet: without printing a diagnostic (see shard_parse) */
+    jmp_buf fail;
+    int quiet;
+} Parser;
+
+/* line and column (1-based, counting bytes) of source offset pos */
+static void lex_line_col(Parser *P, size_t pos, int *line, int *col) {
+    if (pos < P->line_pos) {
+        /* behind the cursor (only diagnostics go back): count again */
+        P->line_pos = P->line_start = P->src_start;
+        P->line_no = 1;
+    }
+    const char *nl;
+    while ((nl = memchr(P->src + P->line_pos, '\n', pos - P->line_pos))) {
+        P->line_no++;
+        P->line_pos = P->line_start = (size_t)(nl - P->src) + 1;
+    }
+    P->line_pos = pos;
+    *line = P->line_no;
+    *col = (int)(pos - P->line_start) + 1;
+}
+
+static char peekc(Parser *P) { return P->pos < P->len ? P->src[P->pos] : '\0'; }
+static char getc_src(Parser *P) { char c = peekc(P); if (P->pos < P->len) P->pos++; return c; }
+
+static void skip_spaces_and_comments(Parser *P) {
+    const char *s = P->src;
+    size_t n = P->len, i = P->pos;
+    for (;;) {
+        i = scan_space(s, i, n);
+        if (i + 1 >= n || s[i] != '/') break;
+        if (s[i+1] == '/') {
+            i = scan_find2(s, i + 2, n, '\n', '\n');
             continue;
         }
-        if (c == '/' && SRC_POS+1 < SRC_LEN && SRC[SRC_POS+1] == '*') {
-            getc_src(); getc_src();
-            while (SRC_POS+1 < SRC_LEN && !(SRC[SRC_POS]=='*' && SRC[SRC_POS+1]=='/')) getc_src();
-            if (SRC_POS+1 < SRC_LEN) { getc_src(); getc_src(); }
-            continue;
+        if (s[i+1] != '*') break;
+        size_t body = i + 2;
+        for (i = body; ; ++i) {
+            i = scan_find2(s, i, n, '*', '*');
+            if (i + 1 >= n) {
+                /* unterminated: stop on the last byte, as the lexer always has */
+                i = body > n - 1 ? body : n - 1;
+                break;
+            }
+            if (s[i+1] == '/') { i += 2; break; }
         }
-        break;
     }
+    P->pos = i;
 }
 
-static int parse_escape_char(void) {
-    if (SRC_POS >= SRC_LEN) return '\\';
-    char esc = getc_src();
+static int decode_escape(char esc) {
     switch (esc) {
         case 'n': return '\n';
         case 't': return '\t';
@@ -117,228 +508,305 @@ static int parse_escape_char(void) {
     }
 }
 
-static Token next_token_internal(void) {
-    skip_spaces_and_comments();
+static Token next_token_internal(Parser *P) {
+    skip_spaces_and_comments(P);
     Token tk; memset(&tk,0,sizeof(tk));
-    tk.pos = SRC_POS; tk.line = LINE; tk.col = COL;
-    if (SRC_POS >= SRC_LEN) { tk.kind = TOK_EOF; return tk; }
-    char c = peekc();
+    tk.pos = P->pos;
+    if (P->pos >= P->len) { tk.kind = TOK_EOF; return tk; }
+    char c = peekc(P);
 
     /* punctuation */
-    if (c == '{') { getc_src(); tk.kind = TOK_LBRACE; return tk; }
-    if (c == '}') { getc_src(); tk.kind = TOK_RBRACE; return tk; }
-    if (c == '=') { getc_src(); tk.kind = TOK_EQ; return tk; }
-    if (c == ';') { getc_src(); tk.kind = TOK_SEMI; return tk; }
-    if (c == ',') { getc_src(); tk.kind = TOK_COMMA; return tk; }
-    if (c == '[') { getc_src(); tk.kind = TOK_LBRACK; return tk; }
-    if (c == ']') { getc_src(); tk.kind = TOK_RBRACK; return tk; }
-    if (c == '$') { getc_src(); tk.kind = TOK_DOLLAR; return tk; }
-    if (c == '.') { getc_src(); tk.kind = TOK_DOT; return tk; }
-    if (c == '^') { getc_src(); tk.kind = TOK_CARET; return tk; }
-
-    /* string literal */
+    if (c == '{') { getc_src(P); tk.kind = TOK_LBRACE; return tk; }
+    if (c == '}') { getc_src(P); tk.kind = TOK_RBRACE; return tk; }
+    if (c == '=') { getc_src(P); tk.kind = TOK_EQ; return tk; }
+    if (c == ';') { getc_src(P); tk.kind = TOK_SEMI; return tk; }
+    if (c == ',') { getc_src(P); tk.kind = TOK_COMMA; return tk; }
+    if (c == '[') { getc_src(P); tk.kind = TOK_LBRACK; return tk; }
+    if (c == ']') { getc_src(P); tk.kind = TOK_RBRACK; return tk; }
+    if (c == '$') { getc_src(P); tk.kind = TOK_DOLLAR; return tk; }
+    if (c == '.') { getc_src(P); tk.kind = TOK_DOT; return tk; }
+    if (c == '^') { getc_src(P); tk.kind = TOK_CARET; return tk; }
+
+    /* string literal: a slice of the source unless it contains escapes */
     if (c == '"') {
-        getc_src();
-        size_t cap = 128, len = 0;
-        char *buf = malloc(cap);
-        while (SRC_POS < SRC_LEN) {
-            char ch = getc_src();
-            if (ch == '"') break;
-            if (ch == '\\') {
-                int ec = parse_escape_char();
-                ch = (char)ec;
-            }
-            if (len + 1 >= cap) { cap *= 2; buf = realloc(buf, cap); }
-            buf[len++] = ch;
+        size_t a = P->pos + 1, b = a;
+        int has_escape = 0;
+        for (;;) {
+            b = scan_find2(P->src, b, P->len, '"', '\\');
+            if (b >= P->len || P->src[b] == '"') break;
+            has_escape = 1;
+            b += 2; /* the backslash and the byte it escapes */
+            if (b > P->len) b = P->len;
         }
-        buf[len] = '\0';
-        tk.kind = TOK_STRING; tk.text = buf;
+        P->pos = b < P->len ? b + 1 : b; /* closing quote */
+        tk.kind = TOK_STRING;
+        tk.text = P->src + a; tk.len = b - a; tk.escaped = has_escape;
         return tk;
     }
 
     /* char literal */
     if (c == '\'') {
-        getc_src();
+        getc_src(P);
         int ch;
-        if (peekc() == '\\') { getc_src(); ch = parse_escape_char(); } else ch = getc_src();
-        if (peekc() == '\'') getc_src();
+        if (peekc(P) == '\\') {
+            getc_src(P);
+            ch = P->pos < P->len ? decode_escape(getc_src(P)) : '\\';
+        } else ch = getc_src(P);
+        if (peekc(P) == '\'') getc_src(P);
         tk.kind = TOK_CHAR; tk.cval = ch;
         return tk;
     }
 
     /* identifier or type keyword or bool literal */
     if (isalpha((unsigned char)c) || c == '_') {
-        size_t a = SRC_POS; getc_src();
-        while (SRC_POS < SRC_LEN && (isalnum((unsigned char)peekc()) || peekc() == '_')) getc_src();
-        size_t b = SRC_POS;
-        char *id = substr_dup(SRC, a, b);
-
-        if (strcmp(id, "int") == 0) { free(id); tk.kind = TOK_TYPE_INT; return tk; }
-        if (strcmp(id, "float") == 0) { free(id); tk.kind = TOK_TYPE_FLOAT; return tk; }
-        if (strcmp(id, "bool") == 0) { free(id); tk.kind = TOK_TYPE_BOOL; return tk; }
-        if (strcmp(id, "string") == 0) { free(id); tk.kind = TOK_TYPE_STRING; return tk; }
-        if (strcmp(id, "true") == 0) { free(id); tk.kind = TOK_BOOL_LITERAL; tk.bval = 1; return tk; }
-        if (strcmp(id, "false") == 0) { free(id); tk.kind = TOK_BOOL_LITERAL; tk.bval = 0; return tk; }
-        if (strcmp(id, "ref") == 0) { free(id); tk.kind = TOK_TYPE_REF; return tk; }
-
-        tk.kind = TOK_IDENT; tk.text = id; return tk;
+        size_t a = P->pos; getc_src(P);
+        while (P->pos < P->len && (isalnum((unsigned char)peekc(P)) || peekc(P) == '_')) getc_src(P);
+        const char *id = P->src + a;
+        size_t n = P->pos - a;
+
+#define KW(s) (n == sizeof(s) - 1 && memcmp(id, s, n) == 0)
+        if (KW("int")) { tk.kind = TOK_TYPE_INT; return tk; }
+        if (KW("float")) { tk.kind = TOK_TYPE_FLOAT; return tk; }
+        if (KW("bool")) { tk.kind = TOK_TYPE_BOOL; return tk; }
+        if (KW("string")) { tk.kind = TOK_TYPE_STRING; return tk; }
+        if (KW("true")) { tk.kind = TOK_BOOL_LITERAL; tk.bval = 1; return tk; }
+        if (KW("false")) { tk.kind = TOK_BOOL_LITERAL; tk.bval = 0; return tk; }
+        if (KW("ref")) { tk.kind = TOK_TYPE_REF; return tk; }
+        if (KW("expr")) { tk.kind = TOK_TYPE_EXPR; return tk; }
+#undef KW
+
+        tk.kind = TOK_IDENT; tk.text = id; tk.len = n; return tk;
     }
 
     /* number literal: either int or float (simple) */
-    if (isdigit((unsigned char)c) || (c == '-' && SRC_POS+1 < SRC_LEN && isdigit((unsigned char)SRC[SRC_POS+1]))) {
-        size_t a = SRC_POS;
-        if (peekc() == '-') getc_src();
+    if (isdigit((unsigned char)c) || (c == '-' && P->pos+1 < P->len && isdigit((unsigned char)P->src[P->pos+1]))) {
+        size_t a = P->pos;
+        if (peekc(P) == '-') getc_src(P);
         /* integer part */
-        while (SRC_POS < SRC_LEN && isdigit((unsigned char)peekc())) getc_src();
+        while (P->pos < P->len && isdigit((unsigned char)peekc(P))) getc_src(P);
         /* fractional part? */
-        if (peekc() == '.') {
-            getc_src();
-            while (SRC_POS < SRC_LEN && isdigit((unsigned char)peekc())) getc_src();
-            size_t b = SRC_POS;
-            char *num = substr_dup(SRC, a, b);
-            tk.kind = TOK_FLOAT_LITERAL;
-            tk.fval = strtod(num, NULL);
-            free(num);
-            return tk;
-        } else {
-            size_t b = SRC_POS;
-            char *num = substr_dup(SRC, a, b);
-            tk.kind = TOK_INT_LITERAL;
-            tk.ival = strtol(num, NULL, 10);
-            free(num);
-            return tk;
+        int is_float = 0;
+        if (peekc(P) == '.') {
+            is_float = 1;
+            getc_src(P);
+            while (P->pos < P->len && isdigit((unsigned char)peekc(P))) getc_src(P);
         }
+        /* the source may not be NUL-terminated (mmap): convert from a stack copy */
+        char num[64];
+        size_t n = P->pos - a;
+        if (n >= sizeof(num)) n = sizeof(num) - 1;
+        memcpy(num, P->src + a, n);
+        num[n] = '\0';
+        if (is_float) { tk.kind = TOK_FLOAT_LITERAL; tk.fval = strtod(num, NULL); }
+        else { tk.kind = TOK_INT_LITERAL; tk.ival = strtol(num, NULL, 10); }
+        return tk;
     }
 
     /* unknown char */
-    getc_src();
+    getc_src(P);
     tk.kind = TOK_UNKNOWN;
     return tk;
 }
 
-static void token_free(Token *t) { if (!t) return; if (t->text) free(t->text); t->text = NULL; }
+/* ---------- parser lookahead ring ---------- */
 
-/* ---------- parser buffer + safe snapshot lookahead ---------- */
+/* The parser looks at most two tokens past the current one. */
 
-static Token BUF = {0};
-static int HAVE_BUF = 0;
-static Token SAVED = {0};
-static int HAVE_SAVED = 0;
-
-static Token get_token_shared(void) {
-    if (HAVE_SAVED) {
-        Token t = SAVED;
-        HAVE_SAVED = 0;
-        return t;
+/* n-th token from the current one (0 = current) */
+static const Token *peek_token(Parser *P, unsigned n) {
+    while (P->ring_count <= n) {
+        P->ring[(P->ring_head + P->ring_count) & (LOOKAHEAD - 1)] = next_token_internal(P);
+        P->ring_count++;
     }
-    return next_token_internal();
+    return &P->ring[(P->ring_head + n) & (LOOKAHEAD - 1)];
 }
 
-static void push_token_shared(Token t) {
-    if (HAVE_SAVED) token_free(&SAVED);
-    SAVED = t;
-    HAVE_SAVED = 1;
+static Token cur_token(Parser *P) { return *peek_token(P, 0); }
+static Token peek1(Parser *P) { return *peek_token(P, 1); }
+static Token peek2(Parser *P) { return *peek_token(P, 2); }
+
+static void consume_token(Parser *P) {
+    (void)peek_token(P, 0);
+    P->ring_head = (P->ring_head + 1) & (LOOKAHEAD - 1);
+    P->ring_count--;
 }
 
-static Token cur_token(void) {
-    if (HAVE_BUF) return BUF;
-    BUF = get_token_shared();
-    HAVE_BUF = 1;
-    return BUF;
+/* continue lexing at source offset pos, dropping any lookahead */
+static void lexer_seek(Parser *P, size_t pos) {
+    P->pos = pos;
+    P->ring_count = 0;
 }
-static void consume_token(void) {
-    if (HAVE_BUF) { token_free(&BUF); HAVE_BUF = 0; }
-    else { Token t = get_token_shared(); token_free(&t); }
+
+/* ---------- brace matching ---------- */
+
+/* A structural pre-scan for lazy trees: the offset of every '{' the lexer
+   would see as a token, with its matching '}', in source order. Strings,
+   char literals and comments are skipped exactly as the lexer skips them,
+   so a parser can jump from a '{' to its '}' without lexing what's between. */
+typedef struct BraceTable { size_t *open, *close; size_t count, cap; } BraceTable;
+
+static void brace_table_free(BraceTable *t) {
+    free(t->open);
+    free(t->close);
 }
-static Token take_token(void) {
-    Token t = cur_token();
-    Token c = t;
-    if (c.text) c.text = str_dup_local(c.text);
-    consume_token();
-    return c;
+
+/* bytes the scan has to look at; everything else is passed over */
+static const unsigned char BRACE_SPECIAL[256] = { ['{'] = 1, ['}'] = 1, ['"'] = 1, ['\''] = 1, ['/'] = 1 };
+
+/* Fill t from s[i..n). Returns 0 if the braces don't balance (or memory
+   runs out), in which case t is left empty. */
+static int brace_scan(const char *s, size_t n, size_t i, BraceTable *t) {
+    size_t *stack = NULL, depth = 0, stack_cap = 0;
+    memset(t, 0, sizeof(*t));
+    int ok = 1;
+    while (ok && i < n) {
+        char c = s[i];
+        if (!BRACE_SPECIAL[(unsigned char)c]) { i++; continue; }
+        if (c == '{') {
+            if (t->count == t->cap) {
+                size_t cap = t->cap ? t->cap * 2 : 256;
+                size_t *no = realloc(t->open, cap * sizeof(size_t));
+                if (no) t->open = no;
+                size_t *nc = no ? realloc(t->close, cap * sizeof(size_t)) : NULL;
+                if (nc) t->close = nc;
+                if (!no || !nc) { ok = 0; break; }
+                t->cap = cap;
+            }
+            if (depth == stack_cap) {
+                size_t cap = stack_cap ? stack_cap * 2 : 64;
+                size_t *ns = realloc(stack, cap * sizeof(size_t));
+                if (!ns) { ok = 0; break; }
+                stack = ns;
+                stack_cap = cap;
+            }
+            stack[depth++] = t->count;
+            t->open[t->count++] = i++;
+        } else if (c == '}') {
+            if (!depth) ok = 0;
+            else t->close[stack[--depth]] = i++;
+        } else if (c == '"') {
+            /* as in next_token_internal */
+            size_t b = i + 1;
+            for (;;) {
+                b = scan_find2(s, b, n, '"', '\\');
+                if (b >= n || s[b] == '"') break;
+                b += 2;
+                if (b > n) b = n;
+            }
+            i = b < n ? b + 1 : b;
+        } else if (c == '\'') {
+            i++;
+            if (i < n && s[i] == '\\') { i++; if (i < n) i++; }
+            else if (i < n) i++;
+            if (i < n && s[i] == '\'') i++;
+        } else if (i + 1 < n && s[i+1] == '/') {
+            i = scan_find2(s, i + 2, n, '\n', '\n');
+        } else if (i + 1 < n && s[i+1] == '*') {
+            /* as in skip_spaces_and_comments, unterminated case included */
+            size_t body = i + 2;
+            for (i = body; ; ++i) {
+                i = scan_find2(s, i, n, '*', '*');
+                if (i + 1 >= n) { i = body > n - 1 ? body : n - 1; break; }
+                if (s[i+1] == '/') { i += 2; break; }
+            }
+        } else {
+            i++; /* a lone '/' */
+        }
+    }
+    free(stack);
+    if (!ok || depth) { brace_table_free(t); memset(t, 0, sizeof(*t)); return 0; }
+    return 1;
 }
 
-typedef struct {
-    size_t src_pos;
-    int line;
-    int col;
-    int have_saved;
-    Token saved_copy;
-    int have_buf;
-    Token buf_copy;
-} Snapshot;
+/* offset of the '}' matching the '{' at `open`; SIZE_MAX if it's not one */
+static size_t brace_close(const BraceTable *t, size_t open) {
+    size_t lo = 0, hi = t->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (t->open[mid] < open) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < t->count && t->open[lo] == open ? t->close[lo] : SIZE_MAX;
+}
+
+/* decode the escapes in a string literal's body; the output is never longer
+   than the input. Returns the decoded length. */
+static size_t decode_string(const char *s, size_t n, char *out) {
+    size_t len = 0;
+    for (size_t i = 0; i < n; ++i) {
+        char ch = s[i];
+        if (ch == '\\' && i + 1 < n) ch = (char)decode_escape(s[++i]);
+        out[len++] = ch;
+    }
+    return len;
+}
+
+/* text of an identifier or string token. Escaped strings are decoded into
+   the parser's reusable buffer, valid until the next call. */
+static const char *token_text(Parser *P, const Token *t, size_t *len) {
+    if (!t->escaped) { *len = t->len; return t->text; }
+    if (t->len + 1 > P->decode_cap) {
+        size_t cap = P->decode_cap ? P->decode_cap : 64;
+        while (cap < t->len + 1) cap *= 2;
+        char *nb = realloc(P->decode, cap);
+        if (!nb) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+        P->decode = nb;
+        P->decode_cap = cap;
+    }
+    *len = decode_string(t->text, t->len, P->decode);
+    P->decode[*len] = '\0';
+    return P->decode;
+}
 
-static void snapshot_begin(Snapshot *S) {
-    S->src_pos = SRC_POS;
-    S->line = LINE;
-    S->col = COL;
-    S->have_saved = HAVE_SAVED;
-    if (S->have_saved) {
-        S->saved_copy = SAVED;
-        if (S->saved_copy.text) S->saved_copy.text = str_dup_local(SAVED.text);
-    } else { memset(&S->saved_copy,0,sizeof(Token)); }
-    S->have_buf = HAVE_BUF;
-    if (S->have_buf) {
-        S->buf_copy = BUF;
-        if (S->buf_copy.text) S->buf_copy.text = str_dup_local(BUF.text);
-    } else { memset(&S->buf_copy,0,sizeof(Token)); }
-}
-
-static void snapshot_restore(Snapshot *S) {
-    if (HAVE_BUF) token_free(&BUF);
-    if (HAVE_SAVED) token_free(&SAVED);
-    SRC_POS = S->src_pos;
-    LINE = S->line;
-    COL = S->col;
-    if (S->have_saved) {
-        SAVED = S->saved_copy; HAVE_SAVED = 1;
-    } else { HAVE_SAVED = 0; memset(&SAVED,0,sizeof(Token)); }
-    if (S->have_buf) {
-        BUF = S->buf_copy; HAVE_BUF = 1;
-    } else { HAVE_BUF = 0; memset(&BUF,0,sizeof(Token)); }
-}
-
-/* peek n tokens ahead (n>=1), return owned copy (caller must token_free) */
-static Token peek_n_safe(int n) {
-    Snapshot S; snapshot_begin(&S);
-    Token out = {0};
-    for (int i = 0; i < n; ++i) {
-        Token t = get_token_shared();
-        out = t;
-        if (out.text) out.text = str_dup_local(out.text);
-        if (i < n-1) token_free(&out);
-    }
-    snapshot_restore(&S);
-    return out;
-}
-static Token peek1(void) { return peek_n_safe(1); }
-static Token peek2(void) { return peek_n_safe(2); }
+/* interned atom of an identifier or string token */
+static char *token_atom(Parser *P, const Token *t) {
+    size_t n;
+    const char *text = token_text(P, t, &n);
+    return intern(P->atoms, P->arena, text, n);
+}
 
 /* ---------- error reporting ---------- */
 
-static void show_line_context(size_t pos, int line, int col) {
-    (void)line; /* unused */
+/* where this thread's diagnostics go; see acl_set_diagnostics */
+static _Thread_local FILE *diag_out;
+
+static FILE *diag(void) { return diag_out ? diag_out : stderr; }
+
+void acl_set_diagnostics(FILE *out) { diag_out = out; }
+
+static void show_line_context(Parser *P, size_t pos, int col) {
     size_t i = pos;
-    while (i > 0 && SRC[i-1] != '\n') i--;
+    while (i > 0 && P->src[i-1] != '\n') i--;
     size_t j = i;
-    while (j < SRC_LEN && SRC[j] != '\n') j++;
+    while (j < P->len && P->src[j] != '\n') j++;
     size_t len = j - i;
     char *buf = malloc(len + 1);
-    memcpy(buf, SRC + i, len); buf[len] = '\0';
-    fprintf(stderr, "  %s\n", buf);
-    fprintf(stderr, "  ");
-    for (int k = 0; k < col-1 && k < (int)len; ++k) fputc((buf[k]=='\t')?'\t':' ', stderr);
-    fprintf(stderr, "^\n");
+    memcpy(buf, P->src + i, len); buf[len] = '\0';
+    FILE *out = diag();
+    fprintf(out, "  %s\n", buf);
+    fprintf(out, "  ");
+    for (int k = 0; k < col-1 && k < (int)len; ++k) fputc((buf[k]=='\t')?'\t':' ', out);
+    fprintf(out, "^\n");
     free(buf);
 }
 
-static void parse_error_token(const Token *t, const char *expect) {
-    fprintf(stderr, "Parse error at %d:%d: unexpected token", t->line, t->col);
-    if (t->text) fprintf(stderr, " '%s'", t->text);
-    if (t->kind == TOK_INT_LITERAL) fprintf(stderr, " (int=%ld)", t->ival);
-    fprintf(stderr, ", expected %s\n", expect ? expect : "valid construct");
-    show_line_context(t->pos, t->line, t->col);
-    exit(1);
+static _Noreturn void parse_error_token(Parser *P, const Token *t, const char *expect) {
+    if (P->quiet) longjmp(P->fail, 1);
+    FILE *out = diag();
+    flockfile(out); /* keep the whole diagnostic together when parsing in parallel */
+    int line, col;
+    lex_line_col(P, t->pos, &line, &col);
+    fprintf(out, "Parse error at %d:%d: unexpected token", line, col);
+    if (t->text) {
+        size_t n;
+        const char *text = token_text(P, t, &n);
+        fprintf(out, " '%.*s'", (int)n, text);
+    }
+    if (t->kind == TOK_INT_LITERAL) fprintf(out, " (int=%ld)", t->ival);
+    fprintf(out, ", expected %s\n", expect ? expect : "valid construct");
+    show_line_context(P, t->pos, col);
+    funlockfile(out);
+    longjmp(P->fail, 1);
 }
 
 /* ---------- values, references, and AST ---------- */
@@ -359,586 +827,1015 @@ typedef struct {
 /* Value kinds (extended with VAL_REF and VAL_ARRAY) */
 typedef enum { VAL_INT, VAL_FLOAT, VAL_BOOL, VAL_STRING, VAL_CHAR, VAL_ARRAY, VAL_REF } ValKind;
 
-typedef struct ValueItem ValueItem;
+/* A value is 24 bytes: the kind and one payload. A string shorter than
+   VAL_INLINE bytes is stored in the value itself (`small`), over arr_len,
+   the payload and arr; read strings through value_str. Longer strings and
+   expression texts point into the arena. arr holds an array's arr_len
+   elements, contiguous in the arena, or an unresolved expr field's operand
+   refs next to its text (sval). kind is 16 bits so that the value's first
+   word never has VAL_IMAGE set, whatever the byte order (see value_kind). */
+#define VAL_INLINE 20
+
 typedef struct Value {
-    ValKind kind;
-    long  ival;
-    double fval;
-    int   bval;
-    char *sval;
-    int   cval;
+    uint16_t kind;   /* ValKind */
+    uint16_t small;  /* VAL_STRING stored inline */
+    uint32_t arr_len;
+    union {
+        long  ival;
+        double fval;
+        int   bval;
+        int   cval;
+        char *sval;
+        Ref  *ref;
+    };
+    struct Value *arr;
+} Value;
 
-    /* arrays */
-    ValueItem *arr;
-    size_t arr_len;
+_Static_assert(sizeof(void *) != 8 || sizeof(Value) == 24, "Value layout");
 
-    /* ref */
-    Ref *ref;
-} Value;
-typedef struct ValueItem { Value v; struct ValueItem *next; } ValueItem;
+static char *value_str(const Value *v) {
+    return v->small ? (char *)v + offsetof(Value, arr_len) : v->sval;
+}
+
+/* sub-values: an array's elements, or an unresolved expr's operand refs */
+static size_t value_nsub(const Value *v) {
+    return v->kind == VAL_ARRAY || (v->kind == VAL_STRING && !v->small) ? v->arr_len : 0;
+}
 
 
 static Value make_int(long x) { Value v; memset(&v,0,sizeof(v)); v.kind = VAL_INT; v.ival = x; return v; }
 static Value make_float(double x) { Value v; memset(&v,0,sizeof(v)); v.kind = VAL_FLOAT; v.fval = x; return v; }
 static Value make_bool(int b) { Value v; memset(&v,0,sizeof(v)); v.kind = VAL_BOOL; v.bval = b?1:0; return v; }
-static Value make_string_owned(char *s) { Value v; memset(&v,0,sizeof(v)); v.kind = VAL_STRING; v.sval = s; return v; }
+static Value make_string(char *s) { Value v; memset(&v,0,sizeof(v)); v.kind = VAL_STRING; v.sval = s; return v; }
 static Value make_char(int c) { Value v; memset(&v,0,sizeof(v)); v.kind = VAL_CHAR; v.cval = c; return v; }
 static Value make_array(void) { Value v; memset(&v,0,sizeof(v)); v.kind = VAL_ARRAY; v.arr = NULL; v.arr_len = 0; return v; }
 static Value make_ref(Ref *r) { Value v; memset(&v,0,sizeof(v)); v.kind = VAL_REF; v.ref = r; return v; }
 
-/* helpers for ref segments */
-static RefSeg *refseg_create_name(const char *name) {
-    RefSeg *s = malloc(sizeof(*s));
-    s->name = name ? str_dup_local(name) : NULL;
+/* string value of s[0..n): inline when short, else copied to the arena */
+static Value make_string_copy(Arena *a, const char *s, size_t n) {
+    if (n >= VAL_INLINE) return make_string(arena_strndup(a, s, n));
+    Value v; memset(&v,0,sizeof(v));
+    v.kind = VAL_STRING;
+    v.small = 1;
+    char *d = value_str(&v);
+    memcpy(d, s, n);
+    d[n] = '\0';
+    return v;
+}
+
+/* helpers for ref segments (arena-owned; name/idx are atoms of the tree) */
+static RefSeg *refseg_create_name(Arena *a, char *name) {
+    RefSeg *s = arena_alloc(a, sizeof(*s));
+    s->name = name;
     s->is_index = 0;
     s->index = NULL;
     s->next = NULL;
     return s;
 }
-static RefSeg *refseg_create_index(const char *idx) {
-    RefSeg *s = malloc(sizeof(*s));
+static RefSeg *refseg_create_index(Arena *a, char *idx) {
+    RefSeg *s = arena_alloc(a, sizeof(*s));
     s->name = NULL;
     s->is_index = 1;
-    s->index = idx ? str_dup_local(idx) : NULL;
+    s->index = idx;
     s->next = NULL;
     return s;
 }
-static void refseg_free(RefSeg *s) {
-    while (s) {
-        RefSeg *n = s->next;
-        if (s->name) free(s->name);
-        if (s->index) free(s->index);
-        free(s);
-        s = n;
-    }
-}
 
-/* ref creation / free */
-static Ref *ref_create(RefScope scope) {
-    Ref *r = malloc(sizeof(*r));
+/* ref creation */
+static Ref *ref_create(Arena *a, RefScope scope) {
+    Ref *r = arena_calloc(a, sizeof(*r));
     r->scope = scope;
-    r->parent_levels = 0;
-    r->head = NULL;
     return r;
 }
-static void ref_free(Ref *r) {
-    if (!r) return;
-    if (r->head) refseg_free(r->head);
-    free(r);
-}
-
-/* free Value (deep) */
-static void value_free(Value *v) {
-    if (!v) return;
-    if (v->kind == VAL_STRING && v->sval) { free(v->sval); v->sval = NULL; }
-    if (v->kind == VAL_ARRAY) {
-        ValueItem *it = v->arr;
-        while (it) {
-            ValueItem *n = it->next;
-            value_free(&it->v);
-            free(it);
-            it = n;
-        }
-        v->arr = NULL;
-        v->arr_len = 0;
-    }
-    if (v->kind == VAL_REF) {
-        if (v->ref) { ref_free(v->ref); v->ref = NULL; }
-    }
-}
 
-/* append to array value (takes ownership of item) */
-static void array_append(Value *arrv, Value item) {
-    if (!arrv || arrv->kind != VAL_ARRAY) return;
-    ValueItem *node = malloc(sizeof(*node));
-    node->v = item;
-    node->next = NULL;
-    if (!arrv->arr) arrv->arr = node;
-    else {
-        ValueItem *it = arrv->arr;
-        while (it->next) it = it->next;
-        it->next = node;
-    }
-    arrv->arr_len++;
+/* exact-size arena copy of n values (NULL for an empty array) */
+static Value *values_copy(Arena *a, const Value *src, size_t n) {
+    if (n == 0) return NULL;
+    Value *dst = arena_alloc(a, n * sizeof(Value));
+    memcpy(dst, src, n * sizeof(Value));
+    return dst;
 }
 
 /* ---------- printing values (including refs and arrays) ---------- */
 
-static void print_ref(const Ref *r) {
-    if (!r) { printf("<ref:null>"); return; }
-    if (r->scope == REF_GLOBAL) printf("$");
-    else if (r->scope == REF_LOCAL) printf("$."); 
+static void print_ref(const Ref *r, FILE *out) {
+    if (!r) { fprintf(out, "<ref:null>"); return; }
+    if (r->scope == REF_GLOBAL) fprintf(out, "$");
+    else if (r->scope == REF_LOCAL) fprintf(out, "$."); 
     else if (r->scope == REF_PARENT) {
-        for (int i = 0; i < r->parent_levels; ++i) printf("^");
+        for (int i = 0; i < r->parent_levels; ++i) fprintf(out, "^");
     }
     RefSeg *s = r->head;
     int first = 1;
     while (s) {
         if (!first && (s->is_index == 0)) {
-            printf(".");
+            fprintf(out, ".");
         }
         if (s->is_index) {
-            printf("[\"%s\"]", s->index ? s->index : "");
+            fprintf(out, "[\"%s\"]", s->index ? s->index : "");
         } else {
-            printf("%s", s->name ? s->name : "");
+            fprintf(out, "%s", s->name ? s->name : "");
         }
         first = 0;
         s = s->next;
     }
 }
 
-static void print_value(const Value *v) {
+static void print_value(const Value *v, FILE *out) {
     if (!v) return;
     switch (v->kind) {
-        case VAL_INT: printf("%ld", v->ival); break;
-        case VAL_FLOAT: printf("%g", v->fval); break;
-        case VAL_BOOL: printf(v->bval ? "true" : "false"); break;
-        case VAL_STRING: printf("\"%s\"", v->sval ? v->sval : ""); break;
+        case VAL_INT: fprintf(out, "%ld", v->ival); break;
+        case VAL_FLOAT: fprintf(out, "%g", v->fval); break;
+        case VAL_BOOL: fputs(v->bval ? "true" : "false", out); break;
+        case VAL_STRING: fprintf(out, "\"%s\"", value_str(v) ? value_str(v) : ""); break;
         case VAL_CHAR:
-            if (v->cval == '\n') printf("'\\n'"); else if (v->cval == '\t') printf("'\\t'");
-            else if (v->cval == '\\') printf("'\\\\'"); else if (v->cval == '\'') printf("'\\''");
-            else printf("'%c'", (char)v->cval);
+            if (v->cval == '\n') fprintf(out, "'\\n'"); else if (v->cval == '\t') fprintf(out, "'\\t'");
+            else if (v->cval == '\\') fprintf(out, "'\\\\'"); else if (v->cval == '\'') fprintf(out, "'\\''");
+            else fprintf(out, "'%c'", (char)v->cval);
             break;
         case VAL_ARRAY: {
-            printf("[");
-            ValueItem *it = v->arr;
-            int first = 1;
-            while (it) {
-                if (!first) printf(", ");
-                print_value(&it->v);
-                first = 0;
-                it = it->next;
+            fprintf(out, "[");
+            for (size_t i = 0; i < v->arr_len; ++i) {
+                if (i) fprintf(out, ", ");
+                print_value(&v->arr[i], out);
             }
-            printf("]");
+            fprintf(out, "]");
             break;
         }
         case VAL_REF:
-            print_ref(v->ref);
+            print_ref(v->ref, out);
             break;
     }
 }
 
 /* ---------- AST: fields and blocks ---------- */
 
-typedef struct Field { char *type; char *name; Value value; struct Field *next; } Field;
-typedef struct Block { char *name; char *label; Field *fields; struct Block *children; struct Block *next; struct Block *parent; } Block;
+/* declared field type; TYPE_INFERRED when the field has no type keyword */
+typedef enum { TYPE_INFERRED, TYPE_INT, TYPE_FLOAT, TYPE_BOOL, TYPE_STRING, TYPE_REF, TYPE_EXPR } FieldType;
+static const char *const TYPE_NAMES[] = { "inferred", "int", "float", "bool", "string", "ref", "expr" };
+
+typedef struct Field { FieldType type; unsigned char rstate; char *name; Value value; size_t src_hash; Value *src; struct Field *next; } Field; /* rstate: see resolve_field; src_hash: see value_src_hash; src: see resolver_push */
+typedef struct Block { unsigned char image_tag; unsigned char lazy; size_t open; char *name; char *label; Field *fields; struct Block *children; struct Block *next; struct Block *parent; struct Tree *tree; struct BlockIndex *index; } Block;
+
+/* Compiled programs of expr fields, keyed by the atom of their text, so
+   fields with the same expression share one program. Programs live in the
+   arena; only the slot table is malloc'd. */
+typedef struct ExprSlot { const char *text; ExprProg *prog; } ExprSlot;
+typedef struct ExprCache { ExprSlot *slots; size_t mask; size_t count; } ExprCache;
+
+/* Resolved references, as (referring field, field it names) pairs, so a
+   reload can find what depends on a field it changes. malloc'd, as it grows. */
+typedef struct FieldDep { struct Field *from, *to; } FieldDep;
+typedef struct DepList { FieldDep *items; size_t count, cap; } DepList;
+
+struct LazySource;
+static void lazy_source_free(struct LazySource *z);
+struct ResolveScratch;
+static void resolve_scratch_free(struct ResolveScratch *rs);
+
+/* A parsed tree: the arena that owns every node and string, the atom table
+   for its names and labels, and the top-level block list. Each block points
+   back at its tree. lazy: the source kept by a lazy tree until every block
+   is parsed; see block_expand. on_demand: lookups resolve the fields they
+   reach (acl_parse_file_lazy, acl_resolve_on_demand), reusing the resolver
+   stacks kept in scratch. */
+typedef struct Tree { Arena arena; Interner atoms; ExprCache exprs; DepList deps; Block *blocks; struct BlockIndex *top;
+                      struct LazySource *lazy; int on_demand; struct ResolveScratch *scratch; } Tree;
+
+static void tree_destroy(Tree *tree) {
+    lazy_source_free(tree->lazy);
+    arena_destroy(&tree->arena);
+    interner_free(&tree->atoms);
+    free(tree->exprs.slots);
+    free(tree->deps.items);
+    resolve_scratch_free(tree->scratch);
+    free(tree);
+}
 
-/* ---------- reference parsing helpers ---------- */
+/* lazy: fields and children not parsed yet; the body starts after the '{'
+   at source offset `open` (see block_expand).
+   image_tag is always 0 in a parsed block. An AclBlock handle may instead
+   be a mapped .aclb image, whose first byte is IMG_MAGIC[0]; the public
+   entry points check is_image() before treating the handle as a Block. */
 
-/* parse path tail: .ident or ["index"] repeated; returns head RefSeg list (owned) */
-static RefSeg *parse_ref_path_segments(void) {
-    RefSeg *head = NULL;
-    RefSeg **tail = &head;
-    while (1) {
-        Token t = cur_token();
-        if (t.kind == TOK_DOT) {
-            consume_token(); /* consume '.' */
-            Token id = cur_token();
-            if (id.kind != TOK_IDENT) parse_error_token(&id, "identifier after '.' in reference");
-            Token idtok = take_token(); /* owned copy of ident */
-            RefSeg *s = refseg_create_name(idtok.text);
-            /* idtok.text transferred into s->name, do not free idtok.text below */
-            *tail = s; tail = &s->next;
-            token_free(&idtok);
-            continue;
-        } else if (t.kind == TOK_LBRACK) {
-            consume_token(); /* consume '[' */
-            Token idx = cur_token();
-            if (idx.kind != TOK_STRING) parse_error_token(&idx, "string index in reference [\"name\"]");
-            Token idxtok = take_token(); /* owns string */
-            Token rb = cur_token();
-            if (rb.kind != TOK_RBRACK) parse_error_token(&rb, "']' after string index in reference");
-            consume_token(); /* consume ']' */
-            RefSeg *s = refseg_create_index(idxtok.text);
-            *tail = s; tail = &s->next;
-            continue;
+/* ---------- per-block lookup index ---------- */
+
+/* After parsing, blocks with at least INDEX_MIN fields or children get
+   open-addressed hash tables over field names, child names, (name, label)
+   pairs and child labels; the top-level list gets the same in Tree.top.
+   Smaller lists keep the linear scan, which wins at that size. Only the
+   first entry for a key is stored, so lookups still favor the first match. */
+
+#define INDEX_MIN 8
+
+typedef enum { IDX_FIELD, IDX_NAME, IDX_PAIR, IDX_LABEL } IndexKind;
+
+typedef struct IndexSlot { size_t hash; void *item; } IndexSlot;
+typedef struct IndexTable { IndexSlot *slots; size_t mask; } IndexTable;   /* slots == NULL: not indexed */
+typedef struct BlockIndex { IndexTable fields, names, pairs, labels; } BlockIndex;
+
+/* keys are atoms: hashes come from the atom header, equality is identity */
+static size_t index_hash(IndexKind k, const char *name, const char *label) {
+    if (k == IDX_LABEL) return atom_hash(label);
+    if (k == IDX_PAIR) return atom_hash(name) * HASH_PRIME ^ atom_hash(label);
+    return atom_hash(name);
+}
+
+static int index_match(IndexKind k, const void *item, const char *name, const char *label) {
+    if (k == IDX_FIELD) return ((const Field*)item)->name == name;
+    const Block *b = item;
+    if (k == IDX_NAME) return b->name == name;
+    if (k == IDX_LABEL) return b->label == label;
+    return b->name == name && b->label == label;
+}
+
+static void *index_get(const IndexTable *t, IndexKind k, const char *name, const char *label) {
+    size_t h = index_hash(k, name, label);
+    for (size_t i = h & t->mask; t->slots[i].item; i = (i + 1) & t->mask) {
+        if (t->slots[i].hash == h && index_match(k, t->slots[i].item, name, label)) return t->slots[i].item;
+    }
+    return NULL;
+}
+
+/* insert unless the key is already present (first one wins) */
+static void index_put(IndexTable *t, IndexKind k, void *item, const char *name, const char *label) {
+    size_t h = index_hash(k, name, label);
+    size_t i = h & t->mask;
+    for (; t->slots[i].item; i = (i + 1) & t->mask) {
+        if (t->slots[i].hash == h && index_match(k, t->slots[i].item, name, label)) return;
+    }
+    t->slots[i].hash = h;
+    t->slots[i].item = item;
+}
+
+static void index_table_init(Arena *a, IndexTable *t, size_t n) {
+    size_t cap = 16;
+    while (cap < n * 2) cap <<= 1;   /* load factor <= 0.5 */
+    t->slots = arena_calloc(a, cap * sizeof(IndexSlot));
+    t->mask = cap - 1;
+}
+
+static BlockIndex *index_build(Arena *a, Block *children, Field *fields) {
+    size_t nchild = 0, nfield = 0;
+    for (Block *c = children; c; c = c->next) nchild++;
+    for (Field *f = fields; f; f = f->next) nfield++;
+    if (nchild < INDEX_MIN && nfield < INDEX_MIN) return NULL;
+
+    BlockIndex *ix = arena_calloc(a, sizeof(BlockIndex));
+    if (nfield >= INDEX_MIN) {
+        index_table_init(a, &ix->fields, nfield);
+        for (Field *f = fields; f; f = f->next) index_put(&ix->fields, IDX_FIELD, f, f->name, NULL);
+    }
+    if (nchild >= INDEX_MIN) {
+        index_table_init(a, &ix->names, nchild);
+        index_table_init(a, &ix->pairs, nchild);
+        index_table_init(a, &ix->labels, nchild);
+        for (Block *c = children; c; c = c->next) {
+            index_put(&ix->names, IDX_NAME, c, c->name, NULL);
+            if (!c->label) continue;
+            index_put(&ix->pairs, IDX_PAIR, c, c->name, c->label);
+            index_put(&ix->labels, IDX_LABEL, c, NULL, c->label);
         }
-        break;
     }
-    return head;
+    return ix;
+}
+
+static void index_blocks(Arena *a, Block *list) {
+    for (Block *b = list; b; b = b->next) {
+        b->index = index_build(a, b->children, b->fields);
+        index_blocks(a, b->children);
+    }
+}
+
+static void tree_build_index(Tree *tree) {
+    tree->top = index_build(&tree->arena, tree->blocks, NULL);
+    index_blocks(&tree->arena, tree->blocks);
+}
+
+/* The index for a block list: a block's children, or the tree's top-level
+   list when `list` is its head. NULL means scan. */
+static const BlockIndex *list_index(const Block *list) {
+    if (!list) return NULL;
+    if (list->parent) return list->parent->index;
+    return list == list->tree->blocks ? list->tree->top : NULL;
+}
+
+/* The list_find_* helpers and find_* wrappers take atoms of the list's
+   tree, so the scans compare pointers. */
+
+/* first block in `list` named `name` */
+static Block *list_find_name(const Block *list, const char *name) {
+    const BlockIndex *ix = list_index(list);
+    if (ix && ix->names.slots) return index_get(&ix->names, IDX_NAME, name, NULL);
+    for (const Block *c = list; c; c = c->next) {
+        if (c->name == name) return (Block*)c;
+    }
+    return NULL;
+}
+
+/* first block in `list` with both `name` and `label` */
+static Block *list_find_pair(const Block *list, const char *name, const char *label) {
+    const BlockIndex *ix = list_index(list);
+    if (ix && ix->pairs.slots) return index_get(&ix->pairs, IDX_PAIR, name, label);
+    for (const Block *c = list; c; c = c->next) {
+        if (c->name == name && c->label == label) return (Block*)c;
+    }
+    return NULL;
+}
+
+/* first block in `list` labelled `label` */
+static Block *list_find_label(const Block *list, const char *label) {
+    const BlockIndex *ix = list_index(list);
+    if (ix && ix->labels.slots) return index_get(&ix->labels, IDX_LABEL, NULL, label);
+    for (const Block *c = list; c; c = c->next) {
+        if (c->label == label) return (Block*)c;
+    }
+    return NULL;
+}
+
+/* ---------- parse events ---------- */
+
+/* The parser does not build anything itself: it reports what it reads to a
+   sink, one event per block, field and array element. parse_all's sink
+   builds the tree; acl_sax_parse_* forward the events to the caller.
+
+   A value is reported as parsed, before anything is allocated for it: its
+   first token, and for a reference its scope, ^ count and segment tokens
+   (names, and string indexes as written). An array field or element is
+   reported with kind VAL_ARRAY at its '{'; its elements follow, then
+   array_end.
+
+   Callbacks return an AclSaxAction. SKIP on a block or an array drops every
+   event up to its end (its own block_exit or array_end included); STOP
+   ends the parse. */
+
+typedef struct ParsedValue {
+    ValKind kind;
+    Token tok;            /* the literal, or a ref's first token, or '{' */
+    size_t end;           /* refs: source offset just past the last segment */
+    RefScope scope;       /* refs only */
+    int parent_levels;
+    const Token *segs;    /* path segments (identifiers or string indexes) */
+    size_t nsegs;
+} ParsedValue;
+
+typedef struct ParseSink {
+    int (*block_enter)(Parser *P, const Token *name, const Token *label, size_t open);
+    int (*block_exit)(Parser *P);
+    int (*field)(Parser *P, FieldType type, const Token *name, const ParsedValue *v);
+    int (*element)(Parser *P, size_t index, const ParsedValue *v);
+    int (*array_end)(Parser *P);
+} ParseSink;
+
+/* act on a callback's answer; inside a skipped subtree nothing is called
+   and every block or array answers SKIP, so it mutes itself in turn */
+static int sink_result(Parser *P, int act) {
+    if (act == ACL_SAX_STOP) longjmp(P->fail, 2);
+    return act;
 }
 
-/* parse a reference value starting at current token (handles $, $., and ^) */
-static Value parse_reference_value(void) {
-    Token t = cur_token();
+#define EMIT(P, call) ((P)->mute ? ACL_SAX_SKIP : sink_result((P), (P)->sink->call))
 
-    size_t start_pos  = t.pos;
-    int    start_line = t.line;
-    int    start_col  = t.col;
+/* ---------- value parsing ---------- */
 
+static void segs_push(Parser *P, size_t n, const Token *t) {
+    if (n == P->segs_cap) {
+        size_t cap = P->segs_cap ? P->segs_cap * 2 : 16;
+        Token *ns = realloc(P->segs, cap * sizeof(Token));
+        if (!ns) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+        P->segs = ns;
+        P->segs_cap = cap;
+    }
+    P->segs[n] = *t;
+}
+
+/* reference at the current token ($, $. or ^...): the first identifier,
+   then .ident or ["index"] repeated. Segments collect in P->segs. */
+static void parse_ref(Parser *P, ParsedValue *v) {
+    Token t = cur_token(P);
+    v->kind = VAL_REF;
+    v->tok = t;
+    const char *first_err;
     if (t.kind == TOK_DOLLAR) {
-        consume_token(); /* consume $ */
-        Token next = cur_token();
-        Ref *r;
-        if (next.kind == TOK_DOT) {
+        consume_token(P); /* consume $ */
+        if (cur_token(P).kind == TOK_DOT) {
             /* local: $.field.path */
-            consume_token(); /* consume '.' */
-            r = ref_create(REF_LOCAL);
-            r->pos = start_pos;
-            r->line = start_line;
-            r->col = start_col;
-            Token id = cur_token();
-            if (id.kind != TOK_IDENT) parse_error_token(&id, "identifier after '$.'");
-            Token idtok = take_token();
-            RefSeg *head = refseg_create_name(idtok.text);
-            token_free(&idtok);
-            RefSeg *rest = parse_ref_path_segments();
-            if (rest) head->next = rest;
-            r->head = head;
-            return make_ref(r);
+            consume_token(P); /* consume '.' */
+            v->scope = REF_LOCAL;
+            first_err = "identifier after '$.'";
         } else {
             /* global: $Name.path or $Name["label"].field... */
-            r = ref_create(REF_GLOBAL);
-            r->pos = start_pos;
-            r->line = start_line;
-            r->col = start_col;
-            Token id = cur_token();
-            if (id.kind != TOK_IDENT) parse_error_token(&id, "identifier after '$'");
-            Token idtok = take_token();
-            RefSeg *head = refseg_create_name(idtok.text);
-            token_free(&idtok);
-            RefSeg *rest = parse_ref_path_segments();
-            if (rest) head->next = rest;
-            r->head = head;
-            return make_ref(r);
+            v->scope = REF_GLOBAL;
+            first_err = "identifier after '$'";
         }
     } else if (t.kind == TOK_CARET) {
         int levels = 0;
-        while (cur_token().kind == TOK_CARET) { consume_token(); levels++; }
-        Ref *r = ref_create(REF_PARENT);
-        r->pos = start_pos;
-        r->line = start_line;
-        r->col = start_col;
-        r->parent_levels = levels;
-        Token id = cur_token();
-        if (id.kind != TOK_IDENT) parse_error_token(&id, "identifier after '^' in parent reference");
-        Token idtok = take_token();
-        RefSeg *head = refseg_create_name(idtok.text);
-        token_free(&idtok);
-        RefSeg *rest = parse_ref_path_segments();
-        if (rest) head->next = rest;
-        r->head = head;
-        return make_ref(r);
-    }
-    parse_error_token(&t, "reference starting with '$' or '^'");
-    return make_int(0);
-}
-
-/* ---------- literal parsing (with arrays and refs) ---------- */
-
-static Value parse_literal_value_final(void); /* forward */
-
-static Value parse_array_literal_final(void) {
-    consume_token(); /* consume '{' */
-    Value arr = make_array();
-    Token next = cur_token();
-    if (next.kind == TOK_RBRACE) { consume_token(); return arr; }
-    while (1) {
-        Value item = parse_literal_value_final();
-        array_append(&arr, item);
-        Token sep = cur_token();
-        if (sep.kind == TOK_COMMA) { consume_token(); continue; }
-        if (sep.kind == TOK_RBRACE) { consume_token(); break; }
-        parse_error_token(&sep, "',' or '}' in array literal");
-    }
-    return arr;
-}
-
-static Value parse_literal_value_final(void) {
-    Token t = cur_token();
-    if (t.kind == TOK_INT_LITERAL) {
-        Token tk = take_token();
-        Value v = make_int(tk.ival);
-        token_free(&tk);
-        return v;
-    }
-    if (t.kind == TOK_FLOAT_LITERAL) {
-        Token tk = take_token();
-        Value v = make_float(tk.fval);
-        token_free(&tk);
-        return v;
-    }
-    if (t.kind == TOK_BOOL_LITERAL) {
-        Token tk = take_token();
-        Value v = make_bool(tk.bval);
-        token_free(&tk);
-        return v;
-    }
-    if (t.kind == TOK_STRING) {
-        Token tk = take_token(); /* owns text */
-        Value v = make_string_owned(tk.text);
-        return v;
-    }
-    if (t.kind == TOK_CHAR) {
-        Token tk = take_token();
-        Value v = make_char(tk.cval);
-        token_free(&tk);
-        return v;
-    }
-    if (t.kind == TOK_LBRACE) return parse_array_literal_final();
-    if (t.kind == TOK_DOLLAR || t.kind == TOK_CARET) return parse_reference_value();
-    /* support local $. handled in parse_reference_value */
-
-    parse_error_token(&t, "literal (int, bool, string, char, array, or reference)");
-    return make_int(0);
+        while (cur_token(P).kind == TOK_CARET) { consume_token(P); levels++; }
+        v->scope = REF_PARENT;
+        v->parent_levels = levels;
+        first_err = "identifier after '^' in parent reference";
+    } else {
+        parse_error_token(P, &t, "reference starting with '$' or '^'");
+    }
+
+    Token id = cur_token(P);
+    if (id.kind != TOK_IDENT) parse_error_token(P, &id, first_err);
+    consume_token(P);
+    size_t n = 0;
+    segs_push(P, n++, &id);
+    v->end = id.pos + id.len;
+    for (;;) {
+        Token t = cur_token(P);
+        if (t.kind == TOK_DOT) {
+            consume_token(P); /* consume '.' */
+            Token id = cur_token(P);
+            if (id.kind != TOK_IDENT) parse_error_token(P, &id, "identifier after '.' in reference");
+            consume_token(P);
+            segs_push(P, n++, &id);
+            v->end = id.pos + id.len;
+            continue;
+        } else if (t.kind == TOK_LBRACK) {
+            consume_token(P); /* consume '[' */
+            Token idx = cur_token(P);
+            if (idx.kind != TOK_STRING) parse_error_token(P, &idx, "string index in reference [\"name\"]");
+            consume_token(P);
+            Token rb = cur_token(P);
+            if (rb.kind != TOK_RBRACK) parse_error_token(P, &rb, "']' after string index in reference");
+            consume_token(P); /* consume ']' */
+            segs_push(P, n++, &idx);
+            v->end = rb.pos + 1;
+            continue;
+        }
+        break;
+    }
+    v->segs = P->segs;
+    v->nsegs = n;
+}
+
+/* literal or reference at the current token; for an array only its '{' is
+   consumed, and the caller reports it before parse_array reads the rest */
+static void parse_value(Parser *P, ParsedValue *v) {
+    memset(v, 0, sizeof(*v));
+    Token t = cur_token(P);
+    switch (t.kind) {
+        case TOK_INT_LITERAL: v->kind = VAL_INT; break;
+        case TOK_FLOAT_LITERAL: v->kind = VAL_FLOAT; break;
+        case TOK_BOOL_LITERAL: v->kind = VAL_BOOL; break;
+        case TOK_STRING: v->kind = VAL_STRING; break;
+        case TOK_CHAR: v->kind = VAL_CHAR; break;
+        case TOK_LBRACE: v->kind = VAL_ARRAY; break;
+        case TOK_DOLLAR: case TOK_CARET: parse_ref(P, v); return;
+        default: parse_error_token(P, &t, "literal (int, bool, string, char, array, or reference)");
+    }
+    v->tok = t;
+    consume_token(P);
+}
+
+/* elements and closing '}' of an array whose '{' was reported with `act` */
+static void parse_array(Parser *P, int act) {
+    int skip = act == ACL_SAX_SKIP;
+    if (skip) P->mute++;
+    if (cur_token(P).kind == TOK_RBRACE) consume_token(P);
+    else {
+        for (size_t i = 0; ; ++i) {
+            ParsedValue v;
+            parse_value(P, &v);
+            int a = EMIT(P, element(P, i, &v));
+            if (v.kind == VAL_ARRAY) parse_array(P, a);
+            Token sep = cur_token(P);
+            if (sep.kind == TOK_COMMA) { consume_token(P); continue; }
+            if (sep.kind == TOK_RBRACE) { consume_token(P); break; }
+            parse_error_token(P, &sep, "',' or '}' in array literal");
+        }
+    }
+    if (skip) P->mute--;
+    else EMIT(P, array_end(P));
+}
+
+/* ---------- expr fields ---------- */
+
+/* An expr field holds its expression as a string literal:
+     expr port = "$.base + 2";
+   Until it is resolved its value is that text (an atom), with the
+   expression's '$' operands as refs in value.arr, in the program's operand
+   order, so the resolver orders and cycle-checks them like any other
+   reference. resolver_finish then runs the program over the resolved
+   operands and stores the int, float or string result. */
+
+static void *arena_alloc_cb(void *ctx, size_t n) { return arena_alloc(ctx, n); }
+
+/* slot of an expression atom; an empty one (text NULL) if it isn't cached */
+static ExprSlot *expr_cache_slot(ExprCache *c, const char *text) {
+    if (!c->slots || (c->count + 1) * 2 > c->mask + 1) {
+        size_t cap = c->slots ? (c->mask + 1) * 2 : 16;
+        ExprSlot *slots = calloc(cap, sizeof(ExprSlot));
+        if (!slots) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+        for (size_t i = 0; c->slots && i <= c->mask; ++i) {
+            if (!c->slots[i].text) continue;
+            size_t j = atom_hash(c->slots[i].text) & (cap - 1);
+            while (slots[j].text) j = (j + 1) & (cap - 1);
+            slots[j] = c->slots[i];
+        }
+        free(c->slots);
+        c->slots = slots;
+        c->mask = cap - 1;
+    }
+    size_t i = atom_hash(text) & c->mask;
+    while (c->slots[i].text && c->slots[i].text != text) i = (i + 1) & c->mask;
+    return &c->slots[i];
+}
+
+/* compiled program for an expression atom; NULL if it doesn't compile */
+static ExprProg *expr_cache_get(Tree *tree, const char *text) {
+    ExprSlot *slot = expr_cache_slot(&tree->exprs, text);
+    if (slot->text) return slot->prog;
+    ExprProg *prog = expr_compile(text, arena_alloc_cb, &tree->arena);
+    if (!prog) return NULL;
+    slot->text = text;
+    slot->prog = prog;
+    tree->exprs.count++;
+    return prog;
+}
+
+/* ref for an operand: "$A.b.c" is global, "$.x" local; 0 if malformed */
+static int expr_operand_ref(Parser *P, const char *s, size_t n, const Token *at, Value *out) {
+    RefScope scope = REF_GLOBAL;
+    s++; n--; /* '$' */
+    if (n && *s == '.') { scope = REF_LOCAL; s++; n--; }
+    Ref *r = ref_create(P->arena, scope);
+    r->pos = at->pos;
+    lex_line_col(P, at->pos, &r->line, &r->col);
+    RefSeg **tail = &r->head;
+    for (;;) {
+        const char *dot = memchr(s, '.', n);
+        size_t len = dot ? (size_t)(dot - s) : n;
+        if (len == 0) return 0;
+        RefSeg *seg = refseg_create_name(P->arena, intern(P->atoms, P->arena, s, len));
+        *tail = seg;
+        tail = &seg->next;
+        if (!dot) break;
+        s += len + 1;
+        n -= len + 1;
+    }
+    *out = make_ref(r);
+    return 1;
+}
+
+/* value of an expr field whose literal `text` started at token `at` */
+static Value expr_field_value(Parser *P, const Token *at, Value text) {
+    if (text.kind != VAL_STRING) parse_error_token(P, at, "expression text (string)");
+    const char *s = value_str(&text);
+    char *atom = intern(P->atoms, P->arena, s, strlen(s));
+    ExprProg *prog = expr_cache_get(P->tree, atom);
+    if (!prog) parse_error_token(P, at, "valid expression");
+
+    Value v = make_string(atom);
+    v.arr_len = expr_load_count(prog);
+    v.arr = v.arr_len ? arena_alloc(P->arena, v.arr_len * sizeof(Value)) : NULL;
+    for (size_t i = 0; i < v.arr_len; ++i) {
+        size_t len;
+        const char *path = expr_load_path(prog, i, &len);
+        if (!expr_operand_ref(P, path, len, at, &v.arr[i])) parse_error_token(P, at, "'$' operand path in expression");
+    }
+    return v;
 }
 
 /* ---------- field parsing ---------- */
 
-static Field *parse_field_with_type(const char *type_name) {
-    Token t = cur_token();
-    if (t.kind != TOK_IDENT) parse_error_token(&t, "field name (identifier)");
-    Token name_tok = take_token();
+/* Hash of a field's source: its type and its value as parsed, before any
+   reference is resolved. Reload compares it first to tell edited fields
+   from unchanged ones; equal hashes are confirmed against the source. */
+static size_t hash_mix(size_t h, size_t x) { return (h ^ x) * HASH_PRIME; }
+
+static size_t value_src_hash(size_t h, const Value *v) {
+    h = hash_mix(h, v->kind);
+    switch (v->kind) {
+        case VAL_INT: h = hash_mix(h, (size_t)v->ival); break;
+        case VAL_FLOAT: { uint64_t bits; memcpy(&bits, &v->fval, sizeof(bits)); h = hash_mix(h, (size_t)bits); break; }
+        case VAL_BOOL: h = hash_mix(h, (size_t)v->bval); break;
+        case VAL_CHAR: h = hash_mix(h, (size_t)v->cval); break;
+        case VAL_STRING: { const char *s = value_str(v); h = hash_mix(h, s ? hash_mem(s, strlen(s)) : 0); break; }
+        case VAL_ARRAY: break;
+        case VAL_REF:
+            h = hash_mix(h, v->ref->scope);
+            h = hash_mix(h, (size_t)v->ref->parent_levels);
+            for (const RefSeg *s = v->ref->head; s; s = s->next) {
+                h = hash_mix(h, (size_t)s->is_index);
+                h = hash_mix(h, atom_hash(s->is_index ? s->index : s->name));
+            }
+            break;
+    }
+    /* an expr field's operand refs (in value.arr) follow from its text */
+    if (v->kind == VAL_ARRAY) {
+        h = hash_mix(h, v->arr_len);
+        for (size_t i = 0; i < v->arr_len; ++i) h = value_src_hash(h, &v->arr[i]);
+    }
+    return h;
+}
 
-    Token eq = cur_token();
-    if (eq.kind != TOK_EQ) parse_error_token(&eq, "'=' after field name");
-    consume_token();
+static void parse_field(Parser *P, FieldType type) {
+    Token name = cur_token(P);
+    if (name.kind != TOK_IDENT) parse_error_token(P, &name, "field name (identifier)");
+    consume_token(P);
 
-    Value v = parse_literal_value_final();
+    Token eq = cur_token(P);
+    if (eq.kind != TOK_EQ) parse_error_token(P, &eq, "'=' after field name");
+    consume_token(P);
 
-    Token semi = cur_token();
-    if (semi.kind != TOK_SEMI) parse_error_token(&semi, "';' after field value");
-    consume_token();
+    ParsedValue v;
+    parse_value(P, &v);
+    int act = EMIT(P, field(P, type, &name, &v));
+    if (v.kind == VAL_ARRAY) parse_array(P, act);
 
-    Field *f = malloc(sizeof(Field)); memset(f,0,sizeof(Field));
-    f->type = type_name ? str_dup_local(type_name) : NULL;
-    f->name = name_tok.text;
-    f->value = v;
-    f->next = NULL;
-    return f;
+    Token semi = cur_token(P);
+    if (semi.kind != TOK_SEMI) parse_error_token(P, &semi, "';' after field value");
+    consume_token(P);
 }
 
 /* typed field that optionally supports array type with [] after type token */
-static Field *parse_field_from_type_token(TokenKind tk_type) {
-    const char *type_name = NULL;
-    if (tk_type == TOK_TYPE_INT) type_name = "int";
-    else if (tk_type == TOK_TYPE_FLOAT) type_name = "float";
-    else if (tk_type == TOK_TYPE_BOOL) type_name = "bool";
-    else if (tk_type == TOK_TYPE_STRING) type_name = "string";
-    else if (tk_type == TOK_TYPE_REF) type_name = "ref";
-    consume_token(); /* consume type token */
+static void parse_field_from_type_token(Parser *P, TokenKind tk_type) {
+    FieldType type = TYPE_INFERRED;
+    if (tk_type == TOK_TYPE_INT) type = TYPE_INT;
+    else if (tk_type == TOK_TYPE_FLOAT) type = TYPE_FLOAT;
+    else if (tk_type == TOK_TYPE_BOOL) type = TYPE_BOOL;
+    else if (tk_type == TOK_TYPE_STRING) type = TYPE_STRING;
+    else if (tk_type == TOK_TYPE_REF) type = TYPE_REF;
+    else if (tk_type == TOK_TYPE_EXPR) type = TYPE_EXPR;
+    consume_token(P); /* consume type token */
 
     /* optional [] after type token */
-    Token nxt = cur_token();
+    Token nxt = cur_token(P);
     if (nxt.kind == TOK_LBRACK) {
-        consume_token();
-        Token r = cur_token();
-        if (r.kind != TOK_RBRACK) parse_error_token(&r, "']' after '[' in type[]");
-        consume_token();
+        consume_token(P);
+        Token r = cur_token(P);
+        if (r.kind != TOK_RBRACK) parse_error_token(P, &r, "']' after '[' in type[]");
+        consume_token(P);
     }
 
-    return parse_field_with_type(type_name);
+    parse_field(P, type);
 }
 
-/* ---------- block parsing with robust lookahead ---------- */
+/* ---------- block parsing ---------- */
 
-static Block *parse_block_recursive(Block *parent) {
-    Token t = cur_token();
-    if (t.kind != TOK_IDENT) parse_error_token(&t, "block name (identifier)");
-    Token name_tok = take_token();
+static void parse_block_body(Parser *P);
+
+static void parse_block(Parser *P) {
+    Token name = cur_token(P);
+    if (name.kind != TOK_IDENT) parse_error_token(P, &name, "block name (identifier)");
+    consume_token(P);
 
     /* optional immediate string label */
-    char *label = NULL;
-    Token after_name = cur_token();
-    if (after_name.kind == TOK_STRING) {
-        Token lab = take_token();
-        label = lab.text;
-        after_name = cur_token();
+    Token label = cur_token(P);
+    int has_label = label.kind == TOK_STRING;
+    if (has_label) consume_token(P);
+
+    Token lb = cur_token(P);
+    if (lb.kind != TOK_LBRACE) parse_error_token(P, &lb, "'{' after block name/label");
+    consume_token(P); /* consume '{' */
+
+    int skip = EMIT(P, block_enter(P, &name, has_label ? &label : NULL, lb.pos)) == ACL_SAX_SKIP;
+    if (skip && P->braces) {
+        /* a lazy tree parses the body later: jump over it */
+        size_t close = brace_close(P->braces, lb.pos);
+        if (close != SIZE_MAX) { lexer_seek(P, close + 1); return; }
     }
+    if (skip) P->mute++;
+    parse_block_body(P);
+    if (skip) P->mute--;
+    else EMIT(P, block_exit(P));
+}
 
-    if (after_name.kind != TOK_LBRACE) parse_error_token(&after_name, "'{' after block name/label");
-    consume_token(); /* consume '{' */
-
-    Block *blk = malloc(sizeof(Block)); memset(blk,0,sizeof(Block));
-    blk->name = name_tok.text;
-    blk->label = label;
-    blk->fields = NULL;
-    blk->children = NULL;
-    blk->next = NULL;
-    blk->parent = parent;
-
-    Field *lastf = NULL;
-    Block *lastchild = NULL;
-
+/* fields and child blocks, through the block's closing '}' */
+static void parse_block_body(Parser *P) {
     for (;;) {
-        Token cur = cur_token();
-        if (cur.kind == TOK_RBRACE) { consume_token(); break; }
-        if (cur.kind == TOK_EOF) parse_error_token(&cur, "unexpected EOF in block");
+        Token cur = cur_token(P);
+        if (cur.kind == TOK_RBRACE) { consume_token(P); break; }
+        if (cur.kind == TOK_EOF) parse_error_token(P, &cur, "unexpected EOF in block");
 
         /* typed field start */
-        if (cur.kind == TOK_TYPE_INT || cur.kind == TOK_TYPE_FLOAT || cur.kind == TOK_TYPE_BOOL || cur.kind == TOK_TYPE_STRING) {
-            Field *f = parse_field_from_type_token(cur.kind);
-            if (!blk->fields) blk->fields = f; else lastf->next = f;
-            lastf = f;
+        if (cur.kind == TOK_TYPE_INT || cur.kind == TOK_TYPE_FLOAT || cur.kind == TOK_TYPE_BOOL || cur.kind == TOK_TYPE_STRING
+            || cur.kind == TOK_TYPE_EXPR) {
+            parse_field_from_type_token(P, cur.kind);
             continue;
         }
 
         /* identifier: could be inferred field or child block (with optional label) */
         if (cur.kind == TOK_IDENT) {
-            Token n1 = peek1();
-            Token n2 = peek2();
+            Token n1 = peek1(P);
+            Token n2 = peek2(P);
 
             int handled = 0;
             if (n1.kind == TOK_EQ) {
-                token_free(&n1); token_free(&n2);
-                Field *f = parse_field_with_type(NULL);
-                if (!blk->fields) blk->fields = f; else lastf->next = f;
-                lastf = f;
+                parse_field(P, TYPE_INFERRED);
                 handled = 1;
             } else if (n1.kind == TOK_LBRACE) {
-                token_free(&n1); token_free(&n2);
-                Block *child = parse_block_recursive(blk);
-                if (!blk->children) blk->children = child; else lastchild->next = child;
-                lastchild = child;
+                parse_block(P);
                 handled = 1;
             } else if (n1.kind == TOK_STRING && n2.kind == TOK_LBRACE) {
-                token_free(&n1); token_free(&n2);
-                Block *child = parse_block_recursive(blk);
-                if (!blk->children) blk->children = child; else lastchild->next = child;
-                lastchild = child;
+                parse_block(P);
                 handled = 1;
-            } else {
-                token_free(&n1); token_free(&n2);
             }
 
             if (handled) continue;
-            parse_error_token(&cur, "expected '=' for field or '{' for child block");
+            parse_error_token(P, &cur, "expected '=' for field or '{' for child block");
         }
 
-        parse_error_token(&cur, "typed field, inferred field, or child block");
+        parse_error_token(P, &cur, "typed field, inferred field, or child block");
     }
-
-    return blk;
 }
 
-/* ---------- top-level parse ---------- */
+/* top-level blocks, up to the end or the first one starting at or after
+   source offset `stop` */
+static void parse_document(Parser *P, size_t stop) {
+    for (;;) {
+        Token t = cur_token(P);
+        if (t.kind == TOK_EOF || t.pos >= stop) break;
+        if (t.kind == TOK_IDENT) { parse_block(P); continue; }
+        parse_error_token(P, &t, "top-level block name (identifier)");
+    }
+}
 
-Block *parse_all(const char *text) {
-    SRC = text;
-    SRC_POS = 0;
-    SRC_LEN = strlen(SRC);
-    /* skip UTF-8 BOM if present */
-    if (SRC_POS+3 <= SRC_LEN && (unsigned char)SRC[0]==0xEF && (unsigned char)SRC[1]==0xBB && (unsigned char)SRC[2]==0xBF) SRC_POS = 3;
-    LINE = 1; COL = 1;
-    HAVE_BUF = 0; HAVE_SAVED = 0;
+/* ---------- tree building ---------- */
+
+/* The sink behind parse_all. Blocks being filled and arrays being collected
+   are kept on two stacks; array elements collect on the scratch value stack
+   (nested arrays stack above their parent's elements) and are copied into
+   the arena in one exact-size block at the array's '}'. */
+
+typedef struct BuildBlock { Block *blk; Field **ftail; Block **ctail; } BuildBlock;
+typedef struct BuildArray { size_t base; Field *field; Token at; } BuildArray; /* field: NULL when nested */
+
+typedef struct TreeBuilder {
+    int lazy;        /* child blocks are left for block_expand */
+    Block *head;
+    Block **tail;
+    BuildBlock *blocks;
+    size_t nblocks, blocks_cap;
+    BuildArray *arrays;
+    size_t narrays, arrays_cap;
+} TreeBuilder;
+
+/* grow a builder stack to hold one more entry */
+static void *stack_reserve(void *items, size_t count, size_t *cap, size_t size) {
+    if (count < *cap) return items;
+    size_t ncap = *cap ? *cap * 2 : 16;
+    void *ni = realloc(items, ncap * size);
+    if (!ni) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+    *cap = ncap;
+    return ni;
+}
 
-    Block *head = NULL, *last = NULL;
-    for (;;) {
-        Token t = cur_token();
-        if (t.kind == TOK_EOF) break;
-        if (t.kind == TOK_IDENT) {
-            Block *b = parse_block_recursive(NULL);
-            if (!head) head = b; else last->next = b;
-            last = b;
-            continue;
+/* push onto the parser's scratch value stack */
+static void scratch_push(Parser *P, Value v) {
+    if (P->scratch_len == P->scratch_cap) {
+        size_t cap = P->scratch_cap ? P->scratch_cap * 2 : 64;
+        Value *nv = realloc(P->scratch, cap * sizeof(Value));
+        if (!nv) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+        P->scratch = nv;
+        P->scratch_cap = cap;
+    }
+    P->scratch[P->scratch_len++] = v;
+}
+
+/* tree value of a scalar or reference; strings and ref segments go to the arena */
+static Value build_value(Parser *P, const ParsedValue *v) {
+    const Token *t = &v->tok;
+    switch (v->kind) {
+        case VAL_INT: return make_int(t->ival);
+        case VAL_FLOAT: return make_float(t->fval);
+        case VAL_BOOL: return make_bool(t->bval);
+        case VAL_CHAR: return make_char(t->cval);
+        case VAL_STRING: {
+            size_t n;
+            const char *s = token_text(P, t, &n);
+            return make_string_copy(P->arena, s, n);
+        }
+        case VAL_REF: {
+            Ref *r = ref_create(P->arena, v->scope);
+            r->pos = t->pos;
+            lex_line_col(P, t->pos, &r->line, &r->col);
+            r->parent_levels = v->parent_levels;
+            RefSeg **tail = &r->head;
+            for (size_t i = 0; i < v->nsegs; ++i) {
+                char *atom = token_atom(P, &v->segs[i]);
+                RefSeg *s = v->segs[i].kind == TOK_STRING ? refseg_create_index(P->arena, atom)
+                                                          : refseg_create_name(P->arena, atom);
+                *tail = s;
+                tail = &s->next;
+            }
+            return make_ref(r);
         }
-        parse_error_token(&t, "top-level block name (identifier)");
+        case VAL_ARRAY: break;
     }
-    return head;
+    return make_array();
 }
 
-/* ---------- resolution helpers ---------- */
+/* a field's value is complete: compile an expr, record the source hash */
+static void build_field_done(Parser *P, Field *f, const Token *at) {
+    if (f->type == TYPE_EXPR) f->value = expr_field_value(P, at, f->value);
+    f->src_hash = value_src_hash(hash_mix(HASH_SEED, f->type), &f->value);
+}
 
-/* deep copy value (owned copy) */
-static Value value_deep_copy(const Value *v) {
-    Value r; memset(&r,0,sizeof(r));
-    r.kind = v->kind;
-    r.ival = v->ival;
-    r.bval = v->bval;
-    r.cval = v->cval;
-    r.fval = v->fval;
-    r.sval = NULL;
-    r.arr = NULL;
-    r.arr_len = 0;
-    r.ref = NULL;
-    if (v->kind == VAL_STRING && v->sval) r.sval = str_dup_local(v->sval);
-    if (v->kind == VAL_FLOAT) r.fval = v->fval;
-    if (v->kind == VAL_ARRAY) {
-        ValueItem *it = v->arr;
-        while (it) {
-            array_append(&r, value_deep_copy(&it->v));
-            it = it->next;
-        }
-    }
-    if (v->kind == VAL_REF && v->ref) {
-        /* copy ref structure so unresolved refs remain independent */
-        Ref *rf = ref_create(v->ref->scope);
-        rf->parent_levels = v->ref->parent_levels;
-        RefSeg *src = v->ref->head;
-        RefSeg **tail = &rf->head;
-        while (src) {
-            if (src->is_index) *tail = refseg_create_index(src->index);
-            else *tail = refseg_create_name(src->name);
-            tail = &(*tail)->next;
-            src = src->next;
-        }
-        r.ref = rf;
+static int build_block_enter(Parser *P, const Token *name, const Token *label, size_t open) {
+    TreeBuilder *B = P->sink_ctx;
+    Block *blk = arena_calloc(P->arena, sizeof(Block));
+    blk->name = token_atom(P, name);
+    blk->label = label ? token_atom(P, label) : NULL;
+    blk->tree = P->tree;
+    blk->lazy = (unsigned char)B->lazy;
+    blk->open = open;
+    if (B->nblocks) {
+        BuildBlock *up = &B->blocks[B->nblocks - 1];
+        blk->parent = up->blk;
+        *up->ctail = blk;
+        up->ctail = &blk->next;
+    } else {
+        *B->tail = blk;
+        B->tail = &blk->next;
     }
-    return r;
+    if (B->lazy) return ACL_SAX_SKIP;
+    B->blocks = stack_reserve(B->blocks, B->nblocks, &B->blocks_cap, sizeof(BuildBlock));
+    B->blocks[B->nblocks++] = (BuildBlock){ blk, &blk->fields, &blk->children };
+    return ACL_SAX_CONTINUE;
+}
+
+static int build_block_exit(Parser *P) {
+    TreeBuilder *B = P->sink_ctx;
+    B->nblocks--;
+    return ACL_SAX_CONTINUE;
+}
+
+static void build_array_open(Parser *P, Field *f, const Token *at) {
+    TreeBuilder *B = P->sink_ctx;
+    B->arrays = stack_reserve(B->arrays, B->narrays, &B->arrays_cap, sizeof(BuildArray));
+    B->arrays[B->narrays++] = (BuildArray){ P->scratch_len, f, *at };
+}
+
+static int build_field(Parser *P, FieldType type, const Token *name, const ParsedValue *v) {
+    TreeBuilder *B = P->sink_ctx;
+    BuildBlock *up = &B->blocks[B->nblocks - 1];
+    Field *f = arena_calloc(P->arena, sizeof(Field));
+    f->type = type;
+    f->name = token_atom(P, name);
+    *up->ftail = f;
+    up->ftail = &f->next;
+    if (v->kind == VAL_ARRAY) { build_array_open(P, f, &v->tok); return ACL_SAX_CONTINUE; }
+    f->value = build_value(P, v);
+    build_field_done(P, f, &v->tok);
+    return ACL_SAX_CONTINUE;
+}
+
+static int build_element(Parser *P, size_t index, const ParsedValue *v) {
+    (void)index;
+    if (v->kind == VAL_ARRAY) build_array_open(P, NULL, &v->tok);
+    else scratch_push(P, build_value(P, v));
+    return ACL_SAX_CONTINUE;
+}
+
+static int build_array_end(Parser *P) {
+    TreeBuilder *B = P->sink_ctx;
+    BuildArray a = B->arrays[--B->narrays];
+    if (P->scratch_len - a.base > UINT32_MAX) parse_error_token(P, &a.at, "array of fewer than 2^32 elements");
+    Value arr = make_array();
+    arr.arr_len = (uint32_t)(P->scratch_len - a.base);
+    arr.arr = values_copy(P->arena, P->scratch + a.base, arr.arr_len);
+    P->scratch_len = a.base;
+    if (!a.field) { scratch_push(P, arr); return ACL_SAX_CONTINUE; }
+    a.field->value = arr;
+    build_field_done(P, a.field, &a.at);
+    return ACL_SAX_CONTINUE;
+}
+
+static const ParseSink tree_sink = {
+    build_block_enter, build_block_exit, build_field, build_element, build_array_end
+};
+
+/* ---------- top-level parse ---------- */
+
+static void lexer_reset(Parser *P, const char *text, size_t len) {
+    P->src = text;
+    P->pos = 0;
+    P->len = len;
+    /* skip UTF-8 BOM if present */
+    if (P->pos+3 <= P->len && (unsigned char)P->src[0]==0xEF && (unsigned char)P->src[1]==0xBB && (unsigned char)P->src[2]==0xBF) P->pos = 3;
+    P->src_start = P->line_pos = P->line_start = P->pos;
+    P->line_no = 1;
+    P->ring_head = 0; P->ring_count = 0;
+}
+
+/* buffers a parse may have grown */
+static void parser_release(Parser *P) {
+    free(P->segs);
+    free(P->decode);
+    free(P->scratch);
+}
+
+/* lexer only, for benchmarking */
+long acl_lex_count(const char *text, size_t len) {
+    if (!text) return 0;
+    Parser P = {0};
+    lexer_reset(&P, text, len);
+    long n = 0;
+    while (next_token_internal(&P).kind != TOK_EOF) n++;
+    return n;
+}
+
+/* Parse `len` bytes of `text` into a new tree; the buffer need not be
+   NUL-terminated. With `lazy`, blocks are left lazy and the tree takes
+   over lazy (on success only). Returns NULL on a parse error (already
+   reported) or an empty source. */
+static Block *parse_tree(const char *text, size_t len, struct LazySource *lazy, const BraceTable *braces) {
+    Tree *tree = malloc(sizeof(Tree));
+    if (!tree) return NULL;
+    memset(tree, 0, sizeof(Tree));
+
+    TreeBuilder B;
+    memset(&B, 0, sizeof(B));
+    B.lazy = lazy != NULL;
+    B.tail = &B.head;
+
+    Parser P;
+    memset(&P, 0, sizeof(P));
+    P.tree = tree;
+    P.arena = &tree->arena;
+    P.atoms = &tree->atoms;
+    P.sink = &tree_sink;
+    P.sink_ctx = &B;
+    P.braces = braces;
+    lexer_reset(&P, text, len);
+
+    if (setjmp(P.fail)) {
+        /* everything built so far lives in the arena */
+        parser_release(&P);
+        free(B.blocks);
+        free(B.arrays);
+        tree_destroy(tree);
+        return NULL;
+    }
+
+    parse_document(&P, SIZE_MAX);
+    parser_release(&P);
+    free(B.blocks);
+    free(B.arrays);
+    if (!B.head) {
+        /* nothing parsed: no tree to hand out */
+        tree_destroy(tree);
+        return NULL;
+    }
+    tree->blocks = B.head;
+    tree->lazy = lazy;
+    tree->on_demand = lazy != NULL;
+    tree_build_index(tree);
+    return B.head;
+}
+
+Block *parse_all(const char *text, size_t len) {
+    return parse_tree(text, len, NULL, NULL);
+}
+
+/* ---------- resolution helpers ---------- */
+
+/* Lookups and the resolver reach a block's fields and children only through
+   these helpers, which parse a lazy block's body first. */
+static void block_expand(Block *b);
+static void tree_expand_all(Tree *tree);
+
+static Block *block_children(const Block *b) {
+    if (b->lazy) block_expand((Block*)b);
+    return b->children;
 }
 
 /* find first child block of `blk` with given name (favor first) */
 static Block *find_child_by_name(Block *blk, const char *name) {
-    if (!blk) return NULL;
-    for (Block *c = blk->children; c; c = c->next) {
-        if (c->name && name && strcmp(c->name, name) == 0) return c;
-    }
-    return NULL;
+    if (!blk || !name) return NULL;
+    return list_find_name(block_children(blk), name);
 }
 
 /* find first child block of `blk` with given name and label */
 static Block *find_child_by_name_and_label(Block *blk, const char *name, const char *label) {
-    if (!blk) return NULL;
-    for (Block *c = blk->children; c; c = c->next) {
-        if (c->name && name && strcmp(c->name, name) == 0) {
-            if (c->label && label && strcmp(c->label, label) == 0) return c;
-        }
-    }
-    return NULL;
+    if (!blk || !name || !label) return NULL;
+    return list_find_pair(block_children(blk), name, label);
 }
 
 /* find field by name in block (favor first) */
 static Field *find_field_in_block(Block *blk, const char *name) {
-    if (!blk) return NULL;
+    if (!blk || !name) return NULL;
+    if (blk->lazy) block_expand(blk);
+    if (blk->index && blk->index->fields.slots) return index_get(&blk->index->fields, IDX_FIELD, name, NULL);
     for (Field *f = blk->fields; f; f = f->next) {
-        if (f->name && name && strcmp(f->name, name) == 0) return f;
+        if (f->name == name) return f;
     }
     return NULL;
 }
 
-static void resolution_error_and_exit(const Ref *r) {
-    /* print location + ref itself */
-    fprintf(stderr,
-        "Reference resolution error at %d:%d: ",
-        r->line, r->col);
-    fprintf(stderr, "\n");
-    /* show the exact line from the source with a caret */
-    show_line_context(r->pos, r->line, r->col);
-    exit(1);
-}
-
-/* resolve a Ref into a Value copy, given root list and current block context.
-   Returns 1 on success and stores copied value in out (caller must value_free), 0 on failure.
-   Ambiguities favor first match. depth limits prevent runaway recursion. */
-/* resolve a Ref into out (deep‐copy), or abort on any failure */
-static int resolve_ref_to_value(const Block *root_list,
-                                const Block *current_block,
-                                const Ref       *r,
-                                Value           *out,
-                                int              depth)
+/* Locate the field a reference names, starting from root_list (global refs)
+   or current_block (local/parent refs). On success returns the field and
+   stores its block in *owner; returns NULL if the path doesn't lead to a
+   field. Ambiguities favor first match. */
+static Field *ref_target(const Block *root_list, const Block *current_block,
+                         const Ref *r, const Block **owner)
 {
-    if (!r || !out) resolution_error_and_exit(r);
-    if (depth > 64)  resolution_error_and_exit(r);
-
-    memset(out, 0, sizeof(*out));
-
-    /* helper to copy a field value into out */
-    int try_field_copy(const Block *blk, const char *field_name) {
-        Field *f = find_field_in_block((Block*)blk, field_name);
-        if (!f) return 0;
-        *out = value_deep_copy(&f->value);
-        return 1;
-    }
+    if (!r) return NULL;
 
     /* pick starting block */
     const Block *pos = NULL;
@@ -946,43 +1843,26 @@ static int resolve_ref_to_value(const Block *root_list,
 
     if (r->scope == REF_GLOBAL) {
         /* first segment must be a name */
-        if (!seg || seg->is_index) resolution_error_and_exit(r);
-        /* scan top‐level list for that block name */
-        const Block *b = root_list;
-        while (b) {
-            if (b->name && strcmp(b->name, seg->name) == 0) { pos = b; break; }
-            b = b->next;
-        }
-        if (!pos) resolution_error_and_exit(r);
+        if (!seg || seg->is_index) return NULL;
+        /* top-level block by name */
+        pos = list_find_name(root_list, seg->name);
         seg = seg->next;
     }
     else if (r->scope == REF_LOCAL) {
-        if (!current_block) resolution_error_and_exit(r);
         pos = current_block;
     }
     else { /* REF_PARENT */
-        if (!current_block) resolution_error_and_exit(r);
         pos = current_block;
-        for (int i = 0; i < r->parent_levels; ++i) {
-            if (!pos->parent) resolution_error_and_exit(r);
-            pos = pos->parent;
-        }
+        for (int i = 0; pos && i < r->parent_levels; ++i) pos = pos->parent;
     }
 
     /* walk each segment */
     while (seg) {
-        if (!pos) resolution_error_and_exit(r);
+        if (!pos) return NULL;
 
         if (seg->is_index) {
             /* select first child whose label matches */
-            const Block *found = NULL;
-            for (const Block *c = pos->children; c; c = c->next) {
-                if (c->label && strcmp(c->label, seg->index) == 0) {
-                    found = c;
-                    break;
-                }
-            }
-            pos = found;
+            pos = list_find_label(block_children(pos), seg->index);
             seg = seg->next;
             continue;
         }
@@ -991,204 +1871,312 @@ static int resolve_ref_to_value(const Block *root_list,
         RefSeg *next = seg->next;
         if (next && next->is_index) {
             /* name + index pair: find child by (name,label) */
-            const char *lbl = next->index;
-            const Block *found = NULL;
-            for (const Block *c = pos->children; c; c = c->next) {
-                if (c->name && strcmp(c->name, seg->name) == 0
-                 && c->label && strcmp(c->label, lbl) == 0) {
-                    found = c;
-                    break;
-                }
-            }
-            pos = found;
+            pos = list_find_pair(block_children(pos), seg->name, next->index);
             seg = next->next;  /* skip both */
             continue;
         }
-        else {
-            /* lone name: pick first child block with that name */
-            const Block *child = NULL;
-            for (const Block *c = pos->children; c; c = c->next) {
-                if (c->name && strcmp(c->name, seg->name) == 0) {
-                    child = c;
-                    break;
-                }
-            }
-            if (child) {
-                pos = child;
-                seg = seg->next;
-                continue;
-            }
-            /* if final segment, try it as a field name */
-            if (seg->next == NULL) {
-                if (try_field_copy(pos, seg->name)) {
-                    return 1;
-                }
-                resolution_error_and_exit(r);
-            }
-            /* intermediate name not found → error */
-            resolution_error_and_exit(r);
+
+        /* lone name: pick first child block with that name */
+        const Block *child = list_find_name(block_children(pos), seg->name);
+        if (child) {
+            pos = child;
+            seg = seg->next;
+            continue;
         }
+        /* only the final segment may name a field */
+        if (seg->next) return NULL;
+        Field *f = find_field_in_block((Block*)pos, seg->name);
+        if (f) *owner = pos;
+        return f;
     }
 
-    /* if we consumed all segments and landed on a block, that's not a field → error */
-    resolution_error_and_exit(r);
-    return 0; /* unreachable */
+    /* consumed all segments and landed on a block: not a field */
+    return NULL;
 }
 
-/* attempt to resolve a single Value if it's VAL_REF; uses block context (the block that owns the field).
-   Returns 1 if replaced (and out value is set into field), 0 if nothing changed. */
-static int try_resolve_value_for_field(const Block *root_list, Block *field_block, Value *v, int depth) {
-    if (!v) return 0;
-    if (v->kind != VAL_REF) return 0;
-    Value resolved;
-    if (resolve_ref_to_value(root_list, field_block, v->ref, &resolved, depth+1)) {
-        /* replace v with resolved (take ownership of resolved) */
-        /* free original ref */
-        value_free(v);
-        *v = resolved;
-        return 1;
+/* print Block["label"].Child.field for diagnostics */
+static void print_field_path(const Block *b, const Field *f, FILE *out) {
+    if (b->parent) print_field_path(b->parent, NULL, out);
+    fprintf(out, "%s", b->name);
+    if (b->label) fprintf(out, "[\"%s\"]", b->label);
+    if (f) fprintf(out, ".%s", f->name);
+    else fprintf(out, ".");
+}
+
+/* ---------- reference resolution ---------- */
+
+/* References are resolved depth-first over the field dependency graph.
+   A field is resolved once all fields its references name are resolved,
+   then marked done, so every field and every reference is handled once,
+   whatever the order or length of reference chains. The DFS runs on an
+   explicit stack: a chain of any length can't overflow the C stack, and
+   the stack is the path printed when a cycle is found.
+
+   Frame slots are the VAL_REF values inside the frame's field (the value
+   itself, or elements of possibly nested arrays); they sit on a shared
+   slot stack in LIFO order with the frames. */
+
+/* RS_FAILED: done, but some reference in it (or in a field it depends on)
+   couldn't be resolved; it was reported once and dependents keep their refs.
+   RS_GONE: dropped from the tree by acl_reload. */
+enum { RS_NONE = 0, RS_ACTIVE, RS_DONE, RS_FAILED, RS_GONE };
+
+typedef struct ResolveFrame {
+    Field *field;
+    const Block *block;
+    size_t slot_begin; /* this frame's slots: [slot_begin, slot_end) */
+    size_t slot_next;  /* next unresolved one */
+    size_t slot_end;
+} ResolveFrame;
+
+typedef struct Resolver {
+    const Block *root;
+    Arena *arena;
+    ResolveFrame *frames; size_t nframes, frames_cap;
+    Value **slots; size_t nslots, slots_cap;
+} Resolver;
+
+static void *grow_vec(void *p, size_t *cap, size_t elem) {
+    *cap = *cap ? *cap * 2 : 64;
+    void *np = realloc(p, *cap * elem);
+    if (!np) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+    return np;
+}
+
+static void collect_ref_slots(Resolver *R, Value *v) {
+    if (v->kind == VAL_REF) {
+        if (R->nslots == R->slots_cap) R->slots = grow_vec(R->slots, &R->slots_cap, sizeof(Value*));
+        R->slots[R->nslots++] = v;
+    } else if (v->kind == VAL_ARRAY) {
+        for (size_t i = 0; i < v->arr_len; ++i) collect_ref_slots(R, &v->arr[i]);
+    }
+}
+
+/* refs in the value, or in an expr field's operands */
+static int value_has_refs(const Value *v) {
+    if (v->kind == VAL_REF) return 1;
+    for (size_t i = 0, n = value_nsub(v); i < n; ++i) {
+        if (value_has_refs(&v->arr[i])) return 1;
     }
     return 0;
 }
 
-/* Walk tree and resolve all field VAL_REF values, using containing block as context.
-   This is iterative but will attempt to resolve nested references by multiple passes up to a limit. */
-void resolve_all_refs(Block *root) {
-    if (!root) return;
+/* v with its arrays (and an expr's operands) copied, so resolving v in
+   place leaves the copy as parsed; strings and refs are shared */
+static Value source_copy(Arena *a, const Value *v) {
+    Value c = *v;
+    if (value_nsub(v)) {
+        c.arr = arena_alloc(a, v->arr_len * sizeof(Value));
+        for (size_t i = 0; i < v->arr_len; ++i) c.arr[i] = source_copy(a, &v->arr[i]);
+    }
+    return c;
+}
 
-    const int MAX_PASSES = 16;
-    for (int pass = 0; pass < MAX_PASSES; ++pass) {
-        int any_changed = 0;
-
-        // traverse top‐level blocks
-        for (Block *b = root; b; b = b->next) {
-            // simple DFS stack for children
-            size_t cap = 64;
-            Block **stack = malloc(sizeof(Block*) * cap);
-            size_t len = 0;
-            stack[len++] = b;
-
-            while (len) {
-                Block *cur = stack[--len];
-
-                // push children onto stack
-                for (Block *c = cur->children; c; c = c->next) {
-                    if (len + 1 > cap) {
-                        cap *= 2;
-                        stack = realloc(stack, sizeof(Block*) * cap);
-                    }
-                    stack[len++] = c;
-                }
+static void resolver_push(Resolver *R, Field *f, const Block *blk) {
+    if (R->nframes == R->frames_cap) R->frames = grow_vec(R->frames, &R->frames_cap, sizeof(ResolveFrame));
+    f->rstate = RS_ACTIVE;
+    ResolveFrame *fr = &R->frames[R->nframes++];
+    fr->field = f;
+    fr->block = blk;
+    fr->slot_begin = fr->slot_next = R->nslots;
+    /* resolving overwrites the refs and evaluating the text: keep a copy of
+       the source for acl_reload to compare against */
+    if (!f->src && ((f->type == TYPE_EXPR && f->value.kind == VAL_STRING) || value_has_refs(&f->value))) {
+        f->src = arena_alloc(R->arena, sizeof(Value));
+        *f->src = source_copy(R->arena, &f->value);
+    }
+    if (f->type == TYPE_EXPR && f->value.kind == VAL_STRING) {
+        /* operands of an expression not yet evaluated */
+        for (size_t i = 0; i < f->value.arr_len; ++i) collect_ref_slots(R, &f->value.arr[i]);
+    } else {
+        collect_ref_slots(R, &f->value);
+    }
+    fr->slot_end = R->nslots;
+}
 
-                // now resolve each field in this block
-                for (Field *f = cur->fields; f; f = f->next) {
+/* operand i of an expression: its resolved value (ctx is value.arr) */
+static int expr_operand(void *ctx, size_t i, ExprVal *out) {
+    const Value *v = (const Value *)ctx + i;
+    switch (v->kind) {
+        case VAL_INT: *out = (ExprVal){EXPR_INT, v->ival, 0, NULL}; return 1;
+        case VAL_FLOAT: *out = (ExprVal){EXPR_DOUBLE, 0, v->fval, NULL}; return 1;
+        case VAL_BOOL: *out = (ExprVal){EXPR_INT, v->bval, 0, NULL}; return 1;
+        case VAL_CHAR: *out = (ExprVal){EXPR_INT, v->cval, 0, NULL}; return 1;
+        case VAL_STRING: *out = (ExprVal){EXPR_STRING, 0, 0, value_str(v) ? value_str(v) : ""}; return 1;
+        default: return 0; /* arrays aren't operands */
+    }
+}
 
-                    // 1) resolve any VAL_REF in scalars
-                    if (f->value.kind == VAL_REF) {
-                        if (try_resolve_value_for_field(root, cur, &f->value, 0)) {
-                            any_changed = 1;
-                            // after a ref resolves, it may produce new refs/arrays
-                        }
-                    }
-                    // 2) resolve refs inside array elements
-                    else if (f->value.kind == VAL_ARRAY) {
-                        ValueItem *it = f->value.arr;
-                        while (it) {
-                            if (it->v.kind == VAL_REF) {
-                                if (try_resolve_value_for_field(root, cur, &it->v, 0)) {
-                                    any_changed = 1;
-                                }
-                            }
-                            it = it->next;
-                        }
-                    }
+/* all references of f handled: evaluate expr fields, mark done, pop */
+static void resolver_finish(Resolver *R) {
+    ResolveFrame *fr = &R->frames[R->nframes - 1];
+    Field *f = fr->field;
+    for (size_t i = fr->slot_begin; i < fr->slot_end; ++i) {
+        if (R->slots[i]->kind == VAL_REF) {
+            f->rstate = RS_FAILED;
+            R->nslots = fr->slot_begin;
+            R->nframes--;
+            return;
+        }
+    }
+    f->rstate = RS_DONE;
+    if (f->type == TYPE_EXPR && f->value.kind == VAL_STRING) {
+        ExprProg *prog = expr_cache_get(R->root->tree, f->value.sval);
+        ExprVal out;
+        if (prog && expr_eval(prog, expr_operand, f->value.arr, arena_alloc_cb, R->arena, &out)) {
+            if (out.type == EXPR_INT) f->value = make_int(out.ival);
+            else if (out.type == EXPR_DOUBLE) f->value = make_float(out.dval);
+            else f->value = make_string((char *)out.sval); /* arena or program storage */
+        } else {
+            /* leave the text */
+            FILE *out = diag();
+            fprintf(out, "Expression evaluation failed: ");
+            print_field_path(fr->block, f, out);
+            fprintf(out, " = \"%s\"\n", f->value.sval);
+            f->value.arr = NULL;
+            f->value.arr_len = 0;
+            f->rstate = RS_FAILED;
+        }
+    }
+    R->nslots = fr->slot_begin;
+    R->nframes--;
+}
 
-                    // 3) evaluate any expression fields
-                    //    - we conventionally declare them as type "expr"
-                    //    - their raw value was parsed as a string literal
-                    else if (f->type
-                          && strcmp(f->type, "expr") == 0
-                          && f->value.kind == VAL_STRING) {
-
-                        // hand the stored string to your expr.h evaluator:
-                        //    char *expr = f->value.sval;
-                        //    char *result = expr_eval_to_string(expr);
-                        //    free(expr);
-                        //    f->value.sval = result;
-                        //
-                        //    if it returns NULL on error, you can handle/report as needed.
-
-                        char *in_expr = f->value.sval;
-                        char *out_str = expr_eval_to_string(in_expr);
-                        if (out_str) {
-                            free(in_expr);
-                            f->value.sval = out_str;
-                            any_changed = 1;
-                        }
-                        // else leave the original and maybe log an error
-                    }
-                }
-            }
+static void report_unresolved(const Ref *r) {
+    FILE *out = diag();
+    fprintf(out, "Reference resolution error at %d:%d: ", r->line, r->col);
+    print_ref(r, out);
+    fprintf(out, "\n");
+}
 
-            free(stack);
+/* frames[from..] form a cycle back to frames[from].field */
+static void report_cycle(const Resolver *R, size_t from) {
+    const Ref *r = R->slots[R->frames[R->nframes - 1].slot_next]->ref;
+    FILE *out = diag();
+    fprintf(out, "Reference cycle at %d:%d: ", r->line, r->col);
+    for (size_t i = from; i < R->nframes; ++i) {
+        const ResolveFrame *fr = &R->frames[i];
+        print_field_path(fr->block, fr->field, out);
+        fprintf(out, " -> ");
+    }
+    print_field_path(R->frames[from].block, R->frames[from].field, out);
+    fprintf(out, "\n");
+}
+
+/* resolve one field and everything it depends on */
+static void resolve_field(Resolver *R, Field *start, const Block *start_blk) {
+    if (start->rstate != RS_NONE) return;
+    resolver_push(R, start, start_blk);
+
+    while (R->nframes) {
+        ResolveFrame *fr = &R->frames[R->nframes - 1];
+        if (fr->slot_next == fr->slot_end) { resolver_finish(R); continue; }
+
+        Value *slot = R->slots[fr->slot_next];
+        const Block *owner = NULL;
+        Field *target = ref_target(R->root, fr->block, slot->ref, &owner);
+        if (!target) {
+            /* leave the ref in place and carry on with the rest */
+            report_unresolved(slot->ref);
+            fr->slot_next++;
+            continue;
+        }
+        if (target->rstate == RS_NONE) {
+            resolver_push(R, target, owner); /* may move frames: fr is stale */
+            continue;
+        }
+        if (target->rstate == RS_ACTIVE) {
+            size_t from = R->nframes - 1;
+            while (R->frames[from].field != target) from--;
+            report_cycle(R, from);
+            fr->slot_next++;
+            continue;
         }
+        if (target->rstate == RS_FAILED) {
+            fr->slot_next++;
+            continue;
+        }
+        /* target is done: alias its value. Strings and arrays are arena
+           storage that nothing writes once resolved, so every use site can
+           share them; the ref itself stays in the arena until the tree is freed */
+        *slot = target->value;
+        DepList *deps = &R->root->tree->deps;
+        if (deps->count == deps->cap) deps->items = grow_vec(deps->items, &deps->cap, sizeof(FieldDep));
+        deps->items[deps->count++] = (FieldDep){ fr->field, target };
+        fr->slot_next++;
+    }
+}
 
-        // if we made no progress on this pass, stop early
-        if (!any_changed) break;
+/* Resolve every reference (and evaluate expr fields) in the tree.
+   Returns the number of fields left with unresolved references; those are
+   reported on stderr (once, on the call that meets them) and left in place
+   as VAL_REF. Calling it again on the same tree is cheap and returns the
+   same count. */
+int resolve_all_refs(Block *root) {
+    if (!root) return 0;
+    tree_expand_all(root->tree);
+    Resolver R;
+    memset(&R, 0, sizeof(R));
+    R.root = root;
+    R.arena = &root->tree->arena;
+
+    /* pre-order walk over all blocks via parent links: no stack needed */
+    int unresolved = 0;
+    Block *b = root;
+    while (b) {
+        for (Field *f = b->fields; f; f = f->next) {
+            resolve_field(&R, f, b);
+            if (f->rstate == RS_FAILED) unresolved++;
+        }
+        if (b->children) { b = b->children; continue; }
+        while (b && !b->next) b = b->parent;
+        if (b) b = b->next;
     }
+
+    free(R.frames);
+    free(R.slots);
+    return unresolved;
 }
 
 /* ---------- printing/freeing ---------- */
 
-static void print_block(const Block *b, int indent);
-void print_all(const Block *root) {
+static void print_block(const Block *b, int indent, FILE *out);
+void print_all(const Block *root, FILE *out) {
+    if (root) tree_expand_all(root->tree);
     for (const Block *b = root; b; b = b->next) {
-        print_block(b, 0);
-        printf("\n");
+        print_block(b, 0, out);
+        fprintf(out, "\n");
     }
 }
 
-static void print_block(const Block *b, int indent) {
-    for (int i = 0; i < indent; ++i) printf("  ");
-    if (b->label) printf("Block: %s  label: \"%s\"\n", b->name, b->label);
-    else printf("Block: %s\n", b->name);
+static void print_block(const Block *b, int indent, FILE *out) {
+    for (int i = 0; i < indent; ++i) fprintf(out, "  ");
+    if (b->label) fprintf(out, "Block: %s  label: \"%s\"\n", b->name, b->label);
+    else fprintf(out, "Block: %s\n", b->name);
     for (const Field *f = b->fields; f; f = f->next) {
-        for (int i = 0; i < indent; ++i) printf("  ");
-        printf("  Field: %s  ", f->name);
-        if (f->type) printf("(type: %s)  ", f->type); else printf("(type: inferred)  ");
-        printf("value: ");
-        print_value(&f->value);
-        printf("\n");
+        for (int i = 0; i < indent; ++i) fprintf(out, "  ");
+        fprintf(out, "  Field: %s  ", f->name);
+        fprintf(out, "(type: %s)  ", TYPE_NAMES[f->type]);
+        fprintf(out, "value: ");
+        print_value(&f->value, out);
+        fprintf(out, "\n");
     }
-    for (const Block *c = b->children; c; c = c->next) print_block(c, indent+1);
+    for (const Block *c = b->children; c; c = c->next) print_block(c, indent+1, out);
 }
 
+/* release a whole tree: one free() per arena chunk, no tree walk */
 void free_blocks(Block *b) {
-    while (b) {
-        Block *nb = b->next;
-        if (b->name) free(b->name);
-        if (b->label) free(b->label);
-        for (Field *f = b->fields; f; ) {
-            Field *nf = f->next;
-            if (f->type) free(f->type);
-            if (f->name) free(f->name);
-            value_free(&f->value);
-            free(f);
-            f = nf;
-        }
-        if (b->children) free_blocks(b->children);
-        free(b);
-        b = nb;
-    }
+    if (!b) return;
+    tree_destroy(b->tree);
 }
 
 /* Forward declarations of parser internals */
 extern struct Block;
 typedef struct Block Block;
 
-extern Block *parse_all(const char *text);
-extern void resolve_all_refs(Block *root);
-extern void print_all(const Block *root);
+extern Block *parse_all(const char *text, size_t len);
+extern int resolve_all_refs(Block *root);
+extern void print_all(const Block *root, FILE *out);
 extern void free_blocks(Block *root);
 
 /* -----------------------------
@@ -1203,307 +2191,2987 @@ void acl_shutdown(void) {
     /* No-op for now */
 }
 
+/* Read a whole file through stdio; fallback for sources mmap can't map. */
+static char *read_whole_file(int fd, size_t *len_out) {
+    size_t cap = 4096, len = 0;
+    char *buf = malloc(cap);
+    if (!buf) return NULL;
+    for (;;) {
+        if (len == cap) {
+            char *nb = realloc(buf, cap * 2);
+            if (!nb) { free(buf); return NULL; }
+            buf = nb; cap *= 2;
+        }
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n < 0) { if (errno == EINTR) continue; free(buf); return NULL; }
+        if (n == 0) break;
+        len += (size_t)n;
+    }
+    *len_out = len;
+    return buf;
+}
+
+/* A source file, mapped read-only where possible: the lexer works on slices
+   of the mapping, and only the strings that end up in a tree are copied.
+   A source that outlives the call reading it (a lazy tree's) is read into
+   a private buffer instead, since the file may be rewritten in place
+   meanwhile: a mapping would then show the new bytes at the old offsets,
+   or fault past a shortened end. */
+typedef struct Source { const char *text; size_t len; void *map; char *buf; } Source;
+
+static int source_open(const char *path, Source *src, int may_map) {
+    memset(src, 0, sizeof(*src));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { fprintf(diag(), "open: %s\n", strerror(errno)); return 0; }
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); return 0; }
+
+    if (may_map && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size_t len = (size_t)st.st_size;
+        void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            close(fd);
+            src->text = src->map = map;
+            src->len = len;
+            return 1;
+        }
+    }
+
+    src->buf = read_whole_file(fd, &src->len);
+    close(fd);
+    src->text = src->buf;
+    return src->buf != NULL;
+}
+
+static void source_close(Source *src) {
+    if (src->map) munmap(src->map, src->len);
+    free(src->buf);
+}
+
 AclBlock *acl_parse_file(const char *path) {
     if (!path) return NULL;
-    FILE *f = fopen(path, "rb");
-    if (!f) { perror("fopen"); return NULL; }
-    if (fseek(f, 0, SEEK_END) != 0) { fclose(f); return NULL; }
-    long sz = ftell(f);
-    if (sz < 0) { fclose(f); return NULL; }
-    if (fseek(f, 0, SEEK_SET) != 0) { fclose(f); return NULL; }
-    char *buf = malloc((size_t)sz + 1);
-    if (!buf) { fclose(f); return NULL; }
-    if (fread(buf, 1, (size_t)sz, f) != (size_t)sz) { free(buf); fclose(f); return NULL; }
-    buf[sz] = '\0';
-    fclose(f);
-
-    Block *root = parse_all(buf);
-    free(buf);
+    Source src;
+    if (!source_open(path, &src, 1)) return NULL;
+    Block *root = parse_all(src.text, src.len);
+    source_close(&src);
     return (AclBlock*)root;
 }
 
 AclBlock *acl_parse_string(const char *text) {
     if (!text) return NULL;
-    Block *root = parse_all(text);
+    Block *root = parse_all(text, strlen(text));
     return (AclBlock*)root;
 }
 
-int acl_resolve_all(AclBlock *root) {
-    if (!root) return 0;
-    resolve_all_refs((Block*)root);
-    return 1;
+/* ---------- streaming parse ---------- */
+
+/* The parser's events forwarded to an AclSaxHandler. Nothing is allocated
+   per event: text is a slice of the source, or of the parser's decode
+   buffer for escaped strings. */
+typedef struct SaxState { const AclSaxHandler *h; void *ctx; } SaxState;
+
+static void sax_value(Parser *P, FieldType type, const ParsedValue *pv, AclSaxValue *out) {
+    const Token *t = &pv->tok;
+    memset(out, 0, sizeof(*out));
+    out->offset = t->pos;
+    switch (pv->kind) {
+        case VAL_INT: out->kind = ACL_SAX_INT; out->i = t->ival; break;
+        case VAL_FLOAT: out->kind = ACL_SAX_FLOAT; out->f = t->fval; break;
+        case VAL_BOOL: out->kind = ACL_SAX_BOOL; out->i = t->bval; break;
+        case VAL_CHAR: out->kind = ACL_SAX_CHAR; out->i = t->cval; break;
+        case VAL_STRING:
+            out->kind = type == TYPE_EXPR ? ACL_SAX_EXPR : ACL_SAX_STRING;
+            out->str = token_text(P, t, &out->len);
+            break;
+        case VAL_REF:
+            out->kind = ACL_SAX_REF;
+            out->str = P->src + t->pos;
+            out->len = pv->end - t->pos;
+            break;
+        case VAL_ARRAY: out->kind = ACL_SAX_ARRAY; break;
+    }
 }
 
-void acl_print(AclBlock *root, FILE *out) {
-    (void)out;
-    if (!root) return;
-    print_all((Block*)root);
+static int sax_block_enter(Parser *P, const Token *name, const Token *label, size_t open) {
+    (void)open;
+    SaxState *S = P->sink_ctx;
+    if (!S->h->block_enter) return ACL_SAX_CONTINUE;
+    size_t llen = 0;
+    const char *ltext = label ? token_text(P, label, &llen) : NULL;
+    return S->h->block_enter(S->ctx, name->text, name->len, ltext, llen);
 }
 
-void acl_free(AclBlock *root) {
-    if (!root) return;
-    free_blocks((Block*)root);
+static int sax_block_exit(Parser *P) {
+    SaxState *S = P->sink_ctx;
+    return S->h->block_exit ? S->h->block_exit(S->ctx) : ACL_SAX_CONTINUE;
 }
 
-void acl_error_free(AclError *err) {
-    if (!err) return;
-    if (err->message) free(err->message);
-    free(err);
+static int sax_field(Parser *P, FieldType type, const Token *name, const ParsedValue *v) {
+    SaxState *S = P->sink_ctx;
+    if (!S->h->field) return ACL_SAX_CONTINUE;
+    AclSaxValue sv;
+    sax_value(P, type, v, &sv);
+    return S->h->field(S->ctx, name->text, name->len, &sv);
 }
 
-/* ---------------------------
-   Array-index aware path lookup
-   ---------------------------
-   Supports segments like:
-     name
-     name["label"]
-     name[123]        -> numeric index selecting array element
-     ["label"]
-   Final segment may be a field with optional numeric index, e.g. field[2]
-*/
+static int sax_element(Parser *P, size_t index, const ParsedValue *v) {
+    SaxState *S = P->sink_ctx;
+    if (!S->h->element) return ACL_SAX_CONTINUE;
+    AclSaxValue sv;
+    sax_value(P, TYPE_INFERRED, v, &sv);
+    return S->h->element(S->ctx, index, &sv);
+}
 
-/* Parse a segment string (portion between dots) and return:
-   - out_name: malloc'd identifier or NULL
-   - out_label: malloc'd label string from quoted form or NULL
-   - out_index: >=0 if numeric index present, -1 if not
-   On success returns 1 and leaves *endp at end of segment string; returns 0 on parse error.
-*/
-static int parse_segment_with_index(const char *seg, char **out_name, char **out_label, int *out_index) {
-    *out_name = NULL; *out_label = NULL; *out_index = -1;
-    const char *s = seg;
-    /* skip leading whitespace */
-    while (*s && isspace((unsigned char)*s)) s++;
+static int sax_array_end(Parser *P) {
+    SaxState *S = P->sink_ctx;
+    return S->h->array_end ? S->h->array_end(S->ctx) : ACL_SAX_CONTINUE;
+}
 
-    /* optional name */
-    if (*s && (isalpha((unsigned char)*s) || *s == '_')) {
-        const char *a = s++;
-        while (*s && (isalnum((unsigned char)*s) || *s == '_')) s++;
-        size_t n = (size_t)(s - a);
-        *out_name = malloc(n + 1);
-        if (!*out_name) return 0;
-        memcpy(*out_name, a, n);
-        (*out_name)[n] = '\0';
+static const ParseSink sax_sink = {
+    sax_block_enter, sax_block_exit, sax_field, sax_element, sax_array_end
+};
+
+int acl_sax_parse_string(const char *text, size_t len, const AclSaxHandler *h, void *ctx) {
+    if (!text || !h) return -1;
+    SaxState S = { h, ctx };
+    Parser P;
+    memset(&P, 0, sizeof(P));
+    P.sink = &sax_sink;
+    P.sink_ctx = &S;
+    lexer_reset(&P, text, len);
+
+    switch (setjmp(P.fail)) {
+        case 0: break;
+        case 2: parser_release(&P); return 0; /* a callback stopped it */
+        default: parser_release(&P); return -1;
     }
+    parse_document(&P, SIZE_MAX);
+    parser_release(&P);
+    return 1;
+}
 
-    /* skip whitespace */
-    while (*s && isspace((unsigned char)*s)) s++;
+int acl_sax_parse_file(const char *path, const AclSaxHandler *h, void *ctx) {
+    if (!path || !h) return -1;
+    Source src;
+    if (!source_open(path, &src, 1)) return -1;
+    int rc = acl_sax_parse_string(src.text, src.len, h, ctx);
+    source_close(&src);
+    return rc;
+}
 
-    /* zero or more indexers allowed; we only use the first meaningful one:
-       - ["label"]  -> set out_label
-       - [digits]   -> set out_index
-       If multiple are present (e.g., name["a"][0]) this parser treats the first index here;
-       the lookup routine consumes segments in order so multi-indexing across path segments should
-       be expressed using separate segments if needed.
-    */
-    if (*s == '[') {
-        s++;
-        while (*s && isspace((unsigned char)*s)) s++;
-        if (*s == '"') {
-            /* label index */
-            s++;
-            const char *q = s;
-            while (*q && *q != '"') q++;
-            if (*q != '"') { if (*out_name) free(*out_name); return 0; }
-            size_t len = (size_t)(q - s);
-            *out_label = malloc(len + 1);
-            if (!*out_label) { if (*out_name) free(*out_name); return 0; }
-            memcpy(*out_label, s, len);
-            (*out_label)[len] = '\0';
-            s = q + 1;
-            while (*s && isspace((unsigned char)*s)) s++;
-            if (*s != ']') { if (*out_name) free(*out_name); free(*out_label); *out_label = NULL; return 0; }
-            s++;
-        } else if (isdigit((unsigned char)*s)) {
-            /* numeric index */
-            char *endptr = NULL;
-            long idx = strtol(s, &endptr, 10);
-            if (endptr == s) { if (*out_name) free(*out_name); return 0; }
-            if (idx < 0) { if (*out_name) free(*out_name); return 0; }
-            *out_index = (int)idx;
-            s = endptr;
-            while (*s && isspace((unsigned char)*s)) s++;
-            if (*s != ']') { if (*out_name) free(*out_name); return 0; }
-            s++;
-        } else {
-            /* unsupported indexer content */
-            if (*out_name) free(*out_name);
-            return 0;
-        }
+/* ---------- lazy parsing ---------- */
+
+/* A lazy tree keeps its source and brace table. Only the top-level block
+   headers are parsed up front; block_expand parses one block's body when a
+   lookup or the resolver first looks inside it, leaving its children lazy
+   in turn, so each body is lexed once and only if it is reached. Whole-tree
+   operations expand everything first (tree_expand_all), which also
+   releases the source. */
+struct LazySource { Source src; BraceTable braces; };
+
+static void lazy_source_free(struct LazySource *z) {
+    if (!z) return;
+    source_close(&z->src);
+    brace_table_free(&z->braces);
+    free(z);
+}
+
+static void block_expand(Block *b) {
+    Tree *tree = b->tree;
+    struct LazySource *z = tree->lazy;
+    b->lazy = 0;
+    if (!z) return;
+
+    TreeBuilder B;
+    memset(&B, 0, sizeof(B));
+    B.lazy = 1;
+    B.blocks = stack_reserve(NULL, 0, &B.blocks_cap, sizeof(BuildBlock));
+    B.blocks[B.nblocks++] = (BuildBlock){ b, &b->fields, &b->children };
+
+    Parser P;
+    memset(&P, 0, sizeof(P));
+    P.tree = tree;
+    P.arena = &tree->arena;
+    P.atoms = &tree->atoms;
+    P.sink = &tree_sink;
+    P.sink_ctx = &B;
+    P.braces = &z->braces;
+    lexer_reset(&P, z->src.text, z->src.len);
+    lexer_seek(&P, b->open + 1);
+
+    if (setjmp(P.fail)) {
+        /* reported once; the block reads as empty rather than half-built */
+        parser_release(&P);
+        free(B.blocks);
+        free(B.arrays);
+        b->fields = NULL;
+        b->children = NULL;
+        return;
     }
+    parse_block_body(&P);
+    parser_release(&P);
+    free(B.blocks);
+    free(B.arrays);
+    b->index = index_build(&tree->arena, b->children, b->fields);
+}
 
-    /* skip trailing whitespace */
-    while (*s && isspace((unsigned char)*s)) s++;
+static void tree_expand_all(Tree *tree) {
+    if (!tree->lazy) return;
+    /* pre-order walk via parent links, expanding on the way down */
+    Block *b = tree->blocks;
+    while (b) {
+        Block *c = block_children(b);
+        if (c) { b = c; continue; }
+        while (b && !b->next) b = b->parent;
+        if (b) b = b->next;
+    }
+    lazy_source_free(tree->lazy);
+    tree->lazy = NULL;
+}
 
-    /* success if we've consumed full seg (caller ensures seg is exact substring) */
-    return 1;
+/* The resolver's stacks, kept by an on-demand tree between lookups so
+   resolving one field doesn't allocate them afresh each time. */
+struct ResolveScratch {
+    ResolveFrame *frames; size_t frames_cap;
+    Value **slots; size_t slots_cap;
+};
+
+static void resolve_scratch_free(struct ResolveScratch *rs) {
+    if (!rs) return;
+    free(rs->frames);
+    free(rs->slots);
+    free(rs);
 }
 
-/* Find a Value* given a path with optional numeric indexing.
-   Returns pointer to Value inside tree (do not free) or NULL if not found/parse error.
-*/
-AclValue *acl_find_value_by_path(AclBlock *root, const char *path) {
-    if (!root || !path) return NULL;
-    const char *p = path;
-    Block *cur_block = NULL;
-    Block *top = (Block*)root;
+/* resolve a field of an on-demand tree when a lookup reaches it */
+static void resolve_on_demand(Field *f, Block *blk) {
+    Tree *tree = blk->tree;
+    if (!tree->scratch && !(tree->scratch = calloc(1, sizeof(struct ResolveScratch)))) {
+        fprintf(stderr, "acl: out of memory\n");
+        exit(1);
+    }
+    struct ResolveScratch *rs = tree->scratch;
+    Resolver R;
+    memset(&R, 0, sizeof(R));
+    R.root = tree->blocks;
+    R.arena = &tree->arena;
+    R.frames = rs->frames;
+    R.frames_cap = rs->frames_cap;
+    R.slots = rs->slots;
+    R.slots_cap = rs->slots_cap;
+    resolve_field(&R, f, blk);
+    rs->frames = R.frames;
+    rs->frames_cap = R.frames_cap;
+    rs->slots = R.slots;
+    rs->slots_cap = R.slots_cap;
+}
 
-    while (*p) {
-        /* find next '.' separating segments (not inside brackets) */
-        int in_br = 0;
-        const char *q = p;
-        while (*q) {
-            if (*q == '[') in_br = 1;
-            else if (*q == ']') in_br = 0;
-            else if (!in_br && *q == '.') break;
-            q++;
-        }
-        size_t seglen = (size_t)(q - p);
-        if (seglen == 0) return NULL;
-        char *seg = malloc(seglen + 1);
-        if (!seg) return NULL;
-        memcpy(seg, p, seglen); seg[seglen] = '\0';
-
-        char *name = NULL;
-        char *label = NULL;
-        int index = -1;
-        if (!parse_segment_with_index(seg, &name, &label, &index)) {
-            free(seg); if (name) free(name); if (label) free(label); return NULL;
-        }
-        free(seg);
-
-        int is_final = (*q == '\0');
+AclBlock *acl_parse_file_lazy(const char *path) {
+    if (!path) return NULL;
+    struct LazySource *z = calloc(1, sizeof(*z));
+    if (!z) return NULL;
+    if (!source_open(path, &z->src, 0)) { free(z); return NULL; }
+    Block *root;
+    if (brace_scan(z->src.text, z->src.len, 0, &z->braces)) {
+        root = parse_tree(z->src.text, z->src.len, z, &z->braces);
+        if (root) return (AclBlock*)root; /* the tree owns z now */
+    } else {
+        /* unbalanced braces: a full parse reports where */
+        root = parse_all(z->src.text, z->src.len);
+    }
+    lazy_source_free(z);
+    return (AclBlock*)root;
+}
 
-        if (!cur_block) {
-            /* selecting a top-level block */
-            if (name) {
-                /* find first top-level block with matching name */
-                Block *b = top;
-                while (b) {
-                    if (b->name && strcmp(b->name, name) == 0) { cur_block = b; break; }
-                    b = b->next;
-                }
-                if (!cur_block) { free(name); if (label) free(label); return NULL; }
-                /* if label present select child with that label under this block name (rare at top-level) */
-                if (label) {
-                    Block *found = find_child_by_name_and_label(cur_block, name, label);
-                    if (found) cur_block = found;
-                    else { free(name); free(label); return NULL; }
-                }
-            } else {
-                /* no name, label provided: find first top-level block with matching label */
-                Block *b = top;
-                while (b) {
-                    if (b->label && label && strcmp(b->label, label) == 0) { cur_block = b; break; }
-                    b = b->next;
-                }
-                if (!cur_block) { if (label) free(label); return NULL; }
-            }
-        } else {
-            if (is_final) {
-                /* final segment: must refer to a field name (name != NULL).
-                   If index >=0 then we want an element inside an array field.
-                */
-                if (!name) { if (label) free(label); if (name) free(name); return NULL; }
-                Field *f = find_field_in_block(cur_block, name);
-                if (!f) { free(name); if (label) free(label); return NULL; }
-                free(name); if (label) free(label);
-                if (index < 0) {
-                    return (AclValue*)&f->value;
-                } else {
-                    /* field must be array and index in-bounds; return pointer to element Value */
-                    if (f->value.kind != VAL_ARRAY) return NULL;
-                    if ((size_t)index >= f->value.arr_len) return NULL;
-                    ValueItem *it = f->value.arr;
-                    for (int i = 0; i < index; ++i) it = it->next;
-                    return (AclValue*)&it->v;
-                }
-            } else {
-                /* intermediate segment: select child block by name/label, or if name refers to a child array block? */
-                Block *next = NULL;
-                if (label && name) {
-                    next = find_child_by_name_and_label(cur_block, name, label);
-                } else if (label && !name) {
-                    /* choose first child whose label matches */
-                    for (Block *c = cur_block->children; c; c = c->next) {
-                        if (c->label && strcmp(c->label, label) == 0) { next = c; break; }
-                    }
-                } else if (name && !label) {
-                    /* first child with that name */
-                    next = find_child_by_name(cur_block, name);
-                }
-                if (!next) { free(name); if (label) free(label); return NULL; }
-                cur_block = next;
-
-                /* if an index was provided on an intermediate segment, interpret it as:
-                   select the Nth child with that name (0-based). This is a convenience:
-                     foo.bar[1].baz
-                   will select the second child block named "bar" under foo.
-                */
-                if (index >= 0) {
-                    /* walk children and select nth matching name */
-                    int seen = 0;
-                    Block *sel = NULL;
-                    for (Block *c = cur_block->parent ? cur_block->parent->children : top; c; c = c->next) {
-                        if (c->name && name && strcmp(c->name, name) == 0) {
-                            if (seen == index) { sel = c; break; }
-                            seen++;
-                        }
-                    }
-                    if (!sel) { if (name) free(name); if (label) free(label); return NULL; }
-                    cur_block = sel;
-                }
-            }
-        }
+/* ---------- parallel file loading ---------- */
 
-        if (name) free(name);
-        if (label) free(label);
-        p = q;
-        if (*p == '.') p++;
-    }
+/* Each parse owns its Parser and arena, so workers share nothing but the
+   next-file counter. Results land in out[] by index; order is preserved. */
+typedef struct ParseJob {
+    const char *const *paths;
+    AclBlock **out;
+    size_t n;
+    atomic_size_t next;
+    atomic_size_t ok;
+} ParseJob;
 
+static void *parse_worker(void *arg) {
+    ParseJob *job = arg;
+    for (;;) {
+        size_t i = atomic_fetch_add(&job->next, 1);
+        if (i >= job->n) break;
+        job->out[i] = acl_parse_file(job->paths[i]);
+        if (job->out[i]) atomic_fetch_add(&job->ok, 1);
+    }
     return NULL;
 }
 
-/* Updated typed getters that use the above function.
-   These return 1 on success, 0 otherwise.
-*/
+size_t acl_parse_files_parallel(const char *const *paths, size_t n, AclBlock **out, int threads) {
+    if (!paths || !out || n == 0) return 0;
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if ((size_t)threads > n) threads = (int)n;
 
-int acl_get_int(AclBlock *root, const char *path, long *out) {
-    if (!out) return 0;
-    AclValue *pv = acl_find_value_by_path(root, path);
-    if (!pv) return 0;
-    Value *v = (Value*)pv;
-    if (v->kind == VAL_INT) { *out = v->ival; return 1; }
-    return 0;
+    ParseJob job = { .paths = paths, .out = out, .n = n };
+    atomic_init(&job.next, 0);
+    atomic_init(&job.ok, 0);
+
+    pthread_t *tids = threads > 1 ? malloc(sizeof(pthread_t) * (size_t)(threads - 1)) : NULL;
+    int started = 0;
+    for (int t = 0; tids && t < threads - 1; ++t) {
+        if (pthread_create(&tids[t], NULL, parse_worker, &job) != 0) break;
+        started++;
+    }
+    /* the calling thread works too; if thread creation failed it does it all */
+    parse_worker(&job);
+    for (int t = 0; t < started; ++t) pthread_join(tids[t], NULL);
+    free(tids);
+    return atomic_load(&job.ok);
+}
+
+/* ---------- split parsing ---------- */
+
+/* One large file is parsed on several threads by cutting it into shards at
+   guessed top-level block boundaries: line starts that look like the first
+   block's name line (same indentation, then an identifier). Nothing is
+   scanned up front, as a serial pass over the file would cap the speedup;
+   instead the guesses are checked by the parse itself. Each shard has its
+   own parser and scratch tree, lexes from its start and parses top-level
+   blocks until one begins at or past the next shard's start. The lexer's
+   state is only its position, so when shard k-1 stopped at exactly the
+   token shard k began with, shard k read the same tokens a single parse
+   would. Shard 0 starts at the top, so by induction every shard is right.
+   A failed guess, or any parse error, falls back to a plain parse_all,
+   which also reports the error where a single parse would.
+
+   The shards are then stitched into shard 0's tree: their atoms are
+   adopted by its interner (a serial pass over distinct spellings only),
+   their nodes are rewritten to the canonical atoms in parallel, and their
+   arena chunks and expr programs are handed over. References are left for
+   acl_resolve_all, as after any parse. */
+
+#define SPLIT_MIN (256 * 1024) /* smallest shard worth a thread */
+
+typedef struct Shard {
+    const char *text;
+    size_t len;
+    size_t start, stop;  /* lex from start; parse blocks starting before stop */
+    Tree *tree;          /* shard 0: the result; others: merged into it */
+    Tree *into;
+    Block *head, *tail;
+    size_t first, end;   /* offsets of the first token and of the one it stopped at */
+    size_t lines;        /* newlines in [start, stop) */
+    int line_base;       /* added to the shard's line numbers, which count from start */
+    char **canon;        /* per slot of tree->atoms: the result's atom */
+    int ok;
+} Shard;
+
+/* run fn on every shard, one thread each; the caller takes shard 0 */
+static void shards_run(Shard *sh, size_t n, void *(*fn)(void *)) {
+    pthread_t *tids = malloc(sizeof(pthread_t) * n);
+    unsigned char *started = calloc(n, 1);
+    for (size_t k = 1; tids && started && k < n; ++k)
+        started[k] = pthread_create(&tids[k], NULL, fn, &sh[k]) == 0;
+    fn(&sh[0]);
+    for (size_t k = 1; k < n; ++k) {
+        if (started && started[k]) pthread_join(tids[k], NULL);
+        else fn(&sh[k]);
+    }
+    free(tids);
+    free(started);
+}
+
+static void *shard_parse(void *arg) {
+    Shard *S = arg;
+    TreeBuilder B;
+    memset(&B, 0, sizeof(B));
+    B.tail = &B.head;
+
+    Parser P;
+    memset(&P, 0, sizeof(P));
+    P.tree = S->tree;
+    P.arena = &S->tree->arena;
+    P.atoms = &S->tree->atoms;
+    P.sink = &tree_sink;
+    P.sink_ctx = &B;
+    P.quiet = 1;
+    lexer_reset(&P, S->text, S->len);
+    if (S->start) P.pos = P.src_start = P.line_pos = P.line_start = S->start;
+
+    if (setjmp(P.fail)) {
+        parser_release(&P);
+        free(B.blocks);
+        free(B.arrays);
+        return NULL;
+    }
+    S->first = cur_token(&P).pos;
+    parse_document(&P, S->stop);
+    S->end = cur_token(&P).pos;
+    parser_release(&P);
+    free(B.blocks);
+    free(B.arrays);
+
+    S->head = B.head;
+    for (Block *b = B.head; b; b = b->next) S->tail = b;
+    size_t lines = 0;
+    for (size_t i = S->start; i < S->stop; ++i) lines += S->text[i] == '\n';
+    S->lines = lines;
+    S->ok = 1;
+    return NULL;
+}
+
+/* the result's atom for an atom of the shard's tree */
+static char *shard_atom(const Shard *S, const char *s) {
+    if (!s) return NULL;
+    const Interner *in = &S->tree->atoms;
+    size_t i = atom_hash(s) & in->mask;
+    while (in->slots[i] != ATOM(s)) i = (i + 1) & in->mask;
+    return S->canon[i];
+}
+
+/* atoms in a value: ref segments, and an expr's text (operand refs in arr) */
+static void shard_value(const Shard *S, Value *v, int is_expr) {
+    if (v->kind == VAL_REF) {
+        v->ref->line += S->line_base;
+        for (RefSeg *s = v->ref->head; s; s = s->next) {
+            s->name = shard_atom(S, s->name);
+            s->index = shard_atom(S, s->index);
+        }
+    } else if (v->kind == VAL_STRING && is_expr) {
+        v->sval = shard_atom(S, v->sval);
+    }
+    for (size_t i = 0, n = value_nsub(v); i < n; ++i) shard_value(S, &v->arr[i], 0);
+}
+
+static void shard_blocks(const Shard *S, Block *list) {
+    for (Block *b = list; b; b = b->next) {
+        b->tree = S->into;
+        b->name = shard_atom(S, b->name);
+        b->label = shard_atom(S, b->label);
+        for (Field *f = b->fields; f; f = f->next) {
+            f->name = shard_atom(S, f->name);
+            shard_value(S, &f->value, f->type == TYPE_EXPR);
+        }
+        shard_blocks(S, b->children);
+    }
+}
+
+/* move the shard's nodes onto the result's atoms, then index them */
+static void *shard_finish(void *arg) {
+    Shard *S = arg;
+    if (S->tree != S->into) shard_blocks(S, S->head);
+    index_blocks(&S->tree->arena, S->head);
+    return NULL;
+}
+
+/* hand a finished shard's memory and expr programs to the result tree */
+static void shard_merge(Shard *S) {
+    Tree *into = S->into;
+    ArenaChunk *last = S->tree->arena.head;
+    if (last) {
+        while (last->next) last = last->next;
+        if (into->arena.head) {
+            /* behind the result's current chunk, which keeps serving allocations */
+            last->next = into->arena.head->next;
+            into->arena.head->next = S->tree->arena.head;
+        } else {
+            into->arena.head = S->tree->arena.head;
+        }
+        S->tree->arena.head = NULL;
+    }
+    const ExprCache *c = &S->tree->exprs;
+    for (size_t i = 0; c->slots && i <= c->mask; ++i) {
+        if (!c->slots[i].text) continue;
+        const char *text = shard_atom(S, c->slots[i].text);
+        ExprSlot *slot = expr_cache_slot(&into->exprs, text);
+        if (slot->text) continue;
+        *slot = (ExprSlot){ text, c->slots[i].prog };
+        into->exprs.count++;
+    }
+}
+
+/* first line start at or after `from` that begins with `indent` blanks and
+   an identifier; SIZE_MAX if there is none */
+static size_t split_guess(const char *s, size_t len, size_t from, size_t indent) {
+    size_t p = from;
+    for (;;) {
+        if (p > 0 && s[p - 1] != '\n') {
+            const char *nl = memchr(s + p, '\n', len - p);
+            if (!nl) return SIZE_MAX;
+            p = (size_t)(nl - s) + 1;
+        }
+        if (p + indent >= len) return SIZE_MAX;
+        size_t i = 0;
+        while (i < indent && (s[p + i] == ' ' || s[p + i] == '\t')) i++;
+        unsigned char c = (unsigned char)s[p + indent];
+        if (i == indent && (isalpha(c) || c == '_')) return p;
+        p++;
+    }
+}
+
+static Block *parse_split(const char *text, size_t len, int threads) {
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    size_t n = len / SPLIT_MIN;
+    if (n > (size_t)threads) n = (size_t)threads;
+    if (n < 2) return parse_all(text, len);
+
+    /* the first block's name line gives the indentation to look for */
+    Parser Q;
+    memset(&Q, 0, sizeof(Q));
+    lexer_reset(&Q, text, len);
+    size_t first = cur_token(&Q).pos, line = first;
+    while (line > Q.src_start && (text[line - 1] == ' ' || text[line - 1] == '\t')) line--;
+    if (line > Q.src_start && text[line - 1] != '\n') return parse_all(text, len);
+    size_t indent = first - line;
+
+    Shard *sh = calloc(n, sizeof(Shard));
+    if (!sh) return NULL;
+    size_t count = 1;
+    for (size_t k = 1; k < n; ++k) {
+        size_t cut = split_guess(text, len, len / n * k, indent);
+        if (cut == SIZE_MAX) break;
+        if (cut <= first || (count > 1 && cut <= sh[count - 1].start)) continue;
+        sh[count++].start = cut;
+    }
+    for (size_t k = 0; k < count; ++k) {
+        Shard *S = &sh[k];
+        S->text = text;
+        S->len = len;
+        S->stop = k + 1 < count ? sh[k + 1].start : len;
+        S->tree = calloc(1, sizeof(Tree));
+        S->into = sh[0].tree;
+        if (!S->tree) { count = k; goto fallback; }
+    }
+    shards_run(sh, count, shard_parse);
+
+    int line_base = 0;
+    for (size_t k = 0; k < count; ++k) {
+        if (!sh[k].ok || (k && sh[k - 1].end != sh[k].first)) goto fallback;
+        sh[k].line_base = line_base;
+        line_base += (int)sh[k].lines;
+    }
+
+    /* atoms: the result's interner takes each distinct spelling once */
+    Tree *tree = sh[0].tree;
+    for (size_t k = 1; k < count; ++k) {
+        const Interner *in = &sh[k].tree->atoms;
+        if (!in->slots) continue;
+        sh[k].canon = malloc((in->mask + 1) * sizeof(char *));
+        if (!sh[k].canon) goto fallback;
+        for (size_t i = 0; i <= in->mask; ++i)
+            if (in->slots[i]) sh[k].canon[i] = interner_adopt(&tree->atoms, in->slots[i]);
+    }
+    shards_run(sh, count, shard_finish);
+
+    Block *head = NULL, **tail = &head;
+    for (size_t k = 0; k < count; ++k) {
+        if (k) shard_merge(&sh[k]);
+        if (!sh[k].head) continue;
+        *tail = sh[k].head;
+        tail = &sh[k].tail->next;
+    }
+    for (size_t k = 1; k < count; ++k) {
+        free(sh[k].canon);
+        tree_destroy(sh[k].tree);
+    }
+    free(sh);
+    if (!head) {
+        tree_destroy(tree);
+        return NULL;
+    }
+    tree->blocks = head;
+    tree->top = index_build(&tree->arena, head, NULL);
+    return head;
+
+fallback:
+    for (size_t k = 0; k < count; ++k) {
+        free(sh[k].canon);
+        tree_destroy(sh[k].tree);
+    }
+    free(sh);
+    return parse_all(text, len);
+}
+
+AclBlock *acl_parse_file_parallel(const char *path, int threads) {
+    if (!path) return NULL;
+    Source src;
+    if (!source_open(path, &src, 1)) return NULL;
+    Block *root = parse_split(src.text, src.len, threads);
+    source_close(&src);
+    return (AclBlock*)root;
+}
+
+AclBlock *acl_parse_string_parallel(const char *text, int threads) {
+    if (!text) return NULL;
+    return (AclBlock*)parse_split(text, strlen(text), threads);
+}
+
+/* compiled images; see acl_open_compiled */
+static int is_image(const void *root);
+static void img_print_all(const char *base, FILE *out);
+static void img_close(char *base);
+
+int acl_resolve_all(AclBlock *root) {
+    if (!root) return 0;
+    if (is_image(root)) return 1; /* images are written resolved */
+    return resolve_all_refs((Block*)root) == 0;
+}
+
+int acl_resolve_on_demand(AclBlock *root) {
+    if (!root) return 0;
+    if (is_image(root)) return 1; /* resolved when it was compiled */
+    ((Block*)root)->tree->on_demand = 1;
+    return 1;
+}
+
+void acl_print(AclBlock *root, FILE *out) {
+    if (!root) return;
+    if (is_image(root)) { img_print_all((const char*)root, out ? out : stdout); return; }
+    print_all((Block*)root, out ? out : stdout);
+}
+
+void acl_free(AclBlock *root) {
+    if (!root) return;
+    if (is_image(root)) { img_close((char*)root); return; }
+    free_blocks((Block*)root);
+}
+
+void acl_error_free(AclError *err) {
+    if (!err) return;
+    if (err->message) free(err->message);
+    free(err);
+}
+
+/* ---------- live reload ---------- */
+
+/* acl_reload merges a fresh parse of the file into the live tree rather
+   than swapping trees, so unchanged nodes keep their addresses. Blocks are
+   matched by (name, label) and fields by name, the n-th occurrence of a key
+   pairing with the n-th. A matched field whose source hash differs takes
+   the new value; unmatched ones are added or dropped. Then only fields
+   whose result can differ are reset and resolved again: edited and added
+   fields, fields that (transitively) referred to an edited or dropped field
+   (Tree.deps), fields that failed before, and fields whose references
+   mention a block or field name that was added, dropped or reordered,
+   since a first-match lookup of it may now land elsewhere. Values replaced
+   stay in the arena until the tree is freed. */
+
+typedef enum { RL_EDITED, RL_ADDED, RL_DEPENDENT, RL_GONE } ReloadKind;
+
+/* a field to resolve again, or (RL_GONE) one dropped from the tree */
+typedef struct ReloadItem { Field *field; const Block *block; Value old; ReloadKind kind; } ReloadItem;
+
+/* a kept field whose value has references, with its new source */
+typedef struct ReloadPair { Field *field; const Block *block; const Field *src; } ReloadPair;
+
+typedef struct Reload {
+    Tree *tree;  /* the live tree */
+    ReloadItem *items; size_t nitems, items_cap;
+    ReloadPair *pairs; size_t npairs, pairs_cap;
+    size_t *moved; size_t moved_mask, moved_count;  /* atom hashes | 1; 0 is empty */
+    AclChange *changes; size_t nchanges, changes_cap;
+    int report;
+} Reload;
+
+static void *reload_xmalloc(size_t n) {
+    void *p = malloc(n ? n : 1);
+    if (!p) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+    return p;
+}
+
+static void reload_change(Reload *L, AclChangeKind kind, const Block *b, const Field *f) {
+    if (!L->report) return;
+    char *path = NULL;
+    size_t len = 0;
+    FILE *m = open_memstream(&path, &len);
+    if (!m) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+    print_field_path(b, f, m);
+    fclose(m);
+    if (!f && len && path[len - 1] == '.') path[len - 1] = '\0';
+    if (L->nchanges == L->changes_cap) L->changes = grow_vec(L->changes, &L->changes_cap, sizeof(AclChange));
+    L->changes[L->nchanges].kind = kind;
+    L->changes[L->nchanges].path = path;
+    L->nchanges++;
+}
+
+static void reload_item(Reload *L, Field *f, const Block *b, ReloadKind kind) {
+    if (L->nitems == L->items_cap) L->items = grow_vec(L->items, &L->items_cap, sizeof(ReloadItem));
+    L->items[L->nitems++] = (ReloadItem){ f, b, f->value, kind };
+}
+
+/* names and labels whose lookups may now find a different node */
+static void reload_moved_add(Reload *L, const char *atom) {
+    if (!atom) return;
+    if (!L->moved || (L->moved_count + 1) * 2 > L->moved_mask + 1) {
+        size_t cap = L->moved ? (L->moved_mask + 1) * 2 : 64;
+        size_t *slots = calloc(cap, sizeof(size_t));
+        if (!slots) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+        for (size_t i = 0; L->moved && i <= L->moved_mask; ++i) {
+            if (!L->moved[i]) continue;
+            size_t j = L->moved[i] & (cap - 1);
+            while (slots[j]) j = (j + 1) & (cap - 1);
+            slots[j] = L->moved[i];
+        }
+        free(L->moved);
+        L->moved = slots;
+        L->moved_mask = cap - 1;
+    }
+    size_t h = atom_hash(atom) | 1;
+    size_t i = h & L->moved_mask;
+    for (; L->moved[i]; i = (i + 1) & L->moved_mask) {
+        if (L->moved[i] == h) return;
+    }
+    L->moved[i] = h;
+    L->moved_count++;
+}
+
+/* by hash alone, so atoms of either tree work; a collision only costs an
+   extra re-resolution */
+static int reload_moved_has(const Reload *L, const char *atom) {
+    if (!L->moved || !atom) return 0;
+    size_t h = atom_hash(atom) | 1;
+    for (size_t i = h & L->moved_mask; L->moved[i]; i = (i + 1) & L->moved_mask) {
+        if (L->moved[i] == h) return 1;
+    }
+    return 0;
+}
+
+static int refs_moved(const Reload *L, const Value *v) {
+    if (v->kind == VAL_REF) {
+        for (const RefSeg *s = v->ref->head; s; s = s->next) {
+            if (reload_moved_has(L, s->is_index ? s->index : s->name)) return 1;
+        }
+        return 0;
+    }
+    for (size_t i = 0, n = value_nsub(v); i < n; ++i) {
+        if (refs_moved(L, &v->arr[i])) return 1;
+    }
+    return 0;
+}
+
+/* atom a of one tree spelled like atom b of another (either may be NULL) */
+static int same_atom(const char *a, const char *b) {
+    if (!a || !b) return a == b;
+    return ATOM(a)->hash == ATOM(b)->hash && ATOM(a)->len == ATOM(b)->len && memcmp(a, b, ATOM(a)->len) == 0;
+}
+
+/* the same reference, spelled in either tree */
+static int refs_equal(const Ref *a, const Ref *b) {
+    if (a->scope != b->scope || a->parent_levels != b->parent_levels) return 0;
+    const RefSeg *x = a->head, *y = b->head;
+    for (; x && y; x = x->next, y = y->next) {
+        if (x->is_index != y->is_index || !same_atom(x->name, y->name) || !same_atom(x->index, y->index)) return 0;
+    }
+    return !x && !y;
+}
+
+static int values_equal(const Value *a, const Value *b) {
+    if (a->kind != b->kind) return 0;
+    switch (a->kind) {
+        case VAL_INT: return a->ival == b->ival;
+        case VAL_FLOAT: return a->fval == b->fval;
+        case VAL_BOOL: return a->bval == b->bval;
+        case VAL_CHAR: return a->cval == b->cval;
+        case VAL_STRING: {
+            const char *x = value_str(a), *y = value_str(b);
+            return x == y || (x && y && strcmp(x, y) == 0);
+        }
+        case VAL_ARRAY:
+            if (a->arr_len != b->arr_len) return 0;
+            for (size_t i = 0; i < a->arr_len; ++i) {
+                if (!values_equal(&a->arr[i], &b->arr[i])) return 0;
+            }
+            return 1;
+        case VAL_REF: return refs_equal(a->ref, b->ref);
+    }
+    return 0;
+}
+
+/* copies from the new tree into the live one; names, ref segments and
+   expr texts become live atoms */
+static char *reload_atom(Reload *L, const char *atom) {
+    return atom ? intern(&L->tree->atoms, &L->tree->arena, atom, ATOM(atom)->len) : NULL;
+}
+
+static Value reload_value(Reload *L, const Value *src, int is_expr) {
+    Arena *a = &L->tree->arena;
+    Value v = *src;
+    if (v.kind == VAL_STRING && !v.small && v.sval) {
+        v.sval = is_expr ? reload_atom(L, v.sval) : arena_strndup(a, v.sval, strlen(v.sval));
+    } else if (v.kind == VAL_REF) {
+        Ref *r = arena_alloc(a, sizeof(Ref));
+        *r = *src->ref;
+        RefSeg **tail = &r->head;
+        for (const RefSeg *s = src->ref->head; s; s = s->next) {
+            RefSeg *c = s->is_index ? refseg_create_index(a, reload_atom(L, s->index))
+                                    : refseg_create_name(a, reload_atom(L, s->name));
+            *tail = c;
+            tail = &c->next;
+        }
+        v.ref = r;
+    }
+    if (value_nsub(&v)) {
+        v.arr = arena_alloc(a, v.arr_len * sizeof(Value));
+        for (size_t i = 0; i < v.arr_len; ++i) v.arr[i] = reload_value(L, &src->arr[i], 0);
+    }
+    return v;
+}
+
+static Field *reload_field(Reload *L, const Field *src) {
+    Field *f = arena_calloc(&L->tree->arena, sizeof(Field));
+    f->type = src->type;
+    f->name = reload_atom(L, src->name);
+    f->value = reload_value(L, &src->value, src->type == TYPE_EXPR);
+    f->src_hash = src->src_hash;
+    return f;
+}
+
+static Block *reload_block(Reload *L, const Block *src, Block *parent) {
+    Block *b = arena_calloc(&L->tree->arena, sizeof(Block));
+    b->name = reload_atom(L, src->name);
+    b->label = reload_atom(L, src->label);
+    b->parent = parent;
+    b->tree = L->tree;
+    Field **ft = &b->fields;
+    for (const Field *sf = src->fields; sf; sf = sf->next) {
+        *ft = reload_field(L, sf);
+        reload_item(L, *ft, b, RL_ADDED);
+        ft = &(*ft)->next;
+    }
+    Block **bt = &b->children;
+    for (const Block *c = src->children; c; c = c->next) {
+        *bt = reload_block(L, c, b);
+        bt = &(*bt)->next;
+    }
+    b->index = index_build(&L->tree->arena, b->children, b->fields);
+    return b;
+}
+
+static void reload_drop_block(Reload *L, Block *b) {
+    for (Field *f = b->fields; f; f = f->next) {
+        f->rstate = RS_GONE;
+        reload_item(L, f, b, RL_GONE);
+    }
+    for (Block *c = b->children; c; c = c->next) reload_drop_block(L, c);
+}
+
+/* take the new source for f and queue it for resolution */
+static void reload_reset(Reload *L, Field *f, const Block *b, const Field *src, ReloadKind kind) {
+    reload_item(L, f, b, kind);
+    f->type = src->type;
+    f->value = reload_value(L, &src->value, src->type == TYPE_EXPR);
+    f->src_hash = src->src_hash;
+    f->src = NULL;
+    f->rstate = RS_NONE;
+}
+
+/* edited: the source differs. The hash rules most fields out; equal hashes
+   are confirmed on the value as parsed (f->value until resolving replaced it) */
+static void reload_keep_field(Reload *L, Field *f, const Block *b, const Field *src) {
+    if (f->src_hash != src->src_hash || f->type != src->type
+        || !values_equal(f->src ? f->src : &f->value, &src->value)) {
+        reload_reset(L, f, b, src, RL_EDITED);
+        reload_change(L, ACL_CHANGE_MODIFIED, b, f);
+    } else if (value_has_refs(&src->value)) {
+        if (L->npairs == L->pairs_cap) L->pairs = grow_vec(L->pairs, &L->pairs_cap, sizeof(ReloadPair));
+        L->pairs[L->npairs++] = (ReloadPair){ f, b, src };
+    }
+}
+
+/* Matching for lists that differ: keys are live atoms, and a new key with
+   a NULL name (spelled in no live atom) matches nothing. match[k] gets
+   the old index paired with new key k, or SIZE_MAX; equal keys pair up in
+   order of appearance. */
+typedef struct ReloadKey { const char *name, *label; } ReloadKey;
+typedef struct ReloadSlot { ReloadKey key; size_t head; } ReloadSlot;
+
+static ReloadSlot *reload_slot(ReloadSlot *tab, size_t mask, ReloadKey k) {
+    size_t i = (atom_hash(k.name) * HASH_PRIME ^ (k.label ? atom_hash(k.label) : 0)) & mask;
+    while (tab[i].key.name && (tab[i].key.name != k.name || tab[i].key.label != k.label)) i = (i + 1) & mask;
+    return &tab[i];
+}
+
+static void reload_match(const ReloadKey *old, size_t nold, const ReloadKey *nw, size_t nnew, size_t *match) {
+    size_t cap = 16;
+    while (cap < nold * 2) cap <<= 1;
+    ReloadSlot *tab = calloc(cap, sizeof(ReloadSlot));
+    size_t *chain = reload_xmalloc(nold * sizeof(size_t));
+    if (!tab) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+    for (size_t i = nold; i-- > 0; ) {
+        ReloadSlot *s = reload_slot(tab, cap - 1, old[i]);
+        if (!s->key.name) { s->key = old[i]; s->head = SIZE_MAX; }
+        chain[i] = s->head;
+        s->head = i;
+    }
+    for (size_t k = 0; k < nnew; ++k) {
+        match[k] = SIZE_MAX;
+        if (!nw[k].name) continue;
+        ReloadSlot *s = reload_slot(tab, cap - 1, nw[k]);
+        if (!s->key.name || s->head == SIZE_MAX) continue;
+        match[k] = s->head;
+        s->head = chain[s->head];
+    }
+    free(tab);
+    free(chain);
+}
+
+/* key of the new tree's (name, label) in live atoms */
+static ReloadKey reload_key(const Reload *L, const char *name, const char *label) {
+    const Interner *in = &L->tree->atoms;
+    ReloadKey k = { interner_find_hashed(in, name, ATOM(name)->len, ATOM(name)->hash), NULL };
+    if (label) {
+        k.label = interner_find_hashed(in, label, ATOM(label)->len, ATOM(label)->hash);
+        if (!k.label) k.name = NULL;
+    }
+    return k;
+}
+
+/* Merge nb's fields into ob's. Returns 1 if fields were added, dropped or
+   reordered. */
+static int reload_fields(Reload *L, Block *ob, const Block *nb) {
+    Field *o = ob->fields, **tail = &ob->fields;
+    const Field *n = nb->fields;
+    /* common case: the same names in the same order */
+    while (o && n && same_atom(o->name, n->name)) {
+        reload_keep_field(L, o, ob, n);
+        tail = &o->next;
+        o = o->next;
+        n = n->next;
+    }
+    if (!o && !n) return 0;
+
+    size_t no = 0, nn = 0;
+    for (Field *f = o; f; f = f->next) no++;
+    for (const Field *f = n; f; f = f->next) nn++;
+    Field **olds = reload_xmalloc(no * sizeof(Field*));
+    ReloadKey *okeys = reload_xmalloc(no * sizeof(ReloadKey));
+    ReloadKey *nkeys = reload_xmalloc(nn * sizeof(ReloadKey));
+    size_t *match = reload_xmalloc(nn * sizeof(size_t));
+    for (size_t i = 0; o; o = o->next, ++i) { olds[i] = o; okeys[i] = (ReloadKey){ o->name, NULL }; }
+    const Field *nfirst = n;
+    for (size_t k = 0; n; n = n->next, ++k) nkeys[k] = reload_key(L, n->name, NULL);
+    reload_match(okeys, no, nkeys, nn, match);
+
+    n = nfirst;
+    for (size_t k = 0; k < nn; ++k, n = n->next) {
+        Field *f;
+        if (match[k] != SIZE_MAX) {
+            f = olds[match[k]];
+            olds[match[k]] = NULL;
+            reload_keep_field(L, f, ob, n);
+        } else {
+            f = reload_field(L, n);
+            reload_item(L, f, ob, RL_ADDED);
+            reload_change(L, ACL_CHANGE_ADDED, ob, f);
+            reload_moved_add(L, f->name);
+        }
+        *tail = f;
+        tail = &f->next;
+    }
+    *tail = NULL;
+    for (size_t i = 0; i < no; ++i) {
+        if (!olds[i]) continue;
+        olds[i]->rstate = RS_GONE;
+        reload_item(L, olds[i], ob, RL_GONE);
+        reload_change(L, ACL_CHANGE_REMOVED, ob, olds[i]);
+        reload_moved_add(L, olds[i]->name);
+    }
+    free(olds); free(okeys); free(nkeys); free(match);
+    return 1;
+}
+
+static void reload_block_merge(Reload *L, Block *ob, const Block *nb);
+
+/* Merge the new list nl into the live list *list (children of `parent`,
+   NULL at top level). Returns 1 if blocks were added, dropped or reordered. */
+static int reload_blocks(Reload *L, Block **list, const Block *nl, Block *parent) {
+    Block *o = *list, **tail = list;
+    const Block *n = nl;
+    while (o && n && same_atom(o->name, n->name) && same_atom(o->label, n->label)) {
+        reload_block_merge(L, o, n);
+        tail = &o->next;
+        o = o->next;
+        n = n->next;
+    }
+    if (!o && !n) return 0;
+
+    size_t no = 0, nn = 0;
+    for (Block *b = o; b; b = b->next) no++;
+    for (const Block *b = n; b; b = b->next) nn++;
+    Block **olds = reload_xmalloc(no * sizeof(Block*));
+    const Block **news = reload_xmalloc(nn * sizeof(Block*));
+    ReloadKey *okeys = reload_xmalloc(no * sizeof(ReloadKey));
+    ReloadKey *nkeys = reload_xmalloc(nn * sizeof(ReloadKey));
+    size_t *match = reload_xmalloc(nn * sizeof(size_t));
+    for (size_t i = 0; o; o = o->next, ++i) { olds[i] = o; okeys[i] = (ReloadKey){ o->name, o->label }; }
+    for (size_t k = 0; n; n = n->next, ++k) { news[k] = n; nkeys[k] = reload_key(L, n->name, n->label); }
+    reload_match(okeys, no, nkeys, nn, match);
+
+    int reordered = 0;
+    size_t next_min = 0;
+    for (size_t k = 0; k < nn; ++k) {
+        Block *b;
+        if (match[k] != SIZE_MAX) {
+            b = olds[match[k]];
+            olds[match[k]] = NULL;
+            if (match[k] < next_min) reordered = 1;
+            next_min = match[k] + 1;
+            reload_block_merge(L, b, news[k]);
+        } else {
+            b = reload_block(L, news[k], parent);
+            reload_change(L, ACL_CHANGE_ADDED, b, NULL);
+            reload_moved_add(L, b->name);
+            reload_moved_add(L, b->label);
+        }
+        *tail = b;
+        tail = &b->next;
+    }
+    *tail = NULL;
+    for (size_t i = 0; i < no; ++i) {
+        if (!olds[i]) continue;
+        reload_change(L, ACL_CHANGE_REMOVED, olds[i], NULL);
+        reload_moved_add(L, olds[i]->name);
+        reload_moved_add(L, olds[i]->label);
+        reload_drop_block(L, olds[i]);
+    }
+    if (reordered) {
+        /* first-match lookups over the tail may pick differently now */
+        for (size_t k = 0; k < nn; ++k) {
+            if (match[k] == SIZE_MAX) continue;
+            reload_moved_add(L, nkeys[k].name);
+            reload_moved_add(L, nkeys[k].label);
+        }
+    }
+    free(olds); free(news); free(okeys); free(nkeys); free(match);
+    return 1;
+}
+
+static void reload_block_merge(Reload *L, Block *ob, const Block *nb) {
+    int changed = reload_fields(L, ob, nb);
+    changed |= reload_blocks(L, &ob->children, nb->children, ob);
+    if (changed) ob->index = index_build(&L->tree->arena, ob->children, ob->fields);
+}
+
+static int ptr_cmp(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)a, y = (uintptr_t)b;
+    return x < y ? -1 : x > y;
+}
+static int pair_cmp(const void *a, const void *b) {
+    return ptr_cmp(((const ReloadPair*)a)->field, ((const ReloadPair*)b)->field);
+}
+static int dep_cmp(const void *a, const void *b) {
+    return ptr_cmp(((const FieldDep*)a)->to, ((const FieldDep*)b)->to);
+}
+
+/* Reset the kept fields whose result can change: failed ones, those whose
+   refs mention a moved name, and everything that depends on a reset or
+   dropped field. Then forget dependencies that are about to be re-recorded
+   or point at dropped fields. */
+static void reload_dependents(Reload *L) {
+    for (size_t i = 0; i < L->npairs; ++i) {
+        ReloadPair *p = &L->pairs[i];
+        if (p->field->rstate == RS_FAILED || refs_moved(L, &p->src->value))
+            reload_reset(L, p->field, p->block, p->src, RL_DEPENDENT);
+    }
+
+    DepList *deps = &L->tree->deps;
+    if (deps->count) qsort(deps->items, deps->count, sizeof(FieldDep), dep_cmp);
+    if (L->npairs) qsort(L->pairs, L->npairs, sizeof(ReloadPair), pair_cmp);
+    for (size_t i = 0; i < L->nitems; ++i) { /* grows as dependents are found */
+        if (L->items[i].kind == RL_ADDED) continue; /* nothing refers to it yet */
+        const Field *changed = L->items[i].field;
+        size_t lo = 0, hi = deps->count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (ptr_cmp(deps->items[mid].to, changed) < 0) lo = mid + 1; else hi = mid;
+        }
+        for (; lo < deps->count && deps->items[lo].to == changed; ++lo) {
+            Field *d = deps->items[lo].from;
+            if (d->rstate != RS_DONE && d->rstate != RS_FAILED) continue; /* reset or dropped */
+            ReloadPair key = { d, NULL, NULL };
+            ReloadPair *p = L->npairs ? bsearch(&key, L->pairs, L->npairs, sizeof(ReloadPair), pair_cmp) : NULL;
+            if (p) reload_reset(L, d, p->block, p->src, RL_DEPENDENT);
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < deps->count; ++i) {
+        const FieldDep *d = &deps->items[i];
+        if (d->from->rstate == RS_NONE || d->from->rstate == RS_GONE || d->to->rstate == RS_GONE) continue;
+        deps->items[kept++] = *d;
+    }
+    deps->count = kept;
+}
+
+int acl_reload(AclBlock **root, const char *path, AclChangeSet **changes) {
+    if (changes) *changes = NULL;
+    if (!root || !*root || !path) return -1;
+    Block *fresh = (Block*)acl_parse_file(path);
+    if (!fresh) return -1;
+
+    Reload L;
+    memset(&L, 0, sizeof(L));
+    L.report = changes != NULL;
+    int unresolved;
+    if (is_image(*root)) {
+        /* a mapped image can't be patched: the parsed tree replaces it */
+        unresolved = resolve_all_refs(fresh);
+        for (const Block *b = fresh; b; b = b->next) reload_change(&L, ACL_CHANGE_MODIFIED, b, NULL);
+        img_close((char*)*root);
+        *root = (AclBlock*)fresh;
+    } else {
+        Tree *live = ((Block*)*root)->tree;
+        L.tree = live;
+        /* merge against a fully parsed and resolved tree */
+        if (live->on_demand) resolve_all_refs(live->blocks);
+        if (reload_blocks(&L, &live->blocks, fresh, NULL)) live->top = index_build(&live->arena, live->blocks, NULL);
+        reload_dependents(&L);
+        unresolved = resolve_all_refs(live->blocks);
+        for (size_t i = 0; i < L.nitems; ++i) {
+            const ReloadItem *it = &L.items[i];
+            if (it->kind == RL_DEPENDENT && !values_equal(&it->old, &it->field->value))
+                reload_change(&L, ACL_CHANGE_MODIFIED, it->block, it->field);
+        }
+        free_blocks(fresh);
+        *root = (AclBlock*)live->blocks;
+    }
+    free(L.items);
+    free(L.pairs);
+    free(L.moved);
+
+    if (changes) {
+        AclChangeSet *cs = reload_xmalloc(sizeof(AclChangeSet));
+        cs->count = L.nchanges;
+        cs->items = L.changes;
+        *changes = cs;
+    }
+    return unresolved == 0;
+}
+
+void acl_changes_free(AclChangeSet *changes) {
+    if (!changes) return;
+    for (size_t i = 0; i < changes->count; ++i) free(changes->items[i].path);
+    free(changes->items);
+    free(changes);
+}
+
+/* ---------------------------
+   Array-index aware path lookup
+   ---------------------------
+   Supports segments like:
+     name
+     name["label"]
+     name[123]        -> numeric index selecting array element
+     ["label"]
+   Final segment may be a field with optional numeric index, e.g. field[2]
+*/
+
+/* One path segment as slices of the path text:
+   - name:  identifier or NULL
+   - label: the quoted label or NULL
+   - index: >=0 if a numeric index is present, -1 if not
+   Hashes are precomputed so a lookup only probes the tree's atom table.
+*/
+typedef struct PathSeg {
+    const char *name; size_t name_len; size_t name_hash;
+    const char *label; size_t label_len; size_t label_hash;
+    int index;
+} PathSeg;
+
+/* Parse the segment s[0..end). Returns 1 on success, 0 on parse error. */
+static int parse_segment_with_index(const char *s, const char *end, PathSeg *out) {
+    memset(out, 0, sizeof(*out));
+    out->index = -1;
+    /* skip leading whitespace */
+    while (s < end && isspace((unsigned char)*s)) s++;
+
+    /* optional name */
+    if (s < end && (isalpha((unsigned char)*s) || *s == '_')) {
+        const char *a = s++;
+        while (s < end && (isalnum((unsigned char)*s) || *s == '_')) s++;
+        out->name = a;
+        out->name_len = (size_t)(s - a);
+        out->name_hash = hash_mem(a, out->name_len);
+    }
+
+    /* skip whitespace */
+    while (s < end && isspace((unsigned char)*s)) s++;
+
+    /* zero or more indexers allowed; we only use the first meaningful one:
+       - ["label"]  -> set label
+       - [digits]   -> set index
+       If multiple are present (e.g., name["a"][0]) this parser treats the first index here;
+       the lookup routine consumes segments in order so multi-indexing across path segments should
+       be expressed using separate segments if needed.
+    */
+    if (s < end && *s == '[') {
+        s++;
+        while (s < end && isspace((unsigned char)*s)) s++;
+        if (s < end && *s == '"') {
+            /* label index */
+            s++;
+            const char *q = s;
+            while (q < end && *q != '"') q++;
+            if (q >= end) return 0;
+            out->label = s;
+            out->label_len = (size_t)(q - s);
+            out->label_hash = hash_mem(s, out->label_len);
+            s = q + 1;
+        } else if (s < end && isdigit((unsigned char)*s)) {
+            /* numeric index */
+            long idx = 0;
+            while (s < end && isdigit((unsigned char)*s)) {
+                idx = idx * 10 + (*s++ - '0');
+                if (idx > 0x7fffffffL) return 0;
+            }
+            out->index = (int)idx;
+        } else {
+            /* unsupported indexer content */
+            return 0;
+        }
+        while (s < end && isspace((unsigned char)*s)) s++;
+        if (s >= end || *s != ']') return 0;
+    }
+
+    return 1;
+}
+
+/* end of the segment starting at p: the next '.' outside brackets, or NUL */
+static const char *path_segment_end(const char *p) {
+    int in_br = 0;
+    for (; *p; ++p) {
+        if (*p == '[') in_br = 1;
+        else if (*p == ']') in_br = 0;
+        else if (!in_br && *p == '.') break;
+    }
+    return p;
+}
+
+/* Split `path` into segments. With segs == NULL only counts them.
+   Returns the number of segments, or -1 if the path is malformed
+   (empty segment, trailing '.', bad indexer). */
+static long path_split(const char *path, PathSeg *segs) {
+    long n = 0;
+    const char *p = path;
+    while (*p) {
+        const char *q = path_segment_end(p);
+        if (q == p) return -1;
+        PathSeg seg;
+        if (!parse_segment_with_index(p, q, segs ? &segs[n] : &seg)) return -1;
+        n++;
+        p = q;
+        if (*p == '.' && *++p == '\0') return -1;
+    }
+    return n;
+}
+
+/* Path segments are looked up as atoms: a spelling the tree never interned
+   can't match anything. *out is NULL when the segment has no such part. */
+static int path_atoms(const Block *top, const PathSeg *seg, const char **name, const char **label) {
+    const Interner *atoms = &top->tree->atoms;
+    *name = *label = NULL;
+    if (seg->name && !(*name = interner_find_hashed(atoms, seg->name, seg->name_len, seg->name_hash))) return 0;
+    if (seg->label && !(*label = interner_find_hashed(atoms, seg->label, seg->label_len, seg->label_hash))) return 0;
+    return 1;
+}
+
+/* The block segs[0..n) select, walking down from block `from`, or from
+   the top-level list `top` when from is NULL. NULL if there is none. */
+static Block *path_block(Block *top, Block *from, const PathSeg *segs, size_t n) {
+    Block *cur_block = from;
+
+    for (size_t i = 0; i < n; ++i) {
+        const PathSeg *seg = &segs[i];
+        /* a lazy block's names are interned when its body is parsed */
+        if (cur_block && cur_block->lazy) block_expand(cur_block);
+
+        const char *name, *label;
+        if (!path_atoms(top, seg, &name, &label)) return NULL;
+        int index = seg->index;
+
+        if (!cur_block) {
+            /* selecting a top-level block */
+            if (name) {
+                /* find first top-level block with matching name */
+                cur_block = list_find_name(top, name);
+                if (!cur_block) return NULL;
+                /* if label present select child with that label under this block name (rare at top-level) */
+                if (label) {
+                    cur_block = find_child_by_name_and_label(cur_block, name, label);
+                    if (!cur_block) return NULL;
+                }
+            } else {
+                /* no name, label provided: find first top-level block with matching label */
+                if (label) cur_block = list_find_label(top, label);
+                if (!cur_block) return NULL;
+            }
+        } else {
+            /* intermediate segment: select child block by name/label */
+            Block *next = NULL;
+            if (label && name) {
+                next = find_child_by_name_and_label(cur_block, name, label);
+            } else if (label && !name) {
+                /* choose first child whose label matches */
+                next = list_find_label(block_children(cur_block), label);
+            } else if (name && !label) {
+                /* first child with that name */
+                next = find_child_by_name(cur_block, name);
+            }
+            if (!next) return NULL;
+            cur_block = next;
+
+            /* if an index was provided on an intermediate segment, interpret it as:
+               select the Nth child with that name (0-based). This is a convenience:
+                 foo.bar[1].baz
+               will select the second child block named "bar" under foo.
+            */
+            if (index >= 0) {
+                /* walk children and select nth matching name */
+                int seen = 0;
+                Block *sel = NULL;
+                for (Block *c = cur_block->parent ? cur_block->parent->children : top; c; c = c->next) {
+                    if (name && c->name == name) {
+                        if (seen == index) { sel = c; break; }
+                        seen++;
+                    }
+                }
+                if (!sel) return NULL;
+                cur_block = sel;
+            }
+        }
+    }
+    return cur_block;
+}
+
+/* The field segment `seg` names in block b (a tree with top-level list
+   `top`), or with an index the array element; NULL if there is none. */
+static Value *path_field(Block *top, Block *b, const PathSeg *seg) {
+    if (b->lazy) block_expand(b);
+    const char *name, *label;
+    if (!path_atoms(top, seg, &name, &label) || !name) return NULL;
+    Field *f = find_field_in_block(b, name);
+    if (!f) return NULL;
+    if (f->rstate == RS_NONE && top->tree->on_demand) resolve_on_demand(f, b);
+    if (seg->index < 0) return &f->value;
+    /* field must be array and index in-bounds; return pointer to element Value */
+    if (f->value.kind != VAL_ARRAY) return NULL;
+    if ((size_t)seg->index >= f->value.arr_len) return NULL;
+    return &f->value.arr[seg->index];
+}
+
+/* Walk segs[0..n) from the top-level list `top`. Returns the Value the path
+   names, or NULL. The last segment must name a field (optionally indexed
+   into an array); the ones before it select blocks. */
+static Value *path_walk(Block *top, const PathSeg *segs, size_t n) {
+    if (!top || n < 2) return NULL;
+    Block *b = path_block(top, NULL, segs, n - 1);
+    return b ? path_field(top, b, &segs[n - 1]) : NULL;
+}
+
+/* Find a Value* given a path with optional numeric indexing.
+   Returns pointer to Value inside tree (do not free) or NULL if not found/parse error.
+   Short paths are split on the stack; use acl_path_compile for repeated lookups.
+*/
+struct ImgValue;
+static const struct ImgValue *img_walk(const char *base, const PathSeg *segs, size_t n);
+
+AclValue *acl_find_value_by_path(AclBlock *root, const char *path) {
+    if (!root || !path) return NULL;
+    PathSeg local[16];
+    long n = path_split(path, NULL);
+    if (n < 0) return NULL;
+    PathSeg *segs = (size_t)n <= sizeof(local) / sizeof(local[0]) ? local : malloc(sizeof(PathSeg) * (size_t)n);
+    if (!segs) return NULL;
+    path_split(path, segs);
+    void *v = is_image(root) ? (void*)img_walk((const char*)root, segs, (size_t)n)
+                             : (void*)path_walk((Block*)root, segs, (size_t)n);
+    if (segs != local) free(segs);
+    return (AclValue*)v;
+}
+
+/* ---------- compiled paths ---------- */
+
+/* One allocation: the header, the segment array, then a private copy of
+   the path text the segments point into. Nothing in it refers to a tree,
+   so a handle works against any tree. */
+struct AclPath {
+    size_t nsegs;
+    PathSeg *segs;
+};
+
+AclPath *acl_path_compile(const char *path) {
+    if (!path) return NULL;
+    long n = path_split(path, NULL);
+    if (n < 2) return NULL; /* malformed, or can't name a field */
+    size_t textlen = strlen(path) + 1;
+    size_t segoff = (sizeof(AclPath) + alignof(PathSeg) - 1) & ~(alignof(PathSeg) - 1);
+    size_t textoff = segoff + sizeof(PathSeg) * (size_t)n;
+    char *mem = malloc(textoff + textlen);
+    if (!mem) return NULL;
+    AclPath *p = (AclPath*)mem;
+    p->nsegs = (size_t)n;
+    p->segs = (PathSeg*)(mem + segoff);
+    char *text = memcpy(mem + textoff, path, textlen);
+    path_split(text, p->segs);
+    return p;
+}
+
+void acl_path_free(AclPath *p) {
+    free(p);
+}
+
+AclValue *acl_path_lookup(AclBlock *root, const AclPath *p) {
+    if (!root || !p) return NULL;
+    if (is_image(root)) return (AclValue*)img_walk((const char*)root, p->segs, p->nsegs);
+    return (AclValue*)path_walk((Block*)root, p->segs, p->nsegs);
+}
+
+/* ---------- compiled images (.aclb) ---------- */
+
+/* A compiled image is a resolved tree laid out for mmap. It holds no
+   pointers, only u32 offsets from the start of the image, so it can be
+   mapped anywhere and queried without parsing or allocating:
+
+     header    ImgHeader (magic, versions, source and image hashes)
+     blocks    ImgBlock followed by its ImgField array
+     lists     ImgList: child count, index offset, child block offsets
+     indexes   (hash, offset) tables laid out like BlockIndex
+     strings   u32 length, bytes, NUL; each distinct string stored once
+     arrays    runs of ImgValue; arrays shared in the tree stay shared
+
+   ImgValue kinds have VAL_IMAGE set, which is how the value accessors tell
+   them from tree Values. Their string and array payloads are self-relative
+   offsets, so reading a value never needs the image base.
+
+   An image records the hash and length of the source text it was built
+   from; acl_open_compiled refuses it when the source no longer matches. */
+
+#define VAL_IMAGE 0x100u
+#define IMG_MAGIC "\xac" "ACLB\r\n\x1a"
+#define IMG_VERSION 1u
+#define IMG_BOM 0x01020304u
+
+typedef struct ImgHeader {
+    unsigned char magic[8];
+    uint32_t version;
+    uint32_t bom;          /* byte order of the writer */
+    uint32_t word;         /* sizeof(size_t): index hashes come from hash_mem */
+    uint32_t top;          /* ImgList of top-level blocks */
+    uint64_t file_size;
+    uint64_t source_hash;  /* hash_mem of the source text */
+    uint64_t source_len;
+    uint64_t image_hash;   /* hash_mem of everything after the header */
+} ImgHeader;
+
+typedef struct ImgValue {
+    uint32_t kind;         /* VAL_IMAGE | ValKind */
+    uint32_t len;          /* string length / array element count */
+    union { int64_t i; double f; int64_t rel; } u;
+} ImgValue;
+
+typedef struct ImgField { uint32_t name; uint32_t type; ImgValue value; } ImgField;
+
+typedef struct ImgBlock {
+    uint32_t name, label;  /* string offsets; label 0 = none */
+    uint32_t parent;       /* 0 for top-level blocks */
+    uint32_t children;     /* ImgList, 0 = no children */
+    uint32_t nfields;
+    uint32_t field_index;  /* ImgIndex over field names, 0 = scan */
+    ImgField fields[];
+} ImgBlock;
+
+typedef struct ImgList { uint32_t count; uint32_t index; uint32_t items[]; } ImgList;
+
+/* index tables: mask + 1 slots each; a list index holds names, pairs and
+   labels tables back to back, a field index just one */
+typedef struct ImgSlot { uint32_t hash; uint32_t item; } ImgSlot;
+typedef struct ImgIndex { uint32_t mask; uint32_t pad; ImgSlot slots[]; } ImgIndex;
+
+static int is_image(const void *root) {
+    return root && *(const unsigned char *)root == (unsigned char)IMG_MAGIC[0];
+}
+
+static uint32_t value_kind(const void *v) {
+    uint32_t k;
+    memcpy(&k, v, sizeof(k));
+    return k;
+}
+
+/* ---- reading ---- */
+
+static const char *img_str(const char *base, uint32_t off) { return off ? base + off : NULL; }
+static uint32_t img_strlen(const char *base, uint32_t off) { uint32_t n; memcpy(&n, base + off - 4, 4); return n; }
+static int img_str_eq(const char *base, uint32_t off, const char *s, size_t n) {
+    return off && img_strlen(base, off) == n && memcmp(base + off, s, n) == 0;
+}
+
+static const ImgBlock *img_block(const char *base, uint32_t off) { return (const ImgBlock *)(base + off); }
+static const ImgList *img_list(const char *base, uint32_t off) { return off ? (const ImgList *)(base + off) : NULL; }
+static const ImgValue *img_payload(const ImgValue *v) { return (const ImgValue *)((const char *)v + v->u.rel); }
+
+enum { IMG_NAME, IMG_PAIR, IMG_LABEL };
+
+static int img_block_match(const char *base, uint32_t off, int kind, const PathSeg *seg) {
+    const ImgBlock *b = img_block(base, off);
+    if (kind != IMG_LABEL && !img_str_eq(base, b->name, seg->name, seg->name_len)) return 0;
+    if (kind != IMG_NAME && !img_str_eq(base, b->label, seg->label, seg->label_len)) return 0;
+    return 1;
+}
+
+/* first block in the list matching seg by name, (name, label) or label */
+static uint32_t img_list_find(const char *base, uint32_t list_off, int kind, const PathSeg *seg) {
+    const ImgList *l = img_list(base, list_off);
+    if (!l) return 0;
+    if (l->index) {
+        const ImgIndex *ix = (const ImgIndex *)(base + l->index);
+        size_t h = kind == IMG_NAME ? seg->name_hash
+                 : kind == IMG_LABEL ? seg->label_hash
+                 : seg->name_hash * HASH_PRIME ^ seg->label_hash;
+        const ImgSlot *t = ix->slots + (size_t)kind * (ix->mask + 1);
+        for (uint32_t i = (uint32_t)h & ix->mask; t[i].item; i = (i + 1) & ix->mask) {
+            if (t[i].hash == (uint32_t)h && img_block_match(base, t[i].item, kind, seg)) return t[i].item;
+        }
+        return 0;
+    }
+    for (uint32_t i = 0; i < l->count; ++i) {
+        if (img_block_match(base, l->items[i], kind, seg)) return l->items[i];
+    }
+    return 0;
+}
+
+static const ImgField *img_field_find(const char *base, const ImgBlock *b, const PathSeg *seg) {
+    if (b->field_index) {
+        const ImgIndex *ix = (const ImgIndex *)(base + b->field_index);
+        for (uint32_t i = (uint32_t)seg->name_hash & ix->mask; ix->slots[i].item; i = (i + 1) & ix->mask) {
+            const ImgField *f = (const ImgField *)(base + ix->slots[i].item);
+            if (ix->slots[i].hash == (uint32_t)seg->name_hash && img_str_eq(base, f->name, seg->name, seg->name_len)) return f;
+        }
+        return NULL;
+    }
+    for (uint32_t i = 0; i < b->nfields; ++i) {
+        if (img_str_eq(base, b->fields[i].name, seg->name, seg->name_len)) return &b->fields[i];
+    }
+    return NULL;
+}
+
+/* path_walk for images: same segment rules as the tree walk */
+/* the block segs[0..n) select, from block offset `from` or (0) the
+   top-level list; 0 if there is none */
+static uint32_t img_path_block(const char *base, uint32_t from, const PathSeg *segs, size_t n) {
+    const ImgHeader *h = (const ImgHeader *)base;
+    uint32_t cur = from;
+
+    for (size_t i = 0; i < n; ++i) {
+        const PathSeg *seg = &segs[i];
+        int has_name = seg->name != NULL, has_label = seg->label != NULL;
+
+        if (!cur) {
+            if (has_name) {
+                cur = img_list_find(base, h->top, IMG_NAME, seg);
+                if (cur && has_label) cur = img_list_find(base, img_block(base, cur)->children, IMG_PAIR, seg);
+            } else if (has_label) {
+                cur = img_list_find(base, h->top, IMG_LABEL, seg);
+            }
+            if (!cur) return 0;
+        } else {
+            uint32_t children = img_block(base, cur)->children;
+            uint32_t next = 0;
+            if (has_name && has_label) next = img_list_find(base, children, IMG_PAIR, seg);
+            else if (has_label) next = img_list_find(base, children, IMG_LABEL, seg);
+            else if (has_name) next = img_list_find(base, children, IMG_NAME, seg);
+            if (!next) return 0;
+
+            /* name[N] on an intermediate segment: the Nth child with that name */
+            if (seg->index >= 0) {
+                if (!has_name) return 0;
+                const ImgList *l = img_list(base, children);
+                int seen = 0;
+                next = 0;
+                for (uint32_t k = 0; l && k < l->count; ++k) {
+                    if (!img_block_match(base, l->items[k], IMG_NAME, seg)) continue;
+                    if (seen++ == seg->index) { next = l->items[k]; break; }
+                }
+                if (!next) return 0;
+            }
+            cur = next;
+        }
+    }
+    return cur;
+}
+
+/* the field (or array element) segment `seg` names in block `cur` */
+static const ImgValue *img_path_field(const char *base, uint32_t cur, const PathSeg *seg) {
+    if (!seg->name) return NULL;
+    const ImgField *f = img_field_find(base, img_block(base, cur), seg);
+    if (!f) return NULL;
+    if (seg->index < 0) return &f->value;
+    if (f->value.kind != (VAL_IMAGE | VAL_ARRAY) || (uint32_t)seg->index >= f->value.len) return NULL;
+    return img_payload(&f->value) + seg->index;
+}
+
+static const ImgValue *img_walk(const char *base, const PathSeg *segs, size_t n) {
+    if (n < 2) return NULL;
+    uint32_t cur = img_path_block(base, 0, segs, n - 1);
+    return cur ? img_path_field(base, cur, &segs[n - 1]) : NULL;
+}
+
+static void img_print_value(const ImgValue *v, FILE *out) {
+    switch (v->kind & ~VAL_IMAGE) {
+        case VAL_INT: fprintf(out, "%ld", (long)v->u.i); break;
+        case VAL_FLOAT: fprintf(out, "%g", v->u.f); break;
+        case VAL_BOOL: fputs(v->u.i ? "true" : "false", out); break;
+        case VAL_STRING: fprintf(out, "\"%s\"", (const char *)v + v->u.rel); break;
+        case VAL_CHAR: {
+            Value c; memset(&c, 0, sizeof(c));
+            c.kind = VAL_CHAR; c.cval = (int)v->u.i;
+            print_value(&c, out);
+            break;
+        }
+        case VAL_ARRAY: {
+            fprintf(out, "[");
+            for (uint32_t i = 0; i < v->len; ++i) {
+                if (i) fprintf(out, ", ");
+                img_print_value(img_payload(v) + i, out);
+            }
+            fprintf(out, "]");
+            break;
+        }
+    }
+}
+
+/* same output as print_block */
+static void img_print_block(const char *base, uint32_t off, int indent, FILE *out) {
+    const ImgBlock *b = img_block(base, off);
+    for (int i = 0; i < indent; ++i) fprintf(out, "  ");
+    if (b->label) fprintf(out, "Block: %s  label: \"%s\"\n", img_str(base, b->name), img_str(base, b->label));
+    else fprintf(out, "Block: %s\n", img_str(base, b->name));
+    for (uint32_t k = 0; k < b->nfields; ++k) {
+        const ImgField *f = &b->fields[k];
+        for (int i = 0; i < indent; ++i) fprintf(out, "  ");
+        fprintf(out, "  Field: %s  ", img_str(base, f->name));
+        fprintf(out, "(type: %s)  ", TYPE_NAMES[f->type]);
+        fprintf(out, "value: ");
+        img_print_value(&f->value, out);
+        fprintf(out, "\n");
+    }
+    const ImgList *l = img_list(base, b->children);
+    for (uint32_t k = 0; l && k < l->count; ++k) img_print_block(base, l->items[k], indent + 1, out);
+}
+
+static void img_print_all(const char *base, FILE *out) {
+    const ImgList *l = img_list(base, ((const ImgHeader *)base)->top);
+    for (uint32_t k = 0; l && k < l->count; ++k) {
+        img_print_block(base, l->items[k], 0, out);
+        fprintf(out, "\n");
+    }
+}
+
+/* ---- writing ---- */
+
+typedef struct ImgShared { const Value *arr; uint32_t off; } ImgShared;
+
+typedef struct ImgWriter {
+    char *buf;
+    size_t len, cap;
+    int failed;              /* unresolved ref, or image over 4 GiB */
+
+    /* each distinct string once: offsets of the string bytes, by content */
+    uint32_t *strs; size_t strs_mask, nstrs;
+
+    /* arrays shared in the tree: element storage -> image offset */
+    struct ImgShared *arrs; size_t arrs_mask, narrs;
+} ImgWriter;
+
+static uint32_t img_reserve(ImgWriter *W, size_t n, size_t align) {
+    size_t at = (W->len + align - 1) & ~(align - 1);
+    if (at + n > UINT32_MAX) { W->failed = 1; return 0; }
+    if (at + n > W->cap) {
+        size_t cap = W->cap ? W->cap : 4096;
+        while (cap < at + n) cap *= 2;
+        char *nb = realloc(W->buf, cap);
+        if (!nb) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+        W->buf = nb;
+        W->cap = cap;
+    }
+    memset(W->buf + W->len, 0, at + n - W->len);
+    W->len = at + n;
+    return (uint32_t)at;
+}
+
+static void img_u32(ImgWriter *W, uint32_t at, uint32_t v) { memcpy(W->buf + at, &v, 4); }
+
+/* offset of the bytes of s in the image, written on first use */
+static uint32_t img_put_str(ImgWriter *W, const char *s) {
+    size_t n = strlen(s);
+    size_t h = hash_mem(s, n);
+    if (W->nstrs * 2 >= W->strs_mask) {
+        size_t cap = W->strs_mask ? (W->strs_mask + 1) * 2 : 1024;
+        uint32_t *t = calloc(cap, sizeof(uint32_t));
+        if (!t) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+        for (size_t i = 0; W->strs && i <= W->strs_mask; ++i) {
+            uint32_t off = W->strs[i];
+            if (!off) continue;
+            size_t j = hash_mem(W->buf + off, img_strlen(W->buf, off)) & (cap - 1);
+            while (t[j]) j = (j + 1) & (cap - 1);
+            t[j] = off;
+        }
+        free(W->strs);
+        W->strs = t;
+        W->strs_mask = cap - 1;
+    }
+    size_t i = h & W->strs_mask;
+    for (; W->strs[i]; i = (i + 1) & W->strs_mask) {
+        if (img_str_eq(W->buf, W->strs[i], s, n)) return W->strs[i];
+    }
+    if (n > UINT32_MAX) { W->failed = 1; return 0; }
+    uint32_t at = img_reserve(W, 4 + n + 1, 4);
+    if (W->failed) return 0;
+    img_u32(W, at, (uint32_t)n);
+    memcpy(W->buf + at + 4, s, n + 1);
+    W->strs[i] = at + 4;
+    W->nstrs++;
+    return at + 4;
+}
+
+static uint32_t *img_shared_array(ImgWriter *W, const Value *arr) {
+    if (W->narrs * 2 >= W->arrs_mask) {
+        size_t cap = W->arrs_mask ? (W->arrs_mask + 1) * 2 : 64;
+        ImgShared *nt = calloc(cap, sizeof(ImgShared));
+        if (!nt) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+        for (size_t i = 0; W->arrs && i <= W->arrs_mask; ++i) {
+            if (!W->arrs[i].arr) continue;
+            size_t j = ((uintptr_t)W->arrs[i].arr >> 4) & (cap - 1);
+            while (nt[j].arr) j = (j + 1) & (cap - 1);
+            nt[j] = W->arrs[i];
+        }
+        free(W->arrs);
+        W->arrs = nt;
+        W->arrs_mask = cap - 1;
+    }
+    size_t i = ((uintptr_t)arr >> 4) & W->arrs_mask;
+    for (; W->arrs[i].arr; i = (i + 1) & W->arrs_mask) {
+        if (W->arrs[i].arr == arr) return &W->arrs[i].off;
+    }
+    W->arrs[i].arr = arr;
+    W->arrs[i].off = 0;
+    W->narrs++;
+    return &W->arrs[i].off;
+}
+
+/* write v as the ImgValue at offset `at` (already reserved) */
+static void img_put_value(ImgWriter *W, uint32_t at, const Value *v) {
+    ImgValue iv;
+    memset(&iv, 0, sizeof(iv));
+    iv.kind = VAL_IMAGE | (uint32_t)v->kind;
+    switch (v->kind) {
+        case VAL_INT: iv.u.i = v->ival; break;
+        case VAL_FLOAT: iv.u.f = v->fval; break;
+        case VAL_BOOL: iv.u.i = v->bval; break;
+        case VAL_CHAR: iv.u.i = v->cval; break;
+        case VAL_STRING: {
+            const char *s = value_str(v) ? value_str(v) : "";
+            iv.len = (uint32_t)strlen(s);
+            iv.u.rel = (int64_t)img_put_str(W, s) - at;
+            break;
+        }
+        case VAL_ARRAY: {
+            iv.len = (uint32_t)v->arr_len;
+            if (!v->arr_len) break;
+            uint32_t *shared = img_shared_array(W, v->arr);
+            if (!*shared) {
+                uint32_t elems = img_reserve(W, v->arr_len * sizeof(ImgValue), 8);
+                if (W->failed) return;
+                *shared = elems;
+                for (size_t i = 0; i < v->arr_len; ++i)
+                    img_put_value(W, elems + (uint32_t)(i * sizeof(ImgValue)), &v->arr[i]);
+            }
+            iv.u.rel = (int64_t)*shared - at;
+            break;
+        }
+        case VAL_REF:
+            W->failed = 1; /* only resolved trees can be compiled */
+            return;
+    }
+    memcpy(W->buf + at, &iv, sizeof(iv));
+}
+
+/* keys of an already written item, as string offsets; strings are stored
+   once, so equal offsets mean equal keys */
+static void img_item_keys(const ImgWriter *W, int is_field, uint32_t item, uint32_t *name, uint32_t *label) {
+    if (is_field) { ImgField f; memcpy(&f, W->buf + item, sizeof(f)); *name = f.name; *label = 0; return; }
+    ImgBlock b; memcpy(&b, W->buf + item, sizeof(b));
+    *name = b.name;
+    *label = b.label;
+}
+
+/* insert into table `t` unless the key is already present (first one wins) */
+static void img_index_put(ImgWriter *W, uint32_t t, uint32_t mask, int is_field, int kind,
+                          size_t h, uint32_t item, uint32_t name, uint32_t label) {
+    ImgSlot s;
+    uint32_t i = (uint32_t)h & mask;
+    for (;; i = (i + 1) & mask) {
+        memcpy(&s, W->buf + t + i * sizeof(ImgSlot), sizeof(s));
+        if (!s.item) break;
+        if (s.hash != (uint32_t)h) continue;
+        uint32_t n2, l2;
+        img_item_keys(W, is_field, s.item, &n2, &l2);
+        if ((kind == IMG_LABEL || n2 == name) && (kind == IMG_NAME || l2 == label)) return;
+    }
+    s.hash = (uint32_t)h;
+    s.item = item;
+    memcpy(W->buf + t + i * sizeof(ImgSlot), &s, sizeof(s));
+}
+
+static uint32_t img_index_new(ImgWriter *W, size_t n, int tables, uint32_t *mask) {
+    size_t cap = 16;
+    while (cap < n * 2) cap <<= 1;
+    uint32_t at = img_reserve(W, sizeof(ImgIndex) + (size_t)tables * cap * sizeof(ImgSlot), 8);
+    *mask = (uint32_t)(cap - 1);
+    if (!W->failed) img_u32(W, at + offsetof(ImgIndex, mask), *mask);
+    return at;
 }
 
-int acl_get_float(AclBlock *root, const char *path, double *out) {
-    if (!out) return 0;
-    AclValue *pv = acl_find_value_by_path(root, path);
-    if (!pv) return 0;
-    Value *v = (Value*)pv;
+static uint32_t img_put_list(ImgWriter *W, const Block *list, uint32_t parent);
+
+static uint32_t img_put_block(ImgWriter *W, const Block *b, uint32_t parent) {
+    size_t nfields = 0;
+    for (const Field *f = b->fields; f; f = f->next) nfields++;
+    uint32_t at = img_reserve(W, sizeof(ImgBlock) + nfields * sizeof(ImgField), 8);
+    if (W->failed) return 0;
+
+    ImgBlock hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.name = img_put_str(W, b->name);
+    hdr.label = b->label ? img_put_str(W, b->label) : 0;
+    hdr.parent = parent;
+    hdr.nfields = (uint32_t)nfields;
+
+    size_t k = 0;
+    for (const Field *f = b->fields; f; f = f->next, ++k) {
+        uint32_t fo = at + (uint32_t)(offsetof(ImgBlock, fields) + k * sizeof(ImgField));
+        img_u32(W, fo + offsetof(ImgField, name), img_put_str(W, f->name));
+        img_u32(W, fo + offsetof(ImgField, type), (uint32_t)f->type);
+        img_put_value(W, fo + offsetof(ImgField, value), &f->value);
+        if (W->failed) return 0;
+    }
+
+    if (nfields >= INDEX_MIN) {
+        uint32_t mask;
+        hdr.field_index = img_index_new(W, nfields, 1, &mask);
+        if (W->failed) return 0;
+        for (k = 0; k < nfields; ++k) {
+            uint32_t fo = at + (uint32_t)(offsetof(ImgBlock, fields) + k * sizeof(ImgField));
+            uint32_t name, label;
+            img_item_keys(W, 1, fo, &name, &label);
+            img_index_put(W, hdr.field_index + offsetof(ImgIndex, slots), mask, 1, IMG_NAME,
+                          hash_mem(W->buf + name, img_strlen(W->buf, name)), fo, name, 0);
+        }
+    }
+
+    hdr.children = img_put_list(W, b->children, at);
+    if (W->failed) return 0;
+    memcpy(W->buf + at, &hdr, sizeof(hdr));
+    return at;
+}
+
+static uint32_t img_put_list(ImgWriter *W, const Block *list, uint32_t parent) {
+    size_t count = 0;
+    for (const Block *c = list; c; c = c->next) count++;
+    if (!count) return 0;
+
+    uint32_t *items = malloc(count * sizeof(uint32_t));
+    if (!items) { fprintf(stderr, "acl: out of memory\n"); exit(1); }
+    size_t k = 0;
+    for (const Block *c = list; c; c = c->next) items[k++] = img_put_block(W, c, parent);
+
+    uint32_t at = img_reserve(W, sizeof(ImgList) + count * sizeof(uint32_t), 4);
+    if (!W->failed) {
+        img_u32(W, at + offsetof(ImgList, count), (uint32_t)count);
+        memcpy(W->buf + at + offsetof(ImgList, items), items, count * sizeof(uint32_t));
+    }
+    if (!W->failed && count >= INDEX_MIN) {
+        uint32_t mask;
+        uint32_t ix = img_index_new(W, count, 3, &mask);
+        img_u32(W, at + offsetof(ImgList, index), ix);
+        uint32_t t = ix + offsetof(ImgIndex, slots);
+        size_t tsize = (size_t)(mask + 1) * sizeof(ImgSlot);
+        for (k = 0; !W->failed && k < count; ++k) {
+            uint32_t name, label;
+            img_item_keys(W, 0, items[k], &name, &label);
+            size_t hn = hash_mem(W->buf + name, img_strlen(W->buf, name));
+            img_index_put(W, t, mask, 0, IMG_NAME, hn, items[k], name, 0);
+            if (!label) continue;
+            size_t hl = hash_mem(W->buf + label, img_strlen(W->buf, label));
+            img_index_put(W, t + (uint32_t)tsize, mask, 0, IMG_PAIR, hn * HASH_PRIME ^ hl, items[k], name, label);
+            img_index_put(W, t + (uint32_t)(2 * tsize), mask, 0, IMG_LABEL, hl, items[k], 0, label);
+        }
+    }
+    free(items);
+    return at;
+}
+
+/* hash and length of a source file, read through mmap */
+static int source_digest(const char *path, uint64_t *hash, uint64_t *len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) { close(fd); return 0; }
+    size_t n = (size_t)st.st_size;
+    if (n == 0) { close(fd); *hash = hash_mem("", 0); *len = 0; return 1; }
+    void *map = mmap(NULL, n, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+    *hash = hash_mem(map, n);
+    *len = n;
+    munmap(map, n);
+    return 1;
+}
+
+/* serialize a resolved tree and write it to `path` via a temp file + rename */
+static int image_write(const Block *root, uint64_t src_hash, uint64_t src_len, const char *path) {
+    ImgWriter W;
+    memset(&W, 0, sizeof(W));
+    img_reserve(&W, sizeof(ImgHeader), 8);
+    uint32_t top = img_put_list(&W, root, 0);
+
+    int ok = !W.failed;
+    if (ok) {
+        ImgHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, IMG_MAGIC, sizeof(h.magic));
+        h.version = IMG_VERSION;
+        h.bom = IMG_BOM;
+        h.word = (uint32_t)sizeof(size_t);
+        h.top = top;
+        h.file_size = W.len;
+        h.source_hash = src_hash;
+        h.source_len = src_len;
+        h.image_hash = hash_mem(W.buf + sizeof(ImgHeader), W.len - sizeof(ImgHeader));
+        memcpy(W.buf, &h, sizeof(h));
+
+        size_t plen = strlen(path);
+        char *tmp = malloc(plen + 32);
+        ok = tmp != NULL;
+        if (ok) {
+            snprintf(tmp, plen + 32, "%s.tmp.%ld", path, (long)getpid());
+            FILE *f = fopen(tmp, "wb");
+            ok = f && fwrite(W.buf, 1, W.len, f) == W.len;
+            if (f && fclose(f) != 0) ok = 0;
+            if (ok && rename(tmp, path) != 0) ok = 0;
+            if (!ok) unlink(tmp);
+            free(tmp);
+        }
+    }
+    free(W.buf);
+    free(W.strs);
+    free(W.arrs);
+    return ok;
+}
+
+/* ---- public entry points ---- */
+
+int acl_compile(AclBlock *root, const char *source_path, const char *image_path) {
+    if (!root || !source_path || !image_path || is_image(root)) return 0;
+    uint64_t hash, len;
+    if (!source_digest(source_path, &hash, &len)) return 0;
+    if (resolve_all_refs((Block*)root) != 0) return 0;
+    return image_write((Block*)root, hash, len, image_path);
+}
+
+AclBlock *acl_open_compiled(const char *image_path, const char *source_path) {
+    if (!image_path) return NULL;
+    int fd = open(image_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(ImgHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t n = (size_t)st.st_size;
+    char *base = mmap(NULL, n, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    const ImgHeader *h = (const ImgHeader *)base;
+    int ok = memcmp(h->magic, IMG_MAGIC, sizeof(h->magic)) == 0
+          && h->version == IMG_VERSION
+          && h->bom == IMG_BOM
+          && h->word == sizeof(size_t)
+          && h->file_size == n
+          && h->image_hash == hash_mem(base + sizeof(ImgHeader), n - sizeof(ImgHeader));
+    if (ok && source_path) {
+        uint64_t hash, len;
+        ok = source_digest(source_path, &hash, &len) && hash == h->source_hash && len == h->source_len;
+    }
+    if (!ok) {
+        munmap(base, n);
+        return NULL;
+    }
+    return (AclBlock*)base;
+}
+
+static void img_close(char *base) {
+    munmap(base, (size_t)((const ImgHeader *)base)->file_size);
+}
+
+AclBlock *acl_load(const char *source_path, const char *image_path) {
+    if (!source_path) return NULL;
+    if (image_path) {
+        AclBlock *img = acl_open_compiled(image_path, source_path);
+        if (img) return img;
+    }
+    uint64_t hash = 0, len = 0;
+    int have_digest = source_digest(source_path, &hash, &len);
+    AclBlock *root = acl_parse_file(source_path);
+    if (!root) return NULL;
+    /* refresh a stale or missing image; a read-only /conf just means next
+       time parses again */
+    if (resolve_all_refs((Block*)root) == 0 && image_path && have_digest)
+        (void)image_write((Block*)root, hash, len, image_path);
+    return root;
+}
+
+/* ---------- value accessors and array iteration ---------- */
+
+int acl_value_int(const AclValue *pv, long *out) {
+    const Value *v = (const Value*)pv;
+    if (!v || !out) return 0;
+    if (value_kind(v) & VAL_IMAGE) {
+        const ImgValue *iv = (const ImgValue*)pv;
+        if (iv->kind == (VAL_IMAGE | VAL_INT)) { *out = (long)iv->u.i; return 1; }
+        return 0;
+    }
+    if (v->kind == VAL_INT) { *out = v->ival; return 1; }
+    return 0;
+}
+
+int acl_value_float(const AclValue *pv, double *out) {
+    const Value *v = (const Value*)pv;
+    if (!v || !out) return 0;
+    if (value_kind(v) & VAL_IMAGE) {
+        const ImgValue *iv = (const ImgValue*)pv;
+        if (iv->kind == (VAL_IMAGE | VAL_FLOAT)) { *out = iv->u.f; return 1; }
+        if (iv->kind == (VAL_IMAGE | VAL_INT)) { *out = (double)iv->u.i; return 1; }
+        return 0;
+    }
     if (v->kind == VAL_FLOAT) { *out = v->fval; return 1; }
     if (v->kind == VAL_INT) { *out = (double)v->ival; return 1; }
     return 0;
 }
 
-int acl_get_bool(AclBlock *root, const char *path, int *out) {
-    if (!out) return 0;
-    AclValue *pv = acl_find_value_by_path(root, path);
-    if (!pv) return 0;
-    Value *v = (Value*)pv;
+int acl_value_bool(const AclValue *pv, int *out) {
+    const Value *v = (const Value*)pv;
+    if (!v || !out) return 0;
+    if (value_kind(v) & VAL_IMAGE) {
+        const ImgValue *iv = (const ImgValue*)pv;
+        if (iv->kind == (VAL_IMAGE | VAL_BOOL)) { *out = (int)iv->u.i; return 1; }
+        return 0;
+    }
     if (v->kind == VAL_BOOL) { *out = v->bval; return 1; }
     return 0;
 }
 
+int acl_value_string(const AclValue *pv, const char **out) {
+    const Value *v = (const Value*)pv;
+    if (!v || !out) return 0;
+    if (value_kind(v) & VAL_IMAGE) {
+        const ImgValue *iv = (const ImgValue*)pv;
+        if (iv->kind == (VAL_IMAGE | VAL_STRING)) { *out = (const char*)iv + iv->u.rel; return 1; }
+        return 0;
+    }
+    if (v->kind == VAL_STRING && value_str(v)) { *out = value_str(v); return 1; }
+    return 0;
+}
+
+size_t acl_array_len(const AclValue *pv) {
+    const Value *v = (const Value*)pv;
+    if (v && (value_kind(v) & VAL_IMAGE)) {
+        const ImgValue *iv = (const ImgValue*)pv;
+        return iv->kind == (VAL_IMAGE | VAL_ARRAY) ? iv->len : 0;
+    }
+    return v && v->kind == VAL_ARRAY ? v->arr_len : 0;
+}
+
+int acl_array_iter_init(AclArrayIter *it, const AclValue *pv) {
+    const Value *v = (const Value*)pv;
+    if (!it) return 0;
+    it->priv = NULL;
+    it->index = 0;
+    if (v && (value_kind(v) & VAL_IMAGE)) {
+        if (((const ImgValue*)pv)->kind != (VAL_IMAGE | VAL_ARRAY)) return 0;
+        it->priv = (void*)v;
+        return 1;
+    }
+    if (!v || v->kind != VAL_ARRAY) return 0;
+    it->priv = (void*)v;
+    return 1;
+}
+
+AclValue *acl_array_next(AclArrayIter *it) {
+    if (!it || !it->priv) return NULL;
+    const Value *v = it->priv;
+    if (value_kind(v) & VAL_IMAGE) {
+        const ImgValue *iv = it->priv;
+        if (it->index >= iv->len) return NULL;
+        return (AclValue*)(img_payload(iv) + it->index++);
+    }
+    if (it->index >= v->arr_len) return NULL;
+    return (AclValue*)&v->arr[it->index++];
+}
+
+/* Updated typed getters that use the above function.
+   These return 1 on success, 0 otherwise.
+*/
+
+int acl_get_int(AclBlock *root, const char *path, long *out) {
+    if (!out) return 0;
+    return acl_value_int(acl_find_value_by_path(root, path), out);
+}
+
+int acl_get_float(AclBlock *root, const char *path, double *out) {
+    if (!out) return 0;
+    return acl_value_float(acl_find_value_by_path(root, path), out);
+}
+
+int acl_get_bool(AclBlock *root, const char *path, int *out) {
+    if (!out) return 0;
+    return acl_value_bool(acl_find_value_by_path(root, path), out);
+}
+
 int acl_get_string(AclBlock *root, const char *path, char **out) {
     if (!out) return 0;
-    AclValue *pv = acl_find_value_by_path(root, path);
-    if (!pv) return 0;
-    Value *v = (Value*)pv;
-    if (v->kind == VAL_STRING && v->sval) {
-        *out = str_dup_local(v->sval);
-        return *out != NULL;
+    const char *s = NULL;
+    if (!acl_value_string(acl_find_value_by_path(root, path), &s)) return 0;
+    *out = str_dup_local(s);
+    return *out != NULL;
+}
+
+/* ---------- cursors and bulk lookups ---------- */
+
+/* A cursor remembers the block a path selected: root is the tree's
+   top-level list or the image base, block the Block or its place in the
+   image. Paths read through it start at that block, so fetching several
+   fields of one block walks down to it once. */
+
+int acl_cursor_open(AclCursor *c, AclBlock *root, const char *path) {
+    if (!c) return 0;
+    c->root = c->block = NULL;
+    if (!root || !path) return 0;
+    PathSeg local[16];
+    long n = path_split(path, NULL);
+    if (n < 1) return 0;
+    PathSeg *segs = (size_t)n <= sizeof(local) / sizeof(local[0]) ? local : malloc(sizeof(PathSeg) * (size_t)n);
+    if (!segs) return 0;
+    path_split(path, segs);
+    void *b = NULL;
+    if (is_image(root)) {
+        uint32_t off = img_path_block((const char*)root, 0, segs, (size_t)n);
+        if (off) b = (char*)root + off;
+    } else {
+        b = path_block((Block*)root, NULL, segs, (size_t)n);
+    }
+    if (segs != local) free(segs);
+    if (!b) return 0;
+    c->root = root;
+    c->block = b;
+    return 1;
+}
+
+/* segs[0..n-1) select blocks below the cursor's, segs[n-1] the field */
+static void *cursor_walk(const AclCursor *c, const PathSeg *segs, size_t n) {
+    if (is_image(c->root)) {
+        const char *base = c->root;
+        uint32_t cur = (uint32_t)((const char*)c->block - base);
+        if (n > 1 && !(cur = img_path_block(base, cur, segs, n - 1))) return NULL;
+        return (void*)img_path_field(base, cur, &segs[n - 1]);
+    }
+    Block *b = c->block;
+    if (n > 1 && !(b = path_block(c->root, b, segs, n - 1))) return NULL;
+    return path_field(c->root, b, &segs[n - 1]);
+}
+
+AclValue *acl_cursor_get(const AclCursor *c, const char *path) {
+    if (!c || !c->block || !path) return NULL;
+    PathSeg local[16];
+    long n = path_split(path, NULL);
+    if (n < 1) return NULL;
+    PathSeg *segs = (size_t)n <= sizeof(local) / sizeof(local[0]) ? local : malloc(sizeof(PathSeg) * (size_t)n);
+    if (!segs) return NULL;
+    path_split(path, segs);
+    void *v = cursor_walk(c, segs, (size_t)n);
+    if (segs != local) free(segs);
+    return (AclValue*)v;
+}
+
+size_t acl_query_many(AclBlock *root, const char *base_path, const char *const *fields, size_t n, AclValue **out) {
+    if (!out) return 0;
+    AclCursor c;
+    int open = fields && acl_cursor_open(&c, root, base_path);
+    size_t found = 0;
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = open ? acl_cursor_get(&c, fields[i]) : NULL;
+        if (out[i]) found++;
+    }
+    return found;
+}
+
+/* ---------- queries ---------- */
+
+/* A query is a path whose segments may match many blocks:
+
+     Registry.Package[*].Version[*].sha256
+     **.Version[deprecated == true]
+
+   It compiles to an array of QuerySegs, which act as the states of an
+   automaton: a block's children are matched against the states active in
+   it, and each child that matches state i activates state i + 1 inside
+   that child; "**" stays active all the way down, and also activates the
+   state after it at once. Running a query is a depth-first walk that
+   carries the active states as a bit set per level. A child no state
+   accepts is pruned without being visited (in a lazy tree, without being
+   parsed), and every match is reported once, in tree order, when the walk
+   reaches it. The walk keeps one frame per level of nesting and nothing
+   else: no list of intermediate blocks or results is ever built. */
+
+#define QUERY_MAX_SEGS 64
+
+typedef enum { QOP_EXISTS, QOP_EQ, QOP_NE, QOP_LT, QOP_LE, QOP_GT, QOP_GE } QueryOp;
+
+/* [field op literal]; kind is VAL_INT, VAL_FLOAT, VAL_BOOL or VAL_STRING */
+typedef struct QueryPred {
+    PathSeg field;
+    QueryOp op;
+    ValKind kind;
+    long ival; double fval;
+    const char *sval; size_t slen;
+} QueryPred;
+
+/* seg.name is NULL for "*" and "**"; seg.index >= 0 ("[N]", last segment
+   only) selects one array element and `all` ("[*]") every element */
+typedef struct QuerySeg {
+    PathSeg seg;
+    unsigned char descend, all;
+    QueryPred *preds; size_t npreds;
+} QuerySeg;
+
+/* One allocation, as for AclPath: header, segments, predicates, then the
+   query text they point into. */
+struct AclQuery {
+    size_t nsegs;
+    QuerySeg *segs;
+};
+
+static const char *query_space(const char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    return s;
+}
+
+static const char *query_ident(const char *s, const char **name, size_t *len) {
+    if (!isalpha((unsigned char)*s) && *s != '_') return NULL;
+    const char *a = s++;
+    while (isalnum((unsigned char)*s) || *s == '_') s++;
+    *name = a;
+    *len = (size_t)(s - a);
+    return s;
+}
+
+/* the literal after a predicate's operator; NULL if malformed */
+static const char *query_literal(const char *s, QueryPred *p) {
+    if (*s == '"') {
+        const char *q = strchr(s + 1, '"');
+        if (!q) return NULL;
+        p->kind = VAL_STRING;
+        p->sval = s + 1;
+        p->slen = (size_t)(q - s - 1);
+        return q + 1;
+    }
+    const char *id;
+    size_t n;
+    const char *e = query_ident(s, &id, &n);
+    if (e) {
+        if (n == 4 && memcmp(id, "true", 4) == 0) p->ival = 1;
+        else if (n == 5 && memcmp(id, "false", 5) == 0) p->ival = 0;
+        else return NULL;
+        /* booleans only compare for equality */
+        if (p->op != QOP_EQ && p->op != QOP_NE) return NULL;
+        p->kind = VAL_BOOL;
+        return e;
+    }
+    if (!isdigit((unsigned char)*s) && *s != '-' && *s != '+' && *s != '.') return NULL;
+    char *end;
+    errno = 0;
+    long i = strtol(s, &end, 10);
+    if (end != s && *end != '.' && *end != 'e' && *end != 'E' && !errno) {
+        p->kind = VAL_INT;
+        p->ival = i;
+        return end;
+    }
+    double f = strtod(s, &end);
+    if (end == s) return NULL;
+    p->kind = VAL_FLOAT;
+    p->fval = f;
+    return end;
+}
+
+static const char *query_op(const char *s, QueryOp *op) {
+    if (s[0] == '=' && s[1] == '=') { *op = QOP_EQ; return s + 2; }
+    if (s[0] == '!' && s[1] == '=') { *op = QOP_NE; return s + 2; }
+    if (s[0] == '<') { *op = s[1] == '=' ? QOP_LE : QOP_LT; return s + 1 + (s[1] == '='); }
+    if (s[0] == '>') { *op = s[1] == '=' ? QOP_GE : QOP_GT; return s + 1 + (s[1] == '='); }
+    *op = QOP_EXISTS;
+    return s;
+}
+
+/* Parse the segment at s into *q, appending its predicates to preds
+   (NULL when only counting) at *npreds. Returns the end of the segment,
+   or NULL if it is malformed. */
+static const char *query_segment(const char *s, QuerySeg *q, QueryPred *preds, size_t *npreds) {
+    memset(q, 0, sizeof(*q));
+    q->seg.index = -1;
+    s = query_space(s);
+    if (s[0] == '*' && s[1] == '*') {
+        q->descend = 1;
+        s += 2;
+    } else if (*s == '*') {
+        s++;
+    } else {
+        if (!(s = query_ident(s, &q->seg.name, &q->seg.name_len))) return NULL;
+        q->seg.name_hash = hash_mem(q->seg.name, q->seg.name_len);
+    }
+    if (preds) q->preds = preds + *npreds;
+
+    for (s = query_space(s); *s == '['; s = query_space(s + 1)) {
+        if (q->descend) return NULL;
+        s = query_space(s + 1);
+        if (*s == '"') {
+            const char *e = strchr(s + 1, '"');
+            if (!e || q->seg.label) return NULL;
+            q->seg.label = s + 1;
+            q->seg.label_len = (size_t)(e - s - 1);
+            q->seg.label_hash = hash_mem(q->seg.label, q->seg.label_len);
+            s = e + 1;
+        } else if (*s == '*') {
+            q->all = 1;
+            s++;
+        } else if (isdigit((unsigned char)*s)) {
+            long idx = 0;
+            if (q->seg.index >= 0) return NULL;
+            while (isdigit((unsigned char)*s)) {
+                idx = idx * 10 + (*s++ - '0');
+                if (idx > 0x7fffffffL) return NULL;
+            }
+            q->seg.index = (int)idx;
+        } else {
+            QueryPred p;
+            memset(&p, 0, sizeof(p));
+            p.field.index = -1;
+            if (!(s = query_ident(s, &p.field.name, &p.field.name_len))) return NULL;
+            p.field.name_hash = hash_mem(p.field.name, p.field.name_len);
+            s = query_op(query_space(s), &p.op);
+            if (p.op != QOP_EXISTS && !(s = query_literal(query_space(s), &p))) return NULL;
+            if (preds) preds[*npreds] = p;
+            ++*npreds;
+            q->npreds++;
+        }
+        s = query_space(s);
+        if (*s != ']') return NULL;
+    }
+    return s;
+}
+
+/* Parse a whole query. With segs == NULL only counts segments and
+   predicates. Returns the number of segments, or -1 if malformed.
+   Repeated "**" segments are folded into one. */
+static long query_parse(const char *s, QuerySeg *segs, QueryPred *preds, size_t *npreds) {
+    long n = 0;
+    int prev_descend = 0, prev_index = 0;
+    *npreds = 0;
+    for (;;) {
+        QuerySeg tmp;
+        QuerySeg *q = segs && n < QUERY_MAX_SEGS ? &segs[n] : &tmp;
+        if (!(s = query_segment(s, q, preds, npreds))) return -1;
+        if (prev_index) return -1; /* [N] only on the last segment */
+        if (!(q->descend && prev_descend)) n++;
+        if (n > QUERY_MAX_SEGS) return -1;
+        prev_descend = q->descend;
+        prev_index = q->seg.index >= 0;
+        if (*s == '\0') break;
+        if (*s++ != '.') return -1;
+    }
+    /* the last segment has to name something */
+    return prev_descend ? -1 : n;
+}
+
+AclQuery *acl_query_compile(const char *query) {
+    if (!query) return NULL;
+    size_t npreds;
+    long n = query_parse(query, NULL, NULL, &npreds);
+    if (n < 1) return NULL;
+    size_t textlen = strlen(query) + 1;
+    size_t segoff = (sizeof(AclQuery) + alignof(QuerySeg) - 1) & ~(alignof(QuerySeg) - 1);
+    size_t predoff = (segoff + sizeof(QuerySeg) * (size_t)n + alignof(QueryPred) - 1) & ~(alignof(QueryPred) - 1);
+    size_t textoff = predoff + sizeof(QueryPred) * npreds;
+    char *mem = malloc(textoff + textlen);
+    if (!mem) return NULL;
+    AclQuery *q = (AclQuery*)mem;
+    q->nsegs = (size_t)n;
+    q->segs = (QuerySeg*)(mem + segoff);
+    char *text = memcpy(mem + textoff, query, textlen);
+    query_parse(text, q->segs, (QueryPred*)(mem + predoff), &npreds);
+    return q;
+}
+
+void acl_query_free(AclQuery *q) {
+    free(q);
+}
+
+/* ---- running ---- */
+
+/* QF_FIELDS: testing fields against the last segment;
+   QF_ELEMS: reporting the elements of a field matched with [*];
+   QF_CHILDREN: matching child blocks */
+enum { QF_FIELDS, QF_ELEMS, QF_CHILDREN };
+
+/* One level of the walk: a block (or the top-level list) with the states
+   its children may match. `one`: the field named by the last segment was
+   looked up rather than scanned for. */
+typedef struct QueryFrame {
+    uint64_t active;
+    unsigned char stage, one;
+    size_t elem;
+    union {
+        struct { Block *block; Field *field; Block *child; } t;
+        struct { uint32_t block; uint32_t field, child; } i;
+    };
+} QueryFrame;
+
+/* atoms: the tree's atom for each segment's name and label, looked up
+   when first needed. dead: segments a fully parsed tree can't match, as
+   it never interned their name or label. */
+struct AclQueryIter {
+    const AclQuery *q;
+    void *root;
+    int image;
+    uint64_t dead;
+    QueryFrame *frames;
+    size_t depth, cap;
+    const char **atoms;
+};
+
+#define QBIT(i) ((uint64_t)1 << (i))
+
+/* add the state after every active "**" (it may match no block at all) */
+static uint64_t query_closure(const AclQuery *q, uint64_t s) {
+    for (size_t i = 0; i + 1 < q->nsegs; ++i) {
+        if ((s & QBIT(i)) && q->segs[i].descend) s |= QBIT(i + 1);
+    }
+    return s;
+}
+
+/* can the last segment match a field? */
+static int query_fields_wanted(const AclQuery *q, uint64_t active) {
+    const QuerySeg *s = &q->segs[q->nsegs - 1];
+    return (active & QBIT(q->nsegs - 1)) && !s->seg.label && !s->npreds;
+}
+
+static int query_pred(const QueryPred *p, const AclValue *v) {
+    if (!v) return 0;
+    if (p->op == QOP_EXISTS) return 1;
+    int c;
+    long i;
+    double f;
+    const char *s;
+    switch (p->kind) {
+        case VAL_STRING: {
+            if (!acl_value_string(v, &s)) return 0;
+            size_t n = strlen(s);
+            int r = memcmp(s, p->sval, n < p->slen ? n : p->slen);
+            c = r ? r : (n > p->slen) - (n < p->slen);
+            break;
+        }
+        case VAL_BOOL: {
+            int b;
+            if (!acl_value_bool(v, &b)) return 0;
+            c = b != (int)p->ival;
+            break;
+        }
+        case VAL_INT:
+            if (acl_value_int(v, &i)) c = (i > p->ival) - (i < p->ival);
+            else if (acl_value_float(v, &f)) c = (f > (double)p->ival) - (f < (double)p->ival);
+            else return 0;
+            break;
+        default:
+            if (!acl_value_float(v, &f)) return 0;
+            c = (f > p->fval) - (f < p->fval);
+            break;
+    }
+    switch (p->op) {
+        case QOP_EQ: return c == 0;
+        case QOP_NE: return c != 0;
+        case QOP_LT: return c < 0;
+        case QOP_LE: return c <= 0;
+        case QOP_GT: return c > 0;
+        default:     return c >= 0;
+    }
+}
+
+static int query_hit(const AclQueryIter *it, AclMatch *m, void *value, void *block,
+                     const char *name, const char *label, size_t index) {
+    m->value = value;
+    m->block.root = it->root;
+    m->block.block = block;
+    m->name = name;
+    m->label = label;
+    m->index = index;
+    return 1;
+}
+
+static QueryFrame *query_push(AclQueryIter *it, uint64_t active) {
+    if (it->depth == it->cap) {
+        size_t cap = it->cap * 2;
+        QueryFrame *f = realloc(it->frames, cap * sizeof(QueryFrame));
+        if (!f) return NULL;
+        it->frames = f;
+        it->cap = cap;
+    }
+    QueryFrame *fr = &it->frames[it->depth++];
+    memset(fr, 0, sizeof(*fr));
+    fr->active = active;
+    fr->stage = query_fields_wanted(it->q, active) ? QF_FIELDS : QF_CHILDREN;
+    return fr;
+}
+
+/* Matches the node (a Block, or a block in the image) against named or
+   "*" segment i. */
+typedef int (*QueryMatch)(AclQueryIter *it, size_t i, const void *node);
+
+/* The states active inside child `node` of a block where `active` are;
+   *hit is set when the child matches the last segment. */
+static uint64_t query_step(AclQueryIter *it, uint64_t active, const void *node, QueryMatch match, int *hit) {
+    const AclQuery *q = it->q;
+    uint64_t next = 0;
+    *hit = 0;
+    for (; active; active &= active - 1) {
+        size_t i = (size_t)__builtin_ctzll(active);
+        const QuerySeg *s = &q->segs[i];
+        if (s->descend) { next |= QBIT(i); continue; }
+        if (i + 1 == q->nsegs && s->seg.index >= 0) continue; /* fields only */
+        if (!match(it, i, node)) continue;
+        if (i + 1 == q->nsegs) *hit = 1;
+        else next |= QBIT(i + 1);
+    }
+    return query_closure(q, next) & ~it->dead;
+}
+
+/* -- over a parsed tree -- */
+
+static const char *query_atom(AclQueryIter *it, size_t i, int label) {
+    const char **a = &it->atoms[2 * i + label];
+    if (!*a) {
+        const PathSeg *s = &it->q->segs[i].seg;
+        const Interner *atoms = &((Block*)it->root)->tree->atoms;
+        *a = label ? interner_find_hashed(atoms, s->label, s->label_len, s->label_hash)
+                   : interner_find_hashed(atoms, s->name, s->name_len, s->name_hash);
+    }
+    return *a;
+}
+
+static int query_match_tree(AclQueryIter *it, size_t i, const void *node) {
+    Block *c = (Block*)node;
+    const QuerySeg *s = &it->q->segs[i];
+    const char *a;
+    if (s->seg.name && (!(a = query_atom(it, i, 0)) || c->name != a)) return 0;
+    if (s->seg.label && (!(a = query_atom(it, i, 1)) || c->label != a)) return 0;
+    for (size_t k = 0; k < s->npreds; ++k) {
+        if (!query_pred(&s->preds[k], (AclValue*)path_field(it->root, c, &s->preds[k].field))) return 0;
+    }
+    return 1;
+}
+
+/* Where to start on the children `list` for the states in `active`: with
+   a single named state, its first match from the list's index, since
+   nothing before that can match. */
+static Block *query_first_tree(AclQueryIter *it, Block *list, uint64_t active) {
+    if (!list || (active & (active - 1))) return list;
+    size_t i = (size_t)__builtin_ctzll(active);
+    const QuerySeg *s = &it->q->segs[i];
+    if (s->descend || !s->seg.name) return list;
+    if (i + 1 == it->q->nsegs && s->seg.index >= 0) return NULL;
+    const char *name = query_atom(it, i, 0), *label = NULL;
+    if (!name || (s->seg.label && !(label = query_atom(it, i, 1)))) return NULL;
+    return label ? list_find_pair(list, name, label) : list_find_name(list, name);
+}
+
+/* push block b (NULL: the top-level list) whose children are `list` */
+static int query_push_tree(AclQueryIter *it, Block *b, Block *list, uint64_t active) {
+    QueryFrame *fr = query_push(it, active);
+    if (!fr) return 0;
+    fr->t.block = b;
+    if (!b) fr->stage = QF_CHILDREN;
+    if (fr->stage == QF_FIELDS) {
+        const QuerySeg *ls = &it->q->segs[it->q->nsegs - 1];
+        if (ls->seg.name) {
+            const char *name = query_atom(it, it->q->nsegs - 1, 0);
+            fr->t.field = name ? find_field_in_block(b, name) : NULL;
+            fr->one = 1;
+        } else {
+            if (b->lazy) block_expand(b);
+            fr->t.field = b->fields;
+        }
+    }
+    fr->t.child = query_first_tree(it, list, active);
+    return 1;
+}
+
+static int query_next_tree(AclQueryIter *it, AclMatch *m) {
+    const AclQuery *q = it->q;
+    const QuerySeg *ls = &q->segs[q->nsegs - 1];
+    Block *top = it->root;
+    while (it->depth) {
+        QueryFrame *fr = &it->frames[it->depth - 1];
+        if (fr->stage != QF_CHILDREN) {
+            Field *f = fr->t.field;
+            if (!f) { fr->stage = QF_CHILDREN; continue; }
+            Field *after = fr->one ? NULL : f->next;
+            if (top->tree->on_demand && f->rstate == RS_NONE) resolve_on_demand(f, fr->t.block);
+            if (!ls->all) {
+                fr->t.field = after;
+                if (ls->seg.index < 0) return query_hit(it, m, &f->value, fr->t.block, f->name, NULL, 0);
+                if (f->value.kind == VAL_ARRAY && (size_t)ls->seg.index < f->value.arr_len) {
+                    return query_hit(it, m, &f->value.arr[ls->seg.index], fr->t.block, f->name, NULL, (size_t)ls->seg.index);
+                }
+                continue;
+            }
+            /* [*]: each element of an array field, then the next field */
+            if (f->value.kind == VAL_ARRAY && fr->elem < f->value.arr_len) {
+                size_t k = fr->elem++;
+                fr->stage = QF_ELEMS;
+                return query_hit(it, m, &f->value.arr[k], fr->t.block, f->name, NULL, k);
+            }
+            fr->stage = QF_FIELDS;
+            fr->elem = 0;
+            fr->t.field = after;
+        } else {
+            Block *c = fr->t.child;
+            if (!c) { it->depth--; continue; }
+            fr->t.child = c->next;
+            int hit;
+            uint64_t next = query_step(it, fr->active, c, query_match_tree, &hit);
+            if (next && !query_push_tree(it, c, block_children(c), next)) { it->depth = 0; return 0; }
+            if (hit) return query_hit(it, m, NULL, c, c->name, c->label, 0);
+        }
+    }
+    return 0;
+}
+
+/* -- over a compiled image -- */
+
+static int query_match_img(AclQueryIter *it, size_t i, const void *node) {
+    const char *base = it->root;
+    uint32_t off = (uint32_t)((const char*)node - base);
+    const QuerySeg *s = &it->q->segs[i];
+    const ImgBlock *b = node;
+    if (s->seg.name && !img_str_eq(base, b->name, s->seg.name, s->seg.name_len)) return 0;
+    if (s->seg.label && !img_str_eq(base, b->label, s->seg.label, s->seg.label_len)) return 0;
+    for (size_t k = 0; k < s->npreds; ++k) {
+        if (!query_pred(&s->preds[k], (const AclValue*)img_path_field(base, off, &s->preds[k].field))) return 0;
+    }
+    return 1;
+}
+
+/* query_first_tree for an image list: the position to start at */
+static uint32_t query_first_img(const AclQueryIter *it, uint32_t list_off, uint64_t active) {
+    const char *base = it->root;
+    const ImgList *l = img_list(base, list_off);
+    if (!l || (active & (active - 1))) return 0;
+    size_t i = (size_t)__builtin_ctzll(active);
+    const QuerySeg *s = &it->q->segs[i];
+    if (s->descend || !s->seg.name) return 0;
+    if (i + 1 == it->q->nsegs && s->seg.index >= 0) return l->count;
+    uint32_t off = img_list_find(base, list_off, s->seg.label ? IMG_PAIR : IMG_NAME, &s->seg);
+    if (!off) return l->count;
+    uint32_t k = 0;
+    while (l->items[k] != off) k++;
+    return k;
+}
+
+/* push the block at offset b (0: the top-level list) */
+static int query_push_img(AclQueryIter *it, uint32_t b, uint32_t list_off, uint64_t active) {
+    QueryFrame *fr = query_push(it, active);
+    if (!fr) return 0;
+    fr->i.block = b;
+    if (!b) fr->stage = QF_CHILDREN;
+    if (fr->stage == QF_FIELDS && it->q->segs[it->q->nsegs - 1].seg.name) {
+        const ImgBlock *ib = img_block(it->root, b);
+        const ImgField *f = img_field_find(it->root, ib, &it->q->segs[it->q->nsegs - 1].seg);
+        fr->i.field = f ? (uint32_t)(f - ib->fields) : ib->nfields;
+        fr->one = 1;
+    }
+    fr->i.child = query_first_img(it, list_off, active);
+    return 1;
+}
+
+static int query_next_img(AclQueryIter *it, AclMatch *m) {
+    const AclQuery *q = it->q;
+    const QuerySeg *ls = &q->segs[q->nsegs - 1];
+    char *base = it->root;
+    while (it->depth) {
+        QueryFrame *fr = &it->frames[it->depth - 1];
+        if (fr->stage != QF_CHILDREN) {
+            const ImgBlock *b = img_block(base, fr->i.block);
+            if (fr->i.field >= b->nfields) { fr->stage = QF_CHILDREN; continue; }
+            const ImgField *f = &b->fields[fr->i.field];
+            const char *name = img_str(base, f->name);
+            uint32_t after = fr->one ? b->nfields : fr->i.field + 1;
+            int is_array = f->value.kind == (VAL_IMAGE | VAL_ARRAY);
+            if (!ls->all) {
+                fr->i.field = after;
+                if (ls->seg.index < 0) return query_hit(it, m, (void*)&f->value, (void*)b, name, NULL, 0);
+                if (is_array && (uint32_t)ls->seg.index < f->value.len) {
+                    return query_hit(it, m, (void*)(img_payload(&f->value) + ls->seg.index), (void*)b, name, NULL,
+                                     (size_t)ls->seg.index);
+                }
+                continue;
+            }
+            if (is_array && fr->elem < f->value.len) {
+                size_t k = fr->elem++;
+                fr->stage = QF_ELEMS;
+                return query_hit(it, m, (void*)(img_payload(&f->value) + k), (void*)b, name, NULL, k);
+            }
+            fr->stage = QF_FIELDS;
+            fr->elem = 0;
+            fr->i.field = after;
+        } else {
+            uint32_t list_off = fr->i.block ? img_block(base, fr->i.block)->children : ((const ImgHeader*)base)->top;
+            const ImgList *l = img_list(base, list_off);
+            if (!l || fr->i.child >= l->count) { it->depth--; continue; }
+            uint32_t c = l->items[fr->i.child++];
+            const ImgBlock *cb = img_block(base, c);
+            int hit;
+            uint64_t next = query_step(it, fr->active, cb, query_match_img, &hit);
+            if (next && !query_push_img(it, c, cb->children, next)) { it->depth = 0; return 0; }
+            if (hit) return query_hit(it, m, NULL, (void*)cb, img_str(base, cb->name), img_str(base, cb->label), 0);
+        }
     }
     return 0;
 }
+
+/* -- public entry points -- */
+
+AclQueryIter *acl_query_run(AclBlock *root, const AclQuery *q) {
+    if (!root || !q) return NULL;
+    AclQueryIter *it = calloc(1, sizeof(*it) + 2 * q->nsegs * sizeof(const char*));
+    if (!it) return NULL;
+    it->q = q;
+    it->root = root;
+    it->image = is_image(root);
+    it->atoms = (const char**)(it + 1);
+    it->cap = 16;
+    if (!(it->frames = malloc(it->cap * sizeof(QueryFrame)))) { free(it); return NULL; }
+
+    uint64_t start = query_closure(q, QBIT(0));
+    if (it->image) {
+        query_push_img(it, 0, ((const ImgHeader*)root)->top, start);
+        return it;
+    }
+    Block *top = (Block*)root;
+    /* a parsed tree has interned every name it can match; a lazy one
+       may intern more as blocks are expanded */
+    if (!top->tree->lazy) {
+        for (size_t i = 0; i < q->nsegs; ++i) {
+            const QuerySeg *s = &q->segs[i];
+            if ((s->seg.name && !query_atom(it, i, 0)) || (s->seg.label && !query_atom(it, i, 1))) it->dead |= QBIT(i);
+        }
+    }
+    start &= ~it->dead;
+    if (start) query_push_tree(it, NULL, top, start);
+    return it;
+}
+
+int acl_query_next(AclQueryIter *it, AclMatch *m) {
+    if (!it || !m) return 0;
+    return it->image ? query_next_img(it, m) : query_next_tree(it, m);
+}
+
+void acl_query_iter_free(AclQueryIter *it) {
+    if (!it) return;
+    free(it->frames);
+    free(it);
+}
+
+/* ---------- snapshots ---------- */
+
+/* Readers announce the epoch they entered in and writers free a retired
+   tree once no reader is still in an epoch at or before the one it was
+   retired in. Every step of enter and publish is seq_cst: a reader that
+   stored an epoch after the writer's increment loads the new snapshot, and
+   one whose store the writer's scan missed loads it too, because its load
+   of current follows the scan. */
+
+typedef struct Snapshot {
+    AclBlock *root;
+    unsigned long version;
+    unsigned long retired;   /* epoch it was replaced in */
+    struct Snapshot *next;   /* retired list */
+} Snapshot;
+
+struct AclSnapshotReader {
+    alignas(64) atomic_ulong active; /* epoch entered in, 0 when outside; a cache line per reader */
+    AclSnapshots *owner;
+    int in_use;
+};
+
+struct AclSnapshots {
+    _Atomic(Snapshot*) current;
+    atomic_ulong epoch;
+    pthread_mutex_t lock;            /* writers, reader registration */
+    char *path;
+    unsigned long version;
+    Snapshot *retired;
+    size_t nretired;
+    AclSnapshotReader **readers;
+    size_t nreaders;
+};
+
+static void snapshot_free(Snapshot *s) {
+    acl_free(s->root);
+    free(s);
+}
+
+/* free what no reader can hold; s->lock held */
+static void snapshots_reclaim(AclSnapshots *s) {
+    unsigned long oldest = ULONG_MAX;
+    for (size_t i = 0; i < s->nreaders; ++i) {
+        unsigned long e = atomic_load(&s->readers[i]->active);
+        if (e && e < oldest) oldest = e;
+    }
+    for (Snapshot **p = &s->retired; *p;) {
+        Snapshot *r = *p;
+        if (r->retired < oldest) {
+            *p = r->next;
+            snapshot_free(r);
+            s->nretired--;
+        } else {
+            p = &r->next;
+        }
+    }
+}
+
+AclSnapshots *acl_snapshots_open(const char *path) {
+    if (!path) return NULL;
+    AclSnapshots *s = calloc(1, sizeof(AclSnapshots));
+    if (!s || !(s->path = str_dup_local(path))) { free(s); return NULL; }
+    pthread_mutex_init(&s->lock, NULL);
+    atomic_init(&s->current, NULL);
+    atomic_init(&s->epoch, 1);
+    if (acl_snapshots_reload(s) < 1) {
+        acl_snapshots_close(s);
+        return NULL;
+    }
+    return s;
+}
+
+unsigned long acl_snapshots_publish(AclSnapshots *s, AclBlock *root) {
+    if (!s || !root) { acl_free(root); return 0; }
+    /* lookups must not write to a shared tree: read a lazy tree to the end
+       and resolve everything now */
+    if (!acl_resolve_all(root)) { acl_free(root); return 0; }
+    if (!is_image(root)) ((Block*)root)->tree->on_demand = 0;
+    Snapshot *fresh = malloc(sizeof(Snapshot));
+    if (!fresh) { acl_free(root); return 0; }
+    fresh->root = root;
+    fresh->next = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    fresh->version = ++s->version;
+    Snapshot *old = atomic_exchange(&s->current, fresh);
+    if (old) {
+        old->retired = atomic_fetch_add(&s->epoch, 1);
+        old->next = s->retired;
+        s->retired = old;
+        s->nretired++;
+    }
+    snapshots_reclaim(s);
+    pthread_mutex_unlock(&s->lock);
+    return fresh->version;
+}
+
+int acl_snapshots_reload(AclSnapshots *s) {
+    if (!s) return -1;
+    AclBlock *root = acl_parse_file(s->path);
+    if (!root) return -1;
+    return acl_snapshots_publish(s, root) ? 1 : 0;
+}
+
+size_t acl_snapshots_pending(AclSnapshots *s) {
+    if (!s) return 0;
+    pthread_mutex_lock(&s->lock);
+    snapshots_reclaim(s);
+    size_t n = s->nretired;
+    pthread_mutex_unlock(&s->lock);
+    return n;
+}
+
+void acl_snapshots_close(AclSnapshots *s) {
+    if (!s) return;
+    Snapshot *cur = atomic_load(&s->current);
+    if (cur) snapshot_free(cur);
+    for (Snapshot *r = s->retired, *next; r; r = next) {
+        next = r->next;
+        snapshot_free(r);
+    }
+    for (size_t i = 0; i < s->nreaders; ++i) free(s->readers[i]);
+    free(s->readers);
+    pthread_mutex_destroy(&s->lock);
+    free(s->path);
+    free(s);
+}
+
+AclSnapshotReader *acl_snapshot_reader(AclSnapshots *s) {
+    if (!s) return NULL;
+    AclSnapshotReader *r = NULL;
+    pthread_mutex_lock(&s->lock);
+    for (size_t i = 0; i < s->nreaders && !r; ++i) {
+        if (!s->readers[i]->in_use) r = s->readers[i];
+    }
+    if (!r) {
+        AclSnapshotReader **grown = realloc(s->readers, (s->nreaders + 1) * sizeof(*grown));
+        if (grown) s->readers = grown;
+        if (grown && (r = aligned_alloc(64, sizeof(AclSnapshotReader)))) {
+            memset(r, 0, sizeof(*r));
+            atomic_init(&r->active, 0);
+            r->owner = s;
+            s->readers[s->nreaders++] = r;
+        }
+    }
+    if (r) r->in_use = 1;
+    pthread_mutex_unlock(&s->lock);
+    return r;
+}
+
+void acl_snapshot_reader_close(AclSnapshotReader *r) {
+    if (!r) return;
+    atomic_store(&r->active, 0);
+    pthread_mutex_lock(&r->owner->lock);
+    r->in_use = 0;
+    pthread_mutex_unlock(&r->owner->lock);
+}
+
+AclBlock *acl_snapshot_enter(AclSnapshotReader *r, unsigned long *version) {
+    if (!r) return NULL;
+    AclSnapshots *s = r->owner;
+    atomic_store(&r->active, atomic_load(&s->epoch));
+    Snapshot *cur = atomic_load(&s->current);
+    if (version) *version = cur->version;
+    return cur->root;
+}
+
+void acl_snapshot_leave(AclSnapshotReader *r) {
+    if (!r) return;
+    atomic_store_explicit(&r->active, 0, memory_order_release);
+}
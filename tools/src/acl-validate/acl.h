@@ -15,16 +15,192 @@ void acl_shutdown(void);
 
 /* Parse from file or in-memory string.
    Returns a heap-allocated AclBlock* (linked list of top-level blocks) on success,
-   or NULL on failure (in which case an error may have been printed to stderr). */
+   or NULL on failure (in which case an error may have been printed to stderr).
+   Parsing is reentrant: separate trees may be parsed from different threads. */
 AclBlock *acl_parse_file(const char *path);
 AclBlock *acl_parse_string(const char *text);
 
+/* Lazy parse: only the top-level block headers are read up front, after a
+   quick pass that matches braces. A block's fields and children are parsed
+   the first time a lookup, or a reference being resolved, looks inside it,
+   and lookups resolve the fields they return, so acl_resolve_all isn't
+   needed: startup cost follows what is read rather than the file size.
+   A syntax error inside a block is reported on stderr when the block is
+   first reached, and the block then reads as empty. Lookups modify a lazy
+   tree, so it must not be read from several threads at once.
+   acl_resolve_all, acl_print, acl_compile and acl_reload parse the rest of
+   the file first. The file is read into a private copy, kept until then
+   or until acl_free, so rewriting it meanwhile doesn't change what the
+   tree reads; acl_reload compares the tree as first read with the new
+   file. */
+AclBlock *acl_parse_file_lazy(const char *path);
+
+/* Parse n files on a pool of `threads` workers (0 = one per online CPU).
+   out[i] receives the tree for paths[i], or NULL if that file failed.
+   Returns the number of files parsed successfully. */
+size_t acl_parse_files_parallel(const char *const *paths, size_t n, AclBlock **out, int threads);
+
+/* Parse one large file (or string) on `threads` workers (0 = one per
+   online CPU), each taking a run of top-level blocks. The result is the
+   same tree a plain parse gives, blocks in source order; references are
+   resolved afterwards by acl_resolve_all as usual. Runs are cut at lines
+   indented like the first block's name, so a file whose top-level blocks
+   don't start their own lines, or that is too small to split, is parsed
+   on the calling thread. A parse error is reported as by acl_parse_file. */
+AclBlock *acl_parse_file_parallel(const char *path, int threads);
+AclBlock *acl_parse_string_parallel(const char *text, int threads);
+
+/* Streaming parse: report blocks, fields and array elements to callbacks as
+   they are read, without building a tree. Memory use doesn't grow with the
+   input (beyond the longest reference or escaped string), and no reference
+   is resolved.
+
+   An array field or element is reported with kind ACL_SAX_ARRAY; its
+   elements follow (index counting from 0), then array_end. A string's text
+   is decoded; a reference's or expression's text is as written. Names,
+   labels and value text are not NUL-terminated and are valid only during
+   the callback. `offset` is the value's byte offset in the source.
+
+   Each callback returns an AclSaxAction: CONTINUE, SKIP (from block_enter,
+   or for an array value: pass over its contents without reporting them,
+   the matching block_exit or array_end included) or STOP (end the parse
+   now). NULL callbacks are skipped over as if they returned CONTINUE.
+   Returns 1 when the whole input was read, 0 when a callback stopped the
+   parse, -1 if the file can't be read or has a parse error (reported on
+   stderr, after the events up to it). */
+typedef enum {
+    ACL_SAX_INT, ACL_SAX_FLOAT, ACL_SAX_BOOL, ACL_SAX_CHAR,
+    ACL_SAX_STRING, ACL_SAX_REF, ACL_SAX_EXPR, ACL_SAX_ARRAY
+} AclSaxKind;
+typedef enum { ACL_SAX_CONTINUE, ACL_SAX_SKIP, ACL_SAX_STOP } AclSaxAction;
+typedef struct AclSaxValue {
+    AclSaxKind kind;
+    long i;               /* INT, CHAR, BOOL (0 or 1) */
+    double f;             /* FLOAT */
+    const char *str;      /* STRING, REF, EXPR */
+    size_t len;
+    size_t offset;
+} AclSaxValue;
+typedef struct AclSaxHandler {
+    int (*block_enter)(void *ctx, const char *name, size_t nlen, const char *label, size_t llen); /* label NULL if none */
+    int (*block_exit)(void *ctx);
+    int (*field)(void *ctx, const char *name, size_t nlen, const AclSaxValue *v);
+    int (*element)(void *ctx, size_t index, const AclSaxValue *v);
+    int (*array_end)(void *ctx);
+} AclSaxHandler;
+int acl_sax_parse_file(const char *path, const AclSaxHandler *h, void *ctx);
+int acl_sax_parse_string(const char *text, size_t len, const AclSaxHandler *h, void *ctx);
+
 /* Resolve references in-place. Returns 1 on success, 0 on failure. */
 int acl_resolve_all(AclBlock *root);
 
+/* Resolve references as they are read instead of all up front: after this
+   call, a lookup (path, cursor, query or typed getter) that reaches a field
+   resolves that field and what it refers to, in place, once. A reference
+   that can't be resolved is reported on stderr when a lookup first reaches
+   it, and only reads of the fields it is in fail. Lookups then modify the
+   tree, so it must not be read from several threads at once; a later
+   acl_resolve_all resolves the rest. A compiled image is already
+   resolved. Returns 1, or 0 for a NULL tree. */
+int acl_resolve_on_demand(AclBlock *root);
+
+/* Compiled images (.aclb): a resolved tree serialized for mmap.
+   acl_compile resolves root and writes it to image_path, recording the hash
+   of source_path; returns 1 on success, 0 on failure (unresolved refs, I/O).
+   acl_open_compiled maps an image and returns a handle that works with the
+   lookup, accessor, print and free calls above and below, without parsing
+   or allocating. It returns NULL if the image is invalid or, when
+   source_path is given, was built from different source text.
+   acl_load opens a fresh image if there is one; otherwise it parses and
+   resolves source_path and tries to rewrite image_path for next time. */
+int acl_compile(AclBlock *root, const char *source_path, const char *image_path);
+AclBlock *acl_open_compiled(const char *image_path, const char *source_path);
+AclBlock *acl_load(const char *source_path, const char *image_path);
+
+/* Live reload: reparse the file a tree was loaded from and merge it into
+   the tree in place. Blocks are matched by name and label, fields by name;
+   nodes that survive keep their addresses, so a value looked up before
+   reads the field's new contents. A string or array read out of a field
+   is only good until a reload changes that field (see acl_value_string).
+   Only references that can see a change are resolved again. If `changes`
+   is non-NULL it receives the change set (free it with acl_changes_free):
+   fields edited, added or removed, whole blocks added or removed, and
+   fields whose resolved value changed through a reference. An image
+   handle can't be patched; it is replaced by the parsed tree and each
+   top-level block is reported as modified.
+   Returns 1 if the tree is fully resolved, 0 if references were left
+   unresolved (reported on stderr), or -1 if the file can't be read or
+   parsed, in which case the tree is left as it was. *root may change. */
+typedef enum { ACL_CHANGE_ADDED, ACL_CHANGE_REMOVED, ACL_CHANGE_MODIFIED } AclChangeKind;
+typedef struct AclChange {
+    AclChangeKind kind;
+    char *path;   /* e.g. Network.interface["eth0"].gateway; no field for a block */
+} AclChange;
+typedef struct AclChangeSet {
+    size_t count;
+    AclChange *items;
+} AclChangeSet;
+int acl_reload(AclBlock **root, const char *path, AclChangeSet **changes);
+void acl_changes_free(AclChangeSet *changes);
+
+/* Snapshots: one config shared by threads that read it while another
+   reloads it. Each reload parses a new tree and publishes it whole;
+   readers keep the tree they entered with until they leave, and see the
+   next one on their next enter. Reading takes no lock.
+
+     AclSnapshotReader *r = acl_snapshot_reader(snaps);   once per thread
+     AclBlock *root = acl_snapshot_enter(r, &version);
+     ... lookups, cursors, queries on root ...
+     acl_snapshot_leave(r);
+
+   acl_snapshots_open parses and resolves path as the first snapshot
+   (version 1), or returns NULL. acl_snapshots_reload parses path again
+   and publishes it: returns 1, -1 if the file can't be read or parsed, or
+   0 if references were left unresolved; the current snapshot stays on
+   failure. acl_snapshots_publish does the same for a tree the caller
+   built, and takes it either way: a lazy or on-demand tree is read to the
+   end and resolved first, since lookups would otherwise modify it. It
+   returns the new version, or 0 (and frees root). Publishing is
+   serialized by a mutex, and a replaced tree is freed by a later publish
+   (or acl_snapshots_pending) once no reader entered before it was
+   replaced is still inside. acl_snapshots_pending returns how many
+   replaced trees are still held.
+
+   A reader belongs to one thread at a time; enter/leave pairs don't nest.
+   acl_snapshot_reader_close gives its slot back (for reuse by the next
+   acl_snapshot_reader); acl_snapshots_close frees everything and must
+   come after every reader has left. */
+typedef struct AclSnapshots AclSnapshots;
+typedef struct AclSnapshotReader AclSnapshotReader;
+AclSnapshots *acl_snapshots_open(const char *path);
+int acl_snapshots_reload(AclSnapshots *s);
+unsigned long acl_snapshots_publish(AclSnapshots *s, AclBlock *root);
+size_t acl_snapshots_pending(AclSnapshots *s);
+void acl_snapshots_close(AclSnapshots *s);
+AclSnapshotReader *acl_snapshot_reader(AclSnapshots *s);
+void acl_snapshot_reader_close(AclSnapshotReader *r);
+AclBlock *acl_snapshot_enter(AclSnapshotReader *r, unsigned long *version);
+void acl_snapshot_leave(AclSnapshotReader *r);
+
 /* Utilities */
 void acl_print(AclBlock *root, FILE *out);
 
+/* Diagnostics (parse, reference and expression errors, files that can't
+   be opened) go to stderr. acl_set_diagnostics sends the calling thread's
+   to `out` instead, NULL restoring stderr; the workers of
+   acl_parse_*_parallel keep reporting to stderr. */
+void acl_set_diagnostics(FILE *out);
+
+/* Benchmark hook: run only the lexer over `len` bytes of `text` and
+   return the number of tokens seen (EOF excluded). */
+long acl_lex_count(const char *text, size_t len);
+
+/* Benchmark hook: cap the vector width of the lexer's byte scans at
+   `width` bytes (0 = scalar, 16 = SSE2, 32 = AVX2), clamped to what the
+   CPU supports, and return the width now in use. It applies to every
+   parse in the process; don't change it while one is running. */
+int acl_lex_simd(int width);
+
 /* Free tree returned by parser */
 void acl_free(AclBlock *root);
 
@@ -55,4 +231,101 @@ int acl_get_float(AclBlock *root, const char *path, double *out);
 int acl_get_bool(AclBlock *root, const char *path, int *out);
 int acl_get_string(AclBlock *root, const char *path, char **out);
 
+/* Compiled paths: parse a path once and look it up many times, in any tree.
+   acl_path_compile returns NULL for a malformed path. The handle holds no
+   reference to a tree; free it with acl_path_free. */
+typedef struct AclPath AclPath;
+AclPath *acl_path_compile(const char *path);
+void acl_path_free(AclPath *p);
+AclValue *acl_path_lookup(AclBlock *root, const AclPath *p);
+
+/* Cursors: look a block up once, then read fields relative to it.
+
+     AclCursor c;
+     long uid;
+     if (acl_cursor_open(&c, root, "Users.user[\"root\"]"))
+         acl_value_int(acl_cursor_get(&c, "uid"), &uid);
+
+   acl_cursor_open returns 1 if block_path names a block, else 0 (and the
+   cursor finds nothing). acl_cursor_get takes a path relative to it:
+   "uid", "ports[2]", "Limits.nofile". A cursor holds no resources; it
+   is valid until acl_free, or an acl_reload that removes its block or
+   replaces the image it points into.
+   acl_query_many reads n fields of one block this way: out[i] receives
+   the value of fields[i], or NULL if it is missing. Returns the number
+   found. */
+typedef struct AclCursor {
+    void *root;
+    void *block;
+} AclCursor;
+int acl_cursor_open(AclCursor *c, AclBlock *root, const char *block_path);
+AclValue *acl_cursor_get(const AclCursor *c, const char *path);
+size_t acl_query_many(AclBlock *root, const char *base_path, const char *const *fields, size_t n, AclValue **out);
+
+/* Queries: paths that match many values or blocks, compiled once and run
+   as an iterator over any tree or image.
+
+     Registry.Package[*].Version[*].sha256   every version's sha256
+     **.Version[deprecated == true]          every deprecated Version block
+     Users.*.groups[*]                       each element of every groups array
+
+   A segment is a name, "*" (any name) or "**" (any number of nested
+   blocks, none included), followed by filters in brackets: ["label"],
+   [*] (any label; on the last segment, also every element of an array
+   field), [N] (last segment only: element N of an array field) and
+   predicates [field], [field == literal] (also != < <= > >=) on a block's
+   field, whose literal is an int, float, true, false or "string". A
+   missing field, or one of another type, fails every predicate. Only the
+   last segment matches fields, by the same rule as acl_find_value_by_path;
+   it matches blocks too, unless it has [N]. acl_query_compile returns
+   NULL for a malformed query (or one of more than 64 segments); the
+   handle holds no reference to a tree.
+
+   acl_query_run starts a walk that finds one match per acl_query_next
+   call, in tree order (a block's fields before its children), parsing no
+   more of a lazy tree than the query can reach. A match gives the value
+   (NULL for a block), and a cursor on the block matched or holding the
+   field, for reading more of it. acl_query_next returns 0 when the walk
+   is done. The iterator must not outlive the tree or the query. */
+typedef struct AclQuery AclQuery;
+typedef struct AclQueryIter AclQueryIter;
+typedef struct AclMatch {
+    AclValue *value;      /* field value or array element; NULL for a block */
+    AclCursor block;      /* the block matched, or the one holding the field */
+    const char *name;     /* field or block name */
+    const char *label;    /* block label; NULL if none, and for fields */
+    size_t index;         /* element index for [N] and [*], else 0 */
+} AclMatch;
+AclQuery *acl_query_compile(const char *query);
+void acl_query_free(AclQuery *q);
+AclQueryIter *acl_query_run(AclBlock *root, const AclQuery *q);
+int acl_query_next(AclQueryIter *it, AclMatch *m);
+void acl_query_iter_free(AclQueryIter *it);
+
+/* Typed reads of a looked-up value. Return 1 on success, 0 on a NULL value
+   or kind mismatch. acl_value_string hands out the tree's own string, of
+   any length: it is good until acl_reload changes the field or the tree
+   is freed (copy it, or use acl_get_string, to keep it). */
+int acl_value_int(const AclValue *v, long *out);
+int acl_value_float(const AclValue *v, double *out);
+int acl_value_bool(const AclValue *v, int *out);
+int acl_value_string(const AclValue *v, const char **out);
+
+/* Array iteration, O(1) per element:
+
+     AclArrayIter it;
+     AclValue *e;
+     if (acl_array_iter_init(&it, acl_find_value_by_path(root, "System.Modules.load")))
+         while ((e = acl_array_next(&it))) ...
+
+   acl_array_iter_init returns 0 (and the iterator yields nothing) if v is
+   not an array. `index` is the number of elements returned so far. */
+typedef struct AclArrayIter {
+    void *priv;
+    size_t index;
+} AclArrayIter;
+size_t acl_array_len(const AclValue *v);
+int acl_array_iter_init(AclArrayIter *it, const AclValue *v);
+AclValue *acl_array_next(AclArrayIter *it);
+
 #endif
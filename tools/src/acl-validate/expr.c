@@ -1,578 +1,714 @@
-// expr_eval.c
-// Parse C‐style expressions with casts and then evaluate to a single string.
+// expr.c
+// Compile C‐style expressions with casts to bytecode, then evaluate them.
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <limits.h>
+#include "expr.h"
 
 typedef enum {
     T_END, T_INT, T_DOUBLE, T_STRING, T_IDENT,
     T_OP, T_QUESTION, T_COLON, T_LPAREN, T_RPAREN
 } TokenType;
 
+// tokens are slices of the expression text
 typedef struct {
     TokenType type;
-    char *text;
+    const char *text;
+    size_t len;
 } Token;
 
-const char *src;
-Token curtok;
-
-// AST node kinds
+//----------------------------------------------------------------
+// Bytecode
+//----------------------------------------------------------------
+// Stack machine. Unary ops and casts rewrite the top value, binary ops
+// pop two and push one. Jump offsets are relative to the jump itself, so
+// code can be moved while folding.
 typedef enum {
-    NODE_INT, NODE_DOUBLE, NODE_STRING, NODE_IDENT,
-    NODE_CAST, NODE_UNARY, NODE_BINARY, NODE_TERNARY
-} NodeType;
+    OP_CONST,       // push consts[arg]
+    OP_LOAD,        // push operand arg from the caller
+    OP_NEG, OP_NOT, OP_TO_INT, OP_TO_DOUBLE,
+    OP_MUL, OP_DIV, OP_MOD, OP_ADD, OP_SUB,
+    OP_LT, OP_GT, OP_LE, OP_GE, OP_EQ, OP_NE, OP_AND, OP_OR,
+    OP_JUMP_FALSE,  // pop; if false, jump by arg
+    OP_JUMP         // jump by arg
+} OpCode;
 
-typedef enum {
-    OP_NEG, OP_NOT, OP_MUL, OP_DIV, OP_MOD,
-    OP_ADD, OP_SUB, OP_LT, OP_GT, OP_LE, OP_GE,
-    OP_EQ, OP_NE, OP_AND, OP_OR
-} OpKind;
-
-typedef struct Node {
-    NodeType type;
-    OpKind op;
-    char   *text;      // for strings, id, cast type
-    long    ival;
-    double  dval;
-    struct Node *a, *b, *c;
-} Node;
-
-// Evaluated value
-typedef enum { V_INT, V_DOUBLE, V_STRING } ValType;
-typedef struct {
-    ValType type;
-    long    ival;
-    double  dval;
-    char   *sval;
-} Value;
+#define IS_UNARY(op) ((op) >= OP_NEG && (op) <= OP_TO_DOUBLE)
+#define IS_BINARY(op) ((op) >= OP_MUL && (op) <= OP_OR)
+
+typedef struct { OpCode op; int arg; } Insn;
+
+typedef struct { const char *text; size_t len; } ExprLoad;
+
+// one allocation: this header, then consts, loads, code and string bytes
+struct ExprProg {
+    size_t ncode, nconsts, nloads;
+    const ExprVal *consts;
+    const ExprLoad *loads;
+    const Insn *code;
+};
+
+#define EXPR_STACK 64     // evaluation stack slots
+#define EXPR_NEST 256     // parser recursion limit
 
 //----------------------------------------------------------------
-// Lexer
+// Operations (shared by constant folding and evaluation)
 //----------------------------------------------------------------
-void lex_error(const char *msg) {
-    fprintf(stderr, "Lex error: %s at '%s'\n", msg, src);
-    exit(1);
+#define NUM(v) ((v)->type == EXPR_DOUBLE ? (v)->dval : (double)(v)->ival)
+
+static ExprVal ex_int(long i) { return (ExprVal){EXPR_INT, i, 0, NULL}; }
+static ExprVal ex_double(double d) { return (ExprVal){EXPR_DOUBLE, 0, d, NULL}; }
+
+// ternary / conditional-jump test: a double counts as its integer part
+static int ex_cond(const ExprVal *v) {
+    if (v->type == EXPR_DOUBLE) return v->dval >= 1.0 || v->dval <= -1.0;
+    return v->ival != 0;
+}
+
+// text of v for concatenation and string comparison
+static const char *ex_text(const ExprVal *v, char buf[32]) {
+    if (v->type == EXPR_INT) { snprintf(buf, 32, "%ld", v->ival); return buf; }
+    if (v->type == EXPR_DOUBLE) { snprintf(buf, 32, "%g", v->dval); return buf; }
+    return v->sval;
+}
+
+// wrapping integer arithmetic
+static long wrap(unsigned long x) { return (long)x; }
+
+static int apply_unary(OpCode op, ExprVal *v) {
+    switch (op) {
+      case OP_NEG:
+        if (v->type == EXPR_INT) v->ival = wrap(0UL - (unsigned long)v->ival);
+        else if (v->type == EXPR_DOUBLE) v->dval = -v->dval;
+        return 1;
+      case OP_NOT: {
+        int b;
+        if (v->type == EXPR_INT) b = !v->ival;
+        else if (v->type == EXPR_DOUBLE) b = !(v->dval != 0.0);
+        else b = v->sval[0] == '\0';
+        *v = ex_int(b);
+        return 1;
+      }
+      case OP_TO_INT:
+        if (v->type == EXPR_DOUBLE) {
+            if (!(v->dval > (double)LONG_MIN - 1.0 && v->dval < (double)LONG_MAX)) return 0;
+            *v = ex_int((long)v->dval);
+        } else {
+            *v = ex_int(v->ival);
+        }
+        return 1;
+      case OP_TO_DOUBLE:
+        *v = ex_double(v->type == EXPR_INT ? (double)v->ival : v->dval);
+        return 1;
+      default:
+        return 0;
+    }
+}
+
+// integer division by zero (or LONG_MIN / -1) fails the expression
+static int int_div_ok(const ExprVal *L, const ExprVal *R) {
+    return R->ival != 0 && !(L->ival == LONG_MIN && R->ival == -1);
 }
 
-void next_tok() {
-    while (isspace(*src)) src++;
-    if (*src == '\0') {
-        curtok.type = T_END;
-        curtok.text = NULL;
+// L = L op R
+static int apply_binary(OpCode op, ExprVal *L, const ExprVal *R, ExprAllocFn alloc, void *ctx) {
+    int dbl = L->type == EXPR_DOUBLE || R->type == EXPR_DOUBLE;
+    int str = L->type == EXPR_STRING || R->type == EXPR_STRING;
+    char b1[32], b2[32];
+    switch (op) {
+      case OP_ADD:
+        if (str) {
+            const char *s1 = ex_text(L, b1), *s2 = ex_text(R, b2);
+            size_t n1 = strlen(s1), n2 = strlen(s2);
+            char *res = alloc ? alloc(ctx, n1 + n2 + 1) : NULL;
+            if (!res) return 0;
+            memcpy(res, s1, n1);
+            memcpy(res + n1, s2, n2 + 1);
+            *L = (ExprVal){EXPR_STRING, 0, 0, res};
+            return 1;
+        }
+        *L = dbl ? ex_double(NUM(L) + NUM(R)) : ex_int(wrap((unsigned long)L->ival + (unsigned long)R->ival));
+        return 1;
+      case OP_SUB:
+        *L = dbl ? ex_double(NUM(L) - NUM(R)) : ex_int(wrap((unsigned long)L->ival - (unsigned long)R->ival));
+        return 1;
+      case OP_MUL:
+        *L = dbl ? ex_double(NUM(L) * NUM(R)) : ex_int(wrap((unsigned long)L->ival * (unsigned long)R->ival));
+        return 1;
+      case OP_DIV:
+        if (dbl) { *L = ex_double(NUM(L) / NUM(R)); return 1; }
+        if (!int_div_ok(L, R)) return 0;
+        *L = ex_int(L->ival / R->ival);
+        return 1;
+      case OP_MOD:
+        if (!int_div_ok(L, R)) return 0;
+        *L = ex_int(L->ival % R->ival);
+        return 1;
+      case OP_LT: *L = ex_int(dbl ? NUM(L) < NUM(R) : L->ival < R->ival); return 1;
+      case OP_GT: *L = ex_int(dbl ? NUM(L) > NUM(R) : L->ival > R->ival); return 1;
+      case OP_LE: *L = ex_int(dbl ? NUM(L) <= NUM(R) : L->ival <= R->ival); return 1;
+      case OP_GE: *L = ex_int(dbl ? NUM(L) >= NUM(R) : L->ival >= R->ival); return 1;
+      case OP_EQ:
+      case OP_NE: {
+        int eq;
+        if (str) eq = strcmp(ex_text(L, b1), ex_text(R, b2)) == 0;
+        else if (dbl) eq = NUM(L) == NUM(R);
+        else eq = L->ival == R->ival;
+        *L = ex_int(op == OP_EQ ? eq : !eq);
+        return 1;
+      }
+      case OP_AND: *L = ex_int(NUM(L) && NUM(R)); return 1;
+      case OP_OR: *L = ex_int(NUM(L) || NUM(R)); return 1;
+      default:
+        return 0;
+    }
+}
+
+//----------------------------------------------------------------
+// Compiler state
+//----------------------------------------------------------------
+// Per-compile state. Folded strings are chained onto `allocs` and the
+// code/constant/operand vectors are plain heap arrays; all of it is released
+// once the program has been copied out. Errors unwind to `fail`, so
+// compiles on different threads never interact.
+typedef union Alloc { union Alloc *next; max_align_t align; } Alloc;
+
+typedef struct {
+    const char *src;
+    Token curtok;
+    int nest;
+
+    Insn *code; size_t ncode, code_cap;
+    ExprVal *consts; size_t nconsts, consts_cap;
+    ExprLoad *loads; size_t nloads, loads_cap;
+    int depth, max_depth;
+
+    Alloc *allocs;
+    jmp_buf fail;
+} ExprCtx;
+
+static void *chain_alloc(void *ctx, size_t n) {
+    Alloc **chain = ctx;
+    Alloc *a = malloc(sizeof(Alloc) + n);
+    if (!a) return NULL;
+    a->next = *chain;
+    *chain = a;
+    return a + 1;
+}
+
+static void chain_free(Alloc **chain) {
+    Alloc *a = *chain;
+    while (a) { Alloc *n = a->next; free(a); a = n; }
+    *chain = NULL;
+}
+
+static void *ex_alloc(void *ctx, size_t n) {
+    return chain_alloc(&((ExprCtx *)ctx)->allocs, n);
+}
+
+static void ex_free_all(ExprCtx *C) {
+    chain_free(&C->allocs);
+    free(C->code);
+    free(C->consts);
+    free(C->loads);
+}
+
+static _Noreturn void ex_fail(ExprCtx *C) {
+    longjmp(C->fail, 1);
+}
+
+static void *ex_grow(ExprCtx *C, void *v, size_t *cap, size_t elem) {
+    size_t n = *cap ? *cap * 2 : 16;
+    void *nv = realloc(v, n * elem);
+    if (!nv) ex_fail(C);
+    *cap = n;
+    return nv;
+}
+
+//----------------------------------------------------------------
+// Lexer
+//----------------------------------------------------------------
+static void next_tok(ExprCtx *C) {
+    while (isspace((unsigned char)*C->src)) C->src++;
+    const char *start = C->src;
+    Token *t = &C->curtok;
+    if (*C->src == '\0') {
+        *t = (Token){T_END, NULL, 0};
         return;
     }
-    if (*src == '"') {
-        const char *start = ++src;
-        while (*src && *src != '"') {
-            if (*src == '\\' && src[1]) src++;
-            src++;
+    if (*C->src == '"') {
+        // string contents are kept verbatim, escapes included
+        start = ++C->src;
+        while (*C->src && *C->src != '"') {
+            if (*C->src == '\\' && C->src[1]) C->src++;
+            C->src++;
         }
-        if (*src != '"') lex_error("unterminated string");
-        size_t len = src - start;
-        char *buf = malloc(len+1);
-        strncpy(buf, start, len);
-        buf[len] = '\0';
-        src++;
-        curtok.type = T_STRING;
-        curtok.text = buf;
+        if (*C->src != '"') ex_fail(C);
+        *t = (Token){T_STRING, start, (size_t)(C->src - start)};
+        C->src++;
         return;
     }
-    if (isdigit(*src) || (*src == '.' && isdigit(src[1]))) {
-        const char *start = src;
-        while (isdigit(*src)) src++;
+    if (isdigit((unsigned char)*C->src) || (*C->src == '.' && isdigit((unsigned char)C->src[1]))) {
         int is_double = 0;
-        if (*src == '.') {
+        while (isdigit((unsigned char)*C->src)) C->src++;
+        if (*C->src == '.') {
             is_double = 1;
-            src++;
-            while (isdigit(*src)) src++;
+            C->src++;
+            while (isdigit((unsigned char)*C->src)) C->src++;
         }
-        size_t len = src - start;
-        char *buf = malloc(len+1);
-        strncpy(buf, start, len);
-        buf[len] = '\0';
-        curtok.type = is_double ? T_DOUBLE : T_INT;
-        curtok.text = buf;
+        *t = (Token){is_double ? T_DOUBLE : T_INT, start, (size_t)(C->src - start)};
         return;
     }
-    if (isalpha(*src) || *src == '_' || *src == '$') {
-        const char *start = src;
-        while (isalnum(*src) || *src=='_' || *src=='$' || *src=='.') src++;
-        size_t len = src - start;
-        char *buf = malloc(len+1);
-        strncpy(buf, start, len);
-        buf[len] = '\0';
-        curtok.type = T_IDENT;
-        curtok.text = buf;
+    if (isalpha((unsigned char)*C->src) || *C->src == '_' || *C->src == '$') {
+        while (isalnum((unsigned char)*C->src) || *C->src=='_' || *C->src=='$' || *C->src=='.') C->src++;
+        *t = (Token){T_IDENT, start, (size_t)(C->src - start)};
         return;
     }
     // two-char ops
-    if ((src[0]=='<'&&src[1]=='=')||(src[0]=='>'&&src[1]=='=')||
-        (src[0]=='='&&src[1]=='=')||(src[0]=='!'&&src[1]=='=')||
-        (src[0]=='&'&&src[1]=='&')||(src[0]=='|'&&src[1]=='|')) {
-        char buf[3] = {src[0], src[1], 0};
-        curtok.type = T_OP;
-        curtok.text = strdup(buf);
-        src += 2;
+    if ((C->src[0]=='<'&&C->src[1]=='=')||(C->src[0]=='>'&&C->src[1]=='=')||
+        (C->src[0]=='='&&C->src[1]=='=')||(C->src[0]=='!'&&C->src[1]=='=')||
+        (C->src[0]=='&'&&C->src[1]=='&')||(C->src[0]=='|'&&C->src[1]=='|')) {
+        *t = (Token){T_OP, start, 2};
+        C->src += 2;
         return;
     }
     // single-char
-    char c = *src++;
-    switch (c) {
+    switch (*C->src++) {
       case '+': case '-': case '*': case '/': case '%':
       case '<': case '>': case '!':
-        curtok.type = T_OP;
-        curtok.text = malloc(2);
-        curtok.text[0] = c;
-        curtok.text[1] = '\0';
-        return;
-      case '?':
-        curtok.type = T_QUESTION; curtok.text = strdup("?"); return;
-      case ':':
-        curtok.type = T_COLON; curtok.text = strdup(":"); return;
-      case '(':
-        curtok.type = T_LPAREN; curtok.text = strdup("("); return;
-      case ')':
-        curtok.type = T_RPAREN; curtok.text = strdup(")"); return;
+        *t = (Token){T_OP, start, 1}; return;
+      case '?': *t = (Token){T_QUESTION, start, 1}; return;
+      case ':': *t = (Token){T_COLON, start, 1}; return;
+      case '(': *t = (Token){T_LPAREN, start, 1}; return;
+      case ')': *t = (Token){T_RPAREN, start, 1}; return;
     }
-    lex_error("unknown char");
+    ex_fail(C);
 }
 
-//----------------------------------------------------------------
-// Parser (prec‐climbing)
-//----------------------------------------------------------------
-#define MATCH(t) (curtok.type==t ? (next_tok(),1) : 0)
-
-Node *parse_expr();
-Node *parse_ternary();
-Node *parse_logical_or();
-Node *parse_logical_and();
-Node *parse_equality();
-Node *parse_comparison();
-Node *parse_add();
-Node *parse_mul();
-Node *parse_unary();
-Node *parse_primary();
+static int tok_is(const ExprCtx *C, const char *op) {
+    return C->curtok.type == T_OP && C->curtok.len == strlen(op)
+        && memcmp(C->curtok.text, op, C->curtok.len) == 0;
+}
 
-Node *make_node(NodeType t) {
-    Node *n = calloc(1, sizeof(*n));
-    n->type = t;
-    return n;
+static int ident_is(const Token *t, const char *s) {
+    return t->len == strlen(s) && memcmp(t->text, s, t->len) == 0;
 }
-Node *make_int(long v) {
-    Node *n = make_node(NODE_INT); n->ival = v; return n;
+
+//----------------------------------------------------------------
+// Code emission and constant folding
+//----------------------------------------------------------------
+static void emit(ExprCtx *C, OpCode op, int arg) {
+    if (C->ncode == C->code_cap) C->code = ex_grow(C, C->code, &C->code_cap, sizeof(Insn));
+    C->code[C->ncode++] = (Insn){op, arg};
+    if (op == OP_CONST || op == OP_LOAD) C->depth++;
+    else if (IS_BINARY(op) || op == OP_JUMP_FALSE) C->depth--;
+    if (C->depth > C->max_depth) C->max_depth = C->depth;
 }
-Node *make_double(double v) {
-    Node *n = make_node(NODE_DOUBLE); n->dval = v; return n;
+
+static void emit_const(ExprCtx *C, ExprVal v) {
+    if (C->nconsts == C->consts_cap) C->consts = ex_grow(C, C->consts, &C->consts_cap, sizeof(ExprVal));
+    C->consts[C->nconsts] = v;
+    emit(C, OP_CONST, (int)C->nconsts++);
 }
-Node *make_string(char *s) {
-    Node *n = make_node(NODE_STRING); n->text = s; return n;
+
+static void emit_load(ExprCtx *C, const char *text, size_t len) {
+    size_t i = 0;
+    while (i < C->nloads && !(C->loads[i].len == len && memcmp(C->loads[i].text, text, len) == 0)) i++;
+    if (i == C->nloads) {
+        if (C->nloads == C->loads_cap) C->loads = ex_grow(C, C->loads, &C->loads_cap, sizeof(ExprLoad));
+        C->loads[C->nloads++] = (ExprLoad){text, len};
+    }
+    emit(C, OP_LOAD, (int)i);
 }
-Node *make_ident(char *s) {
-    Node *n = make_node(NODE_IDENT); n->text = s; return n;
+
+// the value pushed by code[start..], if that code is a single constant
+static ExprVal *const_at(ExprCtx *C, size_t start) {
+    if (C->ncode != start + 1 || C->code[start].op != OP_CONST) return NULL;
+    return &C->consts[C->code[start].arg];
 }
 
-Node *parse_expr() {
-    return parse_ternary();
+// operand code starts at `start`
+static void emit_unary(ExprCtx *C, size_t start, OpCode op) {
+    ExprVal *k = const_at(C, start);
+    if (k) {
+        ExprVal v = *k;
+        if (apply_unary(op, &v)) {
+            C->ncode = start;
+            C->depth--;
+            emit_const(C, v);
+            return;
+        }
+    }
+    emit(C, op, 0);
 }
 
-Node *parse_ternary() {
-    Node *c = parse_logical_or();
-    if (MATCH(T_QUESTION)) {
-        Node *t = parse_expr();
-        if (!MATCH(T_COLON)) {
-            fprintf(stderr,"expected ':' in ternary\n");
-            exit(1);
+// left operand code is code[start..mid), right is code[mid..]
+static void emit_binary(ExprCtx *C, size_t start, size_t mid, OpCode op) {
+    if (mid == start + 1 && C->code[start].op == OP_CONST && const_at(C, mid)) {
+        ExprVal l = C->consts[C->code[start].arg];
+        if (apply_binary(op, &l, const_at(C, mid), ex_alloc, C)) {
+            C->ncode = start;
+            C->depth -= 2;
+            emit_const(C, l);
+            return;
         }
-        Node *e = parse_expr();
-        Node *n = make_node(NODE_TERNARY);
-        n->a = c; n->b = t; n->c = e;
-        return n;
     }
-    return c;
+    emit(C, op, 0);
 }
 
-Node *make_cmp(Node *l, Node *r, OpKind op) {
-    Node *n = make_node(NODE_BINARY);
-    n->op = op; n->a = l; n->b = r;
-    return n;
+//----------------------------------------------------------------
+// Parser (prec‐climbing, emitting code as it goes)
+//----------------------------------------------------------------
+#define MATCH(t) (C->curtok.type==t ? (next_tok(C),1) : 0)
+
+static void parse_expr(ExprCtx *C);
+static void parse_ternary(ExprCtx *C);
+static void parse_logical_or(ExprCtx *C);
+static void parse_logical_and(ExprCtx *C);
+static void parse_equality(ExprCtx *C);
+static void parse_comparison(ExprCtx *C);
+static void parse_add(ExprCtx *C);
+static void parse_mul(ExprCtx *C);
+static void parse_unary(ExprCtx *C);
+static void parse_primary(ExprCtx *C);
+
+static void parse_expr(ExprCtx *C) {
+    if (++C->nest > EXPR_NEST) ex_fail(C);
+    parse_ternary(C);
+    C->nest--;
 }
 
-Node *parse_logical_or() {
-    Node *n = parse_logical_and();
-    while (curtok.type==T_OP && strcmp(curtok.text,"||")==0) {
-        next_tok();
-        Node *r = parse_logical_and();
-        Node *o = make_node(NODE_BINARY);
-        o->op = OP_OR; o->a = n; o->b = r;
-        n = o;
+static void parse_ternary(ExprCtx *C) {
+    size_t start = C->ncode;
+    parse_logical_or(C);
+    if (!MATCH(T_QUESTION)) return;
+
+    // a constant condition keeps only the branch it selects
+    ExprVal *k = const_at(C, start);
+    int folded = k != NULL, taken = k && ex_cond(k);
+    size_t jf = C->ncode;
+    if (folded) { C->ncode = start; C->depth--; }
+    else emit(C, OP_JUMP_FALSE, 0);
+
+    int depth = C->depth;
+    size_t then_start = C->ncode;
+    parse_expr(C);
+    if (!MATCH(T_COLON)) ex_fail(C);
+    size_t jmp = C->ncode;
+    if (!folded) emit(C, OP_JUMP, 0);
+    size_t else_start = C->ncode;
+    C->depth = depth;
+    parse_expr(C);
+
+    if (!folded) {
+        C->code[jf].arg = (int)(else_start - jf);
+        C->code[jmp].arg = (int)(C->ncode - jmp);
+    } else if (taken) {
+        C->ncode = else_start;
+    } else {
+        size_t n = C->ncode - else_start;
+        memmove(C->code + then_start, C->code + else_start, n * sizeof(Insn));
+        C->ncode = then_start + n;
     }
-    return n;
 }
 
-Node *parse_logical_and() {
-    Node *n = parse_equality();
-    while (curtok.type==T_OP && strcmp(curtok.text,"&&")==0) {
-        next_tok();
-        Node *r = parse_equality();
-        Node *o = make_node(NODE_BINARY);
-        o->op = OP_AND; o->a = n; o->b = r;
-        n = o;
+static void parse_logical_or(ExprCtx *C) {
+    size_t start = C->ncode;
+    parse_logical_and(C);
+    while (tok_is(C, "||")) {
+        next_tok(C);
+        size_t mid = C->ncode;
+        parse_logical_and(C);
+        emit_binary(C, start, mid, OP_OR);
     }
-    return n;
 }
 
-Node *parse_equality() {
-    Node *n = parse_comparison();
-    while (curtok.type==T_OP &&
-           (strcmp(curtok.text,"==")==0||strcmp(curtok.text,"!=")==0)) {
-        OpKind op = strcmp(curtok.text,"==")==0 ? OP_EQ : OP_NE;
-        next_tok();
-        Node *r = parse_comparison();
-        n = make_cmp(n, r, op);
+static void parse_logical_and(ExprCtx *C) {
+    size_t start = C->ncode;
+    parse_equality(C);
+    while (tok_is(C, "&&")) {
+        next_tok(C);
+        size_t mid = C->ncode;
+        parse_equality(C);
+        emit_binary(C, start, mid, OP_AND);
     }
-    return n;
-}
-
-Node *parse_comparison() {
-    Node *n = parse_add();
-    while (curtok.type==T_OP &&
-          (strcmp(curtok.text,"<")==0||strcmp(curtok.text,">")==0||
-           strcmp(curtok.text,"<=")==0||strcmp(curtok.text,">=")==0)) {
-        OpKind op;
-        if (strcmp(curtok.text,"<")==0) op=OP_LT;
-        else if (strcmp(curtok.text,">")==0) op=OP_GT;
-        else if (strcmp(curtok.text,"<=")==0)op=OP_LE;
-        else op=OP_GE;
-        next_tok();
-        Node *r = parse_add();
-        n = make_cmp(n, r, op);
+}
+
+static void parse_equality(ExprCtx *C) {
+    size_t start = C->ncode;
+    parse_comparison(C);
+    while (tok_is(C, "==") || tok_is(C, "!=")) {
+        OpCode op = tok_is(C, "==") ? OP_EQ : OP_NE;
+        next_tok(C);
+        size_t mid = C->ncode;
+        parse_comparison(C);
+        emit_binary(C, start, mid, op);
     }
-    return n;
-}
-
-Node *parse_add() {
-    Node *n = parse_mul();
-    while (curtok.type==T_OP &&
-          (strcmp(curtok.text,"+")==0||strcmp(curtok.text,"-")==0)) {
-        OpKind op = strcmp(curtok.text,"+")==0 ? OP_ADD : OP_SUB;
-        next_tok();
-        Node *r = parse_mul();
-        Node *o = make_node(NODE_BINARY);
-        o->op = op; o->a = n; o->b = r;
-        n = o;
+}
+
+static void parse_comparison(ExprCtx *C) {
+    size_t start = C->ncode;
+    parse_add(C);
+    while (tok_is(C, "<") || tok_is(C, ">") || tok_is(C, "<=") || tok_is(C, ">=")) {
+        OpCode op;
+        if (tok_is(C, "<")) op = OP_LT;
+        else if (tok_is(C, ">")) op = OP_GT;
+        else if (tok_is(C, "<=")) op = OP_LE;
+        else op = OP_GE;
+        next_tok(C);
+        size_t mid = C->ncode;
+        parse_add(C);
+        emit_binary(C, start, mid, op);
     }
-    return n;
-}
-
-Node *parse_mul() {
-    Node *n = parse_unary();
-    while (curtok.type==T_OP &&
-          (strcmp(curtok.text,"*")==0||strcmp(curtok.text,"/")==0||
-           strcmp(curtok.text,"%")==0)) {
-        OpKind op;
-        if (strcmp(curtok.text,"*")==0) op=OP_MUL;
-        else if (strcmp(curtok.text,"/")==0) op=OP_DIV;
-        else op=OP_MOD;
-        next_tok();
-        Node *r = parse_unary();
-        Node *o = make_node(NODE_BINARY);
-        o->op = op; o->a = n; o->b = r;
-        n = o;
+}
+
+static void parse_add(ExprCtx *C) {
+    size_t start = C->ncode;
+    parse_mul(C);
+    while (tok_is(C, "+") || tok_is(C, "-")) {
+        OpCode op = tok_is(C, "+") ? OP_ADD : OP_SUB;
+        next_tok(C);
+        size_t mid = C->ncode;
+        parse_mul(C);
+        emit_binary(C, start, mid, op);
     }
-    return n;
 }
 
-Node *parse_unary() {
-    if (curtok.type==T_OP && strcmp(curtok.text,"-")==0) {
-        next_tok();
-        Node *c = parse_unary();
-        Node *n = make_node(NODE_UNARY);
-        n->op = OP_NEG; n->a = c;
-        return n;
+static void parse_mul(ExprCtx *C) {
+    size_t start = C->ncode;
+    parse_unary(C);
+    while (tok_is(C, "*") || tok_is(C, "/") || tok_is(C, "%")) {
+        OpCode op;
+        if (tok_is(C, "*")) op = OP_MUL;
+        else if (tok_is(C, "/")) op = OP_DIV;
+        else op = OP_MOD;
+        next_tok(C);
+        size_t mid = C->ncode;
+        parse_unary(C);
+        emit_binary(C, start, mid, op);
     }
-    if (curtok.type==T_OP && strcmp(curtok.text,"!")==0) {
-        next_tok();
-        Node *c = parse_unary();
-        Node *n = make_node(NODE_UNARY);
-        n->op = OP_NOT; n->a = c;
-        return n;
+}
+
+static void parse_unary(ExprCtx *C) {
+    size_t start = C->ncode;
+    if (tok_is(C, "-") || tok_is(C, "!")) {
+        OpCode op = tok_is(C, "-") ? OP_NEG : OP_NOT;
+        next_tok(C);
+        if (++C->nest > EXPR_NEST) ex_fail(C);
+        parse_unary(C);
+        C->nest--;
+        emit_unary(C, start, op);
+        return;
     }
-    // cast
-    if (curtok.type==T_LPAREN) {
-        const char *bk_src = src;
-        Token bk_tok = curtok;
-        next_tok();
-        if (curtok.type==T_IDENT) {
-            char *ctype = strdup(curtok.text);
-            next_tok();
+    // cast: (int) and (double) convert, any other type name is a no-op
+    if (C->curtok.type==T_LPAREN) {
+        const char *bk_src = C->src;
+        Token bk_tok = C->curtok;
+        next_tok(C);
+        if (C->curtok.type==T_IDENT) {
+            Token ctype = C->curtok;
+            next_tok(C);
             if (MATCH(T_RPAREN)) {
-                Node *child = parse_unary();
-                Node *n = make_node(NODE_CAST);
-                n->text = ctype;
-                n->a = child;
-                return n;
+                if (++C->nest > EXPR_NEST) ex_fail(C);
+                parse_unary(C);
+                C->nest--;
+                if (ident_is(&ctype, "int")) emit_unary(C, start, OP_TO_INT);
+                else if (ident_is(&ctype, "double")) emit_unary(C, start, OP_TO_DOUBLE);
+                return;
             }
-            free(ctype);
         }
         // rollback
-        src = bk_src;
-        curtok = bk_tok;
+        C->src = bk_src;
+        C->curtok = bk_tok;
     }
-    return parse_primary();
+    parse_primary(C);
 }
 
-Node *parse_primary() {
+static void parse_primary(ExprCtx *C) {
+    Token t = C->curtok;
     if (MATCH(T_LPAREN)) {
-        Node *e = parse_expr();
-        if (!MATCH(T_RPAREN)) {
-            fprintf(stderr, "expected )\n");
-            exit(1);
-        }
-        return e;
+        parse_expr(C);
+        if (!MATCH(T_RPAREN)) ex_fail(C);
+        return;
     }
-    if (curtok.type==T_INT) {
-        long v = strtol(curtok.text,NULL,10);
-        Node *n = make_int(v);
-        next_tok();
-        return n;
+    if (t.type == T_INT || t.type == T_DOUBLE) {
+        // number tokens aren't NUL-terminated; longer ones can't be valid
+        char num[64];
+        if (t.len >= sizeof(num)) ex_fail(C);
+        memcpy(num, t.text, t.len);
+        num[t.len] = '\0';
+        emit_const(C, t.type == T_INT ? ex_int(strtol(num, NULL, 10)) : ex_double(strtod(num, NULL)));
+    } else if (t.type == T_IDENT && t.text[0] == '$') {
+        emit_load(C, t.text, t.len);
+    } else if (t.type == T_STRING || t.type == T_IDENT) {
+        char *s = ex_alloc(C, t.len + 1);
+        if (!s) ex_fail(C);
+        memcpy(s, t.text, t.len);
+        s[t.len] = '\0';
+        emit_const(C, (ExprVal){EXPR_STRING, 0, 0, s});
+    } else {
+        ex_fail(C);
     }
-    if (curtok.type==T_DOUBLE) {
-        double v = strtod(curtok.text,NULL);
-        Node *n = make_double(v);
-        next_tok();
-        return n;
+    next_tok(C);
+}
+
+//----------------------------------------------------------------
+// Program layout
+//----------------------------------------------------------------
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+// copy the code, the constants and operands it still uses (folding and
+// dead ternary branches leave others behind) and their strings into one block
+static ExprProg *ex_finish(ExprCtx *C, ExprAllocFn alloc, void *ctx) {
+    size_t *cmap = calloc(C->nconsts + C->nloads + 1, sizeof(size_t));
+    if (!cmap) ex_fail(C);
+    size_t *lmap = cmap + C->nconsts;
+    size_t nconsts = 0, nloads = 0, strbytes = 0;
+    for (size_t i = 0; i < C->ncode; ++i) {
+        const Insn *in = &C->code[i];
+        if (in->op == OP_CONST && !cmap[in->arg]) {
+            cmap[in->arg] = ++nconsts;
+            if (C->consts[in->arg].type == EXPR_STRING) strbytes += strlen(C->consts[in->arg].sval) + 1;
+        } else if (in->op == OP_LOAD && !lmap[in->arg]) {
+            lmap[in->arg] = ++nloads;
+            strbytes += C->loads[in->arg].len + 1;
+        }
+    }
+
+    size_t off_consts = ALIGN8(sizeof(ExprProg));
+    size_t off_loads = off_consts + nconsts * sizeof(ExprVal);
+    size_t off_code = ALIGN8(off_loads + nloads * sizeof(ExprLoad));
+    size_t off_str = off_code + C->ncode * sizeof(Insn);
+    char *mem = alloc(ctx, off_str + strbytes);
+    if (!mem) { free(cmap); ex_fail(C); }
+
+    ExprProg *p = (ExprProg *)mem;
+    ExprVal *consts = (ExprVal *)(mem + off_consts);
+    ExprLoad *loads = (ExprLoad *)(mem + off_loads);
+    Insn *code = (Insn *)(mem + off_code);
+    char *str = mem + off_str;
+    for (size_t i = 0; i < C->nconsts; ++i) {
+        if (!cmap[i]) continue;
+        ExprVal v = C->consts[i];
+        if (v.type == EXPR_STRING) {
+            size_t n = strlen(v.sval) + 1;
+            v.sval = memcpy(str, v.sval, n);
+            str += n;
+        }
+        consts[cmap[i] - 1] = v;
     }
-    if (curtok.type==T_STRING) {
-        Node *n = make_string(curtok.text);
-        next_tok();
-        return n;
+    for (size_t i = 0; i < C->nloads; ++i) {
+        if (!lmap[i]) continue;
+        size_t n = C->loads[i].len;
+        memcpy(str, C->loads[i].text, n);
+        str[n] = '\0';
+        loads[lmap[i] - 1] = (ExprLoad){str, n};
+        str += n + 1;
     }
-    if (curtok.type==T_IDENT) {
-        Node *n = make_ident(curtok.text);
-        next_tok();
-        return n;
+    for (size_t i = 0; i < C->ncode; ++i) {
+        code[i] = C->code[i];
+        if (code[i].op == OP_CONST) code[i].arg = (int)cmap[code[i].arg] - 1;
+        else if (code[i].op == OP_LOAD) code[i].arg = (int)lmap[code[i].arg] - 1;
     }
-    fprintf(stderr, "unexpected token '%s'\n",
-            curtok.text?curtok.text:"(end)");
-    exit(1);
+    free(cmap);
+
+    p->ncode = C->ncode;
+    p->nconsts = nconsts;
+    p->nloads = nloads;
+    p->consts = consts;
+    p->loads = loads;
+    p->code = code;
+    return p;
 }
 
 //----------------------------------------------------------------
-// Evaluator
+// Entry points
 //----------------------------------------------------------------
-char *str_from_val(const Value *v) {
-    char buf[64];
-    if (v->type == V_INT) {
-        snprintf(buf, sizeof(buf), "%ld", v->ival);
-        return strdup(buf);
-    }
-    if (v->type == V_DOUBLE) {
-        snprintf(buf, sizeof(buf), "%g", v->dval);
-        return strdup(buf);
+ExprProg *expr_compile(const char *expr_text, ExprAllocFn alloc, void *ctx) {
+    if (!expr_text || !alloc) return NULL;
+
+    ExprCtx C;
+    memset(&C, 0, sizeof(C));
+    if (setjmp(C.fail)) {
+        ex_free_all(&C);
+        return NULL;
     }
-    return strdup(v->sval);
-}
-
-Value eval(Node *n) {
-    if (!n) exit(1);
-    switch(n->type) {
-      case NODE_INT:
-        return (Value){V_INT, n->ival, 0, NULL};
-      case NODE_DOUBLE:
-        return (Value){V_DOUBLE, 0, n->dval, NULL};
-      case NODE_STRING:
-        return (Value){V_STRING, 0, 0, n->text};
-      case NODE_IDENT:
-        return (Value){V_STRING, 0, 0, n->text};
-      case NODE_CAST: {
-        Value v = eval(n->a);
-        if (strcmp(n->text, "int")==0) {
-            long i = (v.type==V_DOUBLE? (long)v.dval : v.ival);
-            return (Value){V_INT, i,0,NULL};
-        }
-        if (strcmp(n->text,"double")==0) {
-            double d = (v.type==V_INT? (double)v.ival : v.dval);
-            return (Value){V_DOUBLE,0,d,NULL};
-        }
-        // fallback: no-op
-        return v;
-      }
-      case NODE_UNARY: {
-        Value v = eval(n->a);
-        if (n->op==OP_NEG) {
-            if (v.type==V_INT) return (Value){V_INT, -v.ival,0,NULL};
-            if (v.type==V_DOUBLE) return (Value){V_DOUBLE,0,-v.dval,NULL};
-        }
-        if (n->op==OP_NOT) {
-            int b = 0;
-            if (v.type==V_INT) b = !v.ival;
-            else if (v.type==V_DOUBLE) b = !(v.dval!=0.0);
-            else b = (v.sval[0]=='\0');
-            return (Value){V_INT, b,0,NULL};
-        }
-        return v;
-      }
-      case NODE_BINARY: {
-        Value L = eval(n->a);
-        Value R = eval(n->b);
-        switch(n->op) {
-          case OP_ADD:
-            // if either is string → concat
-            if (L.type==V_STRING || R.type==V_STRING) {
-                char *s1 = (L.type==V_STRING? L.sval : str_from_val(&L));
-                char *s2 = (R.type==V_STRING? R.sval : str_from_val(&R));
-                char *res = malloc(strlen(s1)+strlen(s2)+1);
-                strcpy(res, s1);
-                strcat(res, s2);
-                if (L.type!=V_STRING) free(s1);
-                if (R.type!=V_STRING) free(s2);
-                return (Value){V_STRING,0,0,res};
-            }
-            // numeric add
-            if (L.type==V_DOUBLE || R.type==V_DOUBLE) {
-                double d = (L.type==V_DOUBLE?L.dval:L.ival)
-                         + (R.type==V_DOUBLE?R.dval:R.ival);
-                return (Value){V_DOUBLE,0,d,NULL};
-            }
-            return (Value){V_INT, L.ival + R.ival,0,NULL};
-          case OP_SUB:
-            if (L.type==V_DOUBLE || R.type==V_DOUBLE) {
-                double d = (L.type==V_DOUBLE?L.dval:L.ival)
-                         - (R.type==V_DOUBLE?R.dval:R.ival);
-                return (Value){V_DOUBLE,0,d,NULL};
-            }
-            return (Value){V_INT, L.ival - R.ival,0,NULL};
-          case OP_MUL:
-            if (L.type==V_DOUBLE || R.type==V_DOUBLE) {
-                double d = (L.type==V_DOUBLE?L.dval:L.ival)
-                         * (R.type==V_DOUBLE?R.dval:R.ival);
-                return (Value){V_DOUBLE,0,d,NULL};
-            }
-            return (Value){V_INT, L.ival * R.ival,0,NULL};
-          case OP_DIV:
-            if (L.type==V_DOUBLE || R.type==V_DOUBLE) {
-                double d = (L.type==V_DOUBLE?L.dval:L.ival)
-                         / (R.type==V_DOUBLE?R.dval:R.ival);
-                return (Value){V_DOUBLE,0,d,NULL};
-            }
-            return (Value){V_INT, L.ival / R.ival,0,NULL};
-          case OP_MOD:
-            return (Value){V_INT, L.ival % R.ival,0,NULL};
-          case OP_LT: {
-            int b = (L.type==V_DOUBLE||R.type==V_DOUBLE)
-                    ? ((L.type==V_DOUBLE?L.dval:L.ival)
-                       < (R.type==V_DOUBLE?R.dval:R.ival))
-                    : (L.ival < R.ival);
-            return (Value){V_INT, b,0,NULL};
-          }
-          case OP_GT: {
-            int b = (L.type==V_DOUBLE||R.type==V_DOUBLE)
-                    ? ((L.type==V_DOUBLE?L.dval:L.ival)
-                       > (R.type==V_DOUBLE?R.dval:R.ival))
-                    : (L.ival > R.ival);
-            return (Value){V_INT, b,0,NULL};
-          }
-          case OP_LE: {
-            int b = (L.type==V_DOUBLE||R.type==V_DOUBLE)
-                    ? ((L.type==V_DOUBLE?L.dval:L.ival)
-                       <= (R.type==V_DOUBLE?R.dval:R.ival))
-                    : (L.ival <= R.ival);
-            return (Value){V_INT, b,0,NULL};
-          }
-          case OP_GE: {
-            int b = (L.type==V_DOUBLE||R.type==V_DOUBLE)
-                    ? ((L.type==V_DOUBLE?L.dval:L.ival)
-                       >= (R.type==V_DOUBLE?R.dval:R.ival))
-                    : (L.ival >= R.ival);
-            return (Value){V_INT, b,0,NULL};
-          }
-          case OP_EQ: {
-            int b = 0;
-            if (L.type==V_STRING||R.type==V_STRING) {
-                char *s1 = str_from_val(&L);
-                char *s2 = str_from_val(&R);
-                b = strcmp(s1,s2)==0;
-                free(s1); free(s2);
-            } else if (L.type==V_DOUBLE||R.type==V_DOUBLE) {
-                b = ((L.type==V_DOUBLE?L.dval:L.ival)
-                     == (R.type==V_DOUBLE?R.dval:R.ival));
-            } else {
-                b = (L.ival == R.ival);
-            }
-            return (Value){V_INT, b,0,NULL};
-          }
-          case OP_NE: {
-            int b = 0;
-            if (L.type==V_STRING||R.type==V_STRING) {
-                char *s1 = str_from_val(&L);
-                char *s2 = str_from_val(&R);
-                b = strcmp(s1,s2)!=0;
-                free(s1); free(s2);
-            } else if (L.type==V_DOUBLE||R.type==V_DOUBLE) {
-                b = ((L.type==V_DOUBLE?L.dval:L.ival)
-                     != (R.type==V_DOUBLE?R.dval:R.ival));
+
+    C.src = expr_text;
+    next_tok(&C);
+    parse_expr(&C);
+    if (C.curtok.type != T_END || C.max_depth > EXPR_STACK) ex_fail(&C);
+
+    ExprProg *p = ex_finish(&C, alloc, ctx);
+    ex_free_all(&C);
+    return p;
+}
+
+size_t expr_load_count(const ExprProg *p) {
+    return p ? p->nloads : 0;
+}
+
+const char *expr_load_path(const ExprProg *p, size_t index, size_t *len) {
+    if (!p || index >= p->nloads) return NULL;
+    if (len) *len = p->loads[index].len;
+    return p->loads[index].text;
+}
+
+int expr_eval(const ExprProg *p, ExprLoadFn load, void *load_ctx,
+              ExprAllocFn alloc, void *alloc_ctx, ExprVal *out) {
+    if (!p || !out) return 0;
+    ExprVal stack[EXPR_STACK];
+    size_t sp = 0;
+    for (size_t pc = 0; pc < p->ncode; ++pc) {
+        const Insn *in = &p->code[pc];
+        switch (in->op) {
+          case OP_CONST:
+            stack[sp++] = p->consts[in->arg];
+            break;
+          case OP_LOAD:
+            if (!load || !load(load_ctx, (size_t)in->arg, &stack[sp])) return 0;
+            sp++;
+            break;
+          case OP_JUMP_FALSE:
+            if (!ex_cond(&stack[--sp])) pc += (size_t)in->arg - 1;
+            break;
+          case OP_JUMP:
+            pc += (size_t)in->arg - 1;
+            break;
+          default:
+            if (IS_UNARY(in->op)) {
+                if (!apply_unary(in->op, &stack[sp - 1])) return 0;
             } else {
-                b = (L.ival != R.ival);
+                sp--;
+                if (!apply_binary(in->op, &stack[sp - 1], &stack[sp], alloc, alloc_ctx)) return 0;
             }
-            return (Value){V_INT, b,0,NULL};
-          }
-          case OP_AND: {
-            int b = ((L.type==V_DOUBLE?L.dval:L.ival) &&
-                     (R.type==V_DOUBLE?R.dval:R.ival));
-            return (Value){V_INT, b,0,NULL};
-          }
-          case OP_OR: {
-            int b = ((L.type==V_DOUBLE?L.dval:L.ival) ||
-                     (R.type==V_DOUBLE?R.dval:R.ival));
-            return (Value){V_INT, b,0,NULL};
-          }
-          default:
-            break;
         }
-      }
-      case NODE_TERNARY: {
-        Value cond = eval(n->a);
-        int b = (cond.type==V_DOUBLE?cond.dval:cond.ival);
-        return eval(b ? n->b : n->c);
-      }
     }
-    return (Value){V_INT,0,0,NULL};
+    *out = stack[0];
+    return 1;
 }
 
-//----------------------------------------------------------------
-// Cleanup
-//----------------------------------------------------------------
-void free_ast(Node *n) {
-    if (!n) return;
-    free_ast(n->a);
-    free_ast(n->b);
-    free_ast(n->c);
-    if (n->text) free(n->text);
-    free(n);
+// operands of the one-shot helper evaluate to their own text
+static int load_path_text(void *ctx, size_t index, ExprVal *out) {
+    *out = (ExprVal){EXPR_STRING, 0, 0, expr_load_path(ctx, index, NULL)};
+    return 1;
 }
 
 char *expr_eval_to_string(const char *expr_text) {
     if (!expr_text) return NULL;
-
-    // point your parser at the input string
-    src = expr_text;
-    next_tok();
-
-    // parse
-    Node *ast = parse_expr();
-    if (curtok.type != T_END) {
-        free_ast(ast);
-        return NULL;
+    Alloc *allocs = NULL;
+    char *out = NULL;
+    ExprProg *p = expr_compile(expr_text, chain_alloc, &allocs);
+    ExprVal v;
+    if (p && expr_eval(p, load_path_text, p, chain_alloc, &allocs, &v)) {
+        char buf[32];
+        out = strdup(ex_text(&v, buf));
     }
-
-    // evaluate
-    Value v = eval(ast);
-    free_ast(ast);
-
-    // convert to string
-    char *out = str_from_val(&v);
+    chain_free(&allocs);
     return out;
-}
\ No newline at end of file
+}
@@ -1,9 +1,53 @@
 #ifndef EXPR_H
 #define EXPR_H
 
-// Evaluate a C-style expression (with casts, unary/binary/ternary, string concatenation).
-// Returns a malloc'd C-string with the result (numeric or string). NULL on parse/eval error.
-// Caller must free() the returned string.
+#include <stddef.h>
+
+// C-style expressions (casts, unary/binary/ternary, string concatenation)
+// compiled once to bytecode and evaluated on a fixed-size value stack.
+//
+// Identifiers starting with '$' ("$System.base", "$.port") are operands the
+// caller supplies at evaluation time; any other identifier is its own text.
+
+typedef enum { EXPR_INT, EXPR_DOUBLE, EXPR_STRING } ExprType;
+
+// An evaluated value. ival is 0 for doubles and strings, as arithmetic on
+// mixed operands reads it directly.
+typedef struct {
+    ExprType type;
+    long ival;
+    double dval;
+    const char *sval;
+} ExprVal;
+
+typedef struct ExprProg ExprProg;
+
+// Allocator for the program and for strings built while evaluating; it must
+// return memory aligned for any type. NULL fails the call.
+typedef void *(*ExprAllocFn)(void *ctx, size_t n);
+
+// Supplies operand `index` (see expr_load_path). Returns 0 to fail evaluation.
+typedef int (*ExprLoadFn)(void *ctx, size_t index, ExprVal *out);
+
+// Compile expr_text, folding constant subexpressions. The program is one
+// block from `alloc` and holds no pointers into expr_text. NULL on a syntax
+// error or an expression too deep to evaluate.
+ExprProg *expr_compile(const char *expr_text, ExprAllocFn alloc, void *ctx);
+
+// Distinct '$' operands of p, numbered in order of first use; the text
+// includes the leading '$'.
+size_t expr_load_count(const ExprProg *p);
+const char *expr_load_path(const ExprProg *p, size_t index, size_t *len);
+
+// Evaluate p. Numeric results never allocate; strings produced by
+// concatenation come from `alloc`. Returns 1 and sets *out on success, 0 on
+// a failed operand load, division by zero or allocation failure.
+int expr_eval(const ExprProg *p, ExprLoadFn load, void *load_ctx,
+              ExprAllocFn alloc, void *alloc_ctx, ExprVal *out);
+
+// One-shot helper: compile and evaluate expr_text, with '$' operands
+// evaluating to their own text. Returns a malloc'd C-string with the result
+// (numeric or string), NULL on parse/eval error. Caller must free() it.
 char *expr_eval_to_string(const char *expr_text);
 
 #endif // EXPR_H
@@ -1,12 +1,266 @@
+/* acl-validate - parse an ACL config and print it, or validate many.
+   Usage: acl-validate <file> [<path>]
+          acl-validate --batch [-j threads] [-n slowest] [-e ext] [-v] <file|dir|@list|->...
+   The first form prints the parsed tree, then the string at <path> if given;
+   it exits 1 if the file is invalid (as --batch judges it: it can't be
+   parsed or has unresolved references) or <path> isn't a string.
+   --batch parses and resolves every file on a pool of threads (default one
+   per online CPU) without printing the trees: directories are searched
+   recursively for files ending in one of the comma-separated extensions
+   (default .acl,.conf; -e '' takes every file), @list reads paths one per
+   line from a file and - from stdin. Each failing file's diagnostics are
+   printed under its name, then a summary with throughput and the -n
+   slowest files (default 10); -v adds a line per file. Exits 0 if every
+   file is valid, 1 if any is not.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "acl.h"
 
+typedef struct Job {
+    char *path;
+    size_t bytes;
+    double secs;     /* parse + resolve + free */
+    int ok;
+    char *diag;      /* what the library reported, NULL if nothing */
+} Job;
+
+typedef struct Batch {
+    Job *jobs;
+    size_t njobs, cap;
+    const char *exts;
+    atomic_size_t next;
+} Batch;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int add_job(Batch *B, const char *path) {
+    if (B->njobs == B->cap) {
+        size_t cap = B->cap ? B->cap * 2 : 256;
+        Job *nj = realloc(B->jobs, cap * sizeof(Job));
+        if (!nj) return 0;
+        B->jobs = nj;
+        B->cap = cap;
+    }
+    Job *j = &B->jobs[B->njobs];
+    memset(j, 0, sizeof(*j));
+    if (!(j->path = strdup(path))) return 0;
+    B->njobs++;
+    return 1;
+}
+
+static int wanted(const char *name, const char *exts) {
+    if (!*exts) return 1;
+    size_t n = strlen(name);
+    for (const char *e = exts; *e;) {
+        size_t len = strcspn(e, ",");
+        if (len && len <= n && memcmp(name + n - len, e, len) == 0) return 1;
+        e += len;
+        if (*e == ',') e++;
+    }
+    return 0;
+}
+
+static int path_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* files under dir, in name order; symlinks are followed to files only */
+static int add_dir(Batch *B, const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) { perror(dir); return 0; }
+    char **names = NULL;
+    size_t n = 0, cap = 0;
+    struct dirent *e;
+    int ok = 1;
+    while ((e = readdir(d))) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            char **nn = realloc(names, cap * sizeof(char *));
+            if (!nn) { ok = 0; break; }
+            names = nn;
+        }
+        size_t len = strlen(dir) + strlen(e->d_name) + 2;
+        if (!(names[n] = malloc(len))) { ok = 0; break; }
+        snprintf(names[n++], len, "%s/%s", dir, e->d_name);
+    }
+    closedir(d);
+    qsort(names, n, sizeof(char *), path_cmp);
+    for (size_t i = 0; i < n; ++i) {
+        struct stat st, lst;
+        if (ok && lstat(names[i], &lst) == 0) {
+            if (S_ISDIR(lst.st_mode)) ok = add_dir(B, names[i]);
+            else if (stat(names[i], &st) == 0 && S_ISREG(st.st_mode) && wanted(names[i], B->exts)) ok = add_job(B, names[i]);
+        }
+        free(names[i]);
+    }
+    free(names);
+    return ok;
+}
+
+static int add_list(Batch *B, FILE *in) {
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    int ok = 1;
+    while (ok && (n = getline(&line, &cap, in)) >= 0) {
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) line[--n] = '\0';
+        if (n > 0) ok = add_job(B, line);
+    }
+    free(line);
+    return ok;
+}
+
+static int add_arg(Batch *B, const char *arg) {
+    if (strcmp(arg, "-") == 0) return add_list(B, stdin);
+    if (arg[0] == '@') {
+        FILE *f = fopen(arg + 1, "r");
+        if (!f) { perror(arg + 1); return 0; }
+        int ok = add_list(B, f);
+        fclose(f);
+        return ok;
+    }
+    struct stat st;
+    if (stat(arg, &st) == 0 && S_ISDIR(st.st_mode)) return add_dir(B, arg);
+    return add_job(B, arg); /* a missing file is reported as invalid */
+}
+
+static void validate(Job *j) {
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *diag = open_memstream(&buf, &len);
+    acl_set_diagnostics(diag);
+    struct stat st;
+    if (stat(j->path, &st) == 0) j->bytes = (size_t)st.st_size;
+    double t0 = now_sec();
+    AclBlock *root = acl_parse_file(j->path);
+    j->ok = root && acl_resolve_all(root);
+    acl_free(root);
+    j->secs = now_sec() - t0;
+    acl_set_diagnostics(NULL);
+    if (diag) fclose(diag);
+    if (len) j->diag = buf;
+    else free(buf);
+}
+
+static void *worker(void *arg) {
+    Batch *B = arg;
+    size_t i;
+    while ((i = atomic_fetch_add(&B->next, 1)) < B->njobs) validate(&B->jobs[i]);
+    return NULL;
+}
+
+static int slower(const void *a, const void *b) {
+    const Job *x = *(const Job *const *)a, *y = *(const Job *const *)b;
+    return x->secs < y->secs ? 1 : x->secs > y->secs ? -1 : 0;
+}
+
+static int batch_main(int argc, char **argv) {
+    long threads = 0, slowest = 10;
+    int verbose = 0, i = 2;
+    Batch B;
+    memset(&B, 0, sizeof(B));
+    B.exts = ".acl,.conf";
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; ++i) {
+        if (strcmp(argv[i], "-v") == 0) verbose = 1;
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = atol(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) slowest = atol(argv[++i]);
+        else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) B.exts = argv[++i];
+        else if (strcmp(argv[i], "--") == 0) { ++i; break; }
+        else { i = argc + 1; break; }
+    }
+    if (i >= argc || threads < 0 || slowest < 0) {
+        fprintf(stderr, "usage: %s --batch [-j threads] [-n slowest] [-e ext] [-v] <file|dir|@list|->...\n", argv[0]);
+        return 2;
+    }
+    for (; i < argc; ++i) {
+        if (!add_arg(&B, argv[i])) { fprintf(stderr, "acl-validate: can't read %s\n", argv[i]); return 2; }
+    }
+    if (!threads) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+    if ((size_t)threads > B.njobs) threads = B.njobs ? (long)B.njobs : 1;
+
+    atomic_init(&B.next, 0);
+    pthread_t *tids = calloc((size_t)threads, sizeof(pthread_t));
+    long started = 0;
+    double t0 = now_sec();
+    /* the calling thread is one of the workers */
+    while (tids && started < threads - 1 && pthread_create(&tids[started], NULL, worker, &B) == 0) started++;
+    worker(&B);
+    for (long t = 0; t < started; ++t) pthread_join(tids[t], NULL);
+    double wall = now_sec() - t0;
+    free(tids);
+
+    size_t failed = 0, bytes = 0;
+    double busy = 0;
+    Job **order = malloc((B.njobs ? B.njobs : 1) * sizeof(Job *));
+    if (!order) { perror("acl-validate"); return 2; }
+    for (size_t k = 0; k < B.njobs; ++k) {
+        Job *j = &B.jobs[k];
+        order[k] = j;
+        bytes += j->bytes;
+        busy += j->secs;
+        if (verbose) printf("%-7s %9.3f ms %10zu bytes  %s\n", j->ok ? "ok" : "FAILED", j->secs * 1e3, j->bytes, j->path);
+        if (j->ok && !j->diag) continue;
+        if (!j->ok) failed++;
+        printf("%s: %s\n", j->path, j->ok ? "warnings" : "invalid");
+        fputs(j->diag ? j->diag : "can't be read or parsed\n", stdout);
+    }
+    qsort(order, B.njobs, sizeof(Job *), slower);
+
+    printf("files:        %zu (%zu valid, %zu invalid)\n", B.njobs, B.njobs - failed, failed);
+    printf("bytes:        %zu (%.2f MB)\n", bytes, bytes / 1e6);
+    printf("wall:         %.3f ms on %ld thread%s, %.0f files/s, %.1f MB/s\n",
+           wall * 1e3, started + 1, started ? "s" : "", B.njobs / wall, bytes / wall / 1e6);
+    if (B.njobs) {
+        printf("per file:     mean %.3f ms, median %.3f ms (parse + resolve + free)\n",
+               busy * 1e3 / B.njobs, order[B.njobs / 2]->secs * 1e3);
+    }
+    if (slowest && B.njobs) {
+        printf("slowest:\n");
+        for (size_t k = 0; k < B.njobs && k < (size_t)slowest; ++k)
+            printf("  %9.3f ms %10zu bytes  %s\n", order[k]->secs * 1e3, order[k]->bytes, order[k]->path);
+    }
+
+    for (size_t k = 0; k < B.njobs; ++k) {
+        free(B.jobs[k].path);
+        free(B.jobs[k].diag);
+    }
+    free(order);
+    free(B.jobs);
+    return failed ? 1 : 0;
+}
+
 int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) return batch_main(argc, argv);
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <file> [<path>]\n       %s --batch [-j threads] [-n slowest] [-e ext] [-v] <file|dir|@list|->...\n",
+                argv[0], argv[0]);
+        return 2;
+    }
     AclBlock* root = acl_parse_file(argv[1]);
+    if (!root) return 1;
+    int rc = acl_resolve_all(root) ? 0 : 1;
     acl_print(root, stdout);
     if (argc == 3) {
-        char* buf;
-        acl_get_string(root, argv[2], &buf);
-        puts(buf);
+        char* buf = NULL;
+        if (acl_get_string(root, argv[2], &buf)) puts(buf);
+        else rc = 1;
+        free(buf);
     }
-    return 0;
-}
\ No newline at end of file
+    acl_free(root);
+    return rc;
+}